@@ -0,0 +1,255 @@
+/**
+ * @file decoder_bench.cpp
+ * @brief JkDecoder configurations against the JKBMS parsers
+ *
+ * Builds a mix of JK02/JK04 cell-info, settings and device-info frames with
+ * the simulator's encoders and decodes them three ways: through a JKBMS
+ * instance (copied to the reassembly buffer and dispatched, as
+ * handleNotification() does), through JkDefaultDecoder and through a
+ * compact JK02-only, fixed-point, cells-only decoder. JKBMS decodes with
+ * JkDefaultDecoder and copies into its fields, so the two must agree on
+ * every field, settings frames of random values included; the compact one
+ * must match the raw protocol values. Exits 1 on any mismatch. The report
+ * gives the instance size and the decode time per frame of each.
+ *
+ * Usage:
+ *   decoder_bench [--frames 200000] [--jk04-share 0.25] [--seed 1]
+ */
+
+#include "../src/libs/JKBMS.h"
+#include "../src/libs/frame_handlers.h"
+#include "../src/libs/jk_decoder.h"
+#include "sim/frame_builder.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+JKBMS jkBmsDevices[1];
+const int bmsDeviceCount = 0;
+
+namespace {
+
+struct Options {
+  int frames = 200000;
+  double jk04Share = 0.25;
+  uint32_t seed = 1;
+};
+
+typedef JkDecoder<JkLayoutJk02<16>, JkFixedStorage, JkNoLog, JkCellFramesOnly> CompactDecoder;
+
+struct Frame {
+  uint8_t data[sim::kFrameSize];
+  bool jk04;
+  sim::PackState state;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+// JKBMS computes in double and stores float; the decoder multiplies in float
+bool near(float a, float b) {
+  return fabsf(a - b) <= 1e-6f * fmaxf(1.0f, fabsf(b));
+}
+
+int compareDefault(const JKBMS& bms, const JkDefaultDecoder& d) {
+  int bad = 0;
+  const JkDefaultDecoder::Cells& c = d.cells;
+  for (int i = 0; i < JKBMS_MAX_CELLS; i++) {
+    bad += !near(c.cellMv[i], bms.cellVoltage[i]);
+    bad += !near(c.wireResist[i], bms.wireResist[i]);
+  }
+  bad += !near(c.batteryVoltage, bms.Battery_Voltage);
+  bad += !near(c.current, bms.Charge_Current);
+  bad += !near(c.power, bms.Battery_Power);
+  bad += !near(c.averageCell, bms.Average_Cell_Voltage);
+  bad += !near(c.deltaCell, bms.Delta_Cell_Voltage);
+  bad += !near(c.balanceCurrent, bms.Balance_Curr);
+  bad += !near(c.mosTemp, bms.MOS_Temp) + !near(c.t1, bms.Battery_T1) + !near(c.t2, bms.Battery_T2);
+  bad += !near(c.capacityRemain, bms.Capacity_Remain) + !near(c.nominalCapacity, bms.Nominal_Capacity);
+  bad += !near(c.cycleCapacity, bms.Cycle_Capacity) + (c.cycleCount != (uint32_t)bms.Cycle_Count);
+  bad += c.soc != bms.Percent_Remain;
+  bad += c.balancingAction != bms.Balancing_Action;
+  bad += c.charge != bms.Charge || c.discharge != bms.Discharge || c.balance != bms.Balance;
+  bad += d.protocol != bms.activeProtocol();
+  return bad;
+}
+
+// Every settings field, as bms_settings() copies them out of JkSettingsData
+int compareSettings(const JKBMS& bms, const JkDefaultDecoder& d) {
+  const JkDefaultDecoder::Settings& s = d.settings;
+  int bad = 0;
+  bad += !near(s.cellUvp, bms.cell_voltage_undervoltage_protection) + !near(s.cellUvpr, bms.cell_voltage_undervoltage_recovery);
+  bad += !near(s.cellOvp, bms.cell_voltage_overvoltage_protection) + !near(s.cellOvpr, bms.cell_voltage_overvoltage_recovery);
+  bad += !near(s.balanceTrigger, bms.balance_trigger_voltage) + !near(s.balanceStart, bms.balance_starting_voltage);
+  bad += !near(s.powerOff, bms.power_off_voltage);
+  bad += !near(s.maxChargeCurrent, bms.max_charge_current) + !near(s.maxDischargeCurrent, bms.max_discharge_current);
+  bad += !near(s.maxBalanceCurrent, bms.max_balance_current) + !near(s.totalCapacity, bms.total_battery_capacity);
+  bad += !near(s.chargeOtp, bms.charge_overtemperature_protection);
+  bad += !near(s.chargeOtpr, bms.charge_overtemperature_protection_recovery);
+  bad += !near(s.dischargeOtp, bms.discharge_overtemperature_protection);
+  bad += !near(s.dischargeOtpr, bms.discharge_overtemperature_protection_recovery);
+  bad += !near(s.chargeUtp, bms.charge_undertemperature_protection);
+  bad += !near(s.chargeUtpr, bms.charge_undertemperature_protection_recovery);
+  bad += !near(s.mosOtp, bms.power_tube_overtemperature_protection);
+  bad += !near(s.mosOtpr, bms.power_tube_overtemperature_protection_recovery);
+  bad += s.chargeOcpDelayS != bms.charge_overcurrent_protection_delay;
+  bad += s.chargeOcpRecoveryS != bms.charge_overcurrent_protection_recovery_time;
+  bad += s.dischargeOcpDelayS != bms.discharge_overcurrent_protection_delay;
+  bad += s.dischargeOcpRecoveryS != bms.discharge_overcurrent_protection_recovery_time;
+  bad += s.scpRecoveryS != bms.short_circuit_protection_recovery_time;
+  bad += s.scpDelayUs != bms.short_circuit_protection_delay;
+  bad += s.cellCount != (uint32_t)bms.cell_count;
+  return bad;
+}
+
+// Distinct values per field, so two swapped offsets cannot agree by chance
+sim::PackSettings randomSettings(std::mt19937& rng) {
+  std::uniform_int_distribution<uint32_t> mv(2500, 3700), ma(1000, 200000), decic(0, 900);
+  sim::PackSettings s;
+  s.cellUvpMv = mv(rng);
+  s.cellUvprMv = mv(rng);
+  s.cellOvpMv = mv(rng);
+  s.cellOvprMv = mv(rng);
+  s.balanceTriggerMv = rng() % 100 + 1;
+  s.powerOffMv = mv(rng);
+  s.maxChargeMa = ma(rng);
+  s.maxDischargeMa = ma(rng);
+  s.maxBalanceMa = ma(rng) / 50;
+  s.chargeOtpDeciC = decic(rng) + 100;
+  s.dischargeOtpDeciC = decic(rng) + 100;
+  s.chargeUtpDeciC = decic(rng) / 10;
+  s.mosOtpDeciC = decic(rng) + 200;
+  s.cellCount = rng() % 24 + 1;
+  s.capacityMah = ma(rng) * 2;
+  s.balanceStartMv = mv(rng);
+  return s;
+}
+
+int compareCompact(const sim::PackState& st, const CompactDecoder& d) {
+  const CompactDecoder::Cells& c = d.cells;
+  int bad = c.cellCount != st.cellCount;
+  for (int i = 0; i < st.cellCount; i++) bad += c.cellMv[i] != st.cellMv[i] || c.wireResist[i] != st.wireResistMohm[i];
+  bad += c.batteryVoltage != st.batteryMv || c.current != st.currentMa || c.soc != st.socPercent;
+  bad += c.mosTemp != st.mosTempDeciC || c.t1 != st.t1DeciC || c.t2 != st.t2DeciC;
+  bad += c.capacityRemain != (int32_t)st.capacityRemainMah || c.uptimeS != st.uptimeS;
+  return bad;
+}
+
+// The built-in parsers read the reassembly buffer, as after handleNotification()
+void feedBms(JKBMS& bms, const uint8_t* data) {
+  memcpy(bms.receivedBytes, data, sim::kFrameSize);
+  bms.frame = sim::kFrameSize;
+  dispatchFrame(bms, bms.receivedBytes, sim::kFrameSize);
+}
+
+template <typename Fn>
+double nsPerFrame(const std::vector<Frame>& frames, Fn fn) {
+  Clock::time_point t0 = Clock::now();
+  for (const Frame& f : frames) fn(f);
+  return std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / frames.size();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string arg = argv[i];
+    if (arg == "--frames") opt.frames = atoi(argv[i + 1]);
+    else if (arg == "--jk04-share") opt.jk04Share = atof(argv[i + 1]);
+    else if (arg == "--seed") opt.seed = atoi(argv[i + 1]);
+    else { fprintf(stderr, "unknown option %s\n", arg.c_str()); return 2; }
+  }
+  if (opt.frames < 1) return 2;
+
+  // Cell frames of varying packs; JK02 ones also go to the compact decoder
+  std::mt19937 rng(opt.seed);
+  std::uniform_int_distribution<int> mv(3150, 3450), mohm(30, 60), ma(-80000, 80000), temp(-150, 450);
+  std::bernoulli_distribution jk04(opt.jk04Share);
+  std::vector<Frame> jk02Frames, mixedFrames;
+  for (int n = 0; n < opt.frames; n++) {
+    Frame f;
+    sim::PackState& st = f.state;
+    st.cellCount = 16;
+    st.batteryMv = 0;
+    for (int i = 0; i < 16; i++) {
+      st.cellMv[i] = (uint16_t)mv(rng);
+      st.wireResistMohm[i] = (uint16_t)mohm(rng);
+      st.batteryMv += st.cellMv[i];
+    }
+    st.currentMa = ma(rng);
+    st.mosTempDeciC = (int16_t)temp(rng);
+    st.t1DeciC = (int16_t)temp(rng);
+    st.t2DeciC = (int16_t)temp(rng);
+    st.balanceCurrentMa = (int16_t)(ma(rng) / 100);
+    st.socPercent = (uint8_t)(n % 101);
+    st.capacityRemainMah = 2800 * st.socPercent;
+    st.nominalCapacityMah = 280000;
+    st.cycleCount = n % 900;
+    st.cycleCapacityMah = 12345678;
+    st.uptimeS = n * 7;
+    f.jk04 = jk04(rng);
+    if (f.jk04) sim::buildJk04CellInfoFrame(st, (uint8_t)n, f.data);
+    else sim::buildCellInfoFrame(st, (uint8_t)n, f.data);
+    (f.jk04 ? mixedFrames : jk02Frames).push_back(f);
+  }
+  // JK04 packs are told apart by their device-info frame, one decoder per protocol
+  Frame jk02Info, jk04Info, settings;
+  sim::buildDeviceInfoFrame("JK_B2A24S15P", "11.XW", "11.26", 3600, 0, jk02Info.data);
+  sim::buildDeviceInfoFrame("JK-BD6A24S", "3.0", "3.3", 3600, 0, jk04Info.data);
+  sim::buildSettingsFrame(sim::PackSettings(), 0, settings.data);
+
+  // 1. Field parity, one JKBMS and one decoder per protocol
+  int mismatches = 0;
+  JKBMS bms02, bms04;
+  JkDefaultDecoder dec02, dec04;
+  feedBms(bms02, jk02Info.data);
+  feedBms(bms02, settings.data);
+  dec02.decode(jk02Info.data, sim::kFrameSize);
+  dec02.decode(settings.data, sim::kFrameSize);
+  feedBms(bms04, jk04Info.data);
+  dec04.decode(jk04Info.data, sim::kFrameSize);
+  mismatches += compareSettings(bms02, dec02) != 0;
+  for (size_t n = 0; n < jk02Frames.size(); n++) {
+    const Frame& f = jk02Frames[n];
+    if (n % 16 == 0) {
+      Frame s;
+      sim::buildSettingsFrame(randomSettings(rng), (uint8_t)n, s.data);
+      feedBms(bms02, s.data);
+      dec02.decode(s.data, sim::kFrameSize);
+      mismatches += compareSettings(bms02, dec02) != 0;
+    }
+    feedBms(bms02, f.data);
+    dec02.decode(f.data, sim::kFrameSize);
+    mismatches += compareDefault(bms02, dec02) != 0;
+    CompactDecoder compact;
+    compact.decode(f.data, sim::kFrameSize);
+    mismatches += compareCompact(f.state, compact) != 0;
+  }
+  for (const Frame& f : mixedFrames) {
+    feedBms(bms04, f.data);
+    dec04.decode(f.data, sim::kFrameSize);
+    mismatches += compareDefault(bms04, dec04) != 0;
+  }
+
+  // 2. Decode time, JK02 cell frames
+  JKBMS bms;
+  JkDefaultDecoder def;
+  CompactDecoder compact;
+  volatile double sink = 0;   // keeps the decoded values alive
+  const double bmsNs = nsPerFrame(jk02Frames, [&](const Frame& f) { feedBms(bms, f.data); sink += bms.Charge_Current; });
+  const double defNs = nsPerFrame(jk02Frames, [&](const Frame& f) { def.decode(f.data, sim::kFrameSize); sink += def.cells.current; });
+  const double compactNs = nsPerFrame(jk02Frames, [&](const Frame& f) { compact.decode(f.data, sim::kFrameSize); sink += compact.cells.current; });
+
+  printf("JKBMS decoder bench: %zu JK02 and %zu JK04 cell frames\n\n", jk02Frames.size(), mixedFrames.size());
+  printf("%-44s %10s %12s\n", "decoder", "bytes", "ns/frame");
+  printf("%-44s %10zu %12.1f\n", "JKBMS (copy + dispatchFrame)", sizeof(JKBMS), bmsNs);
+  printf("%-44s %10zu %12.1f\n", "JkDefaultDecoder (auto, float, all frames)", sizeof(JkDefaultDecoder), defNs);
+  printf("%-44s %10zu %12.1f\n", "JK02<16>, fixed, no log, cells only", sizeof(CompactDecoder), compactNs);
+  printf("\nField mismatches: %d\n", mismatches);
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,533 @@
+/**
+ * @file fleet_sim.cpp
+ * @brief Host-side fleet simulator for load testing the gateway data path
+ *
+ * Instantiates up to kMaxSimPacks VirtualBms peers on the virtual radio,
+ * binds each one to a JKBMS instance and lets them stream. Every
+ * notification goes through the real library code (notifyCB ->
+ * handleNotification -> parseData/bms_settings/parseDeviceInfo) and every
+ * parsed cell frame is serialized the way an uplink would. The run is
+ * repeated for each requested pack count and reports throughput, latency
+ * percentiles and resource use.
+ *
+ * Radio time is virtual; library time is measured on the host wall clock.
+ * Connections are attached directly through the NimBLE shim rather than
+ * JKBMS::connectToServer(), which caps the gateway at 3 clients (see
+ * reconnect_bench.cpp for the connection path).
+ *
+ * Usage:
+ *   fleet_sim [--packs 1,10,100,500] [--duration-s 120] [--rate-ms 1000]
+ *             [--fragment 128] [--loss 0.0] [--drops-per-hour 0]
+ *             [--profile solar|constant|inverter|idle] [--protocol jk02|jk04|mixed]
+ *             [--uplink json|snapshot] [--snapshot-file PATH] [--outliers]
+ *             [--weak-cells 0] [--shards] [--seed 1] [--csv]
+ *             [--usb-stream PATH] [--usb-kbps 400]
+ *
+ * --protocol jk04 makes every pack send the legacy float layout (mixed: every
+ * other pack), so the parse cost of the two decoders can be compared.
+ * --uplink snapshot serializes into the flat snapshot format (snapshot.h)
+ * instead of JSON; --snapshot-file also appends every snapshot to a file that
+ * snapshot_dump reads in place.
+ * --outliers runs the fleet outlier stage (fleet_outliers.h) once per frame
+ * period over all packs; --weak-cells N gives N packs one cell with less
+ * capacity and more resistance and reports how many of them were flagged.
+ * The other flags are healthy cells whose random initial SoC offset puts
+ * them far from their siblings.
+ * --shards routes the notifications through the device shards
+ * (device_shards.h), inline on the host, and reports how the first
+ * JKBMS_SHARD_DEVICES packs ended up spread over them; with --protocol mixed
+ * the packs cost different amounts, which the rebalancing has to even out.
+ * --usb-stream captures every notification, frame and snapshot through the
+ * gateway's USB stream (usb_stream.h) into PATH, drained every millisecond
+ * of virtual time at --usb-kbps (about what the USB-Serial/JTAG port
+ * sustains), and reports the bandwidth the fleet needs and the records the
+ * ring had to drop; usb_capture decodes the file.
+ */
+
+#include <Arduino.h>
+#include <NimBLEDevice.h>
+#include "../src/libs/JKBMS.h"
+#include "../src/libs/fleet_outliers.h"
+#include "../src/libs/snapshot.h"
+#include "../src/libs/device_shards.h"
+#include "../src/libs/usb_stream.h"
+#include "sim/virtual_bms.h"
+
+#include <sys/resource.h>
+
+#include <chrono>
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#ifndef FLEET_SIM_MAX_PACKS
+#define FLEET_SIM_MAX_PACKS 1024
+#endif
+
+static const int kMaxSimPacks = FLEET_SIM_MAX_PACKS;
+
+JKBMS jkBmsDevices[kMaxSimPacks];
+const int bmsDeviceCount = kMaxSimPacks;
+
+namespace {
+
+struct Options {
+  std::vector<int> packs = { 1, 10, 50, 100, 250, 500 };
+  uint32_t durationS = 120;
+  uint32_t rateMs = 1000;
+  uint16_t fragment = 128;
+  float loss = 0.0f;
+  float dropsPerHour = 0.0f;
+  sim::LoadProfile profile = sim::LoadProfile::Solar;
+  std::string protocol = "jk02";
+  std::string uplink = "json";
+  std::string snapshotFile;
+  bool outliers = false;
+  bool shards = false;
+  int weakCells = 0;
+  uint32_t seed = 1;
+  bool csv = false;
+  std::string usbStream;
+  uint32_t usbKbps = 400;
+};
+
+struct RunStats {
+  uint64_t notifications = 0;
+  uint64_t notifyNs = 0;
+  uint64_t cellFrames = 0;
+  uint64_t otherFrames = 0;
+  uint64_t reconnects = 0;
+  std::vector<uint32_t> parseNs;      // wall time of the call that completed a frame
+  std::vector<uint32_t> linkUs;       // virtual time from first fragment to completion
+  std::vector<uint32_t> uplinkNs;     // wall time to serialize the parsed snapshot
+  uint64_t uplinkBytes = 0;
+  std::vector<uint32_t> outlierNs;    // wall time of one fleet outlier sample
+};
+
+typedef std::chrono::steady_clock Clock;
+
+uint64_t elapsedNs(Clock::time_point a, Clock::time_point b) {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(b - a).count();
+}
+
+double percentile(std::vector<uint32_t>& v, double p) {
+  if (v.empty()) return 0;
+  size_t k = (size_t)(p * (v.size() - 1));
+  std::nth_element(v.begin(), v.begin() + k, v.end());
+  return v[k];
+}
+
+std::string macFor(int i) {
+  char mac[18];
+  snprintf(mac, sizeof(mac), "c8:47:80:%02x:%02x:%02x", (i >> 16) & 0xFF, (i >> 8) & 0xFF, i & 0xFF);
+  return mac;
+}
+
+/**
+ * @brief Serialize the public data fields the way a gateway uplink would
+ */
+size_t serializeUplink(const JKBMS& bms, char* out, size_t size) {
+  int n = snprintf(out, size,
+                   "{\"mac\":\"%s\",\"v\":%.3f,\"i\":%.3f,\"p\":%.1f,\"soc\":%d,\"t1\":%.1f,\"t2\":%.1f,"
+                   "\"mos\":%.1f,\"dv\":%.3f,\"cells\":[",
+                   bms.targetMAC.c_str(), bms.Battery_Voltage, bms.Charge_Current, bms.Battery_Power,
+                   bms.Percent_Remain, bms.Battery_T1, bms.Battery_T2, bms.MOS_Temp, bms.Delta_Cell_Voltage);
+  for (int j = 0; j < 16 && n > 0 && (size_t)n < size; j++) {
+    n += snprintf(out + n, size - n, j ? ",%.3f" : "%.3f", bms.cellVoltage[j]);
+  }
+  if (n > 0 && (size_t)n < size) n += snprintf(out + n, size - n, "]}");
+  return n > 0 ? (size_t)n : 0;
+}
+
+bool parseOptions(int argc, char** argv, Options& opt) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (arg == "--csv") { opt.csv = true; continue; }
+    if (arg == "--outliers") { opt.outliers = true; continue; }
+    if (arg == "--shards") { opt.shards = true; continue; }
+    if (!value) { fprintf(stderr, "missing value for %s\n", arg.c_str()); return false; }
+    i++;
+    if (arg == "--packs") {
+      opt.packs.clear();
+      for (const char* p = value; *p;) {
+        int n = atoi(p);
+        if (n < 1 || n > kMaxSimPacks) { fprintf(stderr, "pack count must be 1..%d\n", kMaxSimPacks); return false; }
+        opt.packs.push_back(n);
+        const char* comma = strchr(p, ',');
+        if (!comma) break;
+        p = comma + 1;
+      }
+    } else if (arg == "--duration-s") opt.durationS = atoi(value);
+    else if (arg == "--rate-ms") opt.rateMs = atoi(value);
+    else if (arg == "--fragment") opt.fragment = atoi(value);
+    else if (arg == "--loss") opt.loss = atof(value);
+    else if (arg == "--drops-per-hour") opt.dropsPerHour = atof(value);
+    else if (arg == "--seed") opt.seed = atoi(value);
+    else if (arg == "--weak-cells") {
+      opt.weakCells = atoi(value);
+      opt.outliers = true;
+    }
+    else if (arg == "--profile") {
+      std::string p = value;
+      if (p == "solar") opt.profile = sim::LoadProfile::Solar;
+      else if (p == "constant") opt.profile = sim::LoadProfile::Constant;
+      else if (p == "inverter") opt.profile = sim::LoadProfile::Inverter;
+      else if (p == "idle") opt.profile = sim::LoadProfile::Idle;
+      else { fprintf(stderr, "unknown profile %s\n", value); return false; }
+    } else if (arg == "--protocol") {
+      opt.protocol = value;
+      if (opt.protocol != "jk02" && opt.protocol != "jk04" && opt.protocol != "mixed") {
+        fprintf(stderr, "unknown protocol %s\n", value);
+        return false;
+      }
+    } else if (arg == "--uplink") {
+      opt.uplink = value;
+      if (opt.uplink != "json" && opt.uplink != "snapshot") {
+        fprintf(stderr, "unknown uplink format %s\n", value);
+        return false;
+      }
+    } else if (arg == "--snapshot-file") {
+      opt.snapshotFile = value;
+      opt.uplink = "snapshot";
+    } else if (arg == "--usb-stream") opt.usbStream = value;
+    else if (arg == "--usb-kbps") opt.usbKbps = atoi(value);
+    else {
+      fprintf(stderr, "unknown option %s\n", arg.c_str());
+      return false;
+    }
+  }
+  if (!opt.usbStream.empty() && !opt.usbKbps) {
+    fprintf(stderr, "--usb-kbps must be positive\n");
+    return false;
+  }
+  return true;
+}
+
+// The USB host side of --usb-stream: whatever the port delivers goes to the file
+size_t writeStream(const uint8_t* data, size_t length, void* ctx) {
+  return fwrite(data, 1, length, (FILE*)ctx);
+}
+
+class FleetRun {
+public:
+  FleetRun(const Options& opt, int packs) : m_opt(opt), m_packs(packs) {}
+
+  ~FleetRun() {
+    if (m_snapshotFile) fclose(m_snapshotFile);
+    fleetOutlierFree(m_outliers);
+    // Clients must go before the peers they point at; pending events capture both
+    NimBLEDevice::deleteAllClients();
+    SimRadio::clear();
+    sim::reset();
+  }
+
+  void setup() {
+    for (int i = 0; i < kMaxSimPacks; i++) {
+      jkBmsDevices[i] = JKBMS(i < m_packs ? macFor(i) : "");
+    }
+
+    std::mt19937 rng(m_opt.seed);
+    // Weak cells go to the first packs, at random positions
+    for (int i = 0; i < m_opt.weakCells && i < m_packs; i++) {
+      m_weak.push_back(std::uniform_int_distribution<int>(0, 15)(rng));
+    }
+    for (int i = 0; i < m_packs; i++) {
+      sim::VirtualBmsConfig config;
+      config.mac = macFor(i);
+      config.seed = m_opt.seed * 7919 + i;
+      config.profile = m_opt.profile;
+      config.initialSoc = std::uniform_real_distribution<float>(0.2f, 0.9f)(rng);
+      config.startHour = 8.0f + std::uniform_real_distribution<float>(0.0f, 2.0f)(rng);
+      config.ambientC = std::uniform_real_distribution<float>(15.0f, 35.0f)(rng);
+      config.framePeriodMs = m_opt.rateMs;
+      config.fragmentSize = m_opt.fragment;
+      config.fragmentLoss = m_opt.loss;
+      config.dropsPerHour = m_opt.dropsPerHour;
+      config.rssi = std::uniform_int_distribution<int>(-90, -50)(rng);
+      config.jk04 = m_opt.protocol == "jk04" || (m_opt.protocol == "mixed" && i % 2);
+      if (i < (int)m_weak.size()) config.weakCell = m_weak[i];
+      m_peers.emplace_back(new sim::VirtualBms(config));
+      sim::VirtualBms* peer = m_peers.back().get();
+      peer->setFragmentSink([this, i](sim::VirtualBms& p, const uint8_t* data, size_t length, const sim::FragmentInfo& info) {
+        onFragment(i, p, data, length, info);
+      });
+      SimRadio::addPeer(peer);
+    }
+
+    for (int i = 0; i < m_packs; i++) attach(i);
+    scheduleSupervisor();
+    if (m_opt.shards && shardsStart()) scheduleShards();
+    if (m_opt.outliers && fleetOutlierInit(m_outliers, (uint16_t)m_packs, 16)) scheduleOutliers();
+    if (!m_opt.usbStream.empty()) scheduleStream();
+    if (!m_opt.snapshotFile.empty()) {
+      m_snapshotFile = fopen(m_opt.snapshotFile.c_str(), "ab");
+      if (!m_snapshotFile) perror(m_opt.snapshotFile.c_str());
+    }
+  }
+
+  void run() {
+    // Let every pack settle into streaming before measuring
+    sim::advance(5ULL * 1000000);
+    m_stats = RunStats();
+    m_measuring = true;
+    m_streamBefore = usbStreamCounters();
+    for (auto& peer : m_peers) m_sentBefore.push_back(peer->stats());
+
+    const uint64_t startUs = sim::nowUs();
+    const uint64_t endUs = startUs + (uint64_t)m_opt.durationS * 1000000;
+    clock_t cpu0 = clock();
+    Clock::time_point wall0 = Clock::now();
+    while (sim::nowUs() < endUs && sim::runNext()) {
+    }
+    m_wallNs = elapsedNs(wall0, Clock::now());
+    m_cpuNs = (uint64_t)((clock() - cpu0) * (1e9 / CLOCKS_PER_SEC));
+    m_virtualUs = sim::nowUs() - startUs;
+    m_measuring = false;
+    m_streamAfter = usbStreamCounters();
+  }
+
+  void report(bool csv, bool header) {
+    uint64_t framesSent = 0, fragmentsSent = 0, fragmentsLost = 0, drops = 0;
+    for (size_t i = 0; i < m_peers.size(); i++) {
+      const sim::VirtualBmsStats& now = m_peers[i]->stats();
+      framesSent += now.framesSent - m_sentBefore[i].framesSent;
+      fragmentsSent += now.fragmentsSent - m_sentBefore[i].fragmentsSent;
+      fragmentsLost += now.fragmentsLost - m_sentBefore[i].fragmentsLost;
+      drops += now.drops - m_sentBefore[i].drops;
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    double virtualS = m_virtualUs / 1e6;
+    double framesPerS = m_stats.cellFrames / virtualS;
+    double nsPerNotify = m_stats.notifications ? (double)m_stats.notifyNs / m_stats.notifications : 0;
+    // Fraction of one host core the library needs to keep up with the fleet in real time
+    double coreShare = (m_stats.notifyNs + sum(m_stats.uplinkNs)) / (virtualS * 1e9);
+    double parseP50 = percentile(m_stats.parseNs, 0.50) / 1000.0;
+    double parseP95 = percentile(m_stats.parseNs, 0.95) / 1000.0;
+    double parseP99 = percentile(m_stats.parseNs, 0.99) / 1000.0;
+    double linkP50 = percentile(m_stats.linkUs, 0.50) / 1000.0;
+    double linkP99 = percentile(m_stats.linkUs, 0.99) / 1000.0;
+    double upP50 = percentile(m_stats.uplinkNs, 0.50) / 1000.0;
+    double upP99 = percentile(m_stats.uplinkNs, 0.99) / 1000.0;
+    double outP50 = percentile(m_stats.outlierNs, 0.50) / 1000.0;
+    double outP99 = percentile(m_stats.outlierNs, 0.99) / 1000.0;
+    int weakFound = 0, flagged = 0;
+    if (m_outliers.packs) {
+      for (int p = 0; p < m_packs; p++) {
+        for (uint8_t c = 0; c < m_outliers.cells; c++) flagged += fleetOutlierFlagged(m_outliers, p, c);
+        if (p < (int)m_weak.size()) weakFound += fleetOutlierFlagged(m_outliers, p, m_weak[p]);
+      }
+    }
+
+    if (csv) {
+      if (header) {
+        printf("packs,virtual_s,wall_s,frames_sent,cell_frames_parsed,cell_frames_per_s,notifications,"
+               "fragments_lost,drops,reconnects,ns_per_notify,parse_p50_us,parse_p95_us,parse_p99_us,"
+               "link_p50_ms,link_p99_ms,uplink_p50_us,uplink_p99_us,cpu_s,core_share,max_rss_kb,"
+               "outlier_p50_us,weak_found,other_flags\n");
+      }
+      printf("%d,%.1f,%.3f,%llu,%llu,%.1f,%llu,%llu,%llu,%llu,%.0f,%.2f,%.2f,%.2f,%.1f,%.1f,%.2f,%.2f,%.3f,%.5f,%ld,%.2f,%d,%d\n",
+             m_packs, virtualS, m_wallNs / 1e9, (unsigned long long)framesSent,
+             (unsigned long long)m_stats.cellFrames, framesPerS, (unsigned long long)m_stats.notifications,
+             (unsigned long long)fragmentsLost, (unsigned long long)drops, (unsigned long long)m_stats.reconnects,
+             nsPerNotify, parseP50, parseP95, parseP99, linkP50, linkP99, upP50, upP99, m_cpuNs / 1e9,
+             coreShare, usage.ru_maxrss, outP50, weakFound, flagged - weakFound);
+      return;
+    }
+
+    printf("\n=== %d packs, %.0f s virtual (%.2f s wall, %.0fx real time) ===\n",
+           m_packs, virtualS, m_wallNs / 1e9, m_wallNs ? virtualS * 1e9 / m_wallNs : 0);
+    printf("Frames sent:            %llu (%llu fragments, %llu lost, %llu link drops, %llu reconnects)\n",
+           (unsigned long long)framesSent, (unsigned long long)fragmentsSent, (unsigned long long)fragmentsLost,
+           (unsigned long long)drops, (unsigned long long)m_stats.reconnects);
+    printf("Cell frames parsed:     %llu (%.1f/s, %.1f%% of sent frames)\n",
+           (unsigned long long)m_stats.cellFrames, framesPerS,
+           framesSent ? 100.0 * (m_stats.cellFrames + m_stats.otherFrames) / framesSent : 0.0);
+    printf("Notifications:          %llu, %.0f ns each on average\n",
+           (unsigned long long)m_stats.notifications, nsPerNotify);
+    printf("Parse latency (wall):   p50 %.2f us, p95 %.2f us, p99 %.2f us\n", parseP50, parseP95, parseP99);
+    printf("Link latency (virtual): p50 %.1f ms, p99 %.1f ms (first fragment to parsed frame)\n", linkP50, linkP99);
+    printf("Uplink serialize:       p50 %.2f us, p99 %.2f us, %llu bytes\n",
+           upP50, upP99, (unsigned long long)m_stats.uplinkBytes);
+    // Host time only: the ESP32-S3 has a different core, caches and flash, so no pack budget follows from it
+    printf("Library CPU (host):     %.4f%% of one host core\n", coreShare * 100);
+    printf("Resources:              %.3f s CPU, max RSS %ld KB, %zu B per JKBMS instance, %zu pending events\n",
+           m_cpuNs / 1e9, usage.ru_maxrss, sizeof(JKBMS), sim::pendingEvents());
+    if (m_outliers.packs) {
+      printf("Fleet outliers:         p50 %.2f us, p99 %.2f us per sample; %d flagged cells, %d/%zu weak cells found, %d others\n",
+             outP50, outP99, flagged, weakFound, m_weak.size(), flagged - weakFound);
+    }
+    if (shardsActive()) {
+      printf("Shards:                ");
+      for (int s = 0; s < JKBMS_SHARDS; s++) {
+        const ShardStats& st = shardStats(s);
+        printf(" [%d] %u devices, %.0f us/s, %u in / %u out;", s, st.devices,
+               st.loadUs / (JKBMS_SHARD_REBALANCE_MS / 1000.0), st.movedIn, st.movedOut);
+      }
+      printf("\n");
+    }
+    if (!m_opt.usbStream.empty()) {
+      const uint32_t records = m_streamAfter.records - m_streamBefore.records;
+      const uint32_t dropped = m_streamAfter.dropped - m_streamBefore.dropped;
+      const double kbps = (m_streamAfter.bytes - m_streamBefore.bytes) / 1024.0 / virtualS;
+      printf("USB stream:             %u records, %.1f KB/s of %u KB/s, %u dropped (%.2f%%), ring high %u of %d bytes\n",
+             records, kbps, m_opt.usbKbps, dropped, records + dropped ? 100.0 * dropped / (records + dropped) : 0.0,
+             m_streamAfter.ringHigh, JKBMS_STREAM_RING);
+    }
+  }
+
+private:
+  static uint64_t sum(const std::vector<uint32_t>& v) {
+    uint64_t total = 0;
+    for (uint32_t x : v) total += x;
+    return total;
+  }
+
+  void attach(int i) {
+    JKBMS& dev = jkBmsDevices[i];
+    m_adverts.emplace_back(NimBLEAddress(dev.targetMAC), m_peers[i]->rssi());
+    dev.advDevice = &m_adverts.back();
+
+    NimBLEClient* client = NimBLEDevice::getClientByPeerAddress(dev.advDevice->getAddress());
+    if (!client) {
+      client = NimBLEDevice::createClient();
+      client->setClientCallbacks(new ClientCallbacks(&dev), true);
+      client->setConnectionParams(24, 24, 0, 400);
+    }
+    if (!client->connect(dev.advDevice)) return;
+    NimBLERemoteService* svc = client->getService("ffe0");
+    NimBLERemoteCharacteristic* chr = svc ? svc->getCharacteristic("ffe1") : nullptr;
+    if (!chr || !chr->subscribe(true, notifyCB)) return;
+    dev.pChr = chr;
+    dev.connected = true;
+    dev.lastNotifyTime = millis();
+    dev.writeRegister(0x96, 0x00000000, 0x00);
+  }
+
+  void scheduleSupervisor() {
+    sim::scheduleIn(1000000, [this]() {
+      for (int i = 0; i < m_packs; i++) {
+        if (!jkBmsDevices[i].connected && m_peers[i]->advertising()) {
+          attach(i);
+          if (m_measuring && jkBmsDevices[i].connected) m_stats.reconnects++;
+        }
+      }
+      scheduleSupervisor();
+    });
+  }
+
+  void scheduleShards() {
+    sim::scheduleIn(1000000, [this]() {
+      shardsUpdate();
+      scheduleShards();
+    });
+  }
+
+  void scheduleOutliers() {
+    sim::scheduleIn((uint64_t)m_opt.rateMs * 1000, [this]() {
+      FleetOutlierEvent events[64];
+      Clock::time_point t0 = Clock::now();
+      fleetOutlierSample(m_outliers, jkBmsDevices, m_packs, events, 64);
+      if (m_measuring) m_stats.outlierNs.push_back((uint32_t)elapsedNs(t0, Clock::now()));
+      scheduleOutliers();
+    });
+  }
+
+  // The port takes usbKbps; 1 ms polls as the writer task does when idle
+  void scheduleStream() {
+    sim::scheduleIn(1000, [this]() {
+      usbStreamPoll((size_t)m_opt.usbKbps * 1024 / 1000);
+      scheduleStream();
+    });
+  }
+
+  void onFragment(int i, sim::VirtualBms& peer, const uint8_t* data, size_t length, const sim::FragmentInfo& info) {
+    JKBMS& dev = jkBmsDevices[i];
+    bool before = dev.received_complete;
+    Clock::time_point t0 = Clock::now();
+    peer.deliver(data, length);
+    Clock::time_point t1 = Clock::now();
+    if (!m_measuring) return;
+
+    m_stats.notifications++;
+    m_stats.notifyNs += elapsedNs(t0, t1);
+    if (before || !dev.received_complete) return;
+
+    m_stats.parseNs.push_back((uint32_t)elapsedNs(t0, t1));
+    m_stats.linkUs.push_back((uint32_t)(sim::nowUs() - info.frameStartUs));
+    if (info.frameType != 0x02) {
+      m_stats.otherFrames++;
+      return;
+    }
+    m_stats.cellFrames++;
+    if (m_opt.uplink == "snapshot") {
+      JkSnapshot snap;
+      Clock::time_point u0 = Clock::now();
+      snapshotFromBms(dev, snap);
+      m_stats.uplinkNs.push_back((uint32_t)elapsedNs(u0, Clock::now()));
+      m_stats.uplinkBytes += sizeof(snap);
+      if (m_snapshotFile) fwrite(&snap, sizeof(snap), 1, m_snapshotFile);
+      return;
+    }
+    char buffer[1024];
+    Clock::time_point u0 = Clock::now();
+    m_stats.uplinkBytes += serializeUplink(dev, buffer, sizeof(buffer));
+    m_stats.uplinkNs.push_back((uint32_t)elapsedNs(u0, Clock::now()));
+  }
+
+  const Options& m_opt;
+  int m_packs;
+  std::vector<std::unique_ptr<sim::VirtualBms>> m_peers;
+  std::vector<sim::VirtualBmsStats> m_sentBefore;
+  std::deque<NimBLEAdvertisedDevice> m_adverts;
+  RunStats m_stats;
+  FleetOutliers m_outliers = {};
+  std::vector<int> m_weak;            // weak cell of pack i
+  bool m_measuring = false;
+  FILE* m_snapshotFile = nullptr;
+  StreamCounters m_streamBefore = {};
+  StreamCounters m_streamAfter = {};
+  uint64_t m_wallNs = 0;
+  uint64_t m_cpuNs = 0;
+  uint64_t m_virtualUs = 0;
+};
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  if (!parseOptions(argc, argv, opt)) return 2;
+
+  if (!opt.csv) {
+    printf("JKBMS fleet simulator: %u s per run, frame every %u ms, %u-byte fragments, %.2f%% loss, %.1f drops/h, %s, %s uplink\n",
+           opt.durationS, opt.rateMs, opt.fragment, opt.loss * 100, opt.dropsPerHour, opt.protocol.c_str(),
+           opt.uplink.c_str());
+  }
+  FILE* stream = nullptr;
+  if (!opt.usbStream.empty()) {
+    stream = fopen(opt.usbStream.c_str(), "wb");
+    if (!stream || !usbStreamStart(STREAM_ALL, writeStream, stream)) {
+      perror(opt.usbStream.c_str());
+      return 1;
+    }
+  }
+  bool header = true;
+  for (int packs : opt.packs) {
+    FleetRun run(opt, packs);
+    run.setup();
+    run.run();
+    run.report(opt.csv, header);
+    header = false;
+  }
+  NimBLEDevice::deleteAllClients();
+  if (stream) {
+    // What is still in the ring, so the file ends on a whole record
+    while (usbStreamPoll()) {
+    }
+    fclose(stream);
+  }
+  return 0;
+}
@@ -0,0 +1,250 @@
+/**
+ * @file history_bench.cpp
+ * @brief Query cost of the summary-indexed history against a full scan
+ *
+ * Fills a HistoryStore with a synthetic pack (daily solar cycle, top-of-charge
+ * cell peaks, temperature swing), then runs typical dashboard queries twice:
+ * through history.h and as a plain scan over every record. Count, min, max
+ * and sum must agree; the report shows the time of each and how many
+ * segments were answered from their summaries, pruned or read.
+ *
+ * Host time only. On the gateway the records sit in PSRAM, so the
+ * "records read" column is the figure that carries over: summary hits cost
+ * one ~100-byte read each instead of a whole segment.
+ *
+ * Usage:
+ *   history_bench [--days 28] [--interval-s 10] [--repeat 20]
+ */
+
+#include "../src/libs/JKBMS.h"
+#include "../src/libs/history.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+JKBMS jkBmsDevices[1];
+const int bmsDeviceCount = 0;
+
+namespace {
+
+struct Options {
+  uint32_t days = 28;
+  uint32_t intervalS = 10;
+  int repeat = 20;
+};
+
+// Flat copy of what was appended, for the reference scan
+struct Reference {
+  std::vector<uint32_t> timeS;
+  std::vector<int32_t> value[HIST_FIELD_COUNT];
+};
+
+typedef std::chrono::steady_clock Clock;
+
+template <typename Fn>
+double medianUs(int repeat, Fn fn) {
+  std::vector<double> us;
+  for (int r = 0; r < repeat; r++) {
+    Clock::time_point t0 = Clock::now();
+    fn();
+    us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+  }
+  std::sort(us.begin(), us.end());
+  return us[us.size() / 2];
+}
+
+void synthesize(uint32_t t, JkSnapshot& snap) {
+  memset(&snap, 0, sizeof(snap));
+  const double day = fmod(t / 86400.0, 1.0);
+  const double sun = std::max(0.0, sin((day - 0.25) * 2 * M_PI));   // 06:00-18:00
+  const double soc = 50 + 48 * sin((day - 0.35) * 2 * M_PI);
+  const int base = (int)(3200 + soc * 1.3);
+  snap.header.cellCount = 16;
+  int32_t total = 0;
+  int cellMin = 99999, cellMax = 0;
+  for (int c = 0; c < 16; c++) {
+    int mv = base + (c * 37 + (int)(t / 60)) % 11;
+    if (c == 7 && soc > 92) mv += (int)((soc - 92) * 40);   // one weak cell runs high at the top
+    snap.cellMv[c] = (uint16_t)mv;
+    total += mv;
+    cellMin = std::min(cellMin, mv);
+    cellMax = std::max(cellMax, mv);
+  }
+  snap.batteryMv = total;
+  snap.currentMa = (int32_t)(sun * 90000 - 25000);
+  snap.soc = (uint8_t)soc;
+  snap.deltaCellMv = (uint16_t)(cellMax - cellMin);
+  snap.t1DeciC = (int16_t)(200 + 80 * sun);
+  snap.t2DeciC = (int16_t)(190 + 60 * sun);
+}
+
+bool sameAggregate(const HistoryAggregate& a, const HistoryAggregate& b) {
+  return a.count == b.count && (!a.count || (a.min == b.min && a.max == b.max && a.sum == b.sum));
+}
+
+// Reference window aggregate over the flat copy
+void scanWindows(const HistoryStore& store, const Reference& ref, HistoryField field, uint32_t fromS, uint32_t toS,
+                 uint32_t windowS, std::vector<HistoryAggregate>& out) {
+  out.assign((toS - fromS) / windowS + 1, HistoryAggregate());
+  for (size_t i = 0; i < ref.timeS.size(); i++) {
+    const uint32_t t = ref.timeS[i];
+    if (t < fromS || t > toS) continue;
+    HistoryAggregate& a = out[(t - fromS) / windowS];
+    const int32_t v = ref.value[field][i];
+    if (!a.count || v < a.min) a.min = v;
+    if (!a.count || v > a.max) a.max = v;
+    a.count++;
+    a.sum += v;
+  }
+}
+
+int scanFind(const Reference& ref, HistoryField field, int32_t threshold, uint32_t fromS, uint32_t toS) {
+  int runs = 0;
+  bool open = false;
+  for (size_t i = 0; i < ref.timeS.size(); i++) {
+    if (ref.timeS[i] < fromS || ref.timeS[i] > toS) continue;
+    bool match = ref.value[field][i] > threshold;
+    if (match && !open) runs++;
+    open = match;
+  }
+  return runs;
+}
+
+void printRow(const char* name, double indexedUs, double scanUs, const HistoryQueryStats& s, bool ok) {
+  printf("%-34s %10.1f %10.1f %7.0fx %6u %7u %6u %6u %9u  %s\n", name, indexedUs, scanUs,
+         indexedUs > 0 ? scanUs / indexedUs : 0, s.segments, s.fromSummary, s.pruned, s.scanned, s.records,
+         ok ? "ok" : "MISMATCH");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string arg = argv[i];
+    if (arg == "--days") opt.days = atoi(argv[i + 1]);
+    else if (arg == "--interval-s") opt.intervalS = atoi(argv[i + 1]);
+    else if (arg == "--repeat") opt.repeat = atoi(argv[i + 1]);
+    else { fprintf(stderr, "unknown option %s\n", arg.c_str()); return 2; }
+  }
+  if (!opt.days || !opt.intervalS || opt.repeat < 1) return 2;
+
+  const uint32_t records = opt.days * 86400 / opt.intervalS;
+  const uint32_t segments = records / JKBMS_HISTORY_SEGMENT_RECORDS + 1;
+  if (segments > 65535) { fprintf(stderr, "too many records\n"); return 2; }
+  HistoryStore store;
+  if (!historyInit(store, (uint16_t)segments)) { fprintf(stderr, "out of memory\n"); return 1; }
+
+  // Start at a round epoch so day boundaries are easy to read
+  const uint32_t t0 = 1767225600;   // 2026-01-01 00:00 UTC
+  Reference ref;
+  JkSnapshot snap;
+  Clock::time_point a0 = Clock::now();
+  double synthUs = 0;
+  for (uint32_t r = 0; r < records; r++) {
+    const uint32_t t = t0 + r * opt.intervalS;
+    Clock::time_point s0 = Clock::now();
+    synthesize(t, snap);
+    synthUs += std::chrono::duration<double, std::micro>(Clock::now() - s0).count();
+    historyAppend(store, t, snap);
+    ref.timeS.push_back(t);
+    const HistorySegment& seg = store.segments[(store.started - 1) % store.capacity];
+    for (int f = 0; f < HIST_FIELD_COUNT; f++) ref.value[f].push_back(seg.value[f][seg.summary.count - 1]);
+  }
+  const double appendNs = (std::chrono::duration<double, std::micro>(Clock::now() - a0).count() - synthUs) * 1000 / records;
+  uint32_t firstS = 0, lastS = 0;
+  historyTimeRange(store, firstS, lastS);
+
+  printf("JKBMS history bench: %u days every %u s = %u records in %u segments (%zu B each, %.1f MB)\n", opt.days,
+         opt.intervalS, historyRecords(store), segments, sizeof(HistorySegment),
+         segments * sizeof(HistorySegment) / 1048576.0);
+  printf("Append: %.0f ns per record, summary %zu B per segment\n\n", appendNs, sizeof(HistorySummary));
+  printf("%-34s %10s %10s %8s %6s %7s %6s %6s %9s\n", "query", "index us", "scan us", "gain", "segs", "summary",
+         "pruned", "read", "records");
+
+  int failures = 0;
+  HistoryQueryStats stats;
+  std::vector<HistoryAggregate> expect;
+
+  // 1. Whole history, one aggregate
+  {
+    HistoryAggregate got;
+    double us = medianUs(opt.repeat, [&]() { historyAggregate(store, HIST_CELL_MAX, firstS, lastS, got, &stats); });
+    double scan = medianUs(opt.repeat, [&]() { scanWindows(store, ref, HIST_CELL_MAX, firstS, lastS, lastS - firstS + 1, expect); });
+    bool ok = sameAggregate(got, expect[0]);
+    failures += !ok;
+    printRow("cell max, all, min/max/avg", us, scan, stats, ok);
+  }
+
+  // 2. Hourly windows over the last 7 days (168 points)
+  {
+    const uint32_t from = lastS - 7 * 86400 + 1;
+    std::vector<HistoryAggregate> got(168);
+    double us = medianUs(opt.repeat, [&]() { historyWindows(store, HIST_VOLTAGE, from, lastS, 3600, got.data(), 168, &stats); });
+    double scan = medianUs(opt.repeat, [&]() { scanWindows(store, ref, HIST_VOLTAGE, from, lastS, 3600, expect); });
+    bool ok = true;
+    for (int w = 0; w < 168; w++) ok &= sameAggregate(got[w], expect[w]);
+    failures += !ok;
+    printRow("voltage, 7 d hourly windows", us, scan, stats, ok);
+  }
+
+  // 3. Daily p95 temperature over everything
+  {
+    std::vector<HistoryAggregate> got(opt.days);
+    int32_t p95 = 0;
+    double us = medianUs(opt.repeat, [&]() {
+      historyWindows(store, HIST_TEMP_MAX, t0, t0 + opt.days * 86400 - 1, 86400, got.data(), opt.days, &stats);
+      for (uint32_t d = 0; d < opt.days; d++) p95 = historyPercentile(store, HIST_TEMP_MAX, got[d], 0.95f);
+    });
+    double scan = medianUs(opt.repeat, [&]() { scanWindows(store, ref, HIST_TEMP_MAX, t0, t0 + opt.days * 86400 - 1, 86400, expect); });
+    bool ok = true;
+    for (uint32_t d = 0; d < opt.days; d++) ok &= sameAggregate(got[d], expect[d]);
+    // Exact p95 of the last day, to show the histogram error
+    std::vector<int32_t> day;
+    for (size_t i = 0; i < ref.timeS.size(); i++) {
+      if (ref.timeS[i] >= t0 + (opt.days - 1) * 86400) day.push_back(ref.value[HIST_TEMP_MAX][i]);
+    }
+    std::sort(day.begin(), day.end());
+    const int32_t exact = day.empty() ? 0 : day[(size_t)(0.95 * (day.size() - 1))];
+    failures += !ok;
+    printRow("temp, daily windows + p95", us, scan, stats, ok);
+    printf("%-34s p95 last day: %.1f °C (exact %.1f °C, bin %.1f °C)\n", "", p95 / 10.0, exact / 10.0,
+           store.binWidth[HIST_TEMP_MAX] / 10.0);
+  }
+
+  // 4. Predicate pushdown: when did any cell exceed 3.55 V?
+  {
+    HistoryMatch matches[512];
+    int n = 0;
+    double us = medianUs(opt.repeat, [&]() { n = historyFind(store, HIST_CELL_MAX, HIST_ABOVE, 3550, firstS, lastS, matches, 512, &stats); });
+    int expectRuns = 0;
+    double scan = medianUs(opt.repeat, [&]() { expectRuns = scanFind(ref, HIST_CELL_MAX, 3550, firstS, lastS); });
+    bool ok = n == std::min(expectRuns, 512);
+    failures += !ok;
+    printRow("cell max > 3550 mV, all", us, scan, stats, ok);
+    if (n) {
+      printf("%-34s %d runs, first %u s long, peak %d mV\n", "", n, matches[0].lastS - matches[0].firstS,
+             matches[0].extreme);
+    }
+  }
+
+  // 5. Unaligned range: edges fall inside segments
+  {
+    const uint32_t from = firstS + 86400 * 3 / 2 + 123, to = from + 86400 * 7 / 2;
+    HistoryAggregate got;
+    double us = medianUs(opt.repeat, [&]() { historyAggregate(store, HIST_CURRENT, from, to, got, &stats); });
+    double scan = medianUs(opt.repeat, [&]() { scanWindows(store, ref, HIST_CURRENT, from, to, to - from + 1, expect); });
+    bool ok = sameAggregate(got, expect[0]);
+    failures += !ok;
+    printRow("current, unaligned 3.5 d", us, scan, stats, ok);
+  }
+
+  historyFree(store);
+  if (failures) fprintf(stderr, "%d queries disagree with the full scan\n", failures);
+  return failures ? 1 : 0;
+}
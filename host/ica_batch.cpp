@@ -0,0 +1,244 @@
+/**
+ * @file ica_batch.cpp
+ * @brief Incremental capacity (dQ/dV) analysis over snapshot archives
+ *
+ * Reads one or more snapshot streams (fleet_sim --snapshot-file, gateway
+ * flash logs, UDP captures saved back to back), groups the records by pack
+ * MAC and runs the same ica.h code the gateway runs, one IcaState per pack.
+ * Packs are independent, so they are spread over a thread pool; files are
+ * mapped read-only and the records are used in place.
+ *
+ * The report gives, per cell, the latest dQ/dV peak, its height against
+ * the cell's first session and against the median cell of the same pack.
+ * A cell that lost capacity shows a lower peak than its siblings. --csv
+ * prints every session peak instead.
+ *
+ * Usage:
+ *   ica_batch FILE... [--threads N] [--nominal-ah AH] [--min-ratio 0.9] [--csv]
+ */
+
+#include "../src/libs/JKBMS.h"
+#include "../src/libs/ica.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+JKBMS jkBmsDevices[1];
+const int bmsDeviceCount = 0;
+
+namespace {
+
+struct Options {
+  std::vector<const char*> paths;
+  int threads = 0;              // 0: hardware concurrency
+  float nominalAh = 0;          // 0: from the snapshots
+  float minRatio = 0.9f;        // cells below this share of the pack median are marked
+  bool csv = false;
+};
+
+struct Pack {
+  uint8_t mac[6];
+  std::vector<const JkSnapshot*> records;
+  IcaState* state = nullptr;
+  std::vector<std::vector<IcaPeak> > peaks;   // per cell, every session
+};
+
+struct Mapping {
+  const uint8_t* data;
+  size_t size;
+};
+
+uint64_t macKey(const uint8_t* mac) {
+  uint64_t k = 0;
+  for (int i = 0; i < 6; i++) k = (k << 8) | mac[i];
+  return k;
+}
+
+bool mapFile(const char* path, Mapping& m) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(path);
+    if (fd >= 0) close(fd);
+    return false;
+  }
+  m.size = (size_t)st.st_size;
+  m.data = nullptr;
+  if (m.size) {
+    void* p = mmap(nullptr, m.size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      perror("mmap");
+      close(fd);
+      return false;
+    }
+    m.data = (const uint8_t*)p;
+  }
+  close(fd);
+  return true;
+}
+
+// Records back to back, as in snapshot_dump; resynchronise on the magic
+size_t collect(const Mapping& m, std::map<uint64_t, Pack>& packs, size_t& invalid) {
+  size_t count = 0, offset = 0;
+  while (offset + sizeof(JkSnapshot) <= m.size) {
+    const JkSnapshot* snap = snapshotView(m.data + offset, m.size - offset);
+    if (!snap) {
+      invalid++;
+      offset++;
+      while (offset + 4 <= m.size) {
+        uint32_t magic;
+        memcpy(&magic, m.data + offset, sizeof(magic));
+        if (magic == JKBMS_SNAPSHOT_MAGIC) break;
+        offset++;
+      }
+      continue;
+    }
+    Pack& p = packs[macKey(snap->header.mac)];
+    memcpy(p.mac, snap->header.mac, 6);
+    p.records.push_back(snap);
+    count++;
+    offset += snap->header.size;
+  }
+  return count;
+}
+
+void analyse(Pack& p, const IcaConfig& config) {
+  // Several files may hold the same pack; the sensor clock orders them
+  std::stable_sort(p.records.begin(), p.records.end(), [](const JkSnapshot* a, const JkSnapshot* b) {
+    return a->header.timestampMs < b->header.timestampMs;
+  });
+  p.state = new IcaState;
+  icaInit(*p.state, &config);
+  p.peaks.assign(JKBMS_ICA_CELLS, std::vector<IcaPeak>());
+
+  uint32_t lastS = 0;
+  auto take = [&p]() {
+    IcaPeak peak;
+    for (int c = 0; c < p.state->cells; c++) {
+      if (icaRecentPeak(*p.state, c, 0, peak)) p.peaks[c].push_back(peak);
+    }
+  };
+  for (const JkSnapshot* snap : p.records) {
+    lastS = snap->header.timestampMs / 1000;
+    if (icaAddSnapshot(*p.state, *snap, lastS)) take();
+  }
+  if (icaFinish(*p.state, lastS)) take();
+}
+
+float median(std::vector<float> v) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  const size_t mid = v.size() / 2;
+  return v.size() % 2 ? v[mid] : (v[mid - 1] + v[mid]) * 0.5f;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--csv") opt.csv = true;
+    else if (arg == "--threads" && i + 1 < argc) opt.threads = atoi(argv[++i]);
+    else if (arg == "--nominal-ah" && i + 1 < argc) opt.nominalAh = atof(argv[++i]);
+    else if (arg == "--min-ratio" && i + 1 < argc) opt.minRatio = atof(argv[++i]);
+    else if (arg[0] != '-') opt.paths.push_back(argv[i]);
+    else {
+      fprintf(stderr, "usage: ica_batch FILE... [--threads N] [--nominal-ah AH] [--min-ratio R] [--csv]\n");
+      return 2;
+    }
+  }
+  if (opt.paths.empty()) {
+    fprintf(stderr, "usage: ica_batch FILE... [--threads N] [--nominal-ah AH] [--min-ratio R] [--csv]\n");
+    return 2;
+  }
+
+  std::vector<Mapping> maps;
+  std::map<uint64_t, Pack> byMac;
+  size_t records = 0, invalid = 0;
+  for (const char* path : opt.paths) {
+    Mapping m;
+    if (!mapFile(path, m)) return 1;
+    maps.push_back(m);
+    records += collect(m, byMac, invalid);
+  }
+  std::vector<Pack*> packs;
+  for (auto& kv : byMac) packs.push_back(&kv.second);
+
+  IcaConfig config;
+  config.nominalAh = opt.nominalAh;
+  int threads = opt.threads > 0 ? opt.threads : (int)std::thread::hardware_concurrency();
+  if (threads < 1) threads = 1;
+  if (threads > (int)packs.size()) threads = (int)packs.size();
+
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> pool;
+  for (int t = 0; t < threads; t++) {
+    pool.emplace_back([&]() {
+      for (size_t i = next++; i < packs.size(); i = next++) analyse(*packs[i], config);
+    });
+  }
+  for (std::thread& t : pool) t.join();
+
+  char mac[18];
+  if (opt.csv) {
+    printf("mac,cell,end_s,charge_ah,peak_v,height_ah_per_v\n");
+  } else {
+    printf("JKBMS ICA: %zu records (%zu invalid), %zu packs, %d threads\n", records, invalid, packs.size(), threads);
+  }
+  int marked = 0;
+  for (Pack* p : packs) {
+    const IcaState& s = *p->state;
+    snprintf(mac, sizeof(mac), "%02x:%02x:%02x:%02x:%02x:%02x", p->mac[0], p->mac[1], p->mac[2], p->mac[3], p->mac[4],
+             p->mac[5]);
+    if (opt.csv) {
+      for (int c = 0; c < s.cells; c++) {
+        for (const IcaPeak& k : p->peaks[c]) {
+          printf("%s,%d,%u,%.2f,%.4f,%.1f\n", mac, c + 1, k.endS, k.chargeAh, k.voltage, k.height);
+        }
+      }
+      delete p->state;
+      continue;
+    }
+
+    std::vector<float> latest;
+    IcaPeak peak;
+    for (int c = 0; c < s.cells; c++) {
+      if (icaRecentPeak(s, c, 0, peak)) latest.push_back(peak.height);
+    }
+    const float med = median(latest);
+    printf("\n%s  %u sessions (%u too short), %zu records\n", mac, s.sessions, s.rejected, p->records.size());
+    if (!latest.empty()) {
+      printf("  cell  sessions   peak V   Ah/V   vs first  vs pack\n");
+      for (int c = 0; c < s.cells; c++) {
+        if (!icaRecentPeak(s, c, 0, peak)) {
+          printf("  %4d  no peak\n", c + 1);
+          continue;
+        }
+        const float ratio = med > 0 ? peak.height / med : 0;
+        const bool low = ratio < opt.minRatio;
+        marked += low;
+        printf("  %4d  %8u  %7.4f  %5.0f  %8.2f  %7.2f%s\n", c + 1, s.trend[c].sessions, peak.voltage, peak.height,
+               icaHeightRatio(s, c), ratio, low ? "  LOW" : "");
+      }
+    }
+    delete p->state;
+  }
+  if (!opt.csv) printf("\n%d cells below %.2f of their pack median\n", marked, opt.minRatio);
+
+  for (const Mapping& m : maps) {
+    if (m.data) munmap((void*)m.data, m.size);
+  }
+  return 0;
+}
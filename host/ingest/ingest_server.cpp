@@ -0,0 +1,326 @@
+/**
+ * @file ingest_server.cpp
+ * @brief Gateway listener and HTTP query endpoint
+ */
+
+#include "ingest_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace ingest {
+
+namespace {
+
+static const uint32_t kDefaultWindowS = 300;
+// A stalled query client would hold the accept thread
+static const int kHttpTimeoutS = 2;
+
+int listenOn(const std::string& address, uint16_t port, uint16_t& bound) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1 ||
+      bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+    close(fd);
+    return -1;
+  }
+  socklen_t len = sizeof(addr);
+  getsockname(fd, (sockaddr*)&addr, &len);
+  bound = ntohs(addr.sin_port);
+  return fd;
+}
+
+bool readAll(int fd, void* buffer, size_t length) {
+  uint8_t* p = (uint8_t*)buffer;
+  while (length) {
+    ssize_t n = recv(fd, p, length, 0);
+    if (n <= 0) return false;
+    p += n;
+    length -= (size_t)n;
+  }
+  return true;
+}
+
+void writeAll(int fd, const char* data, size_t length) {
+  while (length) {
+    ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+    if (n <= 0) return;
+    data += n;
+    length -= (size_t)n;
+  }
+}
+
+void appendf(std::string& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+void appendf(std::string& out, const char* format, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (n > 0) out.append(buffer, (size_t)n < sizeof(buffer) ? (size_t)n : sizeof(buffer) - 1);
+}
+
+void appendDevice(std::string& out, const DeviceView& d, uint32_t windowS, bool cells) {
+  const JkSnapshot& s = d.last;
+  appendf(out, "{\"mac\":\"%s\",\"last_seen_s\":%u,\"records\":%llu,\"sequence\":%u,\"protocol\":%u,",
+          IngestService::macString(d.mac).c_str(), d.lastSeenS, (unsigned long long)d.records,
+          s.header.sequence, s.header.protocol);
+  appendf(out, "\"voltage\":%.3f,\"current\":%.3f,\"power\":%.1f,\"soc\":%u,\"delta_cell\":%.3f,",
+          s.batteryMv * 0.001, s.currentMa * 0.001, s.powerDw * 0.1, s.soc, s.deltaCellMv * 0.001);
+  const Aggregate& a = d.window;
+  appendf(out, "\"window\":{\"seconds\":%u,\"samples\":%u,\"voltage_avg\":%.3f,\"voltage_min\":%.3f,"
+          "\"voltage_max\":%.3f,\"current_avg\":%.3f,\"power_avg\":%.1f,",
+          windowS, a.samples, a.voltageAvg, a.voltageMin, a.voltageMax, a.currentAvg, a.powerAvg);
+  appendf(out, "\"cell_min\":%.3f,\"cell_max\":%.3f,\"delta_max\":%.3f,\"temp_max\":%.1f}",
+          a.cellMinV, a.cellMaxV, a.deltaMaxV, a.tempMaxC);
+  if (cells) {
+    out += ",\"cells\":[";
+    for (int i = 0; i < s.header.cellCount && i < JKBMS_SNAPSHOT_CELLS; i++) {
+      appendf(out, "%s%.3f", i ? "," : "", s.cellMv[i] * 0.001);
+    }
+    out += "]";
+  }
+  out += "}";
+}
+
+// Value of key=... in a query string, "" if absent
+std::string queryParam(const std::string& query, const char* key) {
+  const std::string prefix = std::string(key) + "=";
+  for (size_t pos = 0; pos < query.size();) {
+    size_t end = query.find('&', pos);
+    if (end == std::string::npos) end = query.size();
+    if (query.compare(pos, prefix.size(), prefix) == 0) return query.substr(pos + prefix.size(), end - pos - prefix.size());
+    pos = end + 1;
+  }
+  return "";
+}
+
+uint32_t windowParam(const std::string& query) {
+  size_t pos = query.find("window=");
+  if (pos == std::string::npos) return kDefaultWindowS;
+  long v = strtol(query.c_str() + pos + 7, nullptr, 10);
+  if (v < 0) v = 0;
+  if (v > (long)(kBuckets * kBucketS)) v = kBuckets * kBucketS;
+  return (uint32_t)v;
+}
+
+} // namespace
+
+bool IngestServer::start(const std::string& bindAddress, uint16_t ingestPort, uint16_t httpPort) {
+  m_ingestFd = listenOn(bindAddress, ingestPort, m_ingestPort);
+  m_httpFd = listenOn(bindAddress, httpPort, m_httpPort);
+  if (m_ingestFd < 0 || m_httpFd < 0) {
+    stop();
+    return false;
+  }
+  m_running = true;
+  m_acceptors.emplace_back(&IngestServer::acceptLoop, this, m_ingestFd, false);
+  m_acceptors.emplace_back(&IngestServer::acceptLoop, this, m_httpFd, true);
+  return true;
+}
+
+void IngestServer::stop() {
+  m_running = false;
+  for (int* fd : { &m_ingestFd, &m_httpFd }) {
+    if (*fd < 0) continue;
+    shutdown(*fd, SHUT_RDWR);
+    close(*fd);
+    *fd = -1;
+  }
+  for (auto& t : m_acceptors) t.join();
+  m_acceptors.clear();
+
+  std::vector<std::thread> clients;
+  {
+    std::lock_guard<std::mutex> lock(m_clientsMutex);
+    for (int fd : m_clientFds) shutdown(fd, SHUT_RDWR);
+    clients.swap(m_clients);
+  }
+  for (auto& t : clients) t.join();
+  m_clientFds.clear();
+  m_finished.clear();
+}
+
+void IngestServer::acceptLoop(int listenFd, bool http) {
+  while (m_running) {
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0) {
+      if (!m_running) return;
+      continue;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (http) {
+      // Queries are short: answer on the accept thread
+      const timeval timeout = { kHttpTimeoutS, 0 };
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+      httpConnection(fd);
+      close(fd);
+    } else {
+      m_connections++;
+      track(fd);
+    }
+  }
+}
+
+// Started under the lock, so the connection cannot end before it is tracked
+void IngestServer::track(int fd) {
+  std::lock_guard<std::mutex> lock(m_clientsMutex);
+  // Reap connections that ended: they are past the lock, only closing their socket
+  for (const std::thread::id& id : m_finished) {
+    for (size_t i = 0; i < m_clients.size(); i++) {
+      if (m_clients[i].get_id() != id) continue;
+      m_clients[i].join();
+      m_clients[i] = std::move(m_clients.back());
+      m_clients.pop_back();
+      break;
+    }
+  }
+  m_finished.clear();
+  m_clientFds.push_back(fd);
+  m_clients.emplace_back(&IngestServer::ingestConnection, this, fd);
+}
+
+void IngestServer::ingestConnection(int fd) {
+  std::vector<uint8_t> payload;
+  IngestMessageHeader header;
+  while (m_running && readAll(fd, &header, sizeof(header))) {
+    if (header.magic != JKBMS_INGEST_MAGIC || header.length > JKBMS_INGEST_MAX_PAYLOAD) {
+      m_service.submit(header, nullptr);  // counted as rejected
+      break;
+    }
+    payload.resize(header.length);
+    if (header.length && !readAll(fd, payload.data(), header.length)) break;
+    if (!m_service.submit(header, payload.data())) break;
+  }
+  // Forget the descriptor before closing it, so stop() never shuts down a reused number
+  {
+    std::lock_guard<std::mutex> lock(m_clientsMutex);
+    for (size_t i = 0; i < m_clientFds.size(); i++) {
+      if (m_clientFds[i] != fd) continue;
+      m_clientFds[i] = m_clientFds.back();
+      m_clientFds.pop_back();
+      break;
+    }
+    m_finished.push_back(std::this_thread::get_id());
+  }
+  close(fd);
+}
+
+void IngestServer::httpConnection(int fd) {
+  char request[1024];
+  size_t used = 0;
+  while (used < sizeof(request) - 1) {
+    ssize_t n = recv(fd, request + used, sizeof(request) - 1 - used, 0);
+    if (n <= 0) break;
+    used += (size_t)n;
+    request[used] = '\0';
+    if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) break;
+  }
+  request[used] = '\0';
+
+  std::string body;
+  const char* status = "200 OK";
+  char method[8] = {}, target[512] = {};
+  if (sscanf(request, "%7s %511s", method, target) != 2 || strcmp(method, "GET") != 0) {
+    status = "405 Method Not Allowed";
+    body = "{\"error\":\"only GET is supported\"}";
+  } else if (!handleQuery(target, body)) {
+    status = "404 Not Found";
+    body = "{\"error\":\"not found\"}";
+  }
+  std::string response;
+  appendf(response, "HTTP/1.0 %s\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n"
+          "Connection: close\r\n\r\n", status, body.size());
+  response += body;
+  writeAll(fd, response.data(), response.size());
+}
+
+bool IngestServer::handleQuery(const std::string& target, std::string& body) const {
+  size_t q = target.find('?');
+  const std::string path = target.substr(0, q);
+  const std::string query = q == std::string::npos ? "" : target.substr(q + 1);
+  const uint32_t windowS = windowParam(query);
+
+  if (path == "/devices") {
+    std::vector<DeviceView> devices = m_service.devices(windowS);
+    body.reserve(devices.size() * 480 + 32);
+    body = "{\"devices\":[";
+    for (size_t i = 0; i < devices.size(); i++) {
+      if (i) body += ",";
+      appendDevice(body, devices[i], windowS, false);
+    }
+    body += "]}";
+    return true;
+  }
+  if (path.compare(0, 9, "/devices/") == 0) {
+    uint64_t mac;
+    DeviceView view;
+    if (!IngestService::parseMac(path.substr(9), mac) || !m_service.device(mac, windowS, view)) return false;
+    appendDevice(body, view, windowS, true);
+    return true;
+  }
+  if (path == "/quantiles") {
+    const std::string name = queryParam(query, "metric");
+    const int metric = sketchMetricFromName(name.empty() ? "cell_mv" : name.c_str());
+    const std::string macText = queryParam(query, "mac");
+    uint64_t mac = 0;
+    if (metric < 0 || (!macText.empty() && !IngestService::parseMac(macText, mac))) return false;
+    std::string qs = queryParam(query, "q");
+    if (qs.empty()) qs = "0.01,0.5,0.99";
+    const bool previous = queryParam(query, "day") == "previous";
+    JkSketch sketch;
+    const size_t devices = m_service.quantiles((SketchMetric)metric, previous, mac, sketch);
+    appendf(body, "{\"metric\":\"%s\",\"day\":\"%s\",\"devices\":%zu,\"sketch_bytes\":%zu,\"count\":%llu,"
+            "\"min\":%d,\"max\":%d,\"mean\":%.1f,\"quantiles\":{",
+            sketchMetricName((SketchMetric)metric), previous ? "previous" : "current", devices,
+            devices * sizeof(JkSketch), (unsigned long long)sketch.count, sketch.min, sketch.max,
+            sketch.count ? (double)sketch.sum / sketch.count : 0.0);
+    bool first = true;
+    for (const char* p = qs.c_str(); *p;) {
+      char* end;
+      const float q = strtof(p, &end);
+      if (end == p) break;
+      if (q >= 0 && q <= 1) {
+        appendf(body, "%s\"%g\":%d", first ? "" : ",", q, sketchQuantile(sketch, q));
+        first = false;
+      }
+      p = *end == ',' ? end + 1 : end;
+    }
+    body += "}}";
+    return true;
+  }
+  if (path == "/stats") {
+    ServiceStats s = m_service.stats();
+    appendf(body, "{\"uptime_s\":%u,\"connections\":%llu,\"messages\":%llu,\"rejected\":%llu,\"shards\":[",
+            m_service.nowS(), (unsigned long long)m_connections.load(), (unsigned long long)s.messages,
+            (unsigned long long)s.rejected);
+    for (size_t i = 0; i < s.shards.size(); i++) {
+      const ShardStats& st = s.shards[i];
+      appendf(body, "%s{\"devices\":%zu,\"records\":%llu,\"raw_frames\":%llu,\"sketches\":%llu,"
+              "\"busy_ms\":%.1f,\"queued\":%zu}",
+              i ? "," : "", st.devices, (unsigned long long)st.records, (unsigned long long)st.rawFrames,
+              (unsigned long long)st.sketches, st.busyNs / 1e6, st.queued);
+    }
+    body += "]}";
+    return true;
+  }
+  return false;
+}
+
+} // namespace ingest
@@ -0,0 +1,82 @@
+/**
+ * @file ingest_server.h
+ * @brief TCP front end of the ingest service
+ *
+ * Two listeners:
+ * - ingest port: gateways connect and stream messages (ingest_protocol.h).
+ *   One thread per connection reads a message and hands it to
+ *   IngestService::submit(); a malformed message closes the connection.
+ * - query port: minimal HTTP/1.0, JSON responses
+ *     GET /devices?window=S         latest snapshot + aggregate of every pack
+ *     GET /devices/<mac>?window=S   one pack, with cell voltages
+ *     GET /quantiles?metric=cell_mv&q=0.01,0.5,0.99[&day=previous][&mac=<mac>]
+ *                                   fleet (or one pack) percentiles from the
+ *                                   merged sketches; metric also current_ma,
+ *                                   temp_decic
+ *     GET /stats                    per-shard counters
+ *   window is in seconds (default 300, at most one hour). Queries are
+ *   answered on the accept thread; a client that does not send its request
+ *   within 2 s is dropped.
+ *
+ * POSIX sockets; host only.
+ */
+
+#ifndef HOST_INGEST_INGEST_SERVER_H
+#define HOST_INGEST_INGEST_SERVER_H
+
+#include "ingest_service.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ingest {
+
+class IngestServer {
+public:
+  explicit IngestServer(IngestService& service) : m_service(service) {}
+  ~IngestServer() { stop(); }
+
+  /**
+   * @brief Bind both listeners and start accepting
+   * @param ingestPort 0 picks an ephemeral port (see ingestPort())
+   */
+  bool start(const std::string& bindAddress, uint16_t ingestPort, uint16_t httpPort);
+  void stop();
+
+  uint16_t ingestPort() const { return m_ingestPort; }
+  uint16_t httpPort() const { return m_httpPort; }
+  uint64_t connections() const { return m_connections; }
+
+  /**
+   * @brief Render the JSON body for a query target ("/devices?window=60")
+   * @return false if the path or MAC is unknown (404)
+   */
+  bool handleQuery(const std::string& target, std::string& body) const;
+
+private:
+  void acceptLoop(int listenFd, bool http);
+  void ingestConnection(int fd);
+  void httpConnection(int fd);
+  void track(int fd);
+
+  IngestService& m_service;
+  std::atomic<bool> m_running{ false };
+  std::atomic<uint64_t> m_connections{ 0 };
+  int m_ingestFd = -1;
+  int m_httpFd = -1;
+  uint16_t m_ingestPort = 0;
+  uint16_t m_httpPort = 0;
+  std::vector<std::thread> m_acceptors;
+
+  std::mutex m_clientsMutex;
+  std::vector<int> m_clientFds;
+  std::vector<std::thread> m_clients;
+  std::vector<std::thread::id> m_finished;   // joined by the next track() or stop()
+};
+
+} // namespace ingest
+
+#endif // HOST_INGEST_INGEST_SERVER_H
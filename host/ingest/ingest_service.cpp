@@ -0,0 +1,438 @@
+/**
+ * @file ingest_service.cpp
+ * @brief Sharded worker threads, per-device state and rolling aggregates
+ */
+
+#include "ingest_service.h"
+
+#include "../../src/libs/JKBMS.h"
+#include "../../src/libs/frame_handlers.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace ingest {
+
+namespace {
+
+uint64_t monotonicNs() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// splitmix64 finaliser: MACs of one vendor share their upper bytes
+uint64_t mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+} // namespace
+
+IngestService::IngestService(int shards) : m_startNs(monotonicNs()) {
+  if (shards < 1) shards = 1;
+  for (int i = 0; i < shards; i++) m_shards.emplace_back(new Shard());
+  for (auto& shard : m_shards) {
+    Shard* s = shard.get();
+    s->worker = std::thread([this, s]() { workerLoop(*s); });
+  }
+}
+
+IngestService::~IngestService() {
+  m_stop = true;
+  for (auto& shard : m_shards) {
+    {
+      std::lock_guard<std::mutex> lock(shard->queueMutex);
+    }
+    shard->queueReady.notify_all();
+    shard->queueSpace.notify_all();
+  }
+  for (auto& shard : m_shards) shard->worker.join();
+}
+
+uint32_t IngestService::nowS() const {
+  return (uint32_t)((monotonicNs() - m_startNs) / 1000000000ULL);
+}
+
+uint64_t IngestService::macKey(const uint8_t mac[6]) {
+  uint64_t key = 0;
+  for (int i = 0; i < 6; i++) key = key << 8 | mac[i];
+  return key;
+}
+
+std::string IngestService::macString(uint64_t mac) {
+  char text[18];
+  snprintf(text, sizeof(text), "%02x:%02x:%02x:%02x:%02x:%02x", (unsigned)(mac >> 40 & 0xFF),
+           (unsigned)(mac >> 32 & 0xFF), (unsigned)(mac >> 24 & 0xFF), (unsigned)(mac >> 16 & 0xFF),
+           (unsigned)(mac >> 8 & 0xFF), (unsigned)(mac & 0xFF));
+  return text;
+}
+
+bool IngestService::parseMac(const std::string& text, uint64_t& mac) {
+  uint8_t bytes[6];
+  int digits = 0;
+  for (char c : text) {
+    int v = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+    if (v < 0) {
+      if (c != ':' && c != '-') return false;
+      continue;
+    }
+    if (digits >= 12) return false;
+    bytes[digits / 2] = digits % 2 ? (uint8_t)(bytes[digits / 2] << 4 | v) : (uint8_t)v;
+    digits++;
+  }
+  if (digits != 12) return false;
+  mac = macKey(bytes);
+  return true;
+}
+
+size_t IngestService::shardOf(uint64_t mac) const {
+  return (size_t)(mix(mac) % m_shards.size());
+}
+
+//********************************************
+// Intake (connection threads)
+//********************************************
+
+bool IngestService::submit(const IngestMessageHeader& header, const uint8_t* payload) {
+  if (header.magic != JKBMS_INGEST_MAGIC || header.version != JKBMS_INGEST_VERSION ||
+      header.length > JKBMS_INGEST_MAX_PAYLOAD) {
+    m_rejected++;
+    return false;
+  }
+  m_messages++;
+  if (header.type == INGEST_HELLO) return true;
+  if (header.type == INGEST_SKETCHES) {
+    // Validate the whole message before merging any of it
+    std::vector<const JkSketch*> sketches;
+    size_t offset = 0;
+    for (uint16_t r = 0; r < header.count; r++) {
+      const JkSketch* sketch = sketchView(payload + offset, header.length - offset);
+      if (!sketch || macKey(sketch->mac) == 0) {
+        m_rejected++;
+        return false;
+      }
+      sketches.push_back(sketch);
+      offset += sketch->size;
+    }
+    for (const JkSketch* sketch : sketches) mergeSketch(*sketch);
+    return true;
+  }
+
+  // Route into per-shard batches first, so each shard queue is locked once per message
+  std::vector<std::vector<Item>> batches(m_shards.size());
+  size_t offset = 0;
+  for (uint16_t r = 0; r < header.count; r++) {
+    Item item;
+    item.type = header.type;
+    if (header.type == INGEST_SNAPSHOTS) {
+      const JkSnapshot* snap = snapshotView(payload + offset, header.length - offset);
+      if (!snap) {
+        m_rejected++;
+        return false;
+      }
+      item.mac = macKey(snap->header.mac);
+      item.protocol = snap->header.protocol;
+      item.timestampMs = snap->header.timestampMs;
+      item.length = sizeof(JkSnapshot);
+      memcpy(item.bytes, snap, sizeof(JkSnapshot));
+      offset += snap->header.size;
+    } else if (header.type == INGEST_RAW_FRAMES) {
+      if (header.length - offset < sizeof(IngestRawFrame)) {
+        m_rejected++;
+        return false;
+      }
+      IngestRawFrame raw;
+      memcpy(&raw, payload + offset, sizeof(raw));
+      offset += sizeof(raw);
+      if (raw.length > sizeof(item.bytes) || header.length - offset < raw.length) {
+        m_rejected++;
+        return false;
+      }
+      item.mac = macKey(raw.mac);
+      item.protocol = raw.protocol;
+      item.timestampMs = raw.timestampMs;
+      item.length = raw.length;
+      memcpy(item.bytes, payload + offset, raw.length);
+      offset += raw.length;
+    } else {
+      m_rejected++;
+      return false;
+    }
+    // The parsers and protocolName() only know these
+    if (item.protocol > PROTOCOL_JK04) {
+      m_rejected++;
+      return false;
+    }
+    batches[shardOf(item.mac)].push_back(item);
+  }
+
+  for (size_t i = 0; i < batches.size(); i++) {
+    if (batches[i].empty()) continue;
+    Shard& shard = *m_shards[i];
+    {
+      std::unique_lock<std::mutex> lock(shard.queueMutex);
+      shard.queueSpace.wait(lock, [this, &shard]() { return m_stop || shard.queue.size() < kMaxQueued; });
+      if (shard.queue.empty()) {
+        shard.queue.swap(batches[i]);
+      } else {
+        shard.queue.insert(shard.queue.end(), batches[i].begin(), batches[i].end());
+      }
+    }
+    shard.queueReady.notify_one();
+  }
+  return true;
+}
+
+// Merged on the connection thread: a few microseconds under the shard's state lock
+bool IngestService::mergeSketch(const JkSketch& sketch) {
+  const uint64_t mac = macKey(sketch.mac);
+  Shard& shard = *m_shards[shardOf(mac)];
+  const uint32_t now = nowS();
+  std::lock_guard<std::mutex> lock(shard.stateMutex);
+  Device& device = shard.devices[mac];
+  rollSketches(device, mac, now);
+  if (!sketchMerge(device.today[sketch.metric], sketch)) return false;
+  shard.stats.sketches++;
+  shard.stats.devices = shard.devices.size();
+  return true;
+}
+
+void IngestService::drain() {
+  for (auto& shard : m_shards) {
+    std::unique_lock<std::mutex> lock(shard->queueMutex);
+    shard->queueEmpty.wait(lock, [&shard]() { return shard->queue.empty() && !shard->busy; });
+  }
+}
+
+//********************************************
+// Workers
+//********************************************
+
+void IngestService::workerLoop(Shard& shard) {
+  std::vector<Item> batch;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(shard.queueMutex);
+      shard.busy = false;
+      if (shard.queue.empty()) shard.queueEmpty.notify_all();
+      shard.queueReady.wait(lock, [this, &shard]() { return m_stop || !shard.queue.empty(); });
+      if (m_stop && shard.queue.empty()) return;
+      batch.clear();
+      batch.swap(shard.queue);
+      shard.busy = true;
+    }
+    shard.queueSpace.notify_all();
+    const uint64_t t0 = monotonicNs();
+    const uint32_t now = nowS();
+    std::lock_guard<std::mutex> lock(shard.stateMutex);
+    for (Item& item : batch) apply(shard, item, now);
+    shard.stats.busyNs += monotonicNs() - t0;
+    shard.stats.devices = shard.devices.size();
+  }
+}
+
+void IngestService::apply(Shard& shard, Item& item, uint32_t now) {
+  Device& device = shard.devices[item.mac];
+  JkSnapshot snap;
+  if (item.type == INGEST_SNAPSHOTS) {
+    memcpy(&snap, item.bytes, sizeof(snap));
+  } else {
+    // Raw frame: run the library parsers on this device's own JKBMS instance
+    shard.stats.rawFrames++;
+    if (!device.parser) {
+      device.parser.reset(new JKBMS(macString(item.mac)));
+      device.parser->connected = true;
+      device.parser->protocol = (ProtocolVariant)item.protocol;
+    }
+    JKBMS& bms = *device.parser;
+    if (item.length < 6 || item.length > sizeof(bms.receivedBytes)) return;
+    memcpy(bms.receivedBytes, item.bytes, item.length);
+    bms.frame = item.length;
+    dispatchFrame(bms, bms.receivedBytes, item.length);
+    if (item.bytes[4] != 0x02) return;  // settings and device info only update the parser
+    snapshotFromBms(bms, snap);
+    snap.header.timestampMs = item.timestampMs;
+    snap.crc = snapshotCrc((const uint8_t*)&snap, offsetof(JkSnapshot, crc));
+  }
+  device.last = snap;
+  device.lastSeenS = now;
+  device.records++;
+  shard.stats.records++;
+  addToBuckets(device, snap, now);
+  rollSketches(device, item.mac, now);
+  sketchAddSnapshot(device.today, snap);
+}
+
+void IngestService::rollSketches(Device& device, uint64_t mac, uint32_t now) {
+  const uint32_t day = now / kSketchDayS;
+  if (device.sketched && device.sketchDay == day) return;
+  uint8_t bytes[6];
+  for (int i = 0; i < 6; i++) bytes[i] = (uint8_t)(mac >> (40 - 8 * i));
+  for (int m = 0; m < SKETCH_METRIC_COUNT; m++) {
+    if (device.sketched && device.sketchDay + 1 == day) {
+      device.yesterday[m] = device.today[m];
+    } else {
+      sketchInit(device.yesterday[m], (SketchMetric)m, bytes);
+    }
+    sketchInit(device.today[m], (SketchMetric)m, bytes);
+  }
+  device.sketched = true;
+  device.sketchDay = day;
+}
+
+void IngestService::addToBuckets(Device& device, const JkSnapshot& snap, uint32_t now) {
+  const uint32_t epoch = now / kBucketS;
+  Bucket& b = device.buckets[epoch % kBuckets];
+  const float voltage = snap.batteryMv * 0.001f;
+  float cellMin = 0, cellMax = 0;
+  for (int i = 0; i < snap.header.cellCount && i < JKBMS_SNAPSHOT_CELLS; i++) {
+    float v = snap.cellMv[i] * 0.001f;
+    if (v <= 0) continue;
+    if (cellMin == 0 || v < cellMin) cellMin = v;
+    if (v > cellMax) cellMax = v;
+  }
+  const float temp = std::max(snap.t1DeciC, snap.t2DeciC) * 0.1f;
+  if (b.epoch != epoch || b.samples == 0) {
+    b = Bucket();
+    b.epoch = epoch;
+    b.voltageMin = b.voltageMax = voltage;
+    b.cellMinV = cellMin;
+    b.cellMaxV = cellMax;
+    b.tempMaxC = temp;
+  }
+  b.samples++;
+  b.voltageSum += voltage;
+  b.currentSum += snap.currentMa * 0.001;
+  b.powerSum += snap.powerDw * 0.1;
+  b.voltageMin = std::min(b.voltageMin, voltage);
+  b.voltageMax = std::max(b.voltageMax, voltage);
+  if (cellMin > 0 && (b.cellMinV == 0 || cellMin < b.cellMinV)) b.cellMinV = cellMin;
+  b.cellMaxV = std::max(b.cellMaxV, cellMax);
+  b.deltaMaxV = std::max(b.deltaMaxV, snap.deltaCellMv * 0.001f);
+  b.tempMaxC = std::max(b.tempMaxC, temp);
+}
+
+Aggregate IngestService::aggregate(const Device& device, uint32_t now, uint32_t windowS) {
+  Aggregate a;
+  if (windowS == 0) return a;
+  const uint32_t last = now / kBucketS;
+  uint32_t span = (windowS + kBucketS - 1) / kBucketS;
+  if (span > (uint32_t)kBuckets) span = kBuckets;
+  double vSum = 0, iSum = 0, pSum = 0;
+  for (uint32_t k = 0; k < span && k <= last; k++) {
+    const Bucket& b = device.buckets[(last - k) % kBuckets];
+    if (b.epoch != last - k || b.samples == 0) continue;
+    if (a.samples == 0) {
+      a.voltageMin = b.voltageMin;
+      a.voltageMax = b.voltageMax;
+      a.cellMinV = b.cellMinV;
+      a.cellMaxV = b.cellMaxV;
+      a.tempMaxC = b.tempMaxC;
+    }
+    a.samples += b.samples;
+    vSum += b.voltageSum;
+    iSum += b.currentSum;
+    pSum += b.powerSum;
+    a.voltageMin = std::min(a.voltageMin, b.voltageMin);
+    a.voltageMax = std::max(a.voltageMax, b.voltageMax);
+    if (b.cellMinV > 0 && (a.cellMinV == 0 || b.cellMinV < a.cellMinV)) a.cellMinV = b.cellMinV;
+    a.cellMaxV = std::max(a.cellMaxV, b.cellMaxV);
+    a.deltaMaxV = std::max(a.deltaMaxV, b.deltaMaxV);
+    a.tempMaxC = std::max(a.tempMaxC, b.tempMaxC);
+  }
+  if (a.samples) {
+    a.voltageAvg = (float)(vSum / a.samples);
+    a.currentAvg = (float)(iSum / a.samples);
+    a.powerAvg = (float)(pSum / a.samples);
+  }
+  return a;
+}
+
+//********************************************
+// Queries
+//********************************************
+
+std::vector<DeviceView> IngestService::devices(uint32_t windowS) const {
+  std::vector<DeviceView> out;
+  const uint32_t now = nowS();
+  for (const auto& shard : m_shards) {
+    std::lock_guard<std::mutex> lock(shard->stateMutex);
+    for (const auto& entry : shard->devices) {
+      if (!entry.second.records) continue;
+      DeviceView view;
+      view.mac = entry.first;
+      view.last = entry.second.last;
+      view.lastSeenS = entry.second.lastSeenS;
+      view.records = entry.second.records;
+      view.window = aggregate(entry.second, now, windowS);
+      out.push_back(view);
+    }
+  }
+  std::sort(out.begin(), out.end(), [](const DeviceView& a, const DeviceView& b) { return a.mac < b.mac; });
+  return out;
+}
+
+bool IngestService::device(uint64_t mac, uint32_t windowS, DeviceView& out) const {
+  const Shard& shard = *m_shards[shardOf(mac)];
+  std::lock_guard<std::mutex> lock(shard.stateMutex);
+  auto it = shard.devices.find(mac);
+  if (it == shard.devices.end() || !it->second.records) return false;
+  out.mac = mac;
+  out.last = it->second.last;
+  out.lastSeenS = it->second.lastSeenS;
+  out.records = it->second.records;
+  out.window = aggregate(it->second, nowS(), windowS);
+  return true;
+}
+
+size_t IngestService::quantiles(SketchMetric metric, bool previousDay, uint64_t mac, JkSketch& out) const {
+  sketchInit(out, metric);
+  const uint32_t day = nowS() / kSketchDayS;
+  size_t merged = 0;
+  // A device without records since the day changed still holds the older day as "today"
+  auto add = [&](const Device& device) {
+    if (!device.sketched) return;
+    const JkSketch* sketch = nullptr;
+    if (device.sketchDay == day) sketch = previousDay ? &device.yesterday[metric] : &device.today[metric];
+    else if (previousDay && device.sketchDay + 1 == day) sketch = &device.today[metric];
+    if (!sketch || sketch->count == 0) return;
+    sketchMerge(out, *sketch);
+    merged++;
+  };
+  if (mac) {
+    const Shard& shard = *m_shards[shardOf(mac)];
+    std::lock_guard<std::mutex> lock(shard.stateMutex);
+    auto it = shard.devices.find(mac);
+    if (it != shard.devices.end()) add(it->second);
+    return merged;
+  }
+  for (const auto& shard : m_shards) {
+    std::lock_guard<std::mutex> lock(shard->stateMutex);
+    for (const auto& entry : shard->devices) add(entry.second);
+  }
+  return merged;
+}
+
+ServiceStats IngestService::stats() const {
+  ServiceStats s;
+  s.messages = m_messages;
+  s.rejected = m_rejected;
+  for (const auto& shard : m_shards) {
+    ShardStats st;
+    {
+      std::lock_guard<std::mutex> lock(shard->stateMutex);
+      st = shard->stats;
+    }
+    {
+      std::lock_guard<std::mutex> lock(shard->queueMutex);
+      st.queued = shard->queue.size();
+    }
+    s.shards.push_back(st);
+  }
+  return s;
+}
+
+} // namespace ingest
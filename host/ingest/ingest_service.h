@@ -0,0 +1,182 @@
+/**
+ * @file ingest_service.h
+ * @brief In-memory fleet state for the ingest server, sharded by MAC
+ *
+ * Devices are spread over N shards by a hash of their MAC. Each shard has
+ * one worker thread that owns the shard's devices: it parses raw frames
+ * with the library parsers (one JKBMS instance per device, fed through
+ * dispatchFrame()), turns them into JkSnapshot records and keeps the latest
+ * snapshot plus a rolling per-minute aggregate. Connection threads only
+ * validate and route records, so the parsing and aggregation work scales
+ * with the number of shards.
+ *
+ * Each device also keeps quantile sketches (quantile_sketch.h) of its
+ * cells, current and temperatures for the current and the previous day of
+ * service time, fed from its records and merged with the sketches gateways
+ * send (INGEST_SKETCHES). Fleet percentiles merge them: a few KB per device
+ * instead of every sample.
+ *
+ * Queries lock one shard at a time for a copy, so they never stall the
+ * other shards.
+ */
+
+#ifndef HOST_INGEST_INGEST_SERVICE_H
+#define HOST_INGEST_INGEST_SERVICE_H
+
+#include "../../src/libs/ingest_protocol.h"
+#include "../../src/libs/quantile_sketch.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class JKBMS;
+
+namespace ingest {
+
+// Rolling aggregate: one bucket per minute, one hour kept
+static const int kBuckets = 60;
+static const uint32_t kBucketS = 60;
+// Records waiting per shard before submit() blocks; a slow shard pushes back
+// on the gateway connections through TCP instead of growing without bound
+static const size_t kMaxQueued = 16384;
+// Sketch period: quantile queries cover the current or the previous day
+static const uint32_t kSketchDayS = 86400;
+
+struct Bucket {
+  uint32_t epoch;           // minute since service start this bucket holds
+  uint32_t samples;
+  double voltageSum;
+  double currentSum;
+  double powerSum;
+  float voltageMin;
+  float voltageMax;
+  float cellMinV;
+  float cellMaxV;
+  float deltaMaxV;
+  float tempMaxC;
+};
+
+// Aggregate over the last windowS seconds
+struct Aggregate {
+  uint32_t samples = 0;
+  float voltageAvg = 0, voltageMin = 0, voltageMax = 0;
+  float currentAvg = 0, powerAvg = 0;
+  float cellMinV = 0, cellMaxV = 0, deltaMaxV = 0, tempMaxC = 0;
+};
+
+struct DeviceView {
+  uint64_t mac = 0;
+  JkSnapshot last = {};
+  uint32_t lastSeenS = 0;   // service time of the last record
+  uint64_t records = 0;
+  Aggregate window;
+};
+
+struct ShardStats {
+  uint64_t records = 0;     // applied snapshots
+  uint64_t rawFrames = 0;   // raw frames parsed
+  uint64_t sketches = 0;    // gateway sketches merged
+  uint64_t busyNs = 0;      // worker wall time spent applying batches
+  size_t devices = 0;
+  size_t queued = 0;
+};
+
+struct ServiceStats {
+  uint64_t messages = 0;
+  uint64_t rejected = 0;    // malformed messages or records
+  std::vector<ShardStats> shards;
+};
+
+class IngestService {
+public:
+  explicit IngestService(int shards);
+  ~IngestService();
+
+  /**
+   * @brief Validate one message payload and queue its records on their shards
+   * @return false if the message is malformed (the connection should be closed)
+   */
+  bool submit(const IngestMessageHeader& header, const uint8_t* payload);
+
+  /** @brief Block until every queued record has been applied */
+  void drain();
+
+  // Queries (any thread)
+  std::vector<DeviceView> devices(uint32_t windowS = 0) const;
+  bool device(uint64_t mac, uint32_t windowS, DeviceView& out) const;
+  /**
+   * @brief Merge the sketches of one metric over every device (mac 0) or one device
+   * @param previousDay false: the current day of service time
+   * @return Devices merged
+   */
+  size_t quantiles(SketchMetric metric, bool previousDay, uint64_t mac, JkSketch& out) const;
+  ServiceStats stats() const;
+  int shardCount() const { return (int)m_shards.size(); }
+  uint32_t nowS() const;
+
+  static uint64_t macKey(const uint8_t mac[6]);
+  static std::string macString(uint64_t mac);
+  static bool parseMac(const std::string& text, uint64_t& mac);
+
+private:
+  struct Item {
+    uint64_t mac;
+    uint8_t type;           // INGEST_SNAPSHOTS or INGEST_RAW_FRAMES
+    uint8_t protocol;
+    uint16_t length;
+    uint32_t timestampMs;
+    uint8_t bytes[320];     // a JkSnapshot or a raw frame
+  };
+
+  struct Device {
+    JkSnapshot last = {};
+    uint32_t lastSeenS = 0;
+    uint64_t records = 0;
+    Bucket buckets[kBuckets] = {};
+    std::unique_ptr<JKBMS> parser;   // created on the first raw frame
+    uint32_t sketchDay = 0;
+    bool sketched = false;
+    JkSketch today[SKETCH_METRIC_COUNT];
+    JkSketch yesterday[SKETCH_METRIC_COUNT];
+  };
+
+  struct Shard {
+    std::mutex queueMutex;
+    std::condition_variable queueReady;
+    std::condition_variable queueEmpty;
+    std::condition_variable queueSpace;
+    std::vector<Item> queue;
+    bool busy = false;
+
+    mutable std::mutex stateMutex;
+    std::unordered_map<uint64_t, Device> devices;
+    ShardStats stats;
+
+    std::thread worker;
+  };
+
+  void workerLoop(Shard& shard);
+  void apply(Shard& shard, Item& item, uint32_t nowS);
+  static void addToBuckets(Device& device, const JkSnapshot& snap, uint32_t nowS);
+  static void rollSketches(Device& device, uint64_t mac, uint32_t nowS);
+  bool mergeSketch(const JkSketch& sketch);
+  static Aggregate aggregate(const Device& device, uint32_t nowS, uint32_t windowS);
+  size_t shardOf(uint64_t mac) const;
+
+  std::vector<std::unique_ptr<Shard>> m_shards;
+  std::atomic<bool> m_stop{ false };
+  std::atomic<uint64_t> m_messages{ 0 };
+  std::atomic<uint64_t> m_rejected{ 0 };
+  uint64_t m_startNs;
+};
+
+} // namespace ingest
+
+#endif // HOST_INGEST_INGEST_SERVICE_H
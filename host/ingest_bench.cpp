@@ -0,0 +1,365 @@
+/**
+ * @file ingest_bench.cpp
+ * @brief Throughput and shard scaling of the ingest service
+ *
+ * Starts IngestService + IngestServer on 127.0.0.1 (ephemeral ports) and
+ * connects simulated gateways over real TCP sockets. Each gateway streams
+ * one message per cycle holding every pack it serves, either as snapshots
+ * (already parsed on the gateway) or as raw JK02 frames (parsed by the
+ * shard workers with the library parsers). Messages are prebuilt, so the
+ * gateway threads cost little more than the socket writes.
+ *
+ * For each shard count the run reports applied records per second, the
+ * speedup and scaling efficiency against the first shard count, and the
+ * latency of HTTP queries made after the load stops.
+ *
+ * Usage:
+ *   ingest_bench [--gateways 8] [--packs-per-gateway 64] [--duration-s 5]
+ *                [--shards 1,2,4,8] [--mode raw|snapshot|mixed]
+ *                [--queries 200] [--csv]
+ *
+ * Scaling is bounded by the cores of the machine running the bench: with
+ * fewer cores than shards, the extra shards only add context switches.
+ */
+
+#include "../src/libs/JKBMS.h"
+#include "../src/libs/frame_handlers.h"
+#include "ingest/ingest_server.h"
+#include "sim/frame_builder.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+JKBMS jkBmsDevices[1];
+const int bmsDeviceCount = 0;
+
+namespace {
+
+struct Options {
+  int gateways = 8;
+  int packsPerGateway = 64;
+  uint32_t durationS = 5;
+  std::vector<int> shards = { 1, 2, 4, 8 };
+  std::string mode = "raw";
+  int queries = 200;
+  bool csv = false;
+};
+
+struct RunResult {
+  int shards = 0;
+  double wallS = 0;
+  uint64_t sent = 0;
+  uint64_t applied = 0;
+  uint64_t rawFrames = 0;
+  uint64_t rejected = 0;
+  double busyS = 0;
+  double queryP50Us = 0;
+  double queryP99Us = 0;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+// Cycles of prebuilt messages per gateway, so consecutive records differ
+static const int kVariants = 4;
+
+double elapsedS(Clock::time_point a, Clock::time_point b) {
+  return std::chrono::duration<double>(b - a).count();
+}
+
+double percentile(std::vector<double>& v, double p) {
+  if (v.empty()) return 0;
+  size_t k = (size_t)(p * (v.size() - 1));
+  std::nth_element(v.begin(), v.begin() + k, v.end());
+  return v[k];
+}
+
+std::string macFor(int gateway, int pack) {
+  char mac[18];
+  snprintf(mac, sizeof(mac), "c8:47:80:%02x:%02x:%02x", gateway & 0xFF, (pack >> 8) & 0xFF, pack & 0xFF);
+  return mac;
+}
+
+sim::PackState packState(std::mt19937& rng, int variant) {
+  std::uniform_int_distribution<int> cell(3280, 3340);
+  sim::PackState s;
+  s.cellCount = 16;
+  s.batteryMv = 0;
+  for (int c = 0; c < s.cellCount; c++) {
+    s.cellMv[c] = (uint16_t)cell(rng);
+    s.wireResistMohm[c] = 20;
+    s.batteryMv += s.cellMv[c];
+  }
+  s.currentMa = 5000 + variant * 1000;
+  s.t1DeciC = 250 + variant;
+  s.t2DeciC = 260;
+  s.mosTempDeciC = 300;
+  s.socPercent = 60;
+  s.capacityRemainMah = 168000;
+  s.nominalCapacityMah = 280000;
+  s.cycleCount = 42;
+  s.uptimeS = 86400 + variant;
+  return s;
+}
+
+/**
+ * @brief Build the messages one gateway sends in turn
+ * Snapshot records are produced by running the raw frame through the same
+ * parsers a gateway uses, then snapshotFromBms().
+ */
+std::vector<std::vector<uint8_t>> buildMessages(int gateway, int packs, bool raw) {
+  std::mt19937 rng(1000 + gateway);
+  std::vector<std::vector<uint8_t>> messages;
+  uint8_t frame[sim::kFrameSize];
+  for (int v = 0; v < kVariants; v++) {
+    std::vector<uint8_t> payload;
+    for (int p = 0; p < packs; p++) {
+      const std::string mac = macFor(gateway, p);
+      sim::buildCellInfoFrame(packState(rng, v), (uint8_t)v, frame);
+      if (raw) {
+        IngestRawFrame rf = {};
+        macToBytes(mac.c_str(), rf.mac);
+        rf.timestampMs = v * 1000;
+        rf.length = sim::kFrameSize;
+        payload.insert(payload.end(), (const uint8_t*)&rf, (const uint8_t*)&rf + sizeof(rf));
+        payload.insert(payload.end(), frame, frame + sim::kFrameSize);
+      } else {
+        JKBMS bms(mac);
+        memcpy(bms.receivedBytes, frame, sim::kFrameSize);
+        dispatchFrame(bms, bms.receivedBytes, sim::kFrameSize);
+        JkSnapshot snap;
+        snapshotFromBms(bms, snap);
+        payload.insert(payload.end(), (const uint8_t*)&snap, (const uint8_t*)&snap + sizeof(snap));
+      }
+    }
+    IngestMessageHeader h;
+    ingestHeader(h, raw ? INGEST_RAW_FRAMES : INGEST_SNAPSHOTS, (uint16_t)packs, (uint32_t)payload.size());
+    std::vector<uint8_t> message((const uint8_t*)&h, (const uint8_t*)&h + sizeof(h));
+    message.insert(message.end(), payload.begin(), payload.end());
+    messages.push_back(message);
+  }
+  return messages;
+}
+
+int connectTo(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+bool sendAll(int fd, const uint8_t* data, size_t length) {
+  while (length) {
+    ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    data += n;
+    length -= (size_t)n;
+  }
+  return true;
+}
+
+void gatewayLoop(int gateway, uint16_t port, const std::vector<std::vector<uint8_t>>* messages, int packs,
+                 Clock::time_point deadline, uint64_t* sent) {
+  int fd = connectTo(port);
+  if (fd < 0) return;
+  char name[32];
+  int n = snprintf(name, sizeof(name), "gateway-%d", gateway);
+  IngestMessageHeader hello;
+  ingestHeader(hello, INGEST_HELLO, 0, (uint32_t)n);
+  sendAll(fd, (const uint8_t*)&hello, sizeof(hello));
+  sendAll(fd, (const uint8_t*)name, n);
+  for (size_t k = 0; Clock::now() < deadline; k++) {
+    const std::vector<uint8_t>& m = (*messages)[k % messages->size()];
+    if (!sendAll(fd, m.data(), m.size())) break;
+    *sent += packs;
+  }
+  close(fd);
+}
+
+bool httpGet(uint16_t port, const std::string& target, std::string& body) {
+  int fd = connectTo(port);
+  if (fd < 0) return false;
+  std::string request = "GET " + target + " HTTP/1.0\r\n\r\n";
+  sendAll(fd, (const uint8_t*)request.data(), request.size());
+  std::string response;
+  char buffer[4096];
+  ssize_t n;
+  while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) response.append(buffer, n);
+  close(fd);
+  size_t split = response.find("\r\n\r\n");
+  if (response.compare(0, 12, "HTTP/1.0 200") != 0 || split == std::string::npos) return false;
+  body = response.substr(split + 4);
+  return true;
+}
+
+bool runOnce(const Options& opt, int shards, const std::vector<std::vector<std::vector<uint8_t>>>& messages,
+             RunResult& r) {
+  ingest::IngestService service(shards);
+  ingest::IngestServer server(service);
+  if (!server.start("127.0.0.1", 0, 0)) {
+    fprintf(stderr, "cannot listen on 127.0.0.1\n");
+    return false;
+  }
+
+  std::vector<uint64_t> sent(opt.gateways, 0);
+  std::vector<std::thread> gateways;
+  const Clock::time_point start = Clock::now();
+  const Clock::time_point deadline = start + std::chrono::seconds(opt.durationS);
+  for (int g = 0; g < opt.gateways; g++) {
+    gateways.emplace_back(gatewayLoop, g, server.ingestPort(), &messages[g], opt.packsPerGateway, deadline, &sent[g]);
+  }
+  for (auto& t : gateways) t.join();
+  // Connection threads may still be reading the last messages
+  while (true) {
+    uint64_t total = 0;
+    for (uint64_t s : sent) total += s;
+    ingest::ServiceStats st = service.stats();
+    uint64_t accepted = 0;
+    for (const auto& sh : st.shards) accepted += sh.records + sh.queued;
+    if (accepted >= total || st.rejected) break;
+    usleep(1000);
+  }
+  service.drain();
+  const Clock::time_point end = Clock::now();
+
+  r.shards = shards;
+  r.wallS = elapsedS(start, end);
+  for (uint64_t s : sent) r.sent += s;
+  ingest::ServiceStats st = service.stats();
+  r.rejected = st.rejected;
+  for (const auto& sh : st.shards) {
+    r.applied += sh.records;
+    r.rawFrames += sh.rawFrames;
+    r.busyS += sh.busyNs / 1e9;
+  }
+
+  // Query latency on the loaded state
+  std::vector<double> latencyUs;
+  std::string body;
+  for (int q = 0; q < opt.queries; q++) {
+    std::string target = q % 2 ? "/devices/" + macFor(q % opt.gateways, q % opt.packsPerGateway) + "?window=60"
+                               : "/devices?window=60";
+    const Clock::time_point t0 = Clock::now();
+    if (!httpGet(server.httpPort(), target, body)) {
+      fprintf(stderr, "query %s failed\n", target.c_str());
+      return false;
+    }
+    latencyUs.push_back(elapsedS(t0, Clock::now()) * 1e6);
+  }
+  r.queryP50Us = percentile(latencyUs, 0.50);
+  r.queryP99Us = percentile(latencyUs, 0.99);
+  server.stop();
+  return true;
+}
+
+bool parseOptions(int argc, char** argv, Options& opt) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (arg == "--csv") { opt.csv = true; continue; }
+    if (!value) { fprintf(stderr, "missing value for %s\n", arg.c_str()); return false; }
+    i++;
+    if (arg == "--gateways") opt.gateways = atoi(value);
+    else if (arg == "--packs-per-gateway") opt.packsPerGateway = atoi(value);
+    else if (arg == "--duration-s") opt.durationS = atoi(value);
+    else if (arg == "--queries") opt.queries = atoi(value);
+    else if (arg == "--shards") {
+      opt.shards.clear();
+      for (const char* p = value; *p;) {
+        int n = atoi(p);
+        if (n < 1 || n > 256) { fprintf(stderr, "shard count must be 1..256\n"); return false; }
+        opt.shards.push_back(n);
+        const char* comma = strchr(p, ',');
+        if (!comma) break;
+        p = comma + 1;
+      }
+    } else if (arg == "--mode") {
+      opt.mode = value;
+      if (opt.mode != "raw" && opt.mode != "snapshot" && opt.mode != "mixed") {
+        fprintf(stderr, "unknown mode %s\n", value);
+        return false;
+      }
+    } else {
+      fprintf(stderr, "unknown option %s\n", arg.c_str());
+      return false;
+    }
+  }
+  if (opt.gateways < 1 || opt.gateways > 256 || opt.packsPerGateway < 1 || opt.packsPerGateway > 4096) {
+    fprintf(stderr, "gateways must be 1..256, packs per gateway 1..4096\n");
+    return false;
+  }
+  if (opt.queries < 1) opt.queries = 1;
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  if (!parseOptions(argc, argv, opt)) return 2;
+
+  std::vector<std::vector<std::vector<uint8_t>>> messages;
+  for (int g = 0; g < opt.gateways; g++) {
+    const bool raw = opt.mode == "raw" || (opt.mode == "mixed" && g % 2);
+    messages.push_back(buildMessages(g, opt.packsPerGateway, raw));
+  }
+
+  if (opt.csv) {
+    printf("shards,gateways,packs,mode,wall_s,sent,applied,records_per_s,speedup,efficiency,busy_s,rejected,"
+           "query_p50_us,query_p99_us\n");
+  } else {
+    printf("JKBMS ingest bench: %d gateways x %d packs, %s records, %u s per run, %u hardware threads\n",
+           opt.gateways, opt.packsPerGateway, opt.mode.c_str(), opt.durationS, std::thread::hardware_concurrency());
+    printf("%6s %12s %12s %14s %8s %10s %8s %10s %10s\n", "shards", "sent", "applied", "records/s", "speedup",
+           "efficiency", "busy s", "q p50 us", "q p99 us");
+  }
+
+  double baseRate = 0;
+  int baseShards = 0;
+  int failures = 0;
+  for (int shards : opt.shards) {
+    RunResult r;
+    if (!runOnce(opt, shards, messages, r)) return 1;
+    const double rate = r.applied / r.wallS;
+    if (!baseShards) {
+      baseRate = rate;
+      baseShards = shards;
+    }
+    const double speedup = baseRate > 0 ? rate / baseRate : 0;
+    const double efficiency = speedup * baseShards / shards;
+    if (r.applied != r.sent || r.rejected) failures++;
+    if (opt.csv) {
+      printf("%d,%d,%d,%s,%.3f,%llu,%llu,%.0f,%.2f,%.2f,%.3f,%llu,%.1f,%.1f\n", shards, opt.gateways,
+             opt.gateways * opt.packsPerGateway, opt.mode.c_str(), r.wallS, (unsigned long long)r.sent,
+             (unsigned long long)r.applied, rate, speedup, efficiency, r.busyS, (unsigned long long)r.rejected,
+             r.queryP50Us, r.queryP99Us);
+    } else {
+      printf("%6d %12llu %12llu %14.0f %7.2fx %9.0f%% %8.2f %10.1f %10.1f\n", shards, (unsigned long long)r.sent,
+             (unsigned long long)r.applied, rate, speedup, efficiency * 100, r.busyS, r.queryP50Us, r.queryP99Us);
+    }
+    fflush(stdout);
+  }
+  if (failures) fprintf(stderr, "%d run(s) lost or rejected records\n", failures);
+  return failures ? 1 : 0;
+}
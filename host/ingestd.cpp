@@ -0,0 +1,105 @@
+/**
+ * @file ingestd.cpp
+ * @brief Fleet ingest server: gateways stream snapshots or raw frames in,
+ *        dashboards query the latest state and rolling aggregates out
+ *
+ * Usage:
+ *   ingestd [--bind 0.0.0.0] [--port 7070] [--http-port 8080] [--shards N]
+ *           [--stats-s 60]
+ *
+ * --shards defaults to the number of hardware threads. Runs until SIGINT or
+ * SIGTERM; every --stats-s seconds (0 = never) prints one line per shard.
+ */
+
+#include "../src/libs/JKBMS.h"
+#include "ingest/ingest_server.h"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// The parsers in src/libs reference the gateway's device table; the server
+// keeps its own JKBMS instances per shard.
+JKBMS jkBmsDevices[1];
+const int bmsDeviceCount = 0;
+
+namespace {
+
+struct Options {
+  std::string bind = "0.0.0.0";
+  uint16_t port = 7070;
+  uint16_t httpPort = 8080;
+  int shards = (int)std::thread::hardware_concurrency();
+  uint32_t statsS = 60;
+};
+
+volatile sig_atomic_t stopRequested = 0;
+
+void onSignal(int) {
+  stopRequested = 1;
+}
+
+bool parseOptions(int argc, char** argv, Options& opt) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) { fprintf(stderr, "missing value for %s\n", arg.c_str()); return false; }
+    i++;
+    if (arg == "--bind") opt.bind = value;
+    else if (arg == "--port") opt.port = (uint16_t)atoi(value);
+    else if (arg == "--http-port") opt.httpPort = (uint16_t)atoi(value);
+    else if (arg == "--shards") opt.shards = atoi(value);
+    else if (arg == "--stats-s") opt.statsS = atoi(value);
+    else { fprintf(stderr, "unknown option %s\n", arg.c_str()); return false; }
+  }
+  if (opt.shards < 1) opt.shards = 1;
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  if (!parseOptions(argc, argv, opt)) return 2;
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  ingest::IngestService service(opt.shards);
+  ingest::IngestServer server(service);
+  if (!server.start(opt.bind, opt.port, opt.httpPort)) {
+    fprintf(stderr, "cannot listen on %s:%u / %u: %s\n", opt.bind.c_str(), opt.port, opt.httpPort, strerror(errno));
+    return 1;
+  }
+  printf("ingestd: gateways on %s:%u, queries on http://%s:%u, %d shards\n", opt.bind.c_str(),
+         server.ingestPort(), opt.bind.c_str(), server.httpPort(), service.shardCount());
+  fflush(stdout);
+
+  uint32_t lastStats = 0;
+  while (!stopRequested) {
+    usleep(200 * 1000);
+    const uint32_t now = service.nowS();
+    if (!opt.statsS || now - lastStats < opt.statsS) continue;
+    lastStats = now;
+    ingest::ServiceStats s = service.stats();
+    printf("[%6us] connections %llu, messages %llu, rejected %llu\n", now,
+           (unsigned long long)server.connections(), (unsigned long long)s.messages,
+           (unsigned long long)s.rejected);
+    for (size_t i = 0; i < s.shards.size(); i++) {
+      const ingest::ShardStats& st = s.shards[i];
+      printf("  shard %zu: %zu devices, %llu records, %llu raw frames, busy %.1f ms, queued %zu\n", i,
+             st.devices, (unsigned long long)st.records, (unsigned long long)st.rawFrames, st.busyNs / 1e6,
+             st.queued);
+    }
+    fflush(stdout);
+  }
+
+  printf("ingestd: stopping\n");
+  server.stop();
+  return 0;
+}
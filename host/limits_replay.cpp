@@ -0,0 +1,356 @@
+/**
+ * @file limits_replay.cpp
+ * @brief Replay of the CVL/CCL/DCL engine over snapshot archives
+ *
+ * Reads one or more snapshot streams (fleet_sim --snapshot-file, gateway
+ * flash logs, UDP captures saved back to back), groups the records by pack
+ * MAC and feeds them, in sensor-clock order, to the same charge_limits.h
+ * engine the gateway runs in its cell-frame handler. The engine is a pure
+ * function of the frames, so a replay gives the limits the inverter was sent.
+ *
+ * Snapshots carry no BMS settings: the protections and maximum currents come
+ * from the options below (LFP defaults otherwise).
+ *
+ * The report gives, per pack, the range of each limit, the share of frames
+ * with a reduced CCL/DCL and how often each reason applied, plus a digest of
+ * every computed limit. --expect fails (exit 1) when the digest differs: a
+ * recorded trace and its digest pin the engine's behaviour. --csv prints the
+ * limits of every frame instead.
+ *
+ * --protection-check needs no file: it sweeps the highest cell up to and
+ * past the stop voltage, and the lowest cell down past it, for protections
+ * set inside the knees (OVP 3.40-3.45 V, UVP 3.05-3.10 V) as well as the
+ * defaults. CCL/DCL must never rise as the cell moves towards its
+ * protection and must be 0 from the stop voltage on (exit 1 otherwise).
+ *
+ * Usage:
+ *   limits_replay FILE... [--max-charge 100] [--max-discharge 100] [--ovp 3.65] [--uvp 2.80]
+ *                 [--charge-ot 55] [--charge-ut 0] [--discharge-ot 60] [--mos-ot 80]
+ *                 [--target-v 3.45] [--ramp-aps 10] [--csv] [--expect DIGEST]
+ *   limits_replay --protection-check
+ */
+
+#include "../src/libs/JKBMS.h"
+#include "../src/libs/charge_limits.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+JKBMS jkBmsDevices[1];
+const int bmsDeviceCount = 0;
+
+namespace {
+
+struct Options {
+  std::vector<const char*> paths;
+  ChargeLimitInput settings = ChargeLimitInput();
+  ChargeLimitConfig config;
+  bool csv = false;
+  bool protectionCheck = false;
+  const char* expect = nullptr;
+};
+
+const char* const reasonNames[] = { "cell_high", "cell_low", "charge_temp", "discharge_temp",
+                                    "mos_temp",  "mosfet_off", "ramp",      "stale" };
+const int kReasons = sizeof(reasonNames) / sizeof(reasonNames[0]);
+
+struct Pack {
+  uint8_t mac[6];
+  std::vector<const JkSnapshot*> records;
+  float cvlMin = 0, cvlMax = 0, cclMin = 0, cclMax = 0, dclMin = 0, dclMax = 0;
+  uint32_t cclReduced = 0, dclReduced = 0;
+  uint32_t reasons[kReasons] = {};
+};
+
+struct Mapping {
+  const uint8_t* data;
+  size_t size;
+};
+
+uint64_t macKey(const uint8_t* mac) {
+  uint64_t k = 0;
+  for (int i = 0; i < 6; i++) k = (k << 8) | mac[i];
+  return k;
+}
+
+bool mapFile(const char* path, Mapping& m) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(path);
+    if (fd >= 0) close(fd);
+    return false;
+  }
+  m.size = (size_t)st.st_size;
+  m.data = nullptr;
+  if (m.size) {
+    void* p = mmap(nullptr, m.size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      perror("mmap");
+      close(fd);
+      return false;
+    }
+    m.data = (const uint8_t*)p;
+  }
+  close(fd);
+  return true;
+}
+
+// Records back to back, as in snapshot_dump; resynchronise on the magic
+size_t collect(const Mapping& m, std::map<uint64_t, Pack>& packs, size_t& invalid) {
+  size_t count = 0, offset = 0;
+  while (offset + sizeof(JkSnapshot) <= m.size) {
+    const JkSnapshot* snap = snapshotView(m.data + offset, m.size - offset);
+    if (!snap) {
+      invalid++;
+      offset++;
+      while (offset + 4 <= m.size) {
+        uint32_t magic;
+        memcpy(&magic, m.data + offset, sizeof(magic));
+        if (magic == JKBMS_SNAPSHOT_MAGIC) break;
+        offset++;
+      }
+      continue;
+    }
+    Pack& p = packs[macKey(snap->header.mac)];
+    memcpy(p.mac, snap->header.mac, 6);
+    p.records.push_back(snap);
+    count++;
+    offset += snap->header.size;
+  }
+  return count;
+}
+
+// FNV-1a over the limits in their output resolution: float noise does not count
+uint32_t fnv(uint32_t h, int32_t v) {
+  for (int i = 0; i < 4; i++) {
+    h ^= (uint8_t)(v >> (8 * i));
+    h *= 16777619u;
+  }
+  return h;
+}
+
+void track(float v, float& lo, float& hi, bool first) {
+  if (first || v < lo) lo = v;
+  if (first || v > hi) hi = v;
+}
+
+// As chargeLimitFrame() picks it
+float effectiveMax(float configured, float bms) {
+  return configured > 0 && (bms <= 0 || configured < bms) ? configured : bms;
+}
+
+uint32_t replay(Pack& p, const Options& opt, uint32_t digest) {
+  // Several files may hold the same pack; the sensor clock orders them
+  std::stable_sort(p.records.begin(), p.records.end(), [](const JkSnapshot* a, const JkSnapshot* b) {
+    return a->header.timestampMs < b->header.timestampMs;
+  });
+  char mac[18];
+  snprintf(mac, sizeof(mac), "%02x:%02x:%02x:%02x:%02x:%02x", p.mac[0], p.mac[1], p.mac[2], p.mac[3], p.mac[4],
+           p.mac[5]);
+
+  // Reduced: below what the engine gives with no limiting reason
+  const float maxCharge = effectiveMax(opt.config.maxChargeA, opt.settings.maxChargeA);
+  const float maxDischarge = effectiveMax(opt.config.maxDischargeA, opt.settings.maxDischargeA);
+
+  ChargeLimitState state;
+  chargeLimitInit(state, &opt.config);
+  ChargeLimitInput in;
+  for (size_t i = 0; i < p.records.size(); i++) {
+    const JkSnapshot& snap = *p.records[i];
+    chargeLimitInputFromSnapshot(snap, opt.settings, in);
+    const ChargeLimits& l = chargeLimitFrame(state, in);
+    digest = fnv(digest, (int32_t)lroundf(l.cvl * 100));
+    digest = fnv(digest, (int32_t)lroundf(l.ccl * 10));
+    digest = fnv(digest, (int32_t)lroundf(l.dcl * 10));
+    digest = fnv(digest, l.reasons);
+    if (opt.csv) {
+      printf("%s,%u,%u,%.3f,%.3f,%.1f,%.2f,%.1f,%.1f,%u\n", mac, snap.header.sequence, snap.header.timestampMs,
+             in.cellMinV, in.cellMaxV, in.tempMaxC, l.cvl, l.ccl, l.dcl, l.reasons);
+    }
+    track(l.cvl, p.cvlMin, p.cvlMax, i == 0);
+    track(l.ccl, p.cclMin, p.cclMax, i == 0);
+    track(l.dcl, p.dclMin, p.dclMax, i == 0);
+    p.cclReduced += l.ccl < maxCharge - 0.05f;
+    p.dclReduced += l.dcl < maxDischarge - 0.05f;
+    for (int r = 0; r < kReasons; r++) p.reasons[r] += (l.reasons >> r) & 1;
+  }
+  return digest;
+}
+
+// Limits of a steady frame: the second of two, with the ramp-up out of the way
+ChargeLimits steadyLimits(const ChargeLimitInput& in) {
+  ChargeLimitConfig config;
+  config.rampUpAps = 1e6f;
+  ChargeLimitState state;
+  chargeLimitInit(state, &config);
+  ChargeLimitInput frame = in;
+  frame.frameMs = 1000;
+  chargeLimitFrame(state, frame);
+  frame.frameMs = 2000;
+  return chargeLimitFrame(state, frame);
+}
+
+ChargeLimitInput healthyFrame(float ovpV, float uvpV) {
+  ChargeLimitInput in = ChargeLimitInput();
+  in.cellCount = 16;
+  in.cellMinV = in.cellMaxV = 3.30f;
+  in.batteryV = 16 * 3.30f;
+  in.tempMinC = in.tempMaxC = 25.0f;
+  in.mosC = 30.0f;
+  in.charge = in.discharge = true;
+  in.ovpV = ovpV;
+  in.uvpV = uvpV;
+  in.maxChargeA = in.maxDischargeA = 100.0f;
+  chargeLimitDefaults(in);
+  return in;
+}
+
+// Sweeps towards each protection; returns the number of violations
+int protectionCheck() {
+  const ChargeLimitConfig config;
+  const float ovps[] = { 3.65f, 3.50f, 3.45f, 3.42f, 3.40f };
+  const float uvps[] = { 2.80f, 3.00f, 3.05f, 3.10f, 3.12f };
+  int failures = 0;
+  for (float ovp : ovps) {
+    const float stop = ovp - config.cellMarginV;
+    float previous = 1e9f;
+    int violations = 0;
+    for (int mv = 3000; mv <= (int)lroundf(ovp * 1000) + 100; mv += 5) {
+      ChargeLimitInput in = healthyFrame(ovp, 0);
+      in.cellMaxV = mv * 0.001f;
+      const float ccl = steadyLimits(in).ccl;
+      if (ccl > previous + 1e-3f || (in.cellMaxV >= stop && ccl > 0)) {
+        if (violations++ < 3) printf("  OVP %.2f V: cell max %.3f V gives CCL %.1f A\n", ovp, in.cellMaxV, ccl);
+      }
+      previous = ccl;
+    }
+    ChargeLimitInput low = healthyFrame(ovp, 0);
+    low.cellMaxV = 3.00f;
+    printf("OVP %.2f V (stop %.3f V): CCL %.1f A at 3.000 V, %d violations\n", ovp, stop, steadyLimits(low).ccl,
+           violations);
+    failures += violations;
+  }
+  for (float uvp : uvps) {
+    const float stop = uvp + config.cellMarginV;
+    float previous = 1e9f;
+    int violations = 0;
+    for (int mv = 3400; mv >= (int)lroundf(uvp * 1000) - 100; mv -= 5) {
+      ChargeLimitInput in = healthyFrame(0, uvp);
+      in.cellMinV = mv * 0.001f;
+      const float dcl = steadyLimits(in).dcl;
+      if (dcl > previous + 1e-3f || (in.cellMinV <= stop && dcl > 0)) {
+        if (violations++ < 3) printf("  UVP %.2f V: cell min %.3f V gives DCL %.1f A\n", uvp, in.cellMinV, dcl);
+      }
+      previous = dcl;
+    }
+    ChargeLimitInput high = healthyFrame(0, uvp);
+    high.cellMinV = 3.40f;
+    printf("UVP %.2f V (stop %.3f V): DCL %.1f A at 3.400 V, %d violations\n", uvp, stop, steadyLimits(high).dcl,
+           violations);
+    failures += violations;
+  }
+  return failures;
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: limits_replay FILE... [--max-charge A] [--max-discharge A] [--ovp V] [--uvp V]\n"
+          "                     [--charge-ot C] [--charge-ut C] [--discharge-ot C] [--mos-ot C]\n"
+          "                     [--target-v V] [--ramp-aps A] [--csv] [--expect DIGEST]\n"
+          "       limits_replay --protection-check\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  opt.settings.maxChargeA = 100;
+  opt.settings.maxDischargeA = 100;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const bool value = i + 1 < argc;
+    if (arg == "--csv") opt.csv = true;
+    else if (arg == "--protection-check") opt.protectionCheck = true;
+    else if (arg == "--max-charge" && value) opt.settings.maxChargeA = atof(argv[++i]);
+    else if (arg == "--max-discharge" && value) opt.settings.maxDischargeA = atof(argv[++i]);
+    else if (arg == "--ovp" && value) opt.settings.ovpV = atof(argv[++i]);
+    else if (arg == "--uvp" && value) opt.settings.uvpV = atof(argv[++i]);
+    else if (arg == "--charge-ot" && value) opt.settings.chargeOtC = atof(argv[++i]);
+    else if (arg == "--charge-ut" && value) opt.settings.chargeUtC = atof(argv[++i]);
+    else if (arg == "--discharge-ot" && value) opt.settings.dischargeOtC = atof(argv[++i]);
+    else if (arg == "--mos-ot" && value) opt.settings.mosOtC = atof(argv[++i]);
+    else if (arg == "--target-v" && value) opt.config.cellTargetV = atof(argv[++i]);
+    else if (arg == "--ramp-aps" && value) opt.config.rampUpAps = atof(argv[++i]);
+    else if (arg == "--expect" && value) opt.expect = argv[++i];
+    else if (arg[0] != '-') opt.paths.push_back(argv[i]);
+    else {
+      usage();
+      return 2;
+    }
+  }
+  if (opt.protectionCheck) {
+    const int failures = protectionCheck();
+    printf("\n%d violations\n", failures);
+    return failures ? 1 : 0;
+  }
+  if (opt.paths.empty()) {
+    usage();
+    return 2;
+  }
+  chargeLimitDefaults(opt.settings);
+
+  std::vector<Mapping> maps;
+  std::map<uint64_t, Pack> packs;
+  size_t records = 0, invalid = 0;
+  for (const char* path : opt.paths) {
+    Mapping m;
+    if (!mapFile(path, m)) return 1;
+    maps.push_back(m);
+    records += collect(m, packs, invalid);
+  }
+
+  if (opt.csv) printf("mac,sequence,time_ms,cell_min_v,cell_max_v,temp_max_c,cvl,ccl,dcl,reasons\n");
+  uint32_t digest = 2166136261u;
+  for (auto& kv : packs) {
+    digest = replay(kv.second, opt, digest);
+  }
+
+  if (!opt.csv) {
+    printf("JKBMS charge limits: %zu records (%zu invalid), %zu packs, max %.1f / %.1f A\n", records, invalid,
+           packs.size(), opt.settings.maxChargeA, opt.settings.maxDischargeA);
+    for (auto& kv : packs) {
+      const Pack& p = kv.second;
+      const double n = p.records.empty() ? 1 : (double)p.records.size();
+      printf("\n%02x:%02x:%02x:%02x:%02x:%02x  %zu frames\n", p.mac[0], p.mac[1], p.mac[2], p.mac[3], p.mac[4],
+             p.mac[5], p.records.size());
+      printf("  CVL %6.2f .. %6.2f V\n", p.cvlMin, p.cvlMax);
+      printf("  CCL %6.1f .. %6.1f A   reduced in %5.1f%% of frames\n", p.cclMin, p.cclMax, 100.0 * p.cclReduced / n);
+      printf("  DCL %6.1f .. %6.1f A   reduced in %5.1f%% of frames\n", p.dclMin, p.dclMax, 100.0 * p.dclReduced / n);
+      printf("  reasons:");
+      for (int r = 0; r < kReasons; r++) {
+        if (p.reasons[r]) printf(" %s %.1f%%", reasonNames[r], 100.0 * p.reasons[r] / n);
+      }
+      printf("\n");
+    }
+    printf("\ndigest %08x\n", digest);
+  }
+
+  for (const Mapping& m : maps) {
+    if (m.data) munmap((void*)m.data, m.size);
+  }
+  if (opt.expect && strtoul(opt.expect, nullptr, 16) != digest) {
+    fprintf(stderr, "digest %08x, expected %s\n", digest, opt.expect);
+    return 1;
+  }
+  return 0;
+}
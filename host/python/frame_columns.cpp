@@ -0,0 +1,149 @@
+/**
+ * @file frame_columns.cpp
+ * @brief Header scan and JkDecoder columns for the Python bindings
+ */
+
+#include "frame_columns.h"
+#include "jk_decoder.h"
+
+namespace jkpy {
+
+namespace {
+
+template <class Decoder>
+void appendCells(const Decoder& decoder, int64_t offset, uint8_t counter, CellColumns& out) {
+  const typename Decoder::Cells& c = decoder.cells;
+  out.rows++;
+  out.offset.push_back(offset);
+  out.protocol.push_back(decoder.protocol == PROTOCOL_JK04 ? PROTOCOL_JK04 : PROTOCOL_JK02);
+  out.counter.push_back(counter);
+  out.cellMv.insert(out.cellMv.end(), c.cellMv, c.cellMv + Decoder::CELLS);
+  out.wireResistMohm.insert(out.wireResistMohm.end(), c.wireResist, c.wireResist + Decoder::CELLS);
+  out.averageCellMv.push_back(c.averageCell);
+  out.deltaCellMv.push_back(c.deltaCell);
+  out.batteryMv.push_back(c.batteryVoltage);
+  out.currentMa.push_back(c.current);
+  out.powerMw.push_back(c.power);
+  out.balanceCurrentMa.push_back(c.balanceCurrent);
+  out.capacityRemainMah.push_back(c.capacityRemain);
+  out.nominalCapacityMah.push_back(c.nominalCapacity);
+  out.cycleCapacityMah.push_back(c.cycleCapacity);
+  out.mosDeciC.push_back(c.mosTemp);
+  out.t1DeciC.push_back(c.t1);
+  out.t2DeciC.push_back(c.t2);
+  out.cycleCount.push_back(c.cycleCount);
+  out.uptimeS.push_back(c.uptimeS);
+  out.cellCount.push_back(c.cellCount);
+  out.soc.push_back(c.soc);
+  out.balancingAction.push_back(c.balancingAction);
+  out.charge.push_back(c.charge);
+  out.discharge.push_back(c.discharge);
+  out.balance.push_back(c.balance);
+}
+
+template <class Decoder>
+void appendSettings(const Decoder& decoder, int64_t offset, SettingsColumns& out) {
+  const typename Decoder::Settings& s = decoder.settings;
+  out.rows++;
+  out.offset.push_back(offset);
+  out.cellUvpMv.push_back(s.cellUvp);
+  out.cellUvprMv.push_back(s.cellUvpr);
+  out.cellOvpMv.push_back(s.cellOvp);
+  out.cellOvprMv.push_back(s.cellOvpr);
+  out.balanceTriggerMv.push_back(s.balanceTrigger);
+  out.balanceStartMv.push_back(s.balanceStart);
+  out.powerOffMv.push_back(s.powerOff);
+  out.maxChargeMa.push_back(s.maxChargeCurrent);
+  out.maxDischargeMa.push_back(s.maxDischargeCurrent);
+  out.maxBalanceMa.push_back(s.maxBalanceCurrent);
+  out.totalCapacityMah.push_back(s.totalCapacity);
+  out.chargeOtpDeciC.push_back(s.chargeOtp);
+  out.chargeOtprDeciC.push_back(s.chargeOtpr);
+  out.dischargeOtpDeciC.push_back(s.dischargeOtp);
+  out.dischargeOtprDeciC.push_back(s.dischargeOtpr);
+  out.chargeUtpDeciC.push_back(s.chargeUtp);
+  out.chargeUtprDeciC.push_back(s.chargeUtpr);
+  out.mosOtpDeciC.push_back(s.mosOtp);
+  out.mosOtprDeciC.push_back(s.mosOtpr);
+  out.chargeOcpDelayS.push_back(s.chargeOcpDelayS);
+  out.chargeOcpRecoveryS.push_back(s.chargeOcpRecoveryS);
+  out.dischargeOcpDelayS.push_back(s.dischargeOcpDelayS);
+  out.dischargeOcpRecoveryS.push_back(s.dischargeOcpRecoveryS);
+  out.scpRecoveryS.push_back(s.scpRecoveryS);
+  out.scpDelayUs.push_back(s.scpDelayUs);
+  out.cellCount.push_back(s.cellCount);
+}
+
+bool isHeader(const uint8_t* p) {
+  return p[0] == 0x55 && p[1] == 0xAA && p[2] == 0xEB && p[3] == 0x90;
+}
+
+uint8_t checksum(const uint8_t* frame) {
+  uint8_t sum = 0;
+  for (size_t i = 0; i < JK_FRAME_SIZE - 1; i++) sum += frame[i];
+  return sum;
+}
+
+template <class Decoder>
+void decodeAll(const uint8_t* data, size_t length, bool verifyChecksum, FrameColumns& out) {
+  Decoder decoder;
+  out.cells.cells = Decoder::CELLS;
+  // Reserve for a buffer of back-to-back cell frames, the common capture
+  const size_t frames = length / JK_FRAME_SIZE;
+  CellColumns& cells = out.cells;
+  cells.offset.reserve(frames);
+  cells.cellMv.reserve(frames * Decoder::CELLS);
+  cells.wireResistMohm.reserve(frames * Decoder::CELLS);
+
+  size_t i = 0;
+  while (i + 4 <= length) {
+    if (!isHeader(data + i)) {
+      out.skippedBytes++;
+      i++;
+      continue;
+    }
+    if (i + JK_FRAME_SIZE > length) {
+      out.truncated = true;
+      break;
+    }
+    const uint8_t* frame = data + i;
+    if (verifyChecksum && checksum(frame) != frame[JK_FRAME_SIZE - 1]) {
+      out.badChecksum++;
+      out.skippedBytes++;
+      i++;
+      continue;
+    }
+    switch (decoder.decode(frame, JK_FRAME_SIZE)) {
+      case JK_FRAME_CELL_INFO: appendCells(decoder, (int64_t)i, frame[5], out.cells); break;
+      case JK_FRAME_SETTINGS: appendSettings(decoder, (int64_t)i, out.settings); break;
+      case JK_FRAME_DEVICE_INFO: out.deviceInfoFrames++; break;
+      default: out.undecodedFrames++; break;
+    }
+    i += JK_FRAME_SIZE;
+  }
+  out.skippedBytes += length - i;
+  out.protocol = decoder.protocol;
+}
+
+} // namespace
+
+void decodeFrameColumns(const uint8_t* data, size_t length, ProtocolVariant protocol, bool verifyChecksum,
+                        FrameColumns& out) {
+  out = FrameColumns();
+  if (!data) return;
+  switch (protocol) {
+    case PROTOCOL_JK02:
+      decodeAll<JkDecoder<JkLayoutJk02<16>, JkFixedStorage, JkNoLog, JkAllFrames>>(data, length, verifyChecksum, out);
+      break;
+    case PROTOCOL_JK04:
+      decodeAll<JkDecoder<JkLayoutJk04<JK04_CELLS>, JkFixedStorage, JkNoLog, JkAllFrames>>(data, length,
+                                                                                          verifyChecksum, out);
+      break;
+    default:
+      decodeAll<JkDecoder<JkLayoutAuto<JK04_CELLS>, JkFixedStorage, JkNoLog, JkAllFrames>>(data, length,
+                                                                                          verifyChecksum, out);
+      break;
+  }
+}
+
+} // namespace jkpy
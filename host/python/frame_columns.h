@@ -0,0 +1,98 @@
+/**
+ * @file frame_columns.h
+ * @brief Decode a buffer of concatenated JK frames into columns
+ *
+ * The C++ half of the Python bindings (jkbms_module.cpp), kept free of
+ * Python so it can run with the GIL released. Frames are found by their
+ * 55 AA EB 90 header and decoded with JkDecoder (jk_decoder.h), so every
+ * offset, scale and the JK02/JK04 detection are the firmware's. Units are
+ * those of JkFixedStorage: mV, mA, mAh, mW, mOhm and 0.1 °C as integers.
+ *
+ * Each decoded cell-info frame appends one row to CellColumns, each
+ * settings frame one row to SettingsColumns. Bytes between frames (padding,
+ * partial notifications, the header of a capture format) are skipped and
+ * counted. Like the firmware, JK04 cell frames leave the fields they do not
+ * carry (current, SOC, capacity, temperatures) at their previous value.
+ */
+
+#ifndef HOST_PYTHON_FRAME_COLUMNS_H
+#define HOST_PYTHON_FRAME_COLUMNS_H
+
+#include "protocol_variant.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace jkpy {
+
+// One row per cell-info frame; cellMv and wireResistMohm are rows x cells
+struct CellColumns {
+  size_t rows = 0;
+  int cells = 0;                          // 16 for JK02, 24 otherwise
+  std::vector<int64_t> offset;            // of the frame header in the buffer
+  std::vector<uint8_t> protocol;          // ProtocolVariant used for the frame
+  std::vector<uint8_t> counter;           // byte 5
+  std::vector<uint16_t> cellMv;
+  std::vector<uint16_t> wireResistMohm;
+  std::vector<uint16_t> averageCellMv;
+  std::vector<uint16_t> deltaCellMv;
+  std::vector<int32_t> batteryMv;
+  std::vector<int32_t> currentMa;         // positive while charging
+  std::vector<int32_t> powerMw;
+  std::vector<int32_t> balanceCurrentMa;
+  std::vector<int32_t> capacityRemainMah;
+  std::vector<int32_t> nominalCapacityMah;
+  std::vector<int32_t> cycleCapacityMah;
+  std::vector<int16_t> mosDeciC;
+  std::vector<int16_t> t1DeciC;
+  std::vector<int16_t> t2DeciC;
+  std::vector<uint32_t> cycleCount;
+  std::vector<uint32_t> uptimeS;
+  std::vector<uint8_t> cellCount;         // cells with a voltage
+  std::vector<uint8_t> soc;
+  std::vector<uint8_t> balancingAction;
+  std::vector<uint8_t> charge;            // 0/1
+  std::vector<uint8_t> discharge;
+  std::vector<uint8_t> balance;
+};
+
+// One row per JK02 settings frame (JK04 settings are not decoded, as in JKBMS)
+struct SettingsColumns {
+  size_t rows = 0;
+  std::vector<int64_t> offset;
+  std::vector<int32_t> cellUvpMv, cellUvprMv, cellOvpMv, cellOvprMv;
+  std::vector<int32_t> balanceTriggerMv, balanceStartMv, powerOffMv;
+  std::vector<int32_t> maxChargeMa, maxDischargeMa, maxBalanceMa;
+  std::vector<int32_t> totalCapacityMah;
+  std::vector<int16_t> chargeOtpDeciC, chargeOtprDeciC, dischargeOtpDeciC, dischargeOtprDeciC;
+  std::vector<int16_t> chargeUtpDeciC, chargeUtprDeciC, mosOtpDeciC, mosOtprDeciC;
+  std::vector<uint32_t> chargeOcpDelayS, chargeOcpRecoveryS;
+  std::vector<uint32_t> dischargeOcpDelayS, dischargeOcpRecoveryS;
+  std::vector<uint32_t> scpRecoveryS, scpDelayUs;
+  std::vector<uint32_t> cellCount;
+};
+
+struct FrameColumns {
+  CellColumns cells;
+  SettingsColumns settings;
+  ProtocolVariant protocol = PROTOCOL_AUTO;   // detected, or the one requested
+  uint64_t deviceInfoFrames = 0;
+  uint64_t undecodedFrames = 0;   // unknown type, or JK04 settings
+  uint64_t badChecksum = 0;       // verifyChecksum only; the header is searched again
+  uint64_t skippedBytes = 0;      // outside any frame
+  bool truncated = false;         // the buffer ends inside a frame
+};
+
+/**
+ * Decode every frame in a buffer
+ * @param protocol PROTOCOL_AUTO detects it once for the buffer, as for one
+ *                 device; pass the protocol for buffers mixing devices
+ * @param verifyChecksum Check byte 299 (the firmware does not)
+ */
+void decodeFrameColumns(const uint8_t* data, size_t length, ProtocolVariant protocol, bool verifyChecksum,
+                        FrameColumns& out);
+
+} // namespace jkpy
+
+#endif // HOST_PYTHON_FRAME_COLUMNS_H
@@ -0,0 +1,177 @@
+/**
+ * @file jkbms_module.cpp
+ * @brief Python bindings: JK frames from a bytes or numpy buffer to numpy columns
+ *
+ *   import jkbms
+ *   data = jkbms.decode(open("frames.bin", "rb").read())
+ *   cells = data["cells"]
+ *   cells["cell_mv"]        # uint16, frames x cells
+ *   cells["current_ma"]     # int32, one per cell frame
+ *
+ * decode() accepts any object with the buffer protocol and 1-byte items
+ * (bytes, bytearray, memoryview, mmap, numpy uint8 arrays), read in place.
+ * Decoding runs in C++ with the GIL released (frame_columns.h); the columns
+ * are handed to numpy without a copy and without a Python object per frame.
+ * Units are integers as in jk_decoder.h JkFixedStorage: mV, mA, mAh, mW,
+ * mOhm, 0.1 °C.
+ *
+ * Build: pip install ./host/python (setup.py)
+ */
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+
+#include "frame_columns.h"
+#include "jk_decoder.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace py = pybind11;
+
+namespace {
+
+// Moves the column into a capsule owned by the numpy array
+template <typename T>
+py::array column(std::vector<T>& values, size_t rows, size_t width = 0, py::dtype dtype = py::dtype::of<T>()) {
+  // An empty vector has no data pointer: numpy would allocate its own array and never take the capsule
+  if (values.empty()) {
+    if (!width) return py::array(dtype, std::vector<py::ssize_t>{ 0 });
+    return py::array(dtype, std::vector<py::ssize_t>{ 0, (py::ssize_t)width });
+  }
+  std::vector<T>* owned = new std::vector<T>(std::move(values));
+  py::capsule base(owned, [](void* p) { delete static_cast<std::vector<T>*>(p); });
+  if (!width) return py::array(dtype, { (py::ssize_t)rows }, { (py::ssize_t)sizeof(T) }, owned->data(), base);
+  return py::array(dtype, { (py::ssize_t)rows, (py::ssize_t)width },
+                   { (py::ssize_t)(width * sizeof(T)), (py::ssize_t)sizeof(T) }, owned->data(), base);
+}
+
+py::array flags(std::vector<uint8_t>& values, size_t rows) {
+  return column(values, rows, 0, py::dtype::of<bool>());
+}
+
+py::dict cellDict(jkpy::CellColumns& c) {
+  const size_t n = c.rows;
+  py::dict d;
+  d["offset"] = column(c.offset, n);
+  d["protocol"] = column(c.protocol, n);
+  d["counter"] = column(c.counter, n);
+  d["cell_mv"] = column(c.cellMv, n, c.cells);
+  d["wire_resist_mohm"] = column(c.wireResistMohm, n, c.cells);
+  d["average_cell_mv"] = column(c.averageCellMv, n);
+  d["delta_cell_mv"] = column(c.deltaCellMv, n);
+  d["battery_mv"] = column(c.batteryMv, n);
+  d["current_ma"] = column(c.currentMa, n);
+  d["power_mw"] = column(c.powerMw, n);
+  d["balance_current_ma"] = column(c.balanceCurrentMa, n);
+  d["capacity_remain_mah"] = column(c.capacityRemainMah, n);
+  d["nominal_capacity_mah"] = column(c.nominalCapacityMah, n);
+  d["cycle_capacity_mah"] = column(c.cycleCapacityMah, n);
+  d["mos_decic"] = column(c.mosDeciC, n);
+  d["t1_decic"] = column(c.t1DeciC, n);
+  d["t2_decic"] = column(c.t2DeciC, n);
+  d["cycle_count"] = column(c.cycleCount, n);
+  d["uptime_s"] = column(c.uptimeS, n);
+  d["cell_count"] = column(c.cellCount, n);
+  d["soc"] = column(c.soc, n);
+  d["balancing_action"] = column(c.balancingAction, n);
+  d["charge"] = flags(c.charge, n);
+  d["discharge"] = flags(c.discharge, n);
+  d["balance"] = flags(c.balance, n);
+  return d;
+}
+
+py::dict settingsDict(jkpy::SettingsColumns& s) {
+  const size_t n = s.rows;
+  py::dict d;
+  d["offset"] = column(s.offset, n);
+  d["cell_uvp_mv"] = column(s.cellUvpMv, n);
+  d["cell_uvpr_mv"] = column(s.cellUvprMv, n);
+  d["cell_ovp_mv"] = column(s.cellOvpMv, n);
+  d["cell_ovpr_mv"] = column(s.cellOvprMv, n);
+  d["balance_trigger_mv"] = column(s.balanceTriggerMv, n);
+  d["balance_start_mv"] = column(s.balanceStartMv, n);
+  d["power_off_mv"] = column(s.powerOffMv, n);
+  d["max_charge_ma"] = column(s.maxChargeMa, n);
+  d["max_discharge_ma"] = column(s.maxDischargeMa, n);
+  d["max_balance_ma"] = column(s.maxBalanceMa, n);
+  d["total_capacity_mah"] = column(s.totalCapacityMah, n);
+  d["charge_otp_decic"] = column(s.chargeOtpDeciC, n);
+  d["charge_otpr_decic"] = column(s.chargeOtprDeciC, n);
+  d["discharge_otp_decic"] = column(s.dischargeOtpDeciC, n);
+  d["discharge_otpr_decic"] = column(s.dischargeOtprDeciC, n);
+  d["charge_utp_decic"] = column(s.chargeUtpDeciC, n);
+  d["charge_utpr_decic"] = column(s.chargeUtprDeciC, n);
+  d["mos_otp_decic"] = column(s.mosOtpDeciC, n);
+  d["mos_otpr_decic"] = column(s.mosOtprDeciC, n);
+  d["charge_ocp_delay_s"] = column(s.chargeOcpDelayS, n);
+  d["charge_ocp_recovery_s"] = column(s.chargeOcpRecoveryS, n);
+  d["discharge_ocp_delay_s"] = column(s.dischargeOcpDelayS, n);
+  d["discharge_ocp_recovery_s"] = column(s.dischargeOcpRecoveryS, n);
+  d["scp_recovery_s"] = column(s.scpRecoveryS, n);
+  d["scp_delay_us"] = column(s.scpDelayUs, n);
+  d["cell_count"] = column(s.cellCount, n);
+  return d;
+}
+
+ProtocolVariant parseProtocol(const std::string& name) {
+  if (name == "auto") return PROTOCOL_AUTO;
+  if (name == "jk02") return PROTOCOL_JK02;
+  if (name == "jk04") return PROTOCOL_JK04;
+  throw py::value_error("protocol must be 'auto', 'jk02' or 'jk04'");
+}
+
+const char* protocolLabel(ProtocolVariant protocol) {
+  return protocol == PROTOCOL_JK02 ? "jk02" : protocol == PROTOCOL_JK04 ? "jk04" : "auto";
+}
+
+py::dict decode(py::buffer buffer, const std::string& protocol, bool verifyChecksum) {
+  const ProtocolVariant variant = parseProtocol(protocol);
+  // A strided view (a[::2]) is refused rather than read wrong
+  py::buffer_info info(buffer.request(false));
+  if (info.itemsize != 1) throw py::value_error("expected a buffer of bytes (itemsize 1)");
+  py::ssize_t expected = 1;
+  for (py::ssize_t k = info.ndim - 1; k >= 0; k--) {
+    if (info.shape[k] > 1 && info.strides[k] != expected) throw py::value_error("buffer must be C-contiguous");
+    expected *= info.shape[k];
+  }
+
+  jkpy::FrameColumns out;
+  {
+    py::gil_scoped_release release;
+    jkpy::decodeFrameColumns(static_cast<const uint8_t*>(info.ptr), (size_t)info.size, variant, verifyChecksum, out);
+  }
+
+  py::dict result;
+  result["cells"] = cellDict(out.cells);
+  result["settings"] = settingsDict(out.settings);
+  result["protocol"] = protocolLabel(out.protocol);
+  result["device_info_frames"] = out.deviceInfoFrames;
+  result["undecoded_frames"] = out.undecodedFrames;
+  result["bad_checksum"] = out.badChecksum;
+  result["skipped_bytes"] = out.skippedBytes;
+  result["truncated"] = out.truncated;
+  return result;
+}
+
+} // namespace
+
+PYBIND11_MODULE(jkbms, m) {
+  m.doc() = "JK BMS frame decoding with the gateway's parsers (jk_decoder.h)";
+  m.attr("FRAME_SIZE") = JK_FRAME_SIZE;
+  m.attr("PROTOCOL_JK02") = (int)PROTOCOL_JK02;
+  m.attr("PROTOCOL_JK04") = (int)PROTOCOL_JK04;
+  m.def("decode", &decode, py::arg("buffer"), py::arg("protocol") = "auto", py::arg("verify_checksum") = false,
+        R"doc(Decode concatenated JK frames (55 AA EB 90 header, 300 bytes each).
+
+Returns a dict: "cells" and "settings" map field names to numpy arrays, one
+row per frame of that type ("cell_mv" and "wire_resist_mohm" are 2-D);
+"protocol" is the one detected (or given); "device_info_frames",
+"undecoded_frames", "bad_checksum", "skipped_bytes" and "truncated" account
+for the rest of the buffer.
+
+protocol="auto" detects JK02/JK04 once per call, as the gateway does per
+device: decode one device per call, or pass "jk02"/"jk04".
+The GIL is released while decoding.)doc");
+}
@@ -0,0 +1,230 @@
+/**
+ * @file make_fixture.cpp
+ * @brief Frames from host/sim/frame_builder and the values they carry, for test_smoke.py
+ *
+ * Writes into DIR:
+ * - jk02.bin: a device-info and a settings frame, then --frames JK02 cell
+ *   frames of random pack states, 7 junk bytes after every tenth frame and
+ *   the first 120 bytes of one more frame at the end;
+ * - jk04.bin: --frames JK04 cell frames back to back;
+ * - expected.json: what jkbms.decode() must return for each file, under the
+ *   key names of its dicts and in its units.
+ *
+ * Usage:
+ *   make_fixture DIR [--frames 50] [--seed 1]
+ */
+
+#include "../sim/frame_builder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Options {
+  const char* dir = nullptr;
+  int frames = 50;
+  uint32_t seed = 1;
+};
+
+static const int kJunkBytes = 7;
+static const size_t kPartialBytes = 120;
+
+// One JSON array per field, one element per row
+struct Column {
+  const char* name;
+  std::string values;
+  void add(long long v) { values += (values.empty() ? "" : ", ") + std::to_string(v); }
+  void addRow(const uint16_t* v, int n, int width) {
+    std::string row;
+    for (int i = 0; i < width; i++) row += (i ? ", " : "") + std::to_string(i < n ? v[i] : 0);
+    values += (values.empty() ? "[" : ", [") + row + "]";
+  }
+};
+
+void writeColumns(FILE* f, const char* name, const std::vector<Column>& columns) {
+  fprintf(f, "    \"%s\": {\n", name);
+  for (size_t i = 0; i < columns.size(); i++) {
+    fprintf(f, "      \"%s\": [%s]%s\n", columns[i].name, columns[i].values.c_str(), i + 1 < columns.size() ? "," : "");
+  }
+  fprintf(f, "    }");
+}
+
+sim::PackState randomState(std::mt19937& rng, uint32_t uptimeS) {
+  sim::PackState s;
+  s.batteryMv = 0;
+  for (int i = 0; i < 16; i++) {
+    s.cellMv[i] = (uint16_t)(3000 + rng() % 600);
+    s.wireResistMohm[i] = (uint16_t)(20 + rng() % 60);
+    s.batteryMv += s.cellMv[i];
+  }
+  s.currentMa = (int32_t)(rng() % 200001) - 100000;
+  s.mosTempDeciC = (int16_t)(150 + rng() % 500);
+  s.t1DeciC = (int16_t)(rng() % 700) - 200;
+  s.t2DeciC = (int16_t)(rng() % 700) - 200;
+  s.balanceCurrentMa = (int16_t)(rng() % 2001) - 1000;
+  s.balancingAction = (uint8_t)(rng() % 3);
+  s.socPercent = (uint8_t)(rng() % 101);
+  s.nominalCapacityMah = 280000;
+  s.capacityRemainMah = s.nominalCapacityMah / 100 * s.socPercent;
+  s.cycleCount = rng() % 4000;
+  s.cycleCapacityMah = s.cycleCount * 250000;
+  s.uptimeS = uptimeS;
+  s.charge = rng() % 4 != 0;
+  s.discharge = rng() % 4 != 0;
+  s.balance = rng() % 2 != 0;
+  return s;
+}
+
+bool writeFile(const std::string& path, const std::vector<uint8_t>& bytes) {
+  FILE* f = fopen(path.c_str(), "wb");
+  if (!f) {
+    perror(path.c_str());
+    return false;
+  }
+  fwrite(bytes.data(), 1, bytes.size(), f);
+  fclose(f);
+  return true;
+}
+
+void append(std::vector<uint8_t>& buffer, const uint8_t* frame, size_t length) {
+  buffer.insert(buffer.end(), frame, frame + length);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (arg == "--frames" && value) opt.frames = atoi(argv[++i]);
+    else if (arg == "--seed" && value) opt.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    else if (!opt.dir && arg[0] != '-') opt.dir = argv[i];
+    else {
+      fprintf(stderr, "usage: make_fixture DIR [--frames N] [--seed N]\n");
+      return 2;
+    }
+  }
+  if (!opt.dir || opt.frames < 1) {
+    fprintf(stderr, "usage: make_fixture DIR [--frames N] [--seed N]\n");
+    return 2;
+  }
+  std::mt19937 rng(opt.seed);
+  uint8_t frame[sim::kFrameSize];
+
+  // JK02: device info, settings, cell frames with junk in between, a cut frame at the end
+  std::vector<uint8_t> jk02;
+  sim::buildDeviceInfoFrame("JK_B2A24S15P", "11.XW", "11.26", 3600, 0, frame);
+  append(jk02, frame, sizeof(frame));
+  sim::PackSettings settings;
+  const size_t settingsOffset = jk02.size();
+  sim::buildSettingsFrame(settings, 1, frame);
+  append(jk02, frame, sizeof(frame));
+
+  std::vector<Column> cells = {
+    { "offset" }, { "counter" }, { "cell_mv" }, { "wire_resist_mohm" }, { "average_cell_mv" }, { "delta_cell_mv" },
+    { "battery_mv" }, { "current_ma" }, { "balance_current_ma" }, { "capacity_remain_mah" },
+    { "nominal_capacity_mah" }, { "cycle_capacity_mah" }, { "mos_decic" }, { "t1_decic" }, { "t2_decic" },
+    { "cycle_count" }, { "uptime_s" }, { "cell_count" }, { "soc" }, { "balancing_action" }, { "charge" },
+    { "discharge" }, { "balance" },
+  };
+  size_t junk = 0;
+  for (int n = 0; n < opt.frames; n++) {
+    const sim::PackState s = randomState(rng, 86400 + n);
+    const uint8_t counter = (uint8_t)(n + 2);
+    uint16_t minMv = 0xFFFF, maxMv = 0;
+    uint32_t sum = 0;
+    for (int i = 0; i < 16; i++) {
+      sum += s.cellMv[i];
+      if (s.cellMv[i] < minMv) minMv = s.cellMv[i];
+      if (s.cellMv[i] > maxMv) maxMv = s.cellMv[i];
+    }
+    int c = 0;
+    cells[c++].add((long long)jk02.size());
+    cells[c++].add(counter);
+    cells[c++].addRow(s.cellMv, 16, 16);
+    cells[c++].addRow(s.wireResistMohm, 16, 16);
+    cells[c++].add(sum / 16);
+    cells[c++].add(maxMv - minMv);
+    cells[c++].add(s.batteryMv);
+    cells[c++].add(s.currentMa);
+    cells[c++].add(s.balanceCurrentMa);
+    cells[c++].add(s.capacityRemainMah);
+    cells[c++].add(s.nominalCapacityMah);
+    cells[c++].add(s.cycleCapacityMah);
+    cells[c++].add(s.mosTempDeciC);
+    cells[c++].add(s.t1DeciC);
+    cells[c++].add(s.t2DeciC);
+    cells[c++].add(s.cycleCount);
+    cells[c++].add(s.uptimeS);
+    cells[c++].add(16);
+    cells[c++].add(s.socPercent);
+    cells[c++].add(s.balancingAction);
+    cells[c++].add(s.charge);
+    cells[c++].add(s.discharge);
+    cells[c++].add(s.balance);
+    sim::buildCellInfoFrame(s, counter, frame);
+    append(jk02, frame, sizeof(frame));
+    if (n % 10 == 9) {
+      jk02.insert(jk02.end(), kJunkBytes, 0xAB);
+      junk += kJunkBytes;
+    }
+  }
+  append(jk02, frame, kPartialBytes);
+
+  std::vector<Column> settingColumns = {
+    { "offset" }, { "cell_uvp_mv" }, { "cell_uvpr_mv" }, { "cell_ovp_mv" }, { "cell_ovpr_mv" },
+    { "balance_trigger_mv" }, { "balance_start_mv" }, { "power_off_mv" }, { "max_charge_ma" },
+    { "max_discharge_ma" }, { "max_balance_ma" }, { "total_capacity_mah" }, { "charge_otp_decic" },
+    { "discharge_otp_decic" }, { "charge_utp_decic" }, { "mos_otp_decic" }, { "cell_count" },
+  };
+  const long long settingValues[] = {
+    (long long)settingsOffset, settings.cellUvpMv, settings.cellUvprMv, settings.cellOvpMv, settings.cellOvprMv,
+    settings.balanceTriggerMv, settings.balanceStartMv, settings.powerOffMv, settings.maxChargeMa,
+    settings.maxDischargeMa, settings.maxBalanceMa, settings.capacityMah, settings.chargeOtpDeciC,
+    settings.dischargeOtpDeciC, settings.chargeUtpDeciC, settings.mosOtpDeciC, settings.cellCount,
+  };
+  for (size_t i = 0; i < settingColumns.size(); i++) settingColumns[i].add(settingValues[i]);
+
+  // JK04: cell voltages and resistances as floats, 24 columns of which 16 are filled
+  std::vector<uint8_t> jk04;
+  std::vector<Column> jk04Cells = { { "offset" }, { "cell_mv" }, { "wire_resist_mohm" }, { "uptime_s" } };
+  for (int n = 0; n < opt.frames; n++) {
+    const sim::PackState s = randomState(rng, 7200 + n);
+    jk04Cells[0].add((long long)jk04.size());
+    jk04Cells[1].addRow(s.cellMv, 16, 24);
+    jk04Cells[2].addRow(s.wireResistMohm, 16, 24);
+    jk04Cells[3].add(s.uptimeS);
+    sim::buildJk04CellInfoFrame(s, (uint8_t)n, frame);
+    append(jk04, frame, sizeof(frame));
+  }
+
+  const std::string dir = opt.dir;
+  if (!writeFile(dir + "/jk02.bin", jk02) || !writeFile(dir + "/jk04.bin", jk04)) return 1;
+  const std::string jsonPath = dir + "/expected.json";
+  FILE* f = fopen(jsonPath.c_str(), "w");
+  if (!f) {
+    perror(jsonPath.c_str());
+    return 1;
+  }
+  fprintf(f, "{\n  \"jk02\": {\n");
+  fprintf(f, "    \"protocol\": \"jk02\",\n    \"device_info_frames\": 1,\n    \"undecoded_frames\": 0,\n");
+  fprintf(f, "    \"skipped_bytes\": %zu,\n    \"truncated\": true,\n", junk + kPartialBytes);
+  writeColumns(f, "cells", cells);
+  fprintf(f, ",\n");
+  writeColumns(f, "settings", settingColumns);
+  fprintf(f, "\n  },\n  \"jk04\": {\n");
+  fprintf(f, "    \"protocol\": \"jk04\",\n    \"device_info_frames\": 0,\n    \"undecoded_frames\": 0,\n");
+  fprintf(f, "    \"skipped_bytes\": 0,\n    \"truncated\": false,\n");
+  writeColumns(f, "cells", jk04Cells);
+  fprintf(f, "\n  }\n}\n");
+  fclose(f);
+  printf("%d JK02 and %d JK04 cell frames in %s (jk02.bin %zu bytes, jk04.bin %zu bytes)\n", opt.frames, opt.frames,
+         opt.dir, jk02.size(), jk04.size());
+  return 0;
+}
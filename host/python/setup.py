@@ -0,0 +1,38 @@
+"""
+Python bindings for the JK frame decoder (jk_decoder.h).
+
+Builds the ``jkbms`` extension from jkbms_module.cpp and frame_columns.cpp
+against the library headers in src/libs and the Arduino shim in host/shim,
+as the host tools are built (JKBMS_HOST).
+
+Usage:
+    pip install ./host/python
+    python -c "import jkbms; print(jkbms.decode(open('frames.bin', 'rb').read())['cells']['battery_mv'])"
+"""
+
+from pathlib import Path
+
+from pybind11.setup_helpers import Pybind11Extension, build_ext
+from setuptools import setup
+
+HERE = Path(__file__).resolve().parent
+ROOT = HERE.parent.parent
+
+extension = Pybind11Extension(
+    "jkbms",
+    ["jkbms_module.cpp", "frame_columns.cpp"],
+    include_dirs=[str(ROOT / "src" / "libs"), str(ROOT / "host" / "shim")],
+    define_macros=[("JKBMS_HOST", None)],
+    cxx_std=17,
+)
+
+setup(
+    name="jkbms",
+    version="0.1.0",
+    description="JK BMS frame decoding into numpy columns with the gateway's parsers",
+    ext_modules=[extension],
+    cmdclass={"build_ext": build_ext},
+    install_requires=["numpy"],
+    python_requires=">=3.8",
+    zip_safe=False,
+)
@@ -0,0 +1,142 @@
+"""
+Smoke test of the jkbms extension against frames built by host/sim/frame_builder.
+
+make_fixture writes the frames and the values they carry; every column that
+jkbms.decode() returns for them must match, with the documented dtypes and
+shapes, whatever buffer type it is given. Checksum verification, a strided
+buffer and a bad protocol name are checked as well.
+
+Usage:
+    pip install ./host/python
+    make_fixture FIXTURE_DIR        (pio run -e native_python_fixture)
+    python host/python/test_smoke.py FIXTURE_DIR
+
+Exits 1 if anything differs, after printing every mismatch.
+"""
+
+import json
+import sys
+from pathlib import Path
+
+import numpy as np
+
+import jkbms
+
+CELL_DTYPES = {
+    "offset": np.int64,
+    "counter": np.uint8,
+    "cell_mv": np.uint16,
+    "wire_resist_mohm": np.uint16,
+    "battery_mv": np.int32,
+    "current_ma": np.int32,
+    "mos_decic": np.int16,
+    "uptime_s": np.uint32,
+    "soc": np.uint8,
+    "charge": np.bool_,
+}
+
+failures = []
+
+
+def check(condition, message):
+    if not condition:
+        failures.append(message)
+
+
+def compare(label, columns, expected):
+    for name, values in expected.items():
+        if name not in columns:
+            check(False, f"{label}: no column {name}")
+            continue
+        got = columns[name]
+        want = np.array(values)
+        if want.size == 0:
+            check(got.size == 0, f"{label}.{name}: {got.size} values, none expected")
+            continue
+        if want.ndim == 2 and got.ndim == 2 and got.shape[1] > want.shape[1]:
+            # protocol="auto" decodes JK02 into 24 cell columns; the extra ones stay 0
+            want = np.pad(want, ((0, 0), (0, got.shape[1] - want.shape[1])))
+        if got.shape != want.shape:
+            check(False, f"{label}.{name}: shape {got.shape}, expected {want.shape}")
+            continue
+        bad = np.flatnonzero((got.astype(np.int64) != want.astype(np.int64)).reshape(len(want), -1).any(axis=1))
+        check(bad.size == 0, f"{label}.{name}: {bad.size} rows differ, first row {bad[:1].tolist()}: "
+              f"{got[bad[:1]].tolist()} != {want[bad[:1]].tolist()}")
+
+
+def check_file(path, expected, protocol):
+    data = path.read_bytes()
+    result = jkbms.decode(data, protocol=protocol)
+    label = f"{path.name} ({protocol})"
+    for key in ("protocol", "device_info_frames", "undecoded_frames", "skipped_bytes", "truncated"):
+        check(result[key] == expected[key], f"{label}: {key} {result[key]!r}, expected {expected[key]!r}")
+    compare(label + " cells", result["cells"], expected["cells"])
+    if "settings" in expected:
+        compare(label + " settings", result["settings"], expected["settings"])
+    else:
+        check(len(result["settings"]["offset"]) == 0, f"{label}: unexpected settings rows")
+
+    cells = result["cells"]
+    for name, dtype in CELL_DTYPES.items():
+        check(cells[name].dtype == dtype, f"{label}: {name} is {cells[name].dtype}, expected {np.dtype(dtype)}")
+    rows = len(expected["cells"]["offset"])
+    check(cells["cell_mv"].ndim == 2 and cells["cell_mv"].shape[0] == rows, f"{label}: cell_mv shape {cells['cell_mv'].shape}")
+
+    # Every buffer type reads the same bytes in place
+    for name, buffer in (("bytearray", bytearray(data)), ("memoryview", memoryview(data)),
+                         ("numpy", np.frombuffer(data, dtype=np.uint8))):
+        other = jkbms.decode(buffer, protocol=protocol)["cells"]
+        check(np.array_equal(other["cell_mv"], cells["cell_mv"]), f"{label}: {name} buffer decodes differently")
+    return rows
+
+
+def check_checksums(path):
+    data = bytearray(path.read_bytes())
+    clean = jkbms.decode(bytes(data), verify_checksum=True)
+    check(clean["bad_checksum"] == 0, f"{path.name}: {clean['bad_checksum']} bad checksums in clean frames")
+    rows = len(clean["cells"]["offset"])
+    # A flipped voltage byte in the second cell frame: only that frame is refused
+    offset = int(clean["cells"]["offset"][1])
+    data[offset + 6] ^= 0x01
+    corrupt = jkbms.decode(bytes(data), verify_checksum=True)
+    check(corrupt["bad_checksum"] == 1, f"{path.name}: bad_checksum {corrupt['bad_checksum']} after one flip")
+    check(len(corrupt["cells"]["offset"]) == rows - 1, f"{path.name}: {len(corrupt['cells']['offset'])} rows after one flip")
+    unchecked = jkbms.decode(bytes(data))
+    check(len(unchecked["cells"]["offset"]) == rows, f"{path.name}: the flip dropped a frame without verify_checksum")
+
+
+def check_errors(path):
+    data = np.frombuffer(path.read_bytes(), dtype=np.uint8)
+    for label, call in (("strided buffer", lambda: jkbms.decode(data[::2])),
+                        ("protocol name", lambda: jkbms.decode(b"", protocol="jk03")),
+                        ("item size", lambda: jkbms.decode(np.zeros(4, dtype=np.uint16)))):
+        try:
+            call()
+            check(False, f"{label}: no ValueError")
+        except ValueError:
+            pass
+    empty = jkbms.decode(b"")
+    check(len(empty["cells"]["offset"]) == 0 and not empty["truncated"], "empty buffer")
+
+
+def main():
+    if len(sys.argv) != 2:
+        print(__doc__)
+        return 2
+    fixture = Path(sys.argv[1])
+    expected = json.loads((fixture / "expected.json").read_text())
+    frames = 0
+    for name in ("jk02", "jk04"):
+        frames += check_file(fixture / f"{name}.bin", expected[name], "auto")
+        frames += check_file(fixture / f"{name}.bin", expected[name], name)
+    check_checksums(fixture / "jk02.bin")
+    check_errors(fixture / "jk02.bin")
+
+    for message in failures:
+        print("FAIL:", message)
+    print(f"jkbms {getattr(jkbms, '__file__', '')}: {frames} cell frames decoded, {len(failures)} failures")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,332 @@
+/**
+ * @file reconnect_bench.cpp
+ * @brief Reconnect-latency benchmark with scripted link failures
+ *
+ * Runs the real gateway application (src/main.cpp setup()/loop()) and the
+ * library's connectToServer() against one simulated BMS on virtual time.
+ * After the first session is up, it repeatedly waits a random settle time,
+ * injects a failure and measures the time until the next cell-info frame
+ * is parsed. Each recovery is broken down into phases using trace points
+ * from the NimBLE shim:
+ *
+ *   detect    failure -> gateway sees the link down
+ *   scan wait link down -> start of the scan that finds the BMS (loop() cadence, missed scans)
+ *   discover  that scan's start -> advert for the BMS reported
+ *   attempt   advert -> connection request issued (loop() spacing, connectToServer delays)
+ *   link      request -> link established (including connect retries)
+ *   gatt      link up -> notifications subscribed (discovery sleeps)
+ *   data      subscribed -> first cell frame parsed (request sleeps, throttling)
+ *
+ * Failure kinds:
+ *   drop   peer-side link loss (supervision timeout), BMS re-advertises after 1 s
+ *   power  BMS powered off for --power-off-s, then back on
+ *   stall  link stays up but the BMS stops sending (caught by the 25 s timeout)
+ *   reboot the gateway restarts (watchdog, OTA): clients and JKBMS state are
+ *          dropped and setup() runs again; checkpoints survive, as RTC
+ *          memory and NVS do on the ESP32
+ *
+ * --bystanders N adds N advertising devices that are not configured (phones,
+ * trackers, other BMSes). The report shows how many adverts reached the host
+ * and were dropped in software; with the controller accept list
+ * (scan_filter.h) that is zero, --open-scan turns it off for comparison.
+ *
+ * Virtual time and seeded randomness make the results deterministic, so the
+ * --max-p50-s / --max-p95-s budgets can gate CI.
+ *
+ * Usage:
+ *   reconnect_bench [--events 40] [--mix drop,power,stall,reboot] [--power-off-s 10]
+ *                   [--bystanders 0] [--open-scan] [--seed 1]
+ *                   [--max-p50-s X] [--max-p95-s X] [--csv]
+ */
+
+#include <Arduino.h>
+#include <NimBLEDevice.h>
+#include "../src/libs/JKBMS.h"
+#include "../src/libs/scan_filter.h"
+#include "sim/virtual_bms.h"
+
+#include <random>
+#include <vector>
+
+void setup();
+void loop();
+
+// Scheduling state of src/main.cpp, back to its boot values on a reboot
+extern unsigned long lastScanTime;
+extern unsigned long lastConnectionAttempt;
+
+namespace {
+
+enum Checkpoint { kFailure, kDetected, kScanStarted, kAdvertFound, kConnectStarted, kLinkUp, kSubscribed, kFirstFrame, kCheckpoints };
+
+const char* kPhaseNames[kCheckpoints - 1] = { "detect", "scan wait", "discover", "attempt", "link", "gatt", "data" };
+
+struct Options {
+  int events = 40;
+  std::vector<std::string> mix = { "drop", "power", "stall" };
+  uint32_t powerOffS = 10;
+  int bystanders = 0;
+  bool openScan = false;
+  uint32_t seed = 1;
+  double maxP50S = 0;
+  double maxP95S = 0;
+  bool csv = false;
+};
+
+struct Recovery {
+  std::string kind;
+  uint64_t at[kCheckpoints];
+  bool recovered;
+};
+
+// Current recovery being measured; checkpoints are filled in by the trace hook
+Recovery* g_current = nullptr;
+bool g_firstFrameSeen = false;
+uint64_t g_lastScanStartUs = 0;
+
+void mark(Checkpoint c) {
+  if (!g_current || g_current->at[c]) return;
+  g_current->at[c] = sim::nowUs();
+}
+
+void onTrace(const SimTrace::Event& e, const std::string& mac) {
+  if (e.type == SimTrace::ScanStart) g_lastScanStartUs = e.atUs;
+  if (!g_current) return;
+  if (!e.address.empty() && e.address != mac) return;
+  switch (e.type) {
+    case SimTrace::LinkDown: mark(kDetected); break;
+    case SimTrace::ScanResult:
+      if (g_current->at[kDetected] && !g_current->at[kAdvertFound]) {
+        g_current->at[kScanStarted] = std::max(g_lastScanStartUs, g_current->at[kDetected]);
+        mark(kAdvertFound);
+      }
+      break;
+    case SimTrace::ConnectStart: if (g_current->at[kDetected]) mark(kConnectStarted); break;
+    case SimTrace::LinkUp: if (g_current->at[kConnectStarted]) mark(kLinkUp); break;
+    case SimTrace::Subscribed: if (g_current->at[kLinkUp]) mark(kSubscribed); break;
+    default: break;
+  }
+}
+
+double percentile(std::vector<double> v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[(size_t)(p * (v.size() - 1))];
+}
+
+bool parseOptions(int argc, char** argv, Options& opt) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--csv") { opt.csv = true; continue; }
+    if (arg == "--open-scan") { opt.openScan = true; continue; }
+    if (i + 1 >= argc) { fprintf(stderr, "missing value for %s\n", arg.c_str()); return false; }
+    const char* value = argv[++i];
+    if (arg == "--events") opt.events = atoi(value);
+    else if (arg == "--power-off-s") opt.powerOffS = atoi(value);
+    else if (arg == "--bystanders") opt.bystanders = atoi(value);
+    else if (arg == "--seed") opt.seed = atoi(value);
+    else if (arg == "--max-p50-s") opt.maxP50S = atof(value);
+    else if (arg == "--max-p95-s") opt.maxP95S = atof(value);
+    else if (arg == "--mix") {
+      opt.mix.clear();
+      std::string list = value;
+      size_t start = 0;
+      while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        std::string kind = list.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        if (kind != "drop" && kind != "power" && kind != "stall" && kind != "reboot") {
+          fprintf(stderr, "unknown failure kind %s\n", kind.c_str());
+          return false;
+        }
+        opt.mix.push_back(kind);
+        if (comma == std::string::npos) break;
+        start = comma + 1;
+      }
+    } else {
+      fprintf(stderr, "unknown option %s\n", arg.c_str());
+      return false;
+    }
+  }
+  return opt.events > 0 && !opt.mix.empty();
+}
+
+/** @brief An advertiser the gateway is not configured for; refuses connections */
+class Bystander : public SimPeer {
+public:
+  Bystander(int index, int rssi) : m_rssi(rssi) {
+    char mac[18];
+    snprintf(mac, sizeof(mac), "5a:%02x:%02x:00:00:%02x", (index >> 8) & 0xFF, index & 0xFF, index % 7);
+    m_address = mac;
+  }
+  std::string address() const override { return m_address; }
+  int rssi() const override { return m_rssi; }
+  bool advertising() const override { return true; }
+  uint32_t connectLatencyUs() override { return 0; }
+  bool acceptConnection() override { return false; }
+  uint32_t discoveryLatencyUs() override { return 0; }
+  uint32_t attRoundTripUs() override { return 0; }
+  void onConnected(NimBLEClient* client) override {}
+  void onDisconnected() override {}
+  void onWrite(const uint8_t* data, size_t length) override {}
+
+private:
+  std::string m_address;
+  int m_rssi;
+};
+
+/** @brief Run the application loop until the predicate holds or the deadline passes */
+template <typename Pred>
+bool runLoopUntil(Pred done, uint64_t deadlineUs) {
+  while (!done()) {
+    if (sim::nowUs() >= deadlineUs) return false;
+    loop();
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  if (!parseOptions(argc, argv, opt)) return 2;
+
+  JKBMS& bms = jkBmsDevices[0];
+  sim::VirtualBmsConfig config;
+  config.mac = bms.targetMAC;
+  config.seed = opt.seed;
+  sim::VirtualBms peer(config);
+  SimRadio::addPeer(&peer);
+  std::vector<Bystander> bystanders;
+  bystanders.reserve(opt.bystanders);
+  for (int i = 0; i < opt.bystanders; i++) {
+    bystanders.emplace_back(i, -60 - (int)(i * 7 % 35));
+    SimRadio::addPeer(&bystanders.back());
+  }
+  scanFilterEnable(!opt.openScan);
+
+  // A frame counts once the call that completes it has run the parser
+  peer.setFragmentSink([&bms](sim::VirtualBms& p, const uint8_t* data, size_t length, const sim::FragmentInfo& info) {
+    bool before = bms.received_complete;
+    p.deliver(data, length);
+    if (!before && bms.received_complete && info.frameType == 0x02) {
+      g_firstFrameSeen = true;
+      mark(kFirstFrame);
+    }
+  });
+  const std::string mac = NimBLEAddress(bms.targetMAC).toString();
+  SimTrace::setHook([&mac](const SimTrace::Event& e) { onTrace(e, mac); });
+
+  setup();
+  const uint64_t bootUs = sim::nowUs();
+  if (!runLoopUntil([]() { return g_firstFrameSeen; }, bootUs + 600ULL * 1000000)) {
+    fprintf(stderr, "initial connection never produced a frame\n");
+    return 1;
+  }
+  const double coldStartS = (sim::nowUs() - bootUs) / 1e6;
+
+  std::mt19937 rng(opt.seed);
+  std::vector<Recovery> recoveries;
+  for (int n = 0; n < opt.events; n++) {
+    // Steady streaming between failures
+    uint64_t settleUs = std::uniform_int_distribution<uint64_t>(30, 90)(rng) * 1000000;
+    runLoopUntil([]() { return false; }, sim::nowUs() + settleUs);
+
+    Recovery r = {};
+    r.kind = opt.mix[n % opt.mix.size()];
+    g_current = &r;
+    r.at[kFailure] = sim::nowUs();
+    if (r.kind == "drop") {
+      peer.forceDrop();
+    } else if (r.kind == "power") {
+      peer.setPowered(false);
+      sim::scheduleIn((uint64_t)opt.powerOffS * 1000000, [&peer]() { peer.setPowered(true); });
+    } else if (r.kind == "reboot") {
+      NimBLEDevice::deleteAllClients();
+      bms = JKBMS(bms.targetMAC);
+      mark(kDetected);
+      lastScanTime = lastConnectionAttempt = 0;
+      setup();
+    } else {
+      peer.stall();
+    }
+    r.recovered = runLoopUntil([&r]() { return r.at[kFirstFrame] != 0; }, r.at[kFailure] + 600ULL * 1000000);
+    g_current = nullptr;
+    recoveries.push_back(r);
+  }
+
+  // Totals and per-phase durations; a missing checkpoint collapses onto the next one
+  std::vector<double> totals;
+  std::vector<std::vector<double>> phases(kCheckpoints - 1);
+  int failed = 0;
+  for (Recovery& r : recoveries) {
+    if (!r.recovered) {
+      failed++;
+      continue;
+    }
+    for (int c = kCheckpoints - 2; c >= 0; c--) {
+      if (!r.at[c]) r.at[c] = r.at[c + 1];
+    }
+    totals.push_back((r.at[kFirstFrame] - r.at[kFailure]) / 1e6);
+    for (int c = 0; c < kCheckpoints - 1; c++) {
+      phases[c].push_back((r.at[c + 1] - r.at[c]) / 1e6);
+    }
+  }
+
+  double p50 = percentile(totals, 0.50);
+  double p95 = percentile(totals, 0.95);
+
+  if (opt.csv) {
+    printf("event,kind,recovered,total_s");
+    for (int c = 0; c < kCheckpoints - 1; c++) printf(",%s_s", kPhaseNames[c]);
+    printf("\n");
+    for (size_t i = 0; i < recoveries.size(); i++) {
+      const Recovery& r = recoveries[i];
+      printf("%zu,%s,%d,%.3f", i, r.kind.c_str(), r.recovered ? 1 : 0,
+             r.recovered ? (r.at[kFirstFrame] - r.at[kFailure]) / 1e6 : -1.0);
+      for (int c = 0; c < kCheckpoints - 1; c++) {
+        printf(",%.3f", r.recovered ? (r.at[c + 1] - r.at[c]) / 1e6 : -1.0);
+      }
+      printf("\n");
+    }
+  } else {
+    printf("JKBMS reconnect benchmark: %d events (%zu kinds), seed %u\n", opt.events, opt.mix.size(), opt.seed);
+    printf("Cold start to first frame: %.2f s\n", coldStartS);
+    printf("Recovered: %zu/%zu\n\n", totals.size(), recoveries.size());
+    printf("%-10s %8s %8s %8s %8s %8s\n", "phase", "min", "p50", "p95", "max", "mean");
+    for (int c = 0; c <= kCheckpoints - 1; c++) {
+      const std::vector<double>& v = c < kCheckpoints - 1 ? phases[c] : totals;
+      double sum = 0;
+      for (double x : v) sum += x;
+      printf("%-10s %8.2f %8.2f %8.2f %8.2f %8.2f\n", c < kCheckpoints - 1 ? kPhaseNames[c] : "total",
+             percentile(v, 0.0), percentile(v, 0.5), percentile(v, 0.95), percentile(v, 1.0),
+             v.empty() ? 0 : sum / v.size());
+    }
+    printf("\nBy failure kind (p50 / max total s):\n");
+    for (const std::string& kind : opt.mix) {
+      std::vector<double> v;
+      for (const Recovery& r : recoveries) {
+        if (r.kind == kind && r.recovered) v.push_back((r.at[kFirstFrame] - r.at[kFailure]) / 1e6);
+      }
+      printf("  %-6s %8.2f %8.2f\n", kind.c_str(), percentile(v, 0.5), percentile(v, 1.0));
+    }
+    const ScanFilterCounters& scan = scanFilterCounters();
+    printf("\nScans: %u with the accept list, %u open (%u fallbacks); adverts at the host: %u matched, %u dropped in software\n",
+           scan.listScans, scan.openScans, scan.fallbacks, scan.hostMatched, scan.hostRejected);
+  }
+
+  int status = 0;
+  if (failed) {
+    fprintf(stderr, "FAIL: %d failures never recovered\n", failed);
+    status = 1;
+  }
+  if (opt.maxP50S > 0 && p50 > opt.maxP50S) {
+    fprintf(stderr, "FAIL: p50 reconnect %.2f s exceeds budget %.2f s\n", p50, opt.maxP50S);
+    status = 1;
+  }
+  if (opt.maxP95S > 0 && p95 > opt.maxP95S) {
+    fprintf(stderr, "FAIL: p95 reconnect %.2f s exceeds budget %.2f s\n", p95, opt.maxP95S);
+    status = 1;
+  }
+  NimBLEDevice::deleteAllClients();
+  return status;
+}
@@ -0,0 +1,254 @@
+/**
+ * @file rest_bench.cpp
+ * @brief Serialization cost of REST pollers with and without version ETags
+ *
+ * A set of devices gets a new cell frame every --rate-ms, while --pollers
+ * clients fetch GET /devices every --poll-ms. The same schedule runs four
+ * times through rest_api.h, in virtual time:
+ *   full      the cache is dropped before every request: every poll
+ *             serializes every device, as the integrations did before
+ *   cached    plain GETs answered from the per-version render cache
+ *   etag      conditional GETs: 304 while nothing changed
+ *   longpoll  conditional GETs with ?wait=: held until the next version
+ * and reports requests, renders, bytes and host CPU per mode, plus the delay
+ * between a new frame and a poller seeing it.
+ *
+ * --serve PORT instead serves the same synthetic devices over HTTP in real
+ * time for --duration-s, for curl or an integration under test:
+ *   curl -i localhost:8080/devices/0
+ *   curl -i -H 'If-None-Match: "<etag>"' 'localhost:8080/devices/0?wait=10'
+ *
+ * Usage:
+ *   rest_bench [--devices 8] [--pollers 10] [--poll-ms 1000] [--rate-ms 5000]
+ *              [--duration-s 600] [--serve PORT]
+ */
+
+#include "../src/libs/JKBMS.h"
+#include "../src/libs/rest_api.h"
+#include "sim_clock.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+JKBMS jkBmsDevices[JKBMS_REST_DEVICES];
+const int bmsDeviceCount = JKBMS_REST_DEVICES;
+
+namespace {
+
+struct Options {
+  int devices = 8;
+  int pollers = 10;
+  uint32_t pollMs = 1000;
+  uint32_t rateMs = 5000;
+  uint32_t durationS = 600;
+  int servePort = 0;
+};
+
+enum Mode { MODE_FULL, MODE_CACHED, MODE_ETAG, MODE_LONGPOLL, MODE_COUNT };
+const char* const modeNames[MODE_COUNT] = { "full", "cached", "etag", "longpoll" };
+
+typedef std::chrono::steady_clock Clock;
+
+const uint32_t kTickMs = 10;
+// restServerPoll() looks at held requests every 50 ms
+const uint32_t kHeldCheckMs = 50;
+
+void setupDevices(int count) {
+  for (int i = 0; i < JKBMS_REST_DEVICES; i++) {
+    char mac[18] = "";
+    if (i < count) snprintf(mac, sizeof(mac), "c8:47:80:00:00:%02x", i);
+    jkBmsDevices[i] = JKBMS(mac);
+    jkBmsDevices[i].connected = i < count;
+    jkBmsDevices[i].cell_count = 16;
+  }
+}
+
+// A new cell frame: what the parser would leave behind
+void updateDevice(int i, uint32_t nowMs) {
+  JKBMS& bms = jkBmsDevices[i];
+  const float phase = nowMs / 60000.0f + i;
+  float sum = 0;
+  for (int c = 0; c < bms.cell_count; c++) {
+    bms.cellVoltage[c] = 3.30f + 0.02f * sinf(phase + c * 0.1f);
+    sum += bms.cellVoltage[c];
+  }
+  bms.Battery_Voltage = sum;
+  bms.Average_Cell_Voltage = sum / bms.cell_count;
+  bms.Delta_Cell_Voltage = 0.004f;
+  bms.Charge_Current = 20.0f * sinf(phase * 0.5f);
+  bms.Battery_Power = bms.Battery_Voltage * bms.Charge_Current;
+  bms.Percent_Remain = 50 + (int)(20 * sinf(phase * 0.1f));
+  bms.Battery_T1 = 25.0f + i;
+  bms.MOS_Temp = 30.0f;
+  bms.snapshotVersion++;
+}
+
+struct Poller {
+  uint32_t offsetMs;
+  std::string etag;
+  bool held = false;
+  RestReply reply;
+  int64_t pendingSinceMs = -1;   // first change this poller has not seen yet
+};
+
+struct ModeResult {
+  uint32_t requests = 0, ok = 0, notModified = 0, renders = 0;
+  uint64_t bytes = 0;
+  double cpuUs = 0;
+  double delaySumMs = 0;
+  uint32_t delays = 0;
+};
+
+// Status line and headers as restServerPoll() sends them, roughly
+const size_t kHeaderBytes = 150;
+
+ModeResult runMode(const Options& opt, Mode mode) {
+  setupDevices(opt.devices);
+  restInvalidate();
+  sim::reset();
+  const RestCounters before = restCounters();
+  std::vector<Poller> pollers(opt.pollers);
+  for (int p = 0; p < opt.pollers; p++) pollers[p].offsetMs = (uint32_t)((uint64_t)opt.pollMs * p / opt.pollers);
+
+  ModeResult r;
+  auto deliver = [&](Poller& poller, const RestReply& reply, uint32_t nowMs) {
+    r.requests++;
+    if (reply.status == 304) {
+      r.notModified++;
+      r.bytes += kHeaderBytes;
+      return;
+    }
+    r.ok++;
+    r.bytes += kHeaderBytes + reply.length;
+    poller.etag = reply.etag;
+    if (poller.pendingSinceMs >= 0) {
+      r.delaySumMs += nowMs - poller.pendingSinceMs;
+      r.delays++;
+      poller.pendingSinceMs = -1;
+    }
+  };
+  auto issue = [&](Poller& poller, uint32_t nowMs) {
+    const char* ifNoneMatch = mode >= MODE_ETAG && !poller.etag.empty() ? poller.etag.c_str() : nullptr;
+    const char* target = mode == MODE_LONGPOLL ? "/devices?wait=30" : "/devices";
+    Clock::time_point t0 = Clock::now();
+    if (mode == MODE_FULL) restInvalidate();
+    restHandleRequest("GET", target, ifNoneMatch, poller.reply);
+    r.cpuUs += std::chrono::duration<double, std::micro>(Clock::now() - t0).count();
+    if (poller.reply.status == 0) {
+      poller.held = true;
+      return;
+    }
+    deliver(poller, poller.reply, nowMs);
+  };
+
+  const uint32_t endMs = opt.durationS * 1000;
+  for (uint32_t now = 0; now < endMs; now += kTickMs) {
+    sim::advanceTo((uint64_t)now * 1000);
+    for (int i = 0; i < opt.devices; i++) {
+      if ((now + (uint32_t)i * opt.rateMs / opt.devices) % opt.rateMs != 0) continue;
+      updateDevice(i, now);
+      for (Poller& poller : pollers) {
+        if (poller.pendingSinceMs < 0) poller.pendingSinceMs = now;
+      }
+    }
+    for (Poller& poller : pollers) {
+      if (mode == MODE_LONGPOLL) {
+        if (!poller.held) {
+          issue(poller, now);
+          continue;
+        }
+        if (now % kHeldCheckMs) continue;
+        // What restServerPoll() does for a held connection
+        Clock::time_point t0 = Clock::now();
+        RestReply reply;
+        bool done = false;
+        if (restResourceKey(poller.reply.resource) != poller.reply.key) {
+          restHandleRequest("GET", "/devices", nullptr, reply, false);
+          done = true;
+        } else if ((int32_t)(millis() - poller.reply.deadlineMs) >= 0) {
+          reply = poller.reply;
+          reply.status = 304;
+          done = true;
+        }
+        r.cpuUs += std::chrono::duration<double, std::micro>(Clock::now() - t0).count();
+        if (done) {
+          poller.held = false;
+          deliver(poller, reply, now);
+        }
+      } else if (now % opt.pollMs == poller.offsetMs) {
+        issue(poller, now);
+      }
+    }
+  }
+  r.renders = restCounters().renders - before.renders;
+  return r;
+}
+
+int serve(const Options& opt) {
+  setupDevices(opt.devices);
+  if (!restServerBegin((uint16_t)opt.servePort)) {
+    perror("listen");
+    return 1;
+  }
+  printf("Serving %d devices on port %d for %u s, a new frame every %u ms per device\n", opt.devices,
+         opt.servePort, opt.durationS, opt.rateMs);
+  fflush(stdout);
+  Clock::time_point start = Clock::now();
+  uint32_t nextUpdateMs = 0;
+  for (;;) {
+    const uint32_t now =
+      (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+    if (now >= opt.durationS * 1000) break;
+    sim::advanceTo((uint64_t)now * 1000);
+    if (now >= nextUpdateMs) {
+      for (int i = 0; i < opt.devices; i++) updateDevice(i, now);
+      nextUpdateMs = now + opt.rateMs;
+    }
+    restServerPoll(10);
+  }
+  restServerEnd();
+  const RestCounters& c = restCounters();
+  printf("requests %u, 304 %u, renders %u, cache hits %u, long polls %u (%u timed out), errors %u, "
+         "sends queued %u\n", c.requests, c.notModified, c.renders, c.cacheHits, c.longPolls, c.longPollTimeouts,
+         c.errors, c.sendsQueued);
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string arg = argv[i];
+    if (arg == "--devices") opt.devices = atoi(argv[i + 1]);
+    else if (arg == "--pollers") opt.pollers = atoi(argv[i + 1]);
+    else if (arg == "--poll-ms") opt.pollMs = atoi(argv[i + 1]);
+    else if (arg == "--rate-ms") opt.rateMs = atoi(argv[i + 1]);
+    else if (arg == "--duration-s") opt.durationS = atoi(argv[i + 1]);
+    else if (arg == "--serve") opt.servePort = atoi(argv[i + 1]);
+    else { fprintf(stderr, "unknown option %s\n", arg.c_str()); return 2; }
+  }
+  if (opt.devices < 1 || opt.devices > JKBMS_REST_DEVICES || opt.pollers < 1 || opt.pollMs < kTickMs ||
+      opt.rateMs < kTickMs || opt.pollMs % kTickMs || opt.rateMs % kTickMs) {
+    fprintf(stderr, "devices 1..%d, pollers >= 1, --poll-ms and --rate-ms multiples of %u\n", JKBMS_REST_DEVICES,
+            kTickMs);
+    return 2;
+  }
+  if (opt.servePort) return serve(opt);
+
+  printf("REST pollers: %d devices (new frame every %u ms), %d pollers of GET /devices every %u ms, %u s\n\n",
+         opt.devices, opt.rateMs, opt.pollers, opt.pollMs, opt.durationS);
+  printf("%-9s %9s %8s %8s %8s %11s %10s %9s %10s\n", "mode", "requests", "200", "304", "renders", "bytes",
+         "cpu_ms", "us/req", "delay_ms");
+  for (int m = 0; m < MODE_COUNT; m++) {
+    ModeResult r = runMode(opt, (Mode)m);
+    printf("%-9s %9u %8u %8u %8u %11llu %10.2f %9.2f %10.1f\n", modeNames[m], r.requests, r.ok, r.notModified,
+           r.renders, (unsigned long long)r.bytes, r.cpuUs / 1000, r.requests ? r.cpuUs / r.requests : 0,
+           r.delays ? r.delaySumMs / r.delays : 0);
+  }
+  return 0;
+}
@@ -0,0 +1,51 @@
+/**
+ * @file Arduino.h
+ * @brief Minimal Arduino core shim for host-side builds of the JKBMS library
+ *
+ * Provides just enough of the Arduino API (types, timing, Serial) for the
+ * library sources in src/libs to compile and run on a Linux host. Time is
+ * virtual: millis()/micros() read the simulation clock and delay() advances
+ * it, running any radio events scheduled in between (see sim_clock.h).
+ */
+
+#ifndef HOST_SHIM_ARDUINO_H
+#define HOST_SHIM_ARDUINO_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdarg>
+#include <cmath>
+#include <string>
+#include <algorithm>
+
+#include "sim_clock.h"
+
+typedef uint8_t byte;
+
+inline uint32_t millis() { return (uint32_t)(sim::nowUs() / 1000); }
+inline uint32_t micros() { return (uint32_t)sim::nowUs(); }
+inline void delay(uint32_t ms) { sim::advance((uint64_t)ms * 1000); }
+inline void yield() {}
+
+/**
+ * @brief Serial console replacement writing to stdout
+ */
+class HostSerial {
+public:
+  void begin(unsigned long) {}
+  void print(const char* s) { fputs(s, stdout); }
+  void println(const char* s = "") { fputs(s, stdout); fputc('\n', stdout); }
+  void printf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+  }
+};
+
+extern HostSerial Serial;
+
+#endif // HOST_SHIM_ARDUINO_H
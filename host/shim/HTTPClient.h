@@ -0,0 +1,9 @@
+/**
+ * @file HTTPClient.h
+ * @brief Empty stand-in so src/main.cpp compiles in host builds
+ */
+
+#ifndef HOST_SHIM_HTTPCLIENT_H
+#define HOST_SHIM_HTTPCLIENT_H
+
+#endif // HOST_SHIM_HTTPCLIENT_H
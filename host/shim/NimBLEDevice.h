@@ -0,0 +1,307 @@
+/**
+ * @file NimBLEDevice.h
+ * @brief Host-side stand-in for the subset of NimBLE-Arduino used by the library
+ *
+ * Clients, services, characteristics and the scanner keep the NimBLE-Arduino
+ * 2.x signatures used in src/, but talk to in-process SimPeer objects through
+ * a virtual radio instead of a controller. Connection setup, discovery and
+ * ATT round trips cost virtual time, so library code that calls delay() or
+ * blocks on connect() behaves as it would on the ESP32, only faster than
+ * real time.
+ */
+
+#ifndef HOST_SHIM_NIMBLE_DEVICE_H
+#define HOST_SHIM_NIMBLE_DEVICE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+#include <deque>
+
+#define ESP_PWR_LVL_P9 9
+#define BLE_ADDR_PUBLIC 0
+#define BLE_ADDR_RANDOM 1
+
+#define BLE_HCI_SCAN_FILT_NO_WL 0
+#define BLE_HCI_SCAN_FILT_USE_WL 1
+
+#define BLE_GAP_LE_PHY_1M 1
+#define BLE_GAP_LE_PHY_2M 2
+#define BLE_GAP_LE_PHY_CODED 3
+#define BLE_GAP_LE_PHY_1M_MASK 0x01
+#define BLE_GAP_LE_PHY_2M_MASK 0x02
+#define BLE_GAP_LE_PHY_CODED_MASK 0x04
+#define BLE_GAP_LE_PHY_CODED_ANY 0
+#define BLE_GAP_LE_PHY_CODED_S2 1
+#define BLE_GAP_LE_PHY_CODED_S8 2
+
+class NimBLEClient;
+class NimBLERemoteCharacteristic;
+
+//********************************************
+// Addresses and UUIDs
+//********************************************
+
+class NimBLEAddress {
+public:
+  NimBLEAddress() : m_type(BLE_ADDR_PUBLIC) {}
+  NimBLEAddress(const std::string& addr, uint8_t type = BLE_ADDR_PUBLIC);
+  std::string toString() const { return m_addr; }
+  uint8_t getType() const { return m_type; }
+  bool isNull() const { return m_addr.empty(); }
+  bool operator==(const NimBLEAddress& other) const { return m_addr == other.m_addr; }
+  bool operator!=(const NimBLEAddress& other) const { return !(*this == other); }
+
+private:
+  std::string m_addr;
+  uint8_t m_type;
+};
+
+class NimBLEUUID {
+public:
+  NimBLEUUID(const std::string& uuid = "") : m_uuid(uuid) {}
+  std::string toString() const { return m_uuid; }
+
+private:
+  std::string m_uuid;
+};
+
+//********************************************
+// Simulated peer interface
+//********************************************
+
+/**
+ * @brief A device on the virtual radio
+ *
+ * Implemented by the simulators (see host/sim/virtual_bms.h). The shim calls
+ * into the peer for advertising state, connection admission and GATT writes;
+ * the peer pushes notifications back through NimBLEClient::simNotify().
+ */
+class SimPeer {
+public:
+  virtual ~SimPeer() {}
+  virtual std::string address() const = 0;
+  virtual int rssi() const = 0;
+  virtual bool advertising() const = 0;
+  /** @brief Virtual time the connection procedure takes, whether or not it succeeds */
+  virtual uint32_t connectLatencyUs() = 0;
+  /** @brief Decide whether this connection attempt is accepted */
+  virtual bool acceptConnection() = 0;
+  /** @brief Virtual time a GATT primary service discovery takes */
+  virtual uint32_t discoveryLatencyUs() = 0;
+  /** @brief Virtual time of one ATT request/response exchange */
+  virtual uint32_t attRoundTripUs() = 0;
+  virtual void onConnected(NimBLEClient* client) = 0;
+  virtual void onDisconnected() = 0;
+  virtual void onWrite(const uint8_t* data, size_t length) = 0;
+  /** @brief PHYs the peer accepts in a PHY update (BLE_GAP_LE_PHY_*_MASK) */
+  virtual uint8_t supportedPhyMask() const { return BLE_GAP_LE_PHY_1M_MASK; }
+  virtual void onPhyChanged(uint8_t phy) {}
+};
+
+/**
+ * @brief Registry of peers reachable by the virtual radio
+ */
+namespace SimRadio {
+void addPeer(SimPeer* peer);
+void removePeer(SimPeer* peer);
+void clear();
+SimPeer* findPeer(const std::string& address);
+/** @brief Average advertising interval used to time scan results */
+void setAdvertisingIntervalMs(uint32_t ms);
+}
+
+/**
+ * @brief Observation points inside the fake stack
+ *
+ * Benchmarks install a hook to timestamp what the library does on the radio
+ * (scans, connects, discovery, writes) without instrumenting src/.
+ */
+namespace SimTrace {
+enum Type { ScanStart, ScanResult, ConnectStart, LinkUp, LinkDown, Subscribed, Write };
+struct Event {
+  Type type;
+  std::string address;
+  uint8_t reg;       // register for Write events
+  uint64_t atUs;
+};
+void setHook(std::function<void(const Event&)> hook);
+void emit(Type type, const std::string& address, uint8_t reg = 0);
+}
+
+//********************************************
+// Callbacks
+//********************************************
+
+class NimBLEAdvertisedDevice {
+public:
+  NimBLEAdvertisedDevice(const NimBLEAddress& addr, int rssi) : m_addr(addr), m_rssi(rssi) {}
+  NimBLEAddress getAddress() const { return m_addr; }
+  int getRSSI() const { return m_rssi; }
+  std::string toString() const { return "Address: " + m_addr.toString(); }
+
+private:
+  NimBLEAddress m_addr;
+  int m_rssi;
+};
+
+class NimBLEClientCallbacks {
+public:
+  virtual ~NimBLEClientCallbacks() {}
+  virtual void onConnect(NimBLEClient* pClient) {}
+  virtual void onDisconnect(NimBLEClient* pClient, int reason) {}
+  virtual void onPhyUpdate(NimBLEClient* pClient, uint8_t txPhy, uint8_t rxPhy) {}
+};
+
+class NimBLEScanCallbacks {
+public:
+  virtual ~NimBLEScanCallbacks() {}
+  virtual void onResult(const NimBLEAdvertisedDevice* advertisedDevice) {}
+  virtual void onScanEnd(int reason) {}
+};
+
+//********************************************
+// GATT client
+//********************************************
+
+typedef void (*notify_callback)(NimBLERemoteCharacteristic* pChr, uint8_t* pData, size_t length, bool isNotify);
+
+class NimBLERemoteCharacteristic {
+public:
+  explicit NimBLERemoteCharacteristic(NimBLEClient* client) : m_client(client) {}
+  bool canNotify() const { return true; }
+  bool subscribe(bool notifications = true, notify_callback notifyCallback = nullptr, bool response = true);
+  bool unsubscribe(bool response = true);
+  bool writeValue(const uint8_t* data, size_t length, bool response = false);
+  NimBLEUUID getUUID() const { return NimBLEUUID("ffe1"); }
+  uint16_t getHandle() const { return 0x0012; }
+  NimBLEClient* getClient() const { return m_client; }
+
+private:
+  friend class NimBLEClient;
+  NimBLEClient* m_client;
+  notify_callback m_notifyCallback = nullptr;
+};
+
+class NimBLERemoteService {
+public:
+  explicit NimBLERemoteService(NimBLEClient* client) : m_chr(client) {}
+  NimBLERemoteCharacteristic* getCharacteristic(const char* uuid);
+
+private:
+  friend class NimBLEClient;
+  NimBLERemoteCharacteristic m_chr;
+};
+
+// Connection parameters as reported by NimBLEClient::getConnInfo()
+class NimBLEConnInfo {
+public:
+  NimBLEConnInfo(uint16_t interval, uint16_t mtu) : m_interval(interval), m_mtu(mtu) {}
+  uint16_t getConnInterval() const { return m_interval; }
+  uint16_t getMTU() const { return m_mtu; }
+
+private:
+  uint16_t m_interval;
+  uint16_t m_mtu;
+};
+
+class NimBLEClient {
+public:
+  NimBLEClient();
+  ~NimBLEClient();
+
+  void setClientCallbacks(NimBLEClientCallbacks* callbacks, bool deleteCallbacks = true);
+  void setConnectionParams(uint16_t minInterval, uint16_t maxInterval, uint16_t latency, uint16_t timeout);
+  void setConnectTimeout(uint32_t timeoutMs) { m_connectTimeoutMs = timeoutMs; }
+  bool connect(const NimBLEAdvertisedDevice* device, bool deleteAttributes = true);
+  bool connect(const NimBLEAddress& address, bool deleteAttributes = true);
+  bool disconnect(uint8_t reason = 0x13);
+  bool isConnected() const { return m_connected; }
+  NimBLEAddress getPeerAddress() const { return m_peerAddress; }
+  int getRssi() const { return m_peer ? m_peer->rssi() : 0; }
+  NimBLERemoteService* getService(const char* uuid);
+  NimBLEConnInfo getConnInfo() const { return NimBLEConnInfo(m_connInterval, getMTU()); }
+  uint16_t getMTU() const;
+  /** @brief Request a PHY change; the result arrives through onPhyUpdate() two connection events later */
+  bool updatePhy(uint8_t txPhysMask, uint8_t rxPhysMask, uint16_t phyOptions = 0);
+  bool getPhy(uint8_t* txPhy, uint8_t* rxPhy);
+
+  /** @brief Deliver a notification from the peer to the subscribed callback */
+  void simNotify(const uint8_t* data, size_t length);
+  /** @brief Terminate the link from the peer side (e.g. supervision timeout) */
+  void simDrop(int reason = 0x08);
+  SimPeer* simPeer() const { return m_peer; }
+
+private:
+  friend class NimBLERemoteCharacteristic;
+  void linkDown(int reason);
+
+  NimBLEClientCallbacks* m_callbacks = nullptr;
+  bool m_deleteCallbacks = false;
+  uint32_t m_connectTimeoutMs = 30000;
+  uint16_t m_connInterval = 24;
+  uint8_t m_phy = BLE_GAP_LE_PHY_1M;
+  uint32_t m_linkEpoch = 0;
+  bool m_connected = false;
+  NimBLEAddress m_peerAddress;
+  SimPeer* m_peer = nullptr;
+  NimBLERemoteService m_service;
+  uint8_t m_notifyBuffer[512];
+};
+
+//********************************************
+// Scanner and device singleton
+//********************************************
+
+class NimBLEScan {
+public:
+  void setScanCallbacks(NimBLEScanCallbacks* callbacks, bool wantDuplicates = false) { m_callbacks = callbacks; }
+  void setInterval(uint16_t interval) { m_interval = interval; }
+  void setWindow(uint16_t window) { m_window = window; }
+  void setActiveScan(bool active) {}
+  void setFilterPolicy(uint8_t policy) { m_filterPolicy = policy; }
+  bool start(uint32_t duration, bool isContinue = false, bool restart = true);
+  bool stop();
+  bool isScanning() const { return m_scanning; }
+
+private:
+  NimBLEScanCallbacks* m_callbacks = nullptr;
+  uint16_t m_interval = 100;
+  uint16_t m_window = 100;
+  uint8_t m_filterPolicy = BLE_HCI_SCAN_FILT_NO_WL;
+  bool m_scanning = false;
+  uint32_t m_epoch = 0;
+  // Results are never cleared so that advDevice pointers held by the
+  // library stay valid for the lifetime of the simulation.
+  std::deque<NimBLEAdvertisedDevice> m_results;
+};
+
+class NimBLEDevice {
+public:
+  static bool init(const std::string& deviceName) { return true; }
+  static bool isInitialized() { return true; }
+  static bool setPower(int power) { return true; }
+  static bool setMTU(uint16_t mtu) { s_mtu = mtu; return true; }
+  static uint16_t getMTU() { return s_mtu; }
+  static NimBLEScan* getScan() { return &s_scan; }
+  static NimBLEClient* createClient();
+  static bool deleteClient(NimBLEClient* client);
+  static void deleteAllClients();
+  static NimBLEClient* getClientByPeerAddress(const NimBLEAddress& address);
+  static size_t getCreatedClientCount() { return s_clients.size(); }
+  // Filter accept list, as small as the ESP32 controller's
+  static bool whiteListAdd(const NimBLEAddress& address);
+  static bool whiteListRemove(const NimBLEAddress& address);
+  static bool onWhiteList(const NimBLEAddress& address);
+  static size_t getWhiteListCount() { return s_whiteList.size(); }
+
+private:
+  static uint16_t s_mtu;
+  static NimBLEScan s_scan;
+  static std::vector<NimBLEClient*> s_clients;
+  static std::vector<NimBLEAddress> s_whiteList;
+};
+
+#endif // HOST_SHIM_NIMBLE_DEVICE_H
@@ -0,0 +1,9 @@
+/**
+ * @file WiFi.h
+ * @brief Empty stand-in so src/main.cpp compiles in host builds
+ */
+
+#ifndef HOST_SHIM_WIFI_H
+#define HOST_SHIM_WIFI_H
+
+#endif // HOST_SHIM_WIFI_H
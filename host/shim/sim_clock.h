@@ -0,0 +1,50 @@
+/**
+ * @file sim_clock.h
+ * @brief Discrete-event virtual clock used by the host-side shims
+ *
+ * All host builds run on virtual time. Events (notifications, adverts,
+ * link drops) are scheduled at absolute microsecond timestamps and run in
+ * order whenever the clock advances, either explicitly by a simulator main
+ * loop (runNext) or implicitly by library code calling delay().
+ */
+
+#ifndef HOST_SIM_CLOCK_H
+#define HOST_SIM_CLOCK_H
+
+#include <cstdint>
+#include <functional>
+
+namespace sim {
+
+typedef std::function<void()> Event;
+
+/** @brief Current virtual time in microseconds */
+uint64_t nowUs();
+
+/** @brief Schedule an event at an absolute virtual time (clamped to now) */
+void schedule(uint64_t atUs, Event event);
+
+/** @brief Schedule an event relative to the current virtual time */
+void scheduleIn(uint64_t deltaUs, Event event);
+
+/** @brief Advance the clock by deltaUs, running every event that falls due */
+void advance(uint64_t deltaUs);
+
+/** @brief Advance the clock to atUs, running every event that falls due */
+void advanceTo(uint64_t atUs);
+
+/**
+ * @brief Jump to the next pending event and run it
+ * @return false if no event is pending
+ */
+bool runNext();
+
+/** @brief Number of events waiting in the queue */
+size_t pendingEvents();
+
+/** @brief Drop all pending events and rewind the clock to zero */
+void reset();
+
+} // namespace sim
+
+#endif // HOST_SIM_CLOCK_H
@@ -0,0 +1,402 @@
+/**
+ * @file sim_shim.cpp
+ * @brief Implementation of the host-side Arduino/NimBLE shims
+ *
+ * Owns the virtual clock, the peer registry and the fake NimBLE objects.
+ * Everything here is single-threaded: events run on the caller of
+ * advance()/runNext(), which plays the role of both the Arduino loop task
+ * and the NimBLE host task.
+ */
+
+#include <Arduino.h>
+#include <NimBLEDevice.h>
+
+#include <queue>
+#include <random>
+
+HostSerial Serial;
+
+//********************************************
+// Virtual clock
+//********************************************
+
+namespace sim {
+
+namespace {
+
+struct Scheduled {
+  uint64_t atUs;
+  uint64_t seq;
+  Event event;
+};
+
+struct Later {
+  bool operator()(const Scheduled& a, const Scheduled& b) const {
+    return a.atUs != b.atUs ? a.atUs > b.atUs : a.seq > b.seq;
+  }
+};
+
+uint64_t g_nowUs = 0;
+uint64_t g_seq = 0;
+std::priority_queue<Scheduled, std::vector<Scheduled>, Later> g_events;
+
+} // namespace
+
+uint64_t nowUs() { return g_nowUs; }
+
+void schedule(uint64_t atUs, Event event) {
+  if (atUs < g_nowUs) atUs = g_nowUs;
+  g_events.push(Scheduled{ atUs, g_seq++, std::move(event) });
+}
+
+void scheduleIn(uint64_t deltaUs, Event event) {
+  schedule(g_nowUs + deltaUs, std::move(event));
+}
+
+void advanceTo(uint64_t atUs) {
+  while (!g_events.empty() && g_events.top().atUs <= atUs) {
+    Scheduled next = g_events.top();
+    g_events.pop();
+    if (next.atUs > g_nowUs) g_nowUs = next.atUs;
+    next.event();
+  }
+  if (atUs > g_nowUs) g_nowUs = atUs;
+}
+
+void advance(uint64_t deltaUs) { advanceTo(g_nowUs + deltaUs); }
+
+bool runNext() {
+  if (g_events.empty()) return false;
+  Scheduled next = g_events.top();
+  g_events.pop();
+  if (next.atUs > g_nowUs) g_nowUs = next.atUs;
+  next.event();
+  return true;
+}
+
+size_t pendingEvents() { return g_events.size(); }
+
+void reset() {
+  g_events = std::priority_queue<Scheduled, std::vector<Scheduled>, Later>();
+  g_nowUs = 0;
+  g_seq = 0;
+}
+
+} // namespace sim
+
+//********************************************
+// Peer registry
+//********************************************
+
+namespace SimRadio {
+
+namespace {
+std::vector<SimPeer*> g_peers;
+uint32_t g_advIntervalMs = 100;
+std::mt19937 g_rng(0x4A4B);
+}
+
+void addPeer(SimPeer* peer) { g_peers.push_back(peer); }
+
+void removePeer(SimPeer* peer) {
+  g_peers.erase(std::remove(g_peers.begin(), g_peers.end(), peer), g_peers.end());
+}
+
+void clear() { g_peers.clear(); }
+
+SimPeer* findPeer(const std::string& address) {
+  for (SimPeer* peer : g_peers) {
+    if (peer->address() == address) return peer;
+  }
+  return nullptr;
+}
+
+void setAdvertisingIntervalMs(uint32_t ms) { g_advIntervalMs = ms ? ms : 1; }
+
+const std::vector<SimPeer*>& peers() { return g_peers; }
+
+uint32_t nextAdvertDelayUs() {
+  return std::uniform_int_distribution<uint32_t>(0, g_advIntervalMs * 1000)(g_rng);
+}
+
+} // namespace SimRadio
+
+//********************************************
+// Trace hook
+//********************************************
+
+namespace SimTrace {
+
+namespace {
+std::function<void(const Event&)> g_hook;
+}
+
+void setHook(std::function<void(const Event&)> hook) { g_hook = hook; }
+
+void emit(Type type, const std::string& address, uint8_t reg) {
+  if (g_hook) g_hook(Event{ type, address, reg, sim::nowUs() });
+}
+
+} // namespace SimTrace
+
+//********************************************
+// Addresses
+//********************************************
+
+NimBLEAddress::NimBLEAddress(const std::string& addr, uint8_t type) : m_addr(addr), m_type(type) {
+  for (char& c : m_addr) c = (char)tolower((unsigned char)c);
+}
+
+//********************************************
+// GATT client
+//********************************************
+
+bool NimBLERemoteCharacteristic::subscribe(bool notifications, notify_callback notifyCallback, bool response) {
+  if (!m_client->isConnected()) return false;
+  sim::advance(m_client->m_peer->attRoundTripUs());  // CCCD write
+  if (!m_client->isConnected()) return false;
+  m_notifyCallback = notifications ? notifyCallback : nullptr;
+  SimTrace::emit(SimTrace::Subscribed, m_client->m_peerAddress.toString());
+  return true;
+}
+
+bool NimBLERemoteCharacteristic::unsubscribe(bool response) {
+  m_notifyCallback = nullptr;
+  return m_client->isConnected();
+}
+
+bool NimBLERemoteCharacteristic::writeValue(const uint8_t* data, size_t length, bool response) {
+  if (!m_client->isConnected()) return false;
+  SimTrace::emit(SimTrace::Write, m_client->m_peerAddress.toString(), length > 4 ? data[4] : 0);
+  m_client->m_peer->onWrite(data, length);
+  if (response) sim::advance(m_client->m_peer->attRoundTripUs());
+  return true;
+}
+
+NimBLERemoteCharacteristic* NimBLERemoteService::getCharacteristic(const char* uuid) {
+  return std::string(uuid) == "ffe1" ? &m_chr : nullptr;
+}
+
+NimBLEClient::NimBLEClient() : m_service(this) {}
+
+NimBLEClient::~NimBLEClient() {
+  if (m_deleteCallbacks) delete m_callbacks;
+}
+
+void NimBLEClient::setClientCallbacks(NimBLEClientCallbacks* callbacks, bool deleteCallbacks) {
+  if (m_deleteCallbacks && m_callbacks != callbacks) delete m_callbacks;
+  m_callbacks = callbacks;
+  m_deleteCallbacks = deleteCallbacks;
+}
+
+void NimBLEClient::setConnectionParams(uint16_t minInterval, uint16_t maxInterval, uint16_t latency, uint16_t timeout) {
+  m_connInterval = maxInterval;
+}
+
+bool NimBLEClient::connect(const NimBLEAdvertisedDevice* device, bool deleteAttributes) {
+  return device ? connect(device->getAddress(), deleteAttributes) : false;
+}
+
+bool NimBLEClient::connect(const NimBLEAddress& address, bool deleteAttributes) {
+  if (m_connected) return true;
+  m_peerAddress = address;
+  SimTrace::emit(SimTrace::ConnectStart, address.toString());
+  SimPeer* peer = SimRadio::findPeer(address.toString());
+  // The initiator waits for an advertisement until the timeout (direct connects
+  // to a peer that is still rebooting or re-advertising)
+  const uint64_t deadlineUs = sim::nowUs() + (uint64_t)m_connectTimeoutMs * 1000;
+  while (peer && !peer->advertising() && sim::nowUs() + 10000 <= deadlineUs) sim::advance(10000);
+  if (!peer || !peer->advertising()) {
+    // Nothing answers the connection request: the controller gives up at the timeout
+    if (sim::nowUs() < deadlineUs) sim::advance(deadlineUs - sim::nowUs());
+    return false;
+  }
+  uint64_t latency = peer->connectLatencyUs();
+  if (latency > (uint64_t)m_connectTimeoutMs * 1000) latency = (uint64_t)m_connectTimeoutMs * 1000;
+  sim::advance(latency);
+  if (!peer->advertising() || !peer->acceptConnection()) {
+    return false;
+  }
+  m_peer = peer;
+  m_connected = true;
+  m_phy = BLE_GAP_LE_PHY_1M;
+  m_linkEpoch++;
+  m_service.m_chr.m_notifyCallback = nullptr;
+  peer->onConnected(this);
+  SimTrace::emit(SimTrace::LinkUp, address.toString());
+  if (m_callbacks) m_callbacks->onConnect(this);
+  return true;
+}
+
+NimBLERemoteService* NimBLEClient::getService(const char* uuid) {
+  if (!m_connected) return nullptr;
+  sim::advance(m_peer->discoveryLatencyUs());
+  if (!m_connected || std::string(uuid) != "ffe0") return nullptr;
+  return &m_service;
+}
+
+uint16_t NimBLEClient::getMTU() const {
+  // The simulated peers accept whatever MTU the central asks for
+  return m_connected ? NimBLEDevice::getMTU() : 0;
+}
+
+bool NimBLEClient::updatePhy(uint8_t txPhysMask, uint8_t rxPhysMask, uint16_t phyOptions) {
+  if (!m_connected) return false;
+  // The controller picks the fastest PHY both sides allow, falling back to the current one
+  uint8_t allowed = txPhysMask & rxPhysMask & m_peer->supportedPhyMask();
+  uint8_t phy = m_phy;
+  if (allowed & BLE_GAP_LE_PHY_2M_MASK) phy = BLE_GAP_LE_PHY_2M;
+  else if (allowed & BLE_GAP_LE_PHY_1M_MASK) phy = BLE_GAP_LE_PHY_1M;
+  else if (allowed & BLE_GAP_LE_PHY_CODED_MASK) phy = BLE_GAP_LE_PHY_CODED;
+
+  uint32_t epoch = m_linkEpoch;
+  sim::scheduleIn(m_peer->attRoundTripUs(), [this, epoch, phy]() {
+    if (!m_connected || epoch != m_linkEpoch) return;
+    m_phy = phy;
+    m_peer->onPhyChanged(phy);
+    if (m_callbacks) m_callbacks->onPhyUpdate(this, phy, phy);
+  });
+  return true;
+}
+
+bool NimBLEClient::getPhy(uint8_t* txPhy, uint8_t* rxPhy) {
+  if (!m_connected) return false;
+  *txPhy = m_phy;
+  *rxPhy = m_phy;
+  return true;
+}
+
+void NimBLEClient::linkDown(int reason) {
+  if (!m_connected) return;
+  m_connected = false;
+  m_service.m_chr.m_notifyCallback = nullptr;
+  SimPeer* peer = m_peer;
+  m_peer = nullptr;
+  if (peer) peer->onDisconnected();
+  SimTrace::emit(SimTrace::LinkDown, m_peerAddress.toString());
+  if (m_callbacks) m_callbacks->onDisconnect(this, reason);
+}
+
+bool NimBLEClient::disconnect(uint8_t reason) {
+  linkDown(0x216);  // BLE_HS_ERR_HCI_BASE + local host terminated
+  return true;
+}
+
+void NimBLEClient::simDrop(int reason) {
+  linkDown(0x200 + reason);
+}
+
+void NimBLEClient::simNotify(const uint8_t* data, size_t length) {
+  notify_callback cb = m_service.m_chr.m_notifyCallback;
+  if (!m_connected || !cb) return;
+  if (length > sizeof(m_notifyBuffer)) length = sizeof(m_notifyBuffer);
+  memcpy(m_notifyBuffer, data, length);
+  cb(&m_service.m_chr, m_notifyBuffer, length, true);
+}
+
+//********************************************
+// Scanner
+//********************************************
+
+namespace SimRadio {
+const std::vector<SimPeer*>& peers();
+uint32_t nextAdvertDelayUs();
+}
+
+bool NimBLEScan::start(uint32_t duration, bool isContinue, bool restart) {
+  if (m_scanning && !restart) return true;
+  m_scanning = true;
+  SimTrace::emit(SimTrace::ScanStart, "");
+  uint32_t epoch = ++m_epoch;
+  uint64_t endUs = sim::nowUs() + (uint64_t)duration * 1000;
+
+  // With duplicate filtering each advertising peer is reported once per scan,
+  // at the first advert that lands inside the scan window.
+  for (SimPeer* peer : SimRadio::peers()) {
+    // Filtered in the controller: the host never hears about the advert
+    if (m_filterPolicy == BLE_HCI_SCAN_FILT_USE_WL && !NimBLEDevice::onWhiteList(NimBLEAddress(peer->address()))) continue;
+    uint64_t atUs = sim::nowUs() + SimRadio::nextAdvertDelayUs();
+    if (duration && atUs >= endUs) continue;
+    std::string address = peer->address();
+    sim::schedule(atUs, [this, epoch, address]() {
+      if (!m_scanning || epoch != m_epoch) return;
+      SimPeer* p = SimRadio::findPeer(address);
+      if (!p || !p->advertising()) return;
+      m_results.emplace_back(NimBLEAddress(address), p->rssi());
+      SimTrace::emit(SimTrace::ScanResult, address);
+      if (m_callbacks) m_callbacks->onResult(&m_results.back());
+    });
+  }
+  if (duration) {
+    sim::schedule(endUs, [this, epoch]() {
+      if (epoch != m_epoch || !m_scanning) return;
+      m_scanning = false;
+      if (m_callbacks) m_callbacks->onScanEnd(0);
+    });
+  }
+  return true;
+}
+
+bool NimBLEScan::stop() {
+  m_scanning = false;
+  ++m_epoch;
+  return true;
+}
+
+//********************************************
+// Device singleton
+//********************************************
+
+uint16_t NimBLEDevice::s_mtu = 23;
+NimBLEScan NimBLEDevice::s_scan;
+std::vector<NimBLEClient*> NimBLEDevice::s_clients;
+std::vector<NimBLEAddress> NimBLEDevice::s_whiteList;
+
+bool NimBLEDevice::whiteListAdd(const NimBLEAddress& address) {
+  if (onWhiteList(address)) return true;
+  if (s_whiteList.size() >= 12) return false;
+  s_whiteList.push_back(address);
+  return true;
+}
+
+bool NimBLEDevice::whiteListRemove(const NimBLEAddress& address) {
+  for (size_t i = 0; i < s_whiteList.size(); i++) {
+    if (s_whiteList[i] != address) continue;
+    s_whiteList.erase(s_whiteList.begin() + i);
+    return true;
+  }
+  return false;
+}
+
+bool NimBLEDevice::onWhiteList(const NimBLEAddress& address) {
+  for (const NimBLEAddress& a : s_whiteList) {
+    if (a == address) return true;
+  }
+  return false;
+}
+
+NimBLEClient* NimBLEDevice::createClient() {
+  NimBLEClient* client = new NimBLEClient();
+  s_clients.push_back(client);
+  return client;
+}
+
+bool NimBLEDevice::deleteClient(NimBLEClient* client) {
+  auto it = std::find(s_clients.begin(), s_clients.end(), client);
+  if (it == s_clients.end()) return false;
+  s_clients.erase(it);
+  client->disconnect();
+  delete client;
+  return true;
+}
+
+void NimBLEDevice::deleteAllClients() {
+  while (!s_clients.empty()) deleteClient(s_clients.back());
+}
+
+NimBLEClient* NimBLEDevice::getClientByPeerAddress(const NimBLEAddress& address) {
+  for (NimBLEClient* client : s_clients) {
+    if (client->getPeerAddress() == address) return client;
+  }
+  return nullptr;
+}
@@ -0,0 +1,168 @@
+/**
+ * @file frame_builder.cpp
+ * @brief JK02/JK04 frame encoders (see frame_builder.h)
+ */
+
+#include "frame_builder.h"
+
+#include <cstring>
+
+namespace sim {
+
+namespace {
+
+void put16(uint8_t* frame, size_t offset, uint16_t value) {
+  frame[offset] = value & 0xFF;
+  frame[offset + 1] = value >> 8;
+}
+
+void put32(uint8_t* frame, size_t offset, uint32_t value) {
+  frame[offset] = value & 0xFF;
+  frame[offset + 1] = (value >> 8) & 0xFF;
+  frame[offset + 2] = (value >> 16) & 0xFF;
+  frame[offset + 3] = value >> 24;
+}
+
+void putFloat(uint8_t* frame, size_t offset, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  put32(frame, offset, bits);
+}
+
+void putText(uint8_t* frame, size_t offset, size_t width, const std::string& text) {
+  memcpy(frame + offset, text.data(), text.size() < width ? text.size() : width);
+}
+
+void header(uint8_t* frame, uint8_t type, uint8_t counter) {
+  memset(frame, 0, kFrameSize);
+  frame[0] = 0x55;
+  frame[1] = 0xAA;
+  frame[2] = 0xEB;
+  frame[3] = 0x90;
+  frame[4] = type;
+  frame[5] = counter;
+}
+
+} // namespace
+
+uint8_t frameChecksum(const uint8_t* frame, size_t length) {
+  uint8_t sum = 0;
+  for (size_t i = 0; i < length; i++) sum += frame[i];
+  return sum;
+}
+
+void buildCellInfoFrame(const PackState& state, uint8_t counter, uint8_t out[kFrameSize]) {
+  header(out, 0x02, counter);
+
+  uint32_t sum = 0;
+  uint16_t minMv = 0xFFFF, maxMv = 0;
+  for (int i = 0; i < 16; i++) {
+    uint16_t mv = i < state.cellCount ? state.cellMv[i] : 0;
+    put16(out, 6 + i * 2, mv);
+    put16(out, 80 + i * 2, i < state.cellCount ? state.wireResistMohm[i] : 0);
+    if (i < state.cellCount) {
+      sum += mv;
+      if (mv < minMv) minMv = mv;
+      if (mv > maxMv) maxMv = mv;
+    }
+  }
+  uint16_t count = state.cellCount > 0 ? state.cellCount : 1;
+  put16(out, 74, (uint16_t)(sum / count));
+  put16(out, 76, state.cellCount > 0 ? (uint16_t)(maxMv - minMv) : 0);
+
+  put16(out, 144, (uint16_t)state.mosTempDeciC);
+  put32(out, 150, (uint32_t)state.batteryMv);
+  put32(out, 158, (uint32_t)state.currentMa);
+  put16(out, 162, (uint16_t)state.t1DeciC);
+  put16(out, 164, (uint16_t)state.t2DeciC);
+
+  // Balance current is sign-magnitude: high nibble 0xF marks a negative value
+  uint16_t balance = state.balanceCurrentMa >= 0
+                       ? (uint16_t)(state.balanceCurrentMa & 0x0FFF)
+                       : (uint16_t)(0xF000 | ((-state.balanceCurrentMa) & 0x0FFF));
+  put16(out, 170, balance);
+
+  out[172] = state.balancingAction;
+  out[173] = state.socPercent;
+  put32(out, 174, state.capacityRemainMah);
+  put32(out, 178, state.nominalCapacityMah);
+  put32(out, 182, state.cycleCount);
+  put32(out, 186, state.cycleCapacityMah);
+  out[194] = state.uptimeS & 0xFF;
+  out[195] = (state.uptimeS >> 8) & 0xFF;
+  out[196] = (state.uptimeS >> 16) & 0xFF;
+  out[198] = state.charge ? 1 : 0;
+  out[199] = state.discharge ? 1 : 0;
+  out[201] = state.balance ? 1 : 0;
+
+  out[kFrameSize - 1] = frameChecksum(out, kFrameSize - 1);
+}
+
+void buildJk04CellInfoFrame(const PackState& state, uint8_t counter, uint8_t out[kFrameSize]) {
+  header(out, 0x02, counter);
+  for (int i = 0; i < state.cellCount && i < 16; i++) {
+    putFloat(out, 6 + i * 4, state.cellMv[i] * 0.001f);
+    putFloat(out, 106 + i * 4, state.wireResistMohm[i] * 0.001f);
+  }
+  out[220] = state.balancingAction;
+  putFloat(out, 222, state.balanceCurrentMa * 0.001f);
+  out[286] = state.uptimeS & 0xFF;
+  out[287] = (state.uptimeS >> 8) & 0xFF;
+  out[288] = (state.uptimeS >> 16) & 0xFF;
+  out[kFrameSize - 1] = frameChecksum(out, kFrameSize - 1);
+}
+
+void buildSettingsFrame(const PackSettings& s, uint8_t counter, uint8_t out[kFrameSize]) {
+  header(out, 0x01, counter);
+  put32(out, 10, s.cellUvpMv);
+  put32(out, 14, s.cellUvprMv);
+  put32(out, 18, s.cellOvpMv);
+  put32(out, 22, s.cellOvprMv);
+  put32(out, 26, s.balanceTriggerMv);
+  put32(out, 46, s.powerOffMv);
+  put32(out, 50, s.maxChargeMa);
+  put32(out, 54, 30);    // charge OCP delay (s)
+  put32(out, 58, 60);    // charge OCP recovery (s)
+  put32(out, 62, s.maxDischargeMa);
+  put32(out, 66, 300);   // discharge OCP delay (s)
+  put32(out, 70, 60);    // discharge OCP recovery (s)
+  put32(out, 74, 5);     // short circuit recovery (s)
+  put32(out, 78, s.maxBalanceMa);
+  put32(out, 82, s.chargeOtpDeciC);
+  put32(out, 86, s.chargeOtpDeciC - 50);
+  put32(out, 90, s.dischargeOtpDeciC);
+  put32(out, 94, s.dischargeOtpDeciC - 50);
+  put32(out, 98, s.chargeUtpDeciC);
+  put32(out, 102, s.chargeUtpDeciC + 50);
+  put32(out, 106, s.mosOtpDeciC);
+  put32(out, 110, s.mosOtpDeciC - 100);
+  put32(out, 114, s.cellCount);
+  put32(out, 118, 1);
+  put32(out, 122, 1);
+  put32(out, 126, 1);
+  put32(out, 130, s.capacityMah);
+  put32(out, 134, 1500); // short circuit delay (us)
+  put32(out, 138, s.balanceStartMv);
+  out[kFrameSize - 1] = frameChecksum(out, kFrameSize - 1);
+}
+
+void buildDeviceInfoFrame(const std::string& name, const std::string& hwVersion,
+                          const std::string& swVersion, uint32_t uptimeS,
+                          uint8_t counter, uint8_t out[kFrameSize]) {
+  header(out, 0x03, counter);
+  putText(out, 6, 16, "JK_B2A16S");
+  putText(out, 22, 8, hwVersion);
+  putText(out, 30, 8, swVersion);
+  put32(out, 38, uptimeS);
+  put32(out, 42, 7);  // power on count
+  putText(out, 46, 16, name);
+  putText(out, 62, 16, "1234");
+  putText(out, 78, 8, "240101");
+  putText(out, 86, 11, "SIM0000001");
+  putText(out, 97, 5, "0000");
+  putText(out, 102, 16, "host simulator");
+  putText(out, 118, 16, "000000");
+  out[kFrameSize - 1] = frameChecksum(out, kFrameSize - 1);
+}
+
+} // namespace sim
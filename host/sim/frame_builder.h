@@ -0,0 +1,80 @@
+/**
+ * @file frame_builder.h
+ * @brief Encoders for JK02/JK04 notification frames used by the host simulators
+ *
+ * The byte offsets mirror the ones decoded by JKBMS::parseData(),
+ * JKBMS::parseDataJk04(), JKBMS::bms_settings() and JKBMS::parseDeviceInfo(),
+ * so a frame built here and fed through handleNotification() round-trips to
+ * the same values.
+ */
+
+#ifndef HOST_SIM_FRAME_BUILDER_H
+#define HOST_SIM_FRAME_BUILDER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace sim {
+
+static const size_t kFrameSize = 300;
+
+/**
+ * @brief Electrical state of a pack at one instant, in protocol units
+ */
+struct PackState {
+  int cellCount = 16;
+  uint16_t cellMv[16] = { 0 };
+  uint16_t wireResistMohm[16] = { 0 };
+  int32_t batteryMv = 0;
+  int32_t currentMa = 0;           // positive = charging
+  int16_t mosTempDeciC = 0;
+  int16_t t1DeciC = 0;
+  int16_t t2DeciC = 0;
+  int16_t balanceCurrentMa = 0;
+  uint8_t balancingAction = 0;
+  uint8_t socPercent = 0;
+  uint32_t capacityRemainMah = 0;
+  uint32_t nominalCapacityMah = 0;
+  uint32_t cycleCount = 0;
+  uint32_t cycleCapacityMah = 0;
+  uint32_t uptimeS = 0;
+  bool charge = true;
+  bool discharge = true;
+  bool balance = true;
+};
+
+/** @brief Protection settings reported in the 0x01 frame, in protocol units */
+struct PackSettings {
+  uint32_t cellUvpMv = 2600;
+  uint32_t cellUvprMv = 2800;
+  uint32_t cellOvpMv = 3650;
+  uint32_t cellOvprMv = 3450;
+  uint32_t balanceTriggerMv = 10;
+  uint32_t powerOffMv = 2500;
+  uint32_t maxChargeMa = 100000;
+  uint32_t maxDischargeMa = 150000;
+  uint32_t maxBalanceMa = 2000;
+  uint32_t chargeOtpDeciC = 550;
+  uint32_t dischargeOtpDeciC = 650;
+  uint32_t chargeUtpDeciC = 0;
+  uint32_t mosOtpDeciC = 900;
+  uint32_t cellCount = 16;
+  uint32_t capacityMah = 280000;
+  uint32_t balanceStartMv = 3400;
+};
+
+/** @brief Sum-of-bytes checksum over bytes [0, 299) stored in byte 299 */
+uint8_t frameChecksum(const uint8_t* frame, size_t length);
+
+void buildCellInfoFrame(const PackState& state, uint8_t counter, uint8_t out[kFrameSize]);
+/** @brief JK04 cell-info frame: float volts/ohms, balancer fields only */
+void buildJk04CellInfoFrame(const PackState& state, uint8_t counter, uint8_t out[kFrameSize]);
+void buildSettingsFrame(const PackSettings& settings, uint8_t counter, uint8_t out[kFrameSize]);
+void buildDeviceInfoFrame(const std::string& name, const std::string& hwVersion,
+                          const std::string& swVersion, uint32_t uptimeS,
+                          uint8_t counter, uint8_t out[kFrameSize]);
+
+} // namespace sim
+
+#endif // HOST_SIM_FRAME_BUILDER_H
@@ -0,0 +1,291 @@
+/**
+ * @file virtual_bms.cpp
+ * @brief Simulated JK BMS peer (see virtual_bms.h)
+ */
+
+#include "virtual_bms.h"
+
+#include <Arduino.h>
+#include <cmath>
+
+namespace sim {
+
+namespace {
+
+// LiFePO4 open-circuit voltage against state of charge
+const double kOcvSoc[] = { 0.00, 0.05, 0.10, 0.20, 0.30, 0.40, 0.50, 0.60, 0.70, 0.80, 0.90, 0.95, 1.00 };
+const double kOcvVolt[] = { 2.50, 3.00, 3.20, 3.25, 3.28, 3.29, 3.30, 3.31, 3.32, 3.33, 3.35, 3.40, 3.60 };
+
+double ocv(double soc) {
+  const int n = sizeof(kOcvSoc) / sizeof(kOcvSoc[0]);
+  if (soc <= kOcvSoc[0]) return kOcvVolt[0];
+  for (int i = 1; i < n; i++) {
+    if (soc <= kOcvSoc[i]) {
+      double f = (soc - kOcvSoc[i - 1]) / (kOcvSoc[i] - kOcvSoc[i - 1]);
+      return kOcvVolt[i - 1] + f * (kOcvVolt[i] - kOcvVolt[i - 1]);
+    }
+  }
+  return kOcvVolt[n - 1];
+}
+
+double clamp01(double v) { return v < 0 ? 0 : (v > 1 ? 1 : v); }
+
+} // namespace
+
+VirtualBms::VirtualBms(const VirtualBmsConfig& config)
+  : m_config(config), m_rng(config.seed) {
+  std::normal_distribution<double> unit(0.0, 1.0);
+  int cells = m_config.cellCount > 16 ? 16 : m_config.cellCount;
+  m_config.cellCount = cells;
+  for (int i = 0; i < cells; i++) {
+    m_cellCapacityAh.push_back(m_config.capacityAh * (1.0 + m_config.capacitySpread * unit(m_rng)));
+    m_cellSoc.push_back(clamp01(m_config.initialSoc + 0.01 * unit(m_rng)));
+    m_cellDriftPerS.push_back(fabs(m_config.driftPerDay * unit(m_rng)) / 86400.0);
+    m_cellResistanceOhm.push_back(m_config.cellResistanceMohm * 0.001 * (1.0 + 0.1 * unit(m_rng)));
+    m_state.wireResistMohm[i] = (uint16_t)(40 + 10 * fabs(unit(m_rng)));
+  }
+  if (m_config.weakCell >= 0 && m_config.weakCell < cells) {
+    m_cellCapacityAh[m_config.weakCell] *= m_config.weakCapacity;
+    m_cellResistanceOhm[m_config.weakCell] *= m_config.weakResistance;
+  }
+  m_state.cellCount = cells;
+  m_state.nominalCapacityMah = (uint32_t)(m_config.capacityAh * 1000);
+  m_state.uptimeS = 3600 * 24 * (m_config.seed % 90);
+  m_state.cycleCount = m_config.seed % 400;
+  m_settings.cellCount = cells;
+  m_settings.capacityMah = m_state.nominalCapacityMah;
+  m_t1C = m_t2C = m_mosC = m_config.ambientC;
+  m_sink = [](VirtualBms& peer, const uint8_t* data, size_t length, const FragmentInfo&) {
+    peer.deliver(data, length);
+  };
+  stepModel(nowUs());
+}
+
+//********************************************
+// Electrical model
+//********************************************
+
+float VirtualBms::loadCurrentA(double tS) {
+  const float peak = m_config.peakCurrentA;
+  switch (m_config.profile) {
+    case LoadProfile::Idle:
+      return -0.3f;
+    case LoadProfile::Constant:
+      return peak;
+    case LoadProfile::Inverter:
+      if (m_modelUs >= m_nextStepUs) {
+        m_stepCurrentA = std::uniform_real_distribution<float>(-peak, 0.5f * peak)(m_rng);
+        m_nextStepUs = m_modelUs + 30000000ULL;
+      }
+      return m_stepCurrentA;
+    case LoadProfile::Solar:
+    default: {
+      double hour = fmod(m_config.startHour + tS / 3600.0, 24.0);
+      if (hour >= 8.0 && hour < 17.0) return (float)(peak * sin(M_PI * (hour - 8.0) / 9.0));
+      if (hour >= 17.0 && hour < 23.0) return -0.4f * peak;
+      return -0.15f * peak;
+    }
+  }
+}
+
+void VirtualBms::stepModel(uint64_t atUs) {
+  double dt = (atUs - m_modelUs) / 1e6;
+  m_modelUs = atUs;
+  std::normal_distribution<double> noise(0.0, 1.0);
+
+  double current = loadCurrentA(atUs / 1e6) + 0.02 * m_config.peakCurrentA * noise(m_rng);
+  int cells = m_config.cellCount;
+
+  // Constant-voltage taper near full and cut-off near empty, like the BMS would enforce
+  double maxSoc = 0, minSoc = 1;
+  for (int i = 0; i < cells; i++) {
+    maxSoc = std::max(maxSoc, m_cellSoc[i]);
+    minSoc = std::min(minSoc, m_cellSoc[i]);
+  }
+  if (current > 0 && maxSoc > 0.97) current *= std::max(0.0, (1.0 - maxSoc) / 0.03);
+  if (current < 0 && minSoc < 0.05) current *= std::max(0.0, minSoc / 0.05);
+
+  uint32_t sumMv = 0;
+  uint16_t minMv = 0xFFFF, maxMv = 0;
+  for (int i = 0; i < cells; i++) {
+    m_cellSoc[i] = clamp01(m_cellSoc[i] + current * dt / 3600.0 / m_cellCapacityAh[i] - m_cellDriftPerS[i] * dt);
+    double v = ocv(m_cellSoc[i]) + current * m_cellResistanceOhm[i] + 0.0005 * noise(m_rng);
+    uint16_t mv = (uint16_t)lround(v * 1000.0);
+    m_state.cellMv[i] = mv;
+    sumMv += mv;
+    minMv = std::min(minMv, mv);
+    maxMv = std::max(maxMv, mv);
+  }
+
+  // First-order thermal lag towards ambient plus I^2 heating
+  double alpha = dt > 0 ? 1.0 - exp(-dt / 600.0) : 0.0;
+  m_t1C += alpha * (m_config.ambientC + 0.002 * current * current - m_t1C);
+  m_t2C += alpha * (m_config.ambientC + 0.0025 * current * current - m_t2C);
+  m_mosC += alpha * (m_config.ambientC + 0.004 * current * current - m_mosC);
+
+  double avgSoc = 0;
+  for (int i = 0; i < cells; i++) avgSoc += m_cellSoc[i];
+  avgSoc /= cells;
+  if (current > 0) m_cycleAh += current * dt / 3600.0;
+
+  bool balancing = current > 0 && maxMv > 3400 && (uint32_t)(maxMv - minMv) > m_settings.balanceTriggerMv;
+
+  m_state.batteryMv = (int32_t)sumMv;
+  m_state.currentMa = (int32_t)lround(current * 1000.0);
+  m_state.t1DeciC = (int16_t)lround(m_t1C * 10);
+  m_state.t2DeciC = (int16_t)lround(m_t2C * 10);
+  m_state.mosTempDeciC = (int16_t)lround(m_mosC * 10);
+  m_state.balanceCurrentMa = balancing ? 1000 : 0;
+  m_state.balancingAction = balancing ? 1 : 0;
+  m_state.socPercent = (uint8_t)lround(avgSoc * 100);
+  m_state.capacityRemainMah = (uint32_t)(avgSoc * m_config.capacityAh * 1000);
+  m_state.cycleCapacityMah = (uint32_t)(m_cycleAh * 1000);
+  m_state.uptimeS += (uint32_t)dt;
+}
+
+//********************************************
+// SimPeer
+//********************************************
+
+bool VirtualBms::advertising() const {
+  return m_powered && !m_client && nowUs() >= m_advertiseAfterUs;
+}
+
+uint32_t VirtualBms::connectLatencyUs() {
+  // Connection request lands on the next advert, then one connection event to establish
+  return std::uniform_int_distribution<uint32_t>(20000, 100000)(m_rng) + m_config.connIntervalUs;
+}
+
+bool VirtualBms::acceptConnection() {
+  return std::uniform_real_distribution<float>(0, 1)(m_rng) >= m_config.connectFailRate;
+}
+
+uint32_t VirtualBms::discoveryLatencyUs() {
+  // Primary services, characteristics and descriptors: a handful of ATT exchanges
+  return 6 * m_config.connIntervalUs;
+}
+
+uint32_t VirtualBms::attRoundTripUs() {
+  return 2 * m_config.connIntervalUs;
+}
+
+void VirtualBms::onConnected(NimBLEClient* client) {
+  m_client = client;
+  m_phy = BLE_GAP_LE_PHY_1M;
+  m_streaming = false;
+  m_epoch++;
+  m_stats.connects++;
+  scheduleDrop();
+}
+
+void VirtualBms::onDisconnected() {
+  m_client = nullptr;
+  m_streaming = false;
+  m_epoch++;
+  m_advertiseAfterUs = nowUs() + (uint64_t)m_config.readvertiseMs * 1000;
+}
+
+void VirtualBms::onWrite(const uint8_t* data, size_t length) {
+  if (length < 20 || data[0] != 0xAA || data[1] != 0x55 || data[2] != 0x90 || data[3] != 0xEB) return;
+  if (frameChecksum(data, 19) != data[19]) return;
+  m_stats.commandsReceived++;
+
+  uint8_t frame[kFrameSize];
+  uint32_t epoch = m_epoch;
+  switch (data[4]) {
+    case 0x97:
+      buildDeviceInfoFrame("SIM-" + m_config.mac.substr(m_config.mac.size() - 5),
+                           m_config.jk04 ? "3.0" : "11.XW", m_config.jk04 ? "3.3" : "11.26",
+                           m_state.uptimeS, m_counter++, frame);
+      sendFrame(frame);
+      break;
+    case 0x96:
+      buildSettingsFrame(m_settings, m_counter++, frame);
+      sendFrame(frame);
+      if (!m_streaming) {
+        m_streaming = true;
+        scheduleIn((uint64_t)m_config.framePeriodMs * 1000 / 2, [this, epoch]() { streamTick(epoch); });
+      }
+      break;
+    case 0x1D: m_state.charge = data[6] != 0; break;
+    case 0x1E: m_state.discharge = data[6] != 0; break;
+    case 0x1F: m_state.balance = data[6] != 0; break;
+    default: break;
+  }
+}
+
+//********************************************
+// Streaming and link behaviour
+//********************************************
+
+void VirtualBms::streamTick(uint32_t epoch) {
+  if (epoch != m_epoch || !m_client || !m_streaming) return;
+  stepModel(nowUs());
+  uint8_t frame[kFrameSize];
+  if (m_config.jk04) {
+    buildJk04CellInfoFrame(m_state, m_counter++, frame);
+  } else {
+    buildCellInfoFrame(m_state, m_counter++, frame);
+  }
+  sendFrame(frame);
+  scheduleIn((uint64_t)m_config.framePeriodMs * 1000, [this, epoch]() { streamTick(epoch); });
+}
+
+void VirtualBms::sendFrame(const uint8_t* frame) {
+  if (!m_client) return;
+  std::shared_ptr<std::vector<uint8_t>> bytes = std::make_shared<std::vector<uint8_t>>(frame, frame + kFrameSize);
+  const size_t fragment = m_config.fragmentSize ? m_config.fragmentSize : 20;
+  const int count = (int)((kFrameSize + fragment - 1) / fragment);
+  // 2M halves the packet airtime, so twice as many fit in a connection event.
+  // Coded trades airtime for about 12 dB of link margin, modelled as less fragment loss.
+  int perEvent = m_config.packetsPerEvent > 0 ? m_config.packetsPerEvent : 1;
+  if (m_phy == BLE_GAP_LE_PHY_2M) perEvent *= 2;
+  const float loss = m_phy == BLE_GAP_LE_PHY_CODED ? m_config.fragmentLoss / 4 : m_config.fragmentLoss;
+  const uint64_t startUs = nowUs();
+  const uint32_t epoch = m_epoch;
+  m_stats.framesSent++;
+
+  for (int k = 0; k < count; k++) {
+    uint64_t atUs = startUs + (uint64_t)(k / perEvent) * m_config.connIntervalUs;
+    schedule(atUs, [this, bytes, k, count, fragment, startUs, epoch, loss]() {
+      if (epoch != m_epoch || !m_client) return;
+      size_t offset = k * fragment;
+      size_t length = std::min(fragment, bytes->size() - offset);
+      m_stats.fragmentsSent++;
+      m_stats.bytesSent += length;
+      if (std::uniform_real_distribution<float>(0, 1)(m_rng) < loss) {
+        m_stats.fragmentsLost++;
+        return;
+      }
+      FragmentInfo info = { (*bytes)[4], k, count, startUs };
+      m_sink(*this, bytes->data() + offset, length, info);
+    });
+  }
+}
+
+void VirtualBms::deliver(const uint8_t* data, size_t length) {
+  if (m_client) m_client->simNotify(data, length);
+}
+
+void VirtualBms::scheduleDrop() {
+  if (m_config.dropsPerHour <= 0) return;
+  double meanS = 3600.0 / m_config.dropsPerHour;
+  uint64_t afterUs = (uint64_t)(std::exponential_distribution<double>(1.0 / meanS)(m_rng) * 1e6);
+  uint32_t epoch = m_epoch;
+  scheduleIn(afterUs, [this, epoch]() {
+    if (epoch == m_epoch && m_client) forceDrop();
+  });
+}
+
+void VirtualBms::forceDrop(int reason) {
+  if (!m_client) return;
+  m_stats.drops++;
+  m_client->simDrop(reason);  // calls back into onDisconnected()
+}
+
+void VirtualBms::setPowered(bool powered) {
+  m_powered = powered;
+  if (!powered) forceDrop(0x08);
+}
+
+} // namespace sim
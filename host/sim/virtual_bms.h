@@ -0,0 +1,165 @@
+/**
+ * @file virtual_bms.h
+ * @brief Simulated JK BMS peer for the host-side load and latency tools
+ *
+ * A VirtualBms advertises on the virtual radio, accepts connections from the
+ * NimBLE shim, answers the 0x96/0x97 requests written by the library and
+ * then streams JK02 cell-info frames. Frames carry the output of a simple
+ * electrical model (load profile, per-cell capacity spread and drift, I*R
+ * sag, thermal lag) and go out fragmented into MTU-sized notifications, with
+ * optional fragment loss and random link drops.
+ */
+
+#ifndef HOST_SIM_VIRTUAL_BMS_H
+#define HOST_SIM_VIRTUAL_BMS_H
+
+#include <NimBLEDevice.h>
+
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "frame_builder.h"
+
+namespace sim {
+
+enum class LoadProfile {
+  Idle,      // small parasitic discharge
+  Constant,  // constant charge at peakCurrentA
+  Solar,     // daily PV charge bell, evening and night discharge
+  Inverter   // random load steps every 30 s
+};
+
+struct VirtualBmsConfig {
+  std::string mac;
+  uint32_t seed = 1;
+
+  // Electrical behaviour
+  int cellCount = 16;
+  float capacityAh = 280.0f;
+  float capacitySpread = 0.02f;         // relative per-cell capacity spread (1 sigma)
+  float initialSoc = 0.6f;
+  float driftPerDay = 0.002f;           // per-cell self-discharge mismatch, SoC fraction/day (1 sigma)
+  float cellResistanceMohm = 0.25f;
+  int weakCell = -1;                    // cell with reduced capacity and raised resistance, -1 for none
+  float weakCapacity = 0.8f;            // relative to the pack's cells
+  float weakResistance = 4.0f;
+  LoadProfile profile = LoadProfile::Solar;
+  float peakCurrentA = 60.0f;
+  float ambientC = 25.0f;
+  float startHour = 10.0f;              // time of day at simulation start
+  bool jk04 = false;                    // speak the legacy JK04 float layout
+
+  // Link behaviour
+  uint32_t framePeriodMs = 1000;        // cell-info period while streaming
+  uint16_t fragmentSize = 128;          // payload bytes per notification
+  uint32_t connIntervalUs = 30000;
+  int packetsPerEvent = 1;              // notifications per connection event
+  float fragmentLoss = 0.0f;            // probability a notification is lost
+  float dropsPerHour = 0.0f;            // mean rate of peer-side link drops
+  float connectFailRate = 0.0f;
+  uint32_t readvertiseMs = 1000;        // silence after a drop before advertising again
+  uint8_t phyMask = BLE_GAP_LE_PHY_1M_MASK;  // PHYs accepted in a PHY update
+  int rssi = -65;
+};
+
+struct FragmentInfo {
+  uint8_t frameType;
+  int index;
+  int count;
+  uint64_t frameStartUs;                // virtual time the first fragment left the peer
+};
+
+struct VirtualBmsStats {
+  uint64_t framesSent = 0;
+  uint64_t fragmentsSent = 0;
+  uint64_t fragmentsLost = 0;
+  uint64_t bytesSent = 0;
+  uint64_t commandsReceived = 0;
+  uint64_t connects = 0;
+  uint64_t drops = 0;
+};
+
+class VirtualBms : public SimPeer {
+public:
+  typedef std::function<void(VirtualBms& peer, const uint8_t* data, size_t length, const FragmentInfo& info)> FragmentSink;
+
+  explicit VirtualBms(const VirtualBmsConfig& config);
+
+  // SimPeer
+  std::string address() const override { return m_config.mac; }
+  int rssi() const override { return m_config.rssi; }
+  bool advertising() const override;
+  uint32_t connectLatencyUs() override;
+  bool acceptConnection() override;
+  uint32_t discoveryLatencyUs() override;
+  uint32_t attRoundTripUs() override;
+  void onConnected(NimBLEClient* client) override;
+  void onDisconnected() override;
+  void onWrite(const uint8_t* data, size_t length) override;
+  uint8_t supportedPhyMask() const override { return m_config.phyMask; }
+  void onPhyChanged(uint8_t phy) override { m_phy = phy; }
+
+  /**
+   * @brief Route outgoing fragments through a custom sink
+   *
+   * The default sink hands each fragment to NimBLEClient::simNotify().
+   * Simulators install their own sink to time the library call.
+   */
+  void setFragmentSink(FragmentSink sink) { m_sink = sink; }
+  void deliver(const uint8_t* data, size_t length);
+
+  /** @brief Drop the link from the peer side right now */
+  void forceDrop(int reason = 0x08);
+  /** @brief Power the BMS off (stops advertising) or back on */
+  void setPowered(bool powered);
+  /** @brief Keep the link up but stop sending frames until the next 0x96 request */
+  void stall() { m_streaming = false; m_epoch++; }
+
+  NimBLEClient* client() const { return m_client; }
+  bool streaming() const { return m_streaming; }
+  uint8_t phy() const { return m_phy; }
+  const VirtualBmsConfig& config() const { return m_config; }
+  VirtualBmsConfig& config() { return m_config; }
+  const VirtualBmsStats& stats() const { return m_stats; }
+  const PackState& state() const { return m_state; }
+
+private:
+  void stepModel(uint64_t atUs);
+  float loadCurrentA(double tS);
+  void sendFrame(const uint8_t* frame);
+  void streamTick(uint32_t epoch);
+  void scheduleDrop();
+
+  VirtualBmsConfig m_config;
+  std::mt19937 m_rng;
+  FragmentSink m_sink;
+  VirtualBmsStats m_stats;
+
+  NimBLEClient* m_client = nullptr;
+  uint32_t m_epoch = 0;
+  bool m_powered = true;
+  bool m_streaming = false;
+  uint64_t m_advertiseAfterUs = 0;
+  uint8_t m_counter = 0;
+  uint8_t m_phy = BLE_GAP_LE_PHY_1M;
+
+  // Electrical model
+  PackState m_state;
+  PackSettings m_settings;
+  std::vector<double> m_cellSoc;
+  std::vector<double> m_cellCapacityAh;
+  std::vector<double> m_cellDriftPerS;
+  std::vector<double> m_cellResistanceOhm;
+  double m_t1C, m_t2C, m_mosC;
+  double m_cycleAh = 0;
+  uint64_t m_modelUs = 0;
+  float m_stepCurrentA = 0;
+  uint64_t m_nextStepUs = 0;
+};
+
+} // namespace sim
+
+#endif // HOST_SIM_VIRTUAL_BMS_H
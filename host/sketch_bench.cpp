@@ -0,0 +1,241 @@
+/**
+ * @file sketch_bench.cpp
+ * @brief Accuracy, size and merge cost of the quantile sketches against exact percentiles
+ *
+ * Reads one or more snapshot streams (fleet_sim --snapshot-file, gateway
+ * flash logs, UDP captures saved back to back) and builds, per pack, the
+ * sketches of quantile_sketch.h the gateway keeps. The packs are then
+ * spread over --gateways gateways; each gateway merges its packs, the
+ * sketches go through sketchSeal()/sketchView() as they would on the wire,
+ * and the fleet is the merge of the gateways. Every sample is also kept and
+ * sorted for the exact percentiles.
+ *
+ * Per metric the report gives the exact and sketched percentiles, their
+ * error, the bytes either needs and the merge time, and checks that merging
+ * pack by pack and gateway by gateway gives the same fleet sketch.
+ *
+ * Usage:
+ *   sketch_bench FILE... [--gateways 4] [--quantiles 0.01,0.05,0.5,0.95,0.99]
+ */
+
+#include "../src/libs/JKBMS.h"
+#include "../src/libs/quantile_sketch.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+JKBMS jkBmsDevices[1];
+const int bmsDeviceCount = 0;
+
+namespace {
+
+struct Options {
+  std::vector<const char*> paths;
+  int gateways = 4;
+  std::vector<float> quantiles = { 0.01f, 0.05f, 0.5f, 0.95f, 0.99f };
+};
+
+struct Pack {
+  JkSketch sketch[SKETCH_METRIC_COUNT];
+};
+
+struct Mapping {
+  const uint8_t* data;
+  size_t size;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+uint64_t macKey(const uint8_t* mac) {
+  uint64_t k = 0;
+  for (int i = 0; i < 6; i++) k = (k << 8) | mac[i];
+  return k;
+}
+
+bool mapFile(const char* path, Mapping& m) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(path);
+    if (fd >= 0) close(fd);
+    return false;
+  }
+  m.size = (size_t)st.st_size;
+  m.data = nullptr;
+  if (m.size) {
+    void* p = mmap(nullptr, m.size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      perror("mmap");
+      close(fd);
+      return false;
+    }
+    m.data = (const uint8_t*)p;
+  }
+  close(fd);
+  return true;
+}
+
+// The same values sketchAddSnapshot() takes, for the exact percentiles
+void addExact(std::vector<int32_t>* exact, const JkSnapshot& snap) {
+  const int cells = snap.header.cellCount < JKBMS_SNAPSHOT_CELLS ? snap.header.cellCount : JKBMS_SNAPSHOT_CELLS;
+  for (int c = 0; c < cells; c++) {
+    if (snap.cellMv[c]) exact[SKETCH_CELL_MV].push_back(snap.cellMv[c]);
+  }
+  exact[SKETCH_CURRENT_MA].push_back(snap.currentMa);
+  exact[SKETCH_TEMP_DECIC].push_back(snap.t1DeciC);
+  if (snap.t2DeciC != 0) exact[SKETCH_TEMP_DECIC].push_back(snap.t2DeciC);
+}
+
+// Records back to back, as in snapshot_dump; resynchronise on the magic
+size_t collect(const Mapping& m, std::map<uint64_t, Pack>& packs, std::vector<int32_t>* exact, size_t& invalid) {
+  size_t count = 0, offset = 0;
+  while (offset + sizeof(JkSnapshot) <= m.size) {
+    const JkSnapshot* snap = snapshotView(m.data + offset, m.size - offset);
+    if (!snap) {
+      invalid++;
+      offset++;
+      while (offset + 4 <= m.size) {
+        uint32_t magic;
+        memcpy(&magic, m.data + offset, sizeof(magic));
+        if (magic == JKBMS_SNAPSHOT_MAGIC) break;
+        offset++;
+      }
+      continue;
+    }
+    const uint64_t key = macKey(snap->header.mac);
+    auto it = packs.find(key);
+    if (it == packs.end()) {
+      it = packs.emplace(key, Pack()).first;
+      for (int s = 0; s < SKETCH_METRIC_COUNT; s++) sketchInit(it->second.sketch[s], (SketchMetric)s, snap->header.mac);
+    }
+    sketchAddSnapshot(it->second.sketch, *snap);
+    addExact(exact, *snap);
+    count++;
+    offset += snap->header.size;
+  }
+  return count;
+}
+
+// Nearest rank, as sketchQuantile() counts
+int32_t exactQuantile(const std::vector<int32_t>& sorted, float q) {
+  if (sorted.empty()) return 0;
+  const size_t rank = (size_t)(q * (double)(sorted.size() - 1));
+  return sorted[rank];
+}
+
+bool parseQuantiles(const char* text, std::vector<float>& out) {
+  out.clear();
+  for (const char* p = text; *p;) {
+    char* end;
+    const float q = strtof(p, &end);
+    if (end == p || q < 0 || q > 1) return false;
+    out.push_back(q);
+    p = *end == ',' ? end + 1 : end;
+  }
+  return !out.empty();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--gateways" && i + 1 < argc) opt.gateways = atoi(argv[++i]);
+    else if (arg == "--quantiles" && i + 1 < argc && parseQuantiles(argv[++i], opt.quantiles)) continue;
+    else if (arg[0] != '-') opt.paths.push_back(argv[i]);
+    else {
+      fprintf(stderr, "usage: sketch_bench FILE... [--gateways G] [--quantiles Q,Q,...]\n");
+      return 2;
+    }
+  }
+  if (opt.paths.empty() || opt.gateways < 1) {
+    fprintf(stderr, "usage: sketch_bench FILE... [--gateways G] [--quantiles Q,Q,...]\n");
+    return 2;
+  }
+
+  std::vector<Mapping> maps;
+  std::map<uint64_t, Pack> packs;
+  std::vector<int32_t> exact[SKETCH_METRIC_COUNT];
+  size_t records = 0, invalid = 0;
+  for (const char* path : opt.paths) {
+    Mapping m;
+    if (!mapFile(path, m)) return 1;
+    maps.push_back(m);
+    records += collect(m, packs, exact, invalid);
+  }
+  if (packs.empty()) {
+    fprintf(stderr, "no valid snapshots\n");
+    return 1;
+  }
+  const int gateways = std::min<int>(opt.gateways, (int)packs.size());
+  printf("JKBMS quantile sketches: %zu records (%zu invalid), %zu packs over %d gateways, %d bins, %zu bytes per sketch\n",
+         records, invalid, packs.size(), gateways, JKBMS_SKETCH_BINS, sizeof(JkSketch));
+
+  bool consistent = true;
+  for (int s = 0; s < SKETCH_METRIC_COUNT; s++) {
+    const SketchMetric metric = (SketchMetric)s;
+
+    // Gateways merge their packs and send sealed records
+    std::vector<JkSketch> wire(gateways);
+    for (JkSketch& g : wire) sketchInit(g, metric);
+    Clock::time_point t0 = Clock::now();
+    int p = 0;
+    for (auto& kv : packs) sketchMerge(wire[p++ % gateways], kv.second.sketch[s]);
+    for (JkSketch& g : wire) sketchSeal(g);
+    const double gatewayUs = std::chrono::duration<double, std::micro>(Clock::now() - t0).count();
+
+    JkSketch fleet;
+    sketchInit(fleet, metric);
+    t0 = Clock::now();
+    for (const JkSketch& g : wire) {
+      const JkSketch* view = sketchView(&g, sizeof(g));
+      if (!view || !sketchMerge(fleet, *view)) consistent = false;
+    }
+    const double fleetUs = std::chrono::duration<double, std::micro>(Clock::now() - t0).count();
+
+    // Same fleet merged pack by pack
+    JkSketch direct;
+    sketchInit(direct, metric);
+    for (auto& kv : packs) sketchMerge(direct, kv.second.sketch[s]);
+
+    std::vector<int32_t>& values = exact[s];
+    t0 = Clock::now();
+    std::sort(values.begin(), values.end());
+    const double sortUs = std::chrono::duration<double, std::micro>(Clock::now() - t0).count();
+
+    printf("\n%s: %zu samples, exact %zu KB (sort %.0f us), sketches %zu KB per fleet merge, %.1f KB on the wire "
+           "(merge %.0f us per gateway, %.0f us fleet)\n",
+           sketchMetricName(metric), values.size(), values.size() * sizeof(int32_t) / 1024,
+           sortUs, packs.size() * sizeof(JkSketch) / 1024, gateways * sizeof(JkSketch) / 1024.0,
+           gatewayUs / gateways, fleetUs);
+    printf("  %9s %10s %10s %8s %8s %9s\n", "quantile", "exact", "sketch", "error", "rel %", "per pack");
+    for (float q : opt.quantiles) {
+      const int32_t e = exactQuantile(values, q);
+      const int32_t v = sketchQuantile(fleet, q);
+      const int32_t d = sketchQuantile(direct, q);
+      if (d != v) consistent = false;
+      const double rel = e ? 100.0 * std::fabs((double)v - e) / std::fabs((double)e) : 0;
+      printf("  %9.3f %10d %10d %8d %8.2f %9s\n", q, e, v, v - e, rel, d == v ? "same" : "DIFFERS");
+    }
+    printf("  count %llu  min %d  max %d  mean %.1f\n", (unsigned long long)fleet.count, fleet.min, fleet.max,
+           fleet.count ? (double)fleet.sum / fleet.count : 0.0);
+  }
+  printf("\nmerge order: %s\n", consistent ? "gateway and pack merges agree" : "MISMATCH");
+
+  for (const Mapping& m : maps) {
+    if (m.data) munmap((void*)m.data, m.size);
+  }
+  return consistent ? 0 : 1;
+}
@@ -0,0 +1,157 @@
+/**
+ * @file snapshot_dump.cpp
+ * @brief Print flat BMS snapshots from a file, read in place
+ *
+ * Accepts either a snapshot ring image (a PSRAM dump or a shared-memory
+ * segment copied to disk, see snapshot.h) or a plain sequence of snapshots
+ * (fleet_sim --snapshot-file, UDP captures saved back to back, flash logs).
+ * The file is mapped read-only and every record is validated and printed
+ * straight from the mapping; nothing is decoded into another structure.
+ *
+ * Usage:
+ *   snapshot_dump FILE [--cells] [--csv]
+ */
+
+#include "../src/libs/snapshot.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+namespace {
+
+struct Options {
+  const char* path = nullptr;
+  bool cells = false;
+  bool csv = false;
+};
+
+void printSnapshot(const JkSnapshot& s, const Options& opt) {
+  const JkSnapshotHeader& h = s.header;
+  char mac[18];
+  snprintf(mac, sizeof(mac), "%02x:%02x:%02x:%02x:%02x:%02x", h.mac[0], h.mac[1], h.mac[2], h.mac[3], h.mac[4], h.mac[5]);
+  if (opt.csv) {
+    printf("%s,%u,%u,%d,%.3f,%.3f,%.1f,%u,%.1f,%.1f,%.1f,%u,%u,%u", mac, h.sequence, h.timestampMs, h.protocol,
+           s.batteryMv / 1000.0, s.currentMa / 1000.0, s.powerDw / 10.0, s.soc, s.t1DeciC / 10.0,
+           s.t2DeciC / 10.0, s.mosDeciC / 10.0, s.deltaCellMv, h.cellCount, h.flags);
+    if (opt.cells) {
+      for (int i = 0; i < h.cellCount && i < JKBMS_SNAPSHOT_CELLS; i++) printf(",%u", s.cellMv[i]);
+    }
+    printf("\n");
+    return;
+  }
+  printf("%s #%-8u t=%10u ms  %7.3f V %8.3f A %8.1f W  SOC %3u%%  T1 %5.1f T2 %5.1f MOS %5.1f  dV %3u mV  %2u cells%s%s%s\n",
+         mac, h.sequence, h.timestampMs, s.batteryMv / 1000.0, s.currentMa / 1000.0, s.powerDw / 10.0, s.soc,
+         s.t1DeciC / 10.0, s.t2DeciC / 10.0, s.mosDeciC / 10.0, s.deltaCellMv, h.cellCount,
+         h.flags & SNAPSHOT_CHARGE ? " CHG" : "", h.flags & SNAPSHOT_DISCHARGE ? " DSG" : "",
+         h.flags & SNAPSHOT_BALANCE ? " BAL" : "");
+  if (opt.cells) {
+    for (int i = 0; i < h.cellCount && i < JKBMS_SNAPSHOT_CELLS; i++) {
+      printf("%s%4u mV/%3u mOhm", i % 6 ? "  " : "\n    ", s.cellMv[i], s.cellResistMohm[i]);
+    }
+    printf("\n");
+  }
+}
+
+// Ring image: walk the slots still held, oldest first
+size_t dumpRing(const uint8_t* data, size_t size, const Options& opt, size_t& invalid) {
+  const SnapshotRingHeader* ring = (const SnapshotRingHeader*)data;
+  uint32_t head = ring->head;
+  uint32_t first = head > ring->slotCount ? head - ring->slotCount : 0;
+  size_t count = 0;
+  for (uint32_t i = first; i < head; i++) {
+    const SnapshotRingSlot* slot = snapshotRingSlot(ring, i);
+    const JkSnapshot* snap = snapshotView((const void*)&slot->snapshot, ring->slotSize - sizeof(slot->sequence));
+    // A dump is not written concurrently; a slot still marked odd was torn by the copy
+    if (!snap || slot->sequence != i * 2 + 2) {
+      invalid++;
+      continue;
+    }
+    printSnapshot(*snap, opt);
+    count++;
+  }
+  return count;
+}
+
+// Records back to back; resynchronise on the magic after a corrupted record
+size_t dumpStream(const uint8_t* data, size_t size, const Options& opt, size_t& invalid) {
+  size_t count = 0;
+  size_t offset = 0;
+  while (offset + sizeof(JkSnapshot) <= size) {
+    const JkSnapshot* snap = snapshotView(data + offset, size - offset);
+    if (!snap) {
+      invalid++;
+      offset++;
+      while (offset + 4 <= size) {
+        uint32_t magic;
+        memcpy(&magic, data + offset, sizeof(magic));
+        if (magic == JKBMS_SNAPSHOT_MAGIC) break;
+        offset++;
+      }
+      continue;
+    }
+    printSnapshot(*snap, opt);
+    count++;
+    offset += snap->header.size;
+  }
+  return count;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--cells") opt.cells = true;
+    else if (arg == "--csv") opt.csv = true;
+    else if (!opt.path && arg[0] != '-') opt.path = argv[i];
+    else {
+      fprintf(stderr, "usage: snapshot_dump FILE [--cells] [--csv]\n");
+      return 2;
+    }
+  }
+  if (!opt.path) {
+    fprintf(stderr, "usage: snapshot_dump FILE [--cells] [--csv]\n");
+    return 2;
+  }
+
+  int fd = open(opt.path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(opt.path);
+    return 1;
+  }
+  size_t size = (size_t)st.st_size;
+  if (size == 0) {
+    close(fd);
+    return 0;
+  }
+  const uint8_t* data = (const uint8_t*)mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+
+  if (opt.csv) {
+    printf("mac,sequence,timestamp_ms,protocol,voltage_v,current_a,power_w,soc,t1_c,t2_c,mos_c,delta_mv,cells,flags");
+    if (opt.cells) {
+      for (int i = 0; i < JKBMS_SNAPSHOT_CELLS; i++) printf(",cell%02d_mv", i + 1);
+    }
+    printf("\n");
+  }
+
+  size_t invalid = 0;
+  bool ring = snapshotRingValid(data, size);
+  size_t count = ring ? dumpRing(data, size, opt, invalid) : dumpStream(data, size, opt, invalid);
+  fprintf(stderr, "%zu snapshots (%s, format v%d, %zu bytes each), %zu invalid\n", count, ring ? "ring" : "stream",
+          JKBMS_SNAPSHOT_VERSION, sizeof(JkSnapshot), invalid);
+  munmap((void*)data, size);
+  return invalid && !count ? 1 : 0;
+}
@@ -0,0 +1,219 @@
+/**
+ * @file usb_capture.cpp
+ * @brief Receive the gateway's USB capture stream and write capture files
+ *
+ * Reads the COBS-framed records of usb_stream.h from the gateway's native
+ * USB port (/dev/ttyACM0 on Linux, put in raw mode here), from a file
+ * (fleet_sim --usb-stream, a port dumped with cat) or from stdin, and
+ * validates every record: COBS, version, length and CRC. Anything between
+ * two 0x00 delimiters that does not validate is counted and skipped, so a
+ * capture may start mid-record.
+ *
+ * --out writes the decoded records back to back (header, payload, CRC);
+ * streamRecordView() reads them in place. --snapshots writes the snapshot
+ * payloads back to back, the format snapshot_dump, window_bench and the
+ * other snapshot tools read.
+ *
+ * Reports records per type and per device, the rate over the capture, the
+ * invalid frames and the records the gateway dropped (gaps in the sequence).
+ * Stops at the end of a file, after --duration-s or on Ctrl-C.
+ *
+ * Usage:
+ *   usb_capture (DEVICE|FILE|-) [--out capture.bin] [--snapshots snaps.bin]
+ *               [--duration-s 0]
+ */
+
+#include "../src/libs/JKBMS.h"
+#include "../src/libs/snapshot.h"
+#include "../src/libs/usb_stream.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+JKBMS jkBmsDevices[1];
+const int bmsDeviceCount = 0;
+
+namespace {
+
+struct Options {
+  const char* path = nullptr;
+  const char* out = nullptr;
+  const char* snapshots = nullptr;
+  uint32_t durationS = 0;
+};
+
+struct Counts {
+  uint64_t records = 0;
+  uint64_t perType[4] = {};
+  std::map<uint16_t, uint64_t> perDevice;
+  uint64_t invalid = 0;         // not COBS, too long, wrong version or CRC
+  uint64_t bytes = 0;           // encoded bytes read
+  uint64_t payloadBytes = 0;
+  bool haveSequence = false;
+  uint32_t firstSequence = 0;
+  uint32_t lastSequence = 0;    // highest seen, in serial number order
+  bool haveTime = false;
+  uint32_t firstUs = 0;
+  uint32_t lastUs = 0;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+volatile sig_atomic_t stopRequested = 0;
+
+void onSignal(int) {
+  stopRequested = 1;
+}
+
+const char* usage = "usage: usb_capture (DEVICE|FILE|-) [--out PATH] [--snapshots PATH] [--duration-s N]\n";
+
+bool openInput(const char* path, int& fd) {
+  fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY | O_NOCTTY);
+  if (fd < 0) {
+    perror(path);
+    return false;
+  }
+  if (!isatty(fd)) return true;
+  // Raw bytes, and a read returns after 100 ms without data so --duration-s and Ctrl-C work
+  struct termios tio;
+  if (tcgetattr(fd, &tio) != 0) {
+    perror("tcgetattr");
+    return false;
+  }
+  cfmakeraw(&tio);
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 1;
+  if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+    perror("tcsetattr");
+    return false;
+  }
+  tcflush(fd, TCIFLUSH);
+  return true;
+}
+
+void record(const StreamRecordHeader& h, const uint8_t* decoded, size_t size, Counts& c, FILE* out, FILE* snaps) {
+  c.records++;
+  if (h.type < 4) c.perType[h.type]++;
+  c.perDevice[h.device]++;
+  c.payloadBytes += h.length;
+  if (!c.haveSequence) {
+    c.haveSequence = true;
+    c.firstSequence = c.lastSequence = h.sequence;
+  } else if ((int32_t)(h.sequence - c.lastSequence) > 0) {
+    c.lastSequence = h.sequence;
+  }
+  if (!c.haveTime) {
+    c.haveTime = true;
+    c.firstUs = h.timestampUs;
+  }
+  c.lastUs = h.timestampUs;
+  if (out) fwrite(decoded, 1, size, out);
+  if (snaps && h.type == STREAM_SNAPSHOT) {
+    const uint8_t* payload = decoded + sizeof(StreamRecordHeader);
+    if (snapshotView(payload, h.length)) fwrite(payload, 1, h.length, snaps);
+  }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (arg == "--out" && value) opt.out = argv[++i];
+    else if (arg == "--snapshots" && value) opt.snapshots = argv[++i];
+    else if (arg == "--duration-s" && value) opt.durationS = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    else if (!opt.path && (arg == "-" || arg[0] != '-')) opt.path = argv[i];
+    else {
+      fprintf(stderr, "%s", usage);
+      return 2;
+    }
+  }
+  if (!opt.path) {
+    fprintf(stderr, "%s", usage);
+    return 2;
+  }
+
+  int fd;
+  if (!openInput(opt.path, fd)) return 1;
+  FILE* out = opt.out ? fopen(opt.out, "wb") : nullptr;
+  FILE* snaps = opt.snapshots ? fopen(opt.snapshots, "wb") : nullptr;
+  if ((opt.out && !out) || (opt.snapshots && !snaps)) {
+    perror(opt.out && !out ? opt.out : opt.snapshots);
+    return 1;
+  }
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  // Longest valid frame between delimiters; anything longer is garbage
+  const size_t maxEncoded = streamEncodedMax(JKBMS_STREAM_MAX_PAYLOAD);
+  std::vector<uint8_t> frame(maxEncoded), decoded(maxEncoded);
+  size_t frameLength = 0;
+  bool overflow = false;
+  Counts c;
+  uint8_t buffer[16384];
+  const Clock::time_point start = Clock::now();
+  while (!stopRequested) {
+    if (opt.durationS && Clock::now() - start >= std::chrono::seconds(opt.durationS)) break;
+    const ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      perror("read");
+      break;
+    }
+    if (n == 0) {
+      if (isatty(fd)) continue;
+      break;
+    }
+    c.bytes += n;
+    for (ssize_t k = 0; k < n; k++) {
+      const uint8_t b = buffer[k];
+      if (b) {
+        if (frameLength < maxEncoded) frame[frameLength++] = b;
+        else overflow = true;
+        continue;
+      }
+      if (!frameLength) continue;
+      const size_t size = overflow ? 0 : cobsDecode(frame.data(), frameLength, decoded.data());
+      const StreamRecordHeader* h = size ? streamRecordView(decoded.data(), size) : nullptr;
+      if (h && streamRecordBytes(h->length) == size) record(*h, decoded.data(), size, c, out, snaps);
+      else c.invalid++;
+      frameLength = 0;
+      overflow = false;
+    }
+  }
+  // A partial record at the end of a file or a stopped capture
+  if (frameLength) c.invalid++;
+  const double wallS = std::chrono::duration<double>(Clock::now() - start).count();
+  if (fd != STDIN_FILENO) close(fd);
+  if (out) fclose(out);
+  if (snaps) fclose(snaps);
+
+  const uint64_t expected = c.haveSequence ? (uint64_t)(c.lastSequence - c.firstSequence) + 1 : 0;
+  const uint64_t dropped = expected > c.records ? expected - c.records : 0;
+  const double spanS = c.haveTime ? (uint32_t)(c.lastUs - c.firstUs) / 1e6 : 0;
+  printf("JKBMS USB capture: %s, %llu bytes in %.1f s\n\n", opt.path, (unsigned long long)c.bytes, wallS);
+  printf("  records        %llu (%llu notifications, %llu frames, %llu snapshots)\n", (unsigned long long)c.records,
+         (unsigned long long)c.perType[STREAM_NOTIFICATION], (unsigned long long)c.perType[STREAM_FRAME],
+         (unsigned long long)c.perType[STREAM_SNAPSHOT]);
+  printf("  gateway time   %.3f s, %.0f records/s, %.1f KB/s on the wire\n", spanS,
+         spanS > 0 ? c.records / spanS : 0.0, spanS > 0 ? c.bytes / 1024.0 / spanS : 0.0);
+  printf("  overhead       %.1f%% over the payloads (header, CRC, COBS, delimiter)\n",
+         c.payloadBytes ? 100.0 * (c.bytes - c.payloadBytes) / c.payloadBytes : 0.0);
+  printf("  dropped        %llu of %llu sequence numbers (%.3f%%)\n", (unsigned long long)dropped,
+         (unsigned long long)expected, expected ? 100.0 * dropped / expected : 0.0);
+  printf("  invalid        %llu frames\n", (unsigned long long)c.invalid);
+  printf("\n  device   records\n");
+  for (const auto& kv : c.perDevice) printf("  %6u  %8llu\n", kv.first, (unsigned long long)kv.second);
+  return 0;
+}
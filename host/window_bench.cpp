@@ -0,0 +1,248 @@
+/**
+ * @file window_bench.cpp
+ * @brief Sliding-window aggregates against scans of buffered samples
+ *
+ * Reads one or more snapshot streams (fleet_sim --snapshot-file, gateway
+ * flash logs, UDP captures saved back to back) in order and feeds every
+ * record, per pack, to the windows of window_stats.h the gateway keeps:
+ *   cell_max  60 s    current  300 s    temp_max  600 s    voltage  60 s
+ * Every --refresh-ms of trace time a dashboard refresh reads every window of
+ * every pack, as alarms and dashboards do, and the same aggregates are
+ * recomputed by scanning a buffer of the samples, as application code does
+ * without the windows. Both use the same slotted window edge, so they must
+ * agree exactly; the samples a strict [now - window, now] edge would keep
+ * are counted too, to show what the slot resolution costs.
+ *
+ * Reports the cost per update and per read against the scan, the memory
+ * of both, and any mismatch (exit code 1).
+ *
+ * Usage:
+ *   window_bench FILE... [--refresh-ms 1000]
+ */
+
+#include "../src/libs/JKBMS.h"
+#include "../src/libs/window_stats.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+JKBMS jkBmsDevices[1];
+const int bmsDeviceCount = 0;
+
+namespace {
+
+struct Options {
+  std::vector<const char*> paths;
+  uint32_t refreshMs = 1000;
+};
+
+struct Bench {
+  const char* name;
+  WindowField field;
+  uint32_t windowMs;
+};
+
+const Bench benches[] = {
+  { "cell_max", WINDOW_CELL_MAX, 60000 },
+  { "current", WINDOW_CURRENT, 300000 },
+  { "temp_max", WINDOW_TEMP_MAX, 600000 },
+  { "voltage", WINDOW_VOLTAGE, 60000 },
+};
+const int BENCH_COUNT = sizeof(benches) / sizeof(benches[0]);
+
+struct Sample {
+  uint32_t timeMs;
+  int32_t value;
+};
+
+struct Pack {
+  SlidingWindow window[BENCH_COUNT];
+  std::deque<Sample> buffer[BENCH_COUNT];
+};
+
+struct Mapping {
+  const uint8_t* data;
+  size_t size;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+uint64_t macKey(const uint8_t* mac) {
+  uint64_t k = 0;
+  for (int i = 0; i < 6; i++) k = (k << 8) | mac[i];
+  return k;
+}
+
+bool mapFile(const char* path, Mapping& m) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(path);
+    if (fd >= 0) close(fd);
+    return false;
+  }
+  m.size = (size_t)st.st_size;
+  m.data = nullptr;
+  if (m.size) {
+    void* p = mmap(nullptr, m.size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      perror("mmap");
+      close(fd);
+      return false;
+    }
+    m.data = (const uint8_t*)p;
+  }
+  close(fd);
+  return true;
+}
+
+// Records back to back, as in snapshot_dump; resynchronise on the magic
+void collect(const Mapping& m, std::vector<const JkSnapshot*>& out, size_t& invalid) {
+  size_t offset = 0;
+  while (offset + sizeof(JkSnapshot) <= m.size) {
+    const JkSnapshot* snap = snapshotView(m.data + offset, m.size - offset);
+    if (!snap) {
+      invalid++;
+      offset++;
+      while (offset + 4 <= m.size) {
+        uint32_t magic;
+        memcpy(&magic, m.data + offset, sizeof(magic));
+        if (magic == JKBMS_SNAPSHOT_MAGIC) break;
+        offset++;
+      }
+      continue;
+    }
+    out.push_back(snap);
+    offset += snap->header.size;
+  }
+}
+
+// What application code does without the windows: scan the buffered samples
+void scan(const std::deque<Sample>& buffer, uint32_t slotMs, uint32_t nowMs, WindowStats& out) {
+  out = WindowStats();
+  const uint32_t oldest = nowMs / slotMs - (JKBMS_WINDOW_SLOTS - 1);
+  int64_t sum = 0;
+  for (const Sample& s : buffer) {
+    if ((int32_t)(s.timeMs / slotMs - oldest) < 0) continue;
+    if (!out.count || s.value < out.min) out.min = s.value;
+    if (!out.count || s.value > out.max) out.max = s.value;
+    sum += s.value;
+    out.count++;
+  }
+  if (out.count) out.average = (float)((double)sum / out.count);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--refresh-ms" && i + 1 < argc) opt.refreshMs = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    else if (arg[0] != '-') opt.paths.push_back(argv[i]);
+    else {
+      fprintf(stderr, "usage: window_bench FILE... [--refresh-ms MS]\n");
+      return 2;
+    }
+  }
+  if (opt.paths.empty() || !opt.refreshMs) {
+    fprintf(stderr, "usage: window_bench FILE... [--refresh-ms MS]\n");
+    return 2;
+  }
+
+  std::vector<Mapping> maps;
+  std::vector<const JkSnapshot*> records;
+  size_t invalid = 0;
+  for (const char* path : opt.paths) {
+    Mapping m;
+    if (!mapFile(path, m)) return 1;
+    maps.push_back(m);
+    collect(m, records, invalid);
+  }
+  if (records.empty()) {
+    fprintf(stderr, "no valid snapshots\n");
+    return 1;
+  }
+
+  std::map<uint64_t, Pack> packs;
+  double updateNs = 0, readNs = 0, scanNs = 0;
+  uint64_t updates = 0, reads = 0, mismatches = 0, scanned = 0, edgeSamples = 0, counted = 0;
+  size_t bufferPeak = 0;
+  uint32_t nextRefresh = 0;
+  for (const JkSnapshot* snap : records) {
+    const uint32_t now = snap->header.timestampMs;
+    auto it = packs.find(macKey(snap->header.mac));
+    if (it == packs.end()) {
+      it = packs.emplace(macKey(snap->header.mac), Pack()).first;
+      for (int b = 0; b < BENCH_COUNT; b++) windowInit(it->second.window[b], benches[b].windowMs);
+    }
+    Pack& pack = it->second;
+    for (int b = 0; b < BENCH_COUNT; b++) {
+      const int32_t value = windowFieldValue(benches[b].field, *snap);
+      Clock::time_point t0 = Clock::now();
+      windowAdd(pack.window[b], now, value);
+      updateNs += std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+      updates++;
+      // The buffer keeps what the longest edge may still need
+      std::deque<Sample>& buffer = pack.buffer[b];
+      buffer.push_back({ now, value });
+      while (now - buffer.front().timeMs > benches[b].windowMs + pack.window[b].slotMs) buffer.pop_front();
+      if (buffer.size() > bufferPeak) bufferPeak = buffer.size();
+    }
+    if ((int32_t)(now - nextRefresh) < 0) continue;
+    nextRefresh = now + opt.refreshMs;
+
+    for (auto& kv : packs) {
+      for (int b = 0; b < BENCH_COUNT; b++) {
+        const SlidingWindow& w = kv.second.window[b];
+        WindowStats got, expected;
+        Clock::time_point t0 = Clock::now();
+        windowRead(w, now, got);
+        readNs += std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+        reads++;
+        t0 = Clock::now();
+        scan(kv.second.buffer[b], w.slotMs, now, expected);
+        scanNs += std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+        scanned += kv.second.buffer[b].size();
+        if (got.count != expected.count || got.min != expected.min || got.max != expected.max ||
+            got.average != expected.average) {
+          if (mismatches++ < 5) {
+            printf("MISMATCH %s at %u ms: window n=%u %d..%d avg %.3f, scan n=%u %d..%d avg %.3f\n", benches[b].name,
+                   now, got.count, got.min, got.max, got.average, expected.count, expected.min, expected.max,
+                   expected.average);
+          }
+        }
+        // A strict time edge, for comparison
+        for (const Sample& s : kv.second.buffer[b]) edgeSamples += now - s.timeMs <= benches[b].windowMs;
+        counted += got.count;
+      }
+    }
+  }
+
+  printf("JKBMS sliding windows: %zu records (%zu invalid), %zu packs, %d windows per pack, %d slots\n\n",
+         records.size(), invalid, packs.size(), BENCH_COUNT, JKBMS_WINDOW_SLOTS);
+  printf("  update  %8.1f ns per sample\n", updateNs / updates);
+  printf("  read    %8.1f ns per window (min, max, average)\n", reads ? readNs / reads : 0);
+  printf("  scan    %8.1f ns per window, %.0f samples scanned\n", reads ? scanNs / reads : 0,
+         reads ? (double)scanned / reads : 0);
+  printf("  memory  %zu bytes per window; the scan buffers up to %zu samples (%zu bytes)\n", sizeof(SlidingWindow),
+         bufferPeak, bufferPeak * sizeof(Sample));
+  printf("  edge    slotted windows hold %.2f%% of the samples a strict time edge would\n",
+         edgeSamples ? 100.0 * counted / edgeSamples : 100.0);
+  printf("\n%llu reads, %llu mismatches\n", (unsigned long long)reads, (unsigned long long)mismatches);
+
+  for (const Mapping& m : maps) {
+    if (m.data) munmap((void*)m.data, m.size);
+  }
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,229 @@
+/**
+ * @file worst_bench.cpp
+ * @brief Incremental top-K worst cells against a rescan of the fleet on every refresh
+ *
+ * A synthetic fleet streams cell frames round robin (random-walk cell
+ * voltages with a few drifting cells, fixed wire resistances, temperatures
+ * following the load). Every frame goes into worst_cells.h; every
+ * --refresh-frames frames a dashboard refresh reads the four lists, and the
+ * same lists are computed by rescanning the latest frame of every device,
+ * as a dashboard would without the tracker.
+ *
+ * Reports, per fleet size, the cost per frame of the incremental update,
+ * the cost per refresh of both, and how often the incremental lists match
+ * the rescan (entries in common, and identical lists). A mismatch is a cell
+ * whose device has not sent a frame since a listed entry improved.
+ *
+ * Usage:
+ *   worst_bench [--devices 32,256,2048] [--cells 16] [--rounds 40]
+ *               [--refresh-frames 0] [--seed 1]
+ *
+ * --refresh-frames 0 refreshes once per fleet round / 8.
+ */
+
+#include "../src/libs/JKBMS.h"
+#include "../src/libs/worst_cells.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+JKBMS jkBmsDevices[1];
+const int bmsDeviceCount = 0;
+
+namespace {
+
+struct Options {
+  std::vector<int> devices = { 32, 256, 2048 };
+  int cells = 16;
+  int rounds = 40;
+  int refreshFrames = 0;
+  uint32_t seed = 1;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+uint32_t rng = 1;
+float uniform() {
+  rng = rng * 1664525u + 1013904223u;
+  return (rng >> 8) * (1.0f / 16777216.0f);
+}
+
+struct Pack {
+  JkSnapshot snap;
+  float cellV[JKBMS_SNAPSHOT_CELLS];
+  float drift[JKBMS_SNAPSHOT_CELLS];
+  float tempC;
+};
+
+void initPack(Pack& p, int index, int cells) {
+  memset(&p.snap, 0, sizeof(p.snap));
+  p.snap.header.cellCount = (uint8_t)cells;
+  for (int i = 0; i < 6; i++) p.snap.header.mac[i] = (uint8_t)(index >> (8 * (5 - i)));
+  for (int c = 0; c < cells; c++) {
+    p.cellV[c] = 3.30f + 0.01f * (uniform() - 0.5f);
+    // One cell in 50 drifts away from its siblings
+    p.drift[c] = uniform() < 0.02f ? 0.0004f * (uniform() - 0.5f) : 0;
+    p.snap.cellResistMohm[c] = (uint16_t)(50 + 40 * uniform() + (uniform() < 0.01f ? 200 : 0));
+  }
+  p.tempC = 20 + 10 * uniform();
+}
+
+void step(Pack& p, int cells, uint32_t nowMs) {
+  const float load = 0.005f * (uniform() - 0.5f);
+  for (int c = 0; c < cells; c++) {
+    p.cellV[c] += load + p.drift[c] + 0.001f * (uniform() - 0.5f);
+    if (p.cellV[c] < 2.9f) p.cellV[c] = 2.9f;
+    if (p.cellV[c] > 3.6f) p.cellV[c] = 3.6f;
+    p.snap.cellMv[c] = (uint16_t)lroundf(p.cellV[c] * 1000);
+  }
+  p.tempC += 0.2f * (uniform() - 0.5f);
+  p.snap.t1DeciC = (int16_t)lroundf(p.tempC * 10);
+  p.snap.t2DeciC = (int16_t)lroundf((p.tempC + 1) * 10);
+  p.snap.mosDeciC = (int16_t)lroundf((p.tempC + 3) * 10);
+  p.snap.header.timestampMs = nowMs;
+}
+
+// What a dashboard does without the tracker: score every cell of every pack, keep the K worst
+void rescan(const std::vector<Pack>& packs, int cells, std::vector<WorstEntry>* out) {
+  std::vector<WorstEntry> all[WORST_CRITERION_COUNT];
+  for (size_t d = 0; d < packs.size(); d++) {
+    const JkSnapshot& s = packs[d].snap;
+    float sum = 0, lo = 0, hi = 0;
+    for (int c = 0; c < cells; c++) {
+      const float v = s.cellMv[c];
+      if (!c || v < lo) lo = v;
+      if (!c || v > hi) hi = v;
+      sum += v;
+    }
+    const float avg = sum / cells;
+    for (int c = 0; c < cells; c++) {
+      const float dev = s.cellMv[c] - avg;
+      all[WORST_CELL_DEVIATION].push_back({ (uint16_t)d, (uint8_t)c, fabsf(dev), dev, 0 });
+      all[WORST_WIRE_RESIST].push_back({ (uint16_t)d, (uint8_t)c, (float)s.cellResistMohm[c], 0, 0 });
+    }
+    const float t = std::max(std::max(s.t1DeciC, s.t2DeciC), s.mosDeciC) * 0.1f;
+    all[WORST_PACK_TEMP].push_back({ (uint16_t)d, WORST_PACK, t, t, 0 });
+    all[WORST_PACK_DELTA].push_back({ (uint16_t)d, WORST_PACK, hi - lo, hi - lo, 0 });
+  }
+  for (int k = 0; k < WORST_CRITERION_COUNT; k++) {
+    std::vector<WorstEntry>& v = all[k];
+    const size_t n = std::min<size_t>(JKBMS_WORST_K, v.size());
+    std::partial_sort(v.begin(), v.begin() + n, v.end(), [](const WorstEntry& a, const WorstEntry& b) {
+      if (a.score != b.score) return a.score > b.score;
+      return (a.device << 8 | a.cell) < (b.device << 8 | b.cell);
+    });
+    out[k].assign(v.begin(), v.begin() + n);
+  }
+}
+
+struct Result {
+  double updateNs = 0;        // per frame
+  double readNs = 0;          // per refresh, four lists
+  double rescanNs = 0;        // per refresh, four lists
+  uint64_t frames = 0, refreshes = 0;
+  uint64_t common = 0, compared = 0, identical = 0, lists = 0;
+};
+
+Result run(const Options& opt, int devices) {
+  rng = opt.seed;
+  std::vector<Pack> packs(devices);
+  for (int d = 0; d < devices; d++) initPack(packs[d], d, opt.cells);
+  WorstCells w;
+  if (!worstInit(w, (uint16_t)devices)) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  const int refreshFrames = opt.refreshFrames > 0 ? opt.refreshFrames : std::max(1, devices / 8);
+  Result r;
+  std::vector<WorstEntry> expected[WORST_CRITERION_COUNT];
+  uint32_t nowMs = 0;
+  for (int round = 0; round < opt.rounds; round++) {
+    for (int d = 0; d < devices; d++) {
+      nowMs += 1000 / std::max(1, devices / 8);
+      step(packs[d], opt.cells, nowMs);
+      Clock::time_point t0 = Clock::now();
+      worstUpdateSnapshot(w, (uint16_t)d, packs[d].snap);
+      r.updateNs += std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+      r.frames++;
+      // Skip the first round: devices not seen yet are missing from the lists
+      if (round == 0 || r.frames % refreshFrames) continue;
+
+      t0 = Clock::now();
+      int counts[WORST_CRITERION_COUNT];
+      WorstEntry lists[WORST_CRITERION_COUNT][JKBMS_WORST_K];
+      for (int k = 0; k < WORST_CRITERION_COUNT; k++) counts[k] = worstRead(w, (WorstCriterion)k, lists[k], JKBMS_WORST_K);
+      r.readNs += std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+      t0 = Clock::now();
+      rescan(packs, opt.cells, expected);
+      r.rescanNs += std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+      r.refreshes++;
+
+      for (int k = 0; k < WORST_CRITERION_COUNT; k++) {
+        const WorstEntry* got = lists[k];
+        bool same = (size_t)counts[k] == expected[k].size();
+        for (size_t i = 0; i < expected[k].size(); i++) {
+          bool found = false;
+          for (int j = 0; j < counts[k]; j++) {
+            found |= got[j].device == expected[k][i].device && got[j].cell == expected[k][i].cell;
+          }
+          r.common += found;
+          same &= i < (size_t)counts[k] && got[i].device == expected[k][i].device && got[i].cell == expected[k][i].cell;
+        }
+        r.compared += expected[k].size();
+        r.identical += same;
+        r.lists++;
+      }
+    }
+  }
+  worstFree(w);
+  return r;
+}
+
+std::vector<int> parseList(const char* text) {
+  std::vector<int> out;
+  for (const char* p = text; *p;) {
+    char* end;
+    long v = strtol(p, &end, 10);
+    if (end == p) break;
+    out.push_back((int)v);
+    p = *end == ',' ? end + 1 : end;
+  }
+  return out;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string arg = argv[i];
+    if (arg == "--devices") opt.devices = parseList(argv[i + 1]);
+    else if (arg == "--cells") opt.cells = atoi(argv[i + 1]);
+    else if (arg == "--rounds") opt.rounds = atoi(argv[i + 1]);
+    else if (arg == "--refresh-frames") opt.refreshFrames = atoi(argv[i + 1]);
+    else if (arg == "--seed") opt.seed = (uint32_t)strtoul(argv[i + 1], nullptr, 10);
+    else { fprintf(stderr, "unknown option %s\n", arg.c_str()); return 2; }
+  }
+  if (opt.cells < 2 || opt.cells > JKBMS_SNAPSHOT_CELLS || opt.rounds < 2 || opt.devices.empty()) {
+    fprintf(stderr, "cells 2..%d, rounds >= 2\n", JKBMS_SNAPSHOT_CELLS);
+    return 2;
+  }
+  printf("Worst cells: top %d of 4 criteria, %d cells per pack, %d rounds\n\n", JKBMS_WORST_K, opt.cells,
+         opt.rounds);
+  printf("%8s %10s %12s %12s %14s %9s %10s\n", "devices", "frames", "update_us", "read_us", "rescan_us",
+         "common", "identical");
+  for (int devices : opt.devices) {
+    if (devices < 1 || devices > 65535) continue;
+    Result r = run(opt, devices);
+    printf("%8d %10llu %12.2f %12.2f %14.1f %8.1f%% %9.1f%%\n", devices, (unsigned long long)r.frames,
+           r.updateNs / r.frames / 1000, r.refreshes ? r.readNs / r.refreshes / 1000 : 0,
+           r.refreshes ? r.rescanNs / r.refreshes / 1000 : 0, r.compared ? 100.0 * r.common / r.compared : 0,
+           r.lists ? 100.0 * r.identical / r.lists : 0);
+  }
+  return 0;
+}
@@ -0,0 +1,81 @@
+"""
+PlatformIO post-build script: report the IRAM consumed by the JKBMS hot path.
+
+Lists every function of src/libs linked into .iram0.text (placed there by
+JKBMS_HOT with JKBMS_IRAM_HOTPATH=1, or by a plain IRAM_ATTR) with its
+size, and the total size of the IRAM text section, so the budget impact of
+the build option is visible on every build. The linked ELF no longer says
+which object a symbol came from: the functions are taken from the .iram1*
+input sections of the src/libs objects in the build directory, their sizes
+from the ELF.
+"""
+
+import os
+import re
+import subprocess
+
+Import("env")  # noqa: F821 - provided by PlatformIO
+
+# <addr> <flags> <section> <size> <name>
+SYMBOL_LINE = re.compile(r"^[0-9a-f]+\s.{7}\s(\S+)\s+([0-9a-f]+)\s+(.*)$")
+
+
+def _tool(name):
+    cc = env.subst("$CC")  # noqa: F821
+    return cc[: -len("gcc")] + name if cc.endswith("gcc") else name
+
+
+def _symbols(objdump, path):
+    """(section, size, name) of every symbol in an object or ELF file"""
+    out = subprocess.check_output([objdump, "-t", "-C", path], text=True)
+    for line in out.splitlines():
+        match = SYMBOL_LINE.match(line)
+        if match:
+            yield match.group(1), int(match.group(2), 16), match.group(3)
+
+
+def _library_iram_names(objdump, build_dir):
+    """Functions the src/libs objects put into IRAM input sections"""
+    names = set()
+    libs = os.path.join("src", "libs")
+    for root, _, files in os.walk(build_dir):
+        if not root.endswith(libs):
+            continue
+        for name in files:
+            if not name.endswith(".o"):
+                continue
+            for section, _, symbol in _symbols(objdump, os.path.join(root, name)):
+                if section.startswith(".iram1") and symbol != section:
+                    names.add(symbol)
+    return names
+
+
+def _iram_report(source, target, env):
+    elf = str(target[0])
+    objdump = _tool("objdump")
+    try:
+        headers = subprocess.check_output([objdump, "-h", elf], text=True)
+        library = _library_iram_names(objdump, env.subst("$BUILD_DIR"))
+        linked = list(_symbols(objdump, elf))
+    except (OSError, subprocess.CalledProcessError) as err:
+        print("iram_report: cannot run %s: %s" % (objdump, err))
+        return
+
+    section_size = 0
+    for line in headers.splitlines():
+        fields = line.split()
+        if len(fields) >= 3 and fields[1] == ".iram0.text":
+            section_size = int(fields[2], 16)
+
+    hot = [(size, name) for section, size, name in linked if section == ".iram0.text" and name in library]
+
+    print("JKBMS IRAM report for %s" % os.path.basename(elf))
+    for size, name in sorted(hot, reverse=True):
+        print("  %6d  %s" % (size, name))
+    total = sum(size for size, _ in hot)
+    print("  hot path: %d bytes of %d bytes .iram0.text" % (total, section_size))
+    if not hot:
+        print("  (hot path is in flash; build with -DJKBMS_IRAM_HOTPATH=1 to move it)")
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", _iram_report)  # noqa: F821
@@ -18,6 +18,13 @@
  */
 
 #include "JKBMS.h"
+#include "metrics.h"
+#include "frame_handlers.h"
+#include "init_phases.h"
+#include "scan_filter.h"
+#include "device_shards.h"
+#include "worst_cells.h"
+#include "usb_stream.h"
 
 //********************************************
 // JKBMS Class Implementation
@@ -61,9 +68,14 @@ JKBMS::JKBMS(const std::string& mac) : targetMAC(mac) {
  */
 bool JKBMS::connectToServer() {
   DEBUG_PRINTF("Attempting to connect to %s...\n", targetMAC.c_str());
-  
+
+  // After a warm restart the stored address is used directly, without a scan
+  const bool direct = warm.direct;
+  warm.direct = false;
+  const NimBLEAddress address = peerAddress();
+
   // Check if client already exists for this device
-  NimBLEClient* pClient = NimBLEDevice::getClientByPeerAddress(advDevice->getAddress());
+  NimBLEClient* pClient = NimBLEDevice::getClientByPeerAddress(address);
 
   if (!pClient) {
     // Check total client count to avoid resource exhaustion
@@ -86,20 +98,19 @@ bool JKBMS::connectToServer() {
     // More conservative connection parameters for multi-BLE stability
     // Interval: 24*1.25ms = 30ms, Latency: 0, Timeout: 400*10ms = 4s
     pClient->setConnectionParams(24, 24, 0, 400);
-    pClient->setConnectTimeout(10000);  // 10 second connection timeout
   }
-
-  // Add small delay to avoid resource conflicts with BLE server
-  delay(100);
+  // A pack that is off does not answer a direct connect: give up early and scan
+  pClient->setConnectTimeout(direct ? WARM_CONNECT_TIMEOUT_MS : 10000);
 
   // Attempt connection with retry logic
+  uint32_t phaseStart = millis();
   int retryCount = 0;
-  const int maxRetries = 3;
+  const int maxRetries = direct ? 1 : 3;
   
   while (retryCount < maxRetries) {
     DEBUG_PRINTF("Connection attempt %d/%d to %s...\n", retryCount + 1, maxRetries, targetMAC.c_str());
     
-    if (pClient->connect(advDevice)) {
+    if (direct ? pClient->connect(address) : pClient->connect(advDevice)) {
       DEBUG_PRINTF("Connected to: %s RSSI: %d (attempt %d)\n", 
                    pClient->getPeerAddress().toString().c_str(), 
                    pClient->getRssi(), retryCount + 1);
@@ -120,39 +131,62 @@ bool JKBMS::connectToServer() {
   
   if (retryCount >= maxRetries) {
     DEBUG_PRINTF("Failed to connect to %s after %d attempts\n", targetMAC.c_str(), maxRetries);
+    initPhaseRecord(INIT_CONNECT, millis() - phaseStart, true);
+    if (direct) checkpointWarmResult(false);
     return false;
   }
+  initPhaseRecord(INIT_CONNECT, millis() - phaseStart);
+  linkStatsConnected(linkStats, pClient->getConnInfo().getConnInterval(), pClient->getMTU());
+  phyApply(phy, pClient, true);  // Connected on 1M, move to the PHY the link quality calls for
 
   // Get the service and characteristic for JKBMS communication
   NimBLERemoteService* pSvc = nullptr;
   
-  // Retry service discovery
+  // Retry service discovery; getService() returns once discovery completed,
+  // so only a failed attempt waits before the next one
+  phaseStart = millis();
   for (int i = 0; i < 3; i++) {
-    delay(500);  // Allow time for service discovery
     pSvc = pClient->getService("ffe0");
-    if (pSvc) break;
+    if (pSvc || !pClient->isConnected()) break;
     DEBUG_PRINTF("Service discovery attempt %d failed\n", i + 1);
+    delay(500);
   }
   
   if (pSvc) {
     pChr = pSvc->getCharacteristic("ffe1");
+    initPhaseRecord(INIT_DISCOVERY, millis() - phaseStart);
     if (pChr && pChr->canNotify()) {
-      // Subscribe to notifications for real-time data
-      if (pChr->subscribe(true, notifyCB)) {
+      // Subscribe to notifications for real-time data; returns once the BMS
+      // acknowledged the CCCD write
+      phaseStart = millis();
+      bool subscribed = pChr->subscribe(true, notifyCB);
+      initPhaseRecord(INIT_SUBSCRIBE, millis() - phaseStart, !subscribed);
+      if (subscribed) {
         DEBUG_PRINTF("Successfully subscribed to notifications for %s\n", pChr->getUUID().toString().c_str());
-        
-        // Request initial device information and data with proper delays
-        delay(1000);  // Longer initial delay for stability
-        writeRegister(0x97, 0x00000000, 0x00);  // Request device info
-        delay(800);
-        writeRegister(0x96, 0x00000000, 0x00);  // Request cell info
-        delay(800);
+
+        // Same handle as before the restart: same BMS firmware, so the restored
+        // device info still holds and the functions are still enabled
+        const bool known = direct && warm.chrHandle != 0 && warm.chrHandle == pChr->getHandle();
+        warm.chrHandle = pChr->getHandle();
+
+        // Request initial device information and data; each request is
+        // answered by a frame, which is the signal to go on (timeout as fallback)
+        if (!known) {
+          requestAndWait(0x97, INIT_DEVICE_INFO);  // Request device info
+        }
+        requestAndWait(0x96, INIT_FIRST_DATA);     // Request cell info
 
         // Enable BMS functions (charge, discharge, balance)
-        enableBMSFunctions();
+        if (!known || !warm.functionsEnabled) {
+          phaseStart = millis();
+          enableBMSFunctions();
+          initPhaseRecord(INIT_ENABLE, millis() - phaseStart);
+          warm.functionsEnabled = true;
+        }
         
         connected = true;
         lastNotifyTime = millis();
+        if (direct) checkpointWarmResult(true);
         DEBUG_PRINTF("BMS %s fully connected and initialized\n", targetMAC.c_str());
         return true;
       } else {
@@ -162,34 +196,67 @@ bool JKBMS::connectToServer() {
       DEBUG_PRINTLN("Characteristic ffe1 not found or cannot notify");
     }
   } else {
+    initPhaseRecord(INIT_DISCOVERY, millis() - phaseStart, true);
     DEBUG_PRINTLN("Service 'ffe0' not found");
   }
   
   // Connection failed, disconnect client
   DEBUG_PRINTF("Connection setup failed for %s, disconnecting\n", targetMAC.c_str());
+  if (direct) checkpointWarmResult(false);
   pClient->disconnect();
   return false;
 }
 
+/**
+ * Send a data request and wait until the BMS answers with a complete frame
+ * @param command 0x97 (device info) or 0x96 (cell info)
+ * @param phase Init phase the wait is reported under
+ * @return false if JKBMS_RESPONSE_TIMEOUT_MS passed without a frame
+ */
+bool JKBMS::requestAndWait(uint8_t command, InitPhase phase) {
+  const uint32_t framesBefore = linkStats.framesTotal;
+  const uint32_t start = millis();
+  writeRegister(command, 0x00000000, 0x00);
+  bool answered = waitUntil([this, framesBefore]() { return linkStats.framesTotal != framesBefore || !connected; },
+                            JKBMS_RESPONSE_TIMEOUT_MS);
+  initPhaseRecord(phase, millis() - start, !answered);
+  return answered;
+}
+
+/**
+ * Address to connect to: the advertisement from the last scan, else the
+ * configured MAC with the address type remembered from an earlier session
+ */
+NimBLEAddress JKBMS::peerAddress() const {
+  if (advDevice) return advDevice->getAddress();
+  return NimBLEAddress(targetMAC, warm.addressType);
+}
+
 /**
  * Enable BMS functions (charge, discharge, balance)
  * Sends commands to enable charging, discharging, and balancing functions
- * Should be called after successful BMS connection and initialization
+ * Should be called after successful BMS connection and initialization.
+ * 0x1D-0x1F are JK02 switch registers: nothing is written to a JK04 device,
+ * whose register map differs.
  */
 void JKBMS::enableBMSFunctions() {
+  if (activeProtocol() == PROTOCOL_JK04) {
+    DEBUG_PRINTF("JK04 device %s: charge/discharge/balance switches left as they are\n", targetMAC.c_str());
+    return;
+  }
   DEBUG_PRINTF("Enabling BMS functions for %s\n", targetMAC.c_str());
   
   // Enable charging (address 0x1D, value 0x00000001)
   writeRegister(0x1D, 0x00000001, 0x04);
-  delay(500); // Delay between commands for stability
+  delay(JKBMS_COMMAND_GAP_MS); // The BMS needs a short gap between commands
   
   // Enable discharging (address 0x1E, value 0x00000001)
   writeRegister(0x1E, 0x00000001, 0x04);
-  delay(500);
+  delay(JKBMS_COMMAND_GAP_MS);
   
   // Enable balancing (address 0x1F, value 0x00000001)
   writeRegister(0x1F, 0x00000001, 0x04);
-  delay(500);
+  delay(JKBMS_COMMAND_GAP_MS);
   
   DEBUG_PRINTF("BMS functions enabled for %s\n", targetMAC.c_str());
 }
@@ -210,7 +277,7 @@ void JKBMS::enableBMSFunctions() {
  * State Machine:
  * 1. Wait for start frame (0x55 0xAA 0xEB 0x90)
  * 2. Accumulate subsequent packets until frame >= 300 bytes
- * 3. Dispatch complete frame to appropriate parser
+ * 3. Dispatch complete frame through the frame-handler table (frame_handlers.h)
  * 4. Reset state for next frame
  * 
  * @param pData Pointer to the received notification data buffer
@@ -220,30 +287,32 @@ void JKBMS::enableBMSFunctions() {
  *       frame counter, and receivedBytes buffer
  * @note Implements notification throttling via ignoreNotifyCount mechanism
  * @note Updates lastNotifyTime for connection monitoring
+ * @note Placed in IRAM together with the parsers when built with JKBMS_IRAM_HOTPATH=1
  */
-void JKBMS::handleNotification(uint8_t* pData, size_t length) {
+void JKBMS_HOT JKBMS::handleNotification(uint8_t* pData, size_t length) {
   DEBUG_PRINTLN("Handling notification...");
+  JKBMS_PROFILE_BEGIN(notifySample);
+  METRICS_PHASE_BEGIN(reassemblySample);
   lastNotifyTime = millis();
+  linkStatsNotify(linkStats, length);
 
   // Handle notification throttling - skip processing if count > 0
+  // Dropped fragments fall through to the end of the chain, so they are profiled too
   if (ignoreNotifyCount > 0) {
     ignoreNotifyCount--;
     DEBUG_PRINTF("Ignoring notification. Remaining: %d\n", ignoreNotifyCount);
-    return;
   }
-
   // Bounds check for minimum frame header
-  if (length < 4) {
+  else if (length < 4) {
     DEBUG_PRINTF("Notification too short: %d bytes\n", length);
-    return;
   }
-
   // Check for start of new data frame (JK BMS protocol header)
-  if (pData[0] == 0x55 && pData[1] == 0xAA && pData[2] == 0xEB && pData[3] == 0x90) {
+  else if (pData[0] == 0x55 && pData[1] == 0xAA && pData[2] == 0xEB && pData[3] == 0x90) {
     DEBUG_PRINTLN("Start of data frame detected.");
     frame = 0;
     received_start = true;
     received_complete = false;
+    linkStatsFrameStart(linkStats);
 
     // Store the received data with bounds checking
     for (int i = 0; i < length && frame < 300; i++) {
@@ -263,29 +332,19 @@ void JKBMS::handleNotification(uint8_t* pData, size_t length) {
         received_complete = true;
         received_start = false;
         new_data = true;
+        phyRecordFrame(phy, linkStatsFrameComplete(linkStats));
         DEBUG_PRINTLN("New data available for parsing.");
 
-        // Determine frame type and dispatch to appropriate parser
-        // Frame type is stored in byte 4 of the complete frame
-        switch (receivedBytes[4]) {
-          case 0x01:
-            DEBUG_PRINTLN("BMS Settings frame detected.");
-            bms_settings();
-            break;
-          case 0x02:
-            DEBUG_PRINTLN("Cell data frame detected.");
-            parseData();
-            break;
-          case 0x03:
-            DEBUG_PRINTLN("Device info frame detected.");
-            parseDeviceInfo();
-            break;
-          default:
-            DEBUG_PRINTF("Unknown frame type: 0x%02X\n", receivedBytes[4]);
-            break;
+        // Dispatch by frame type (byte 4) to the built-in parsers and
+        // registered handlers, see frame_handlers.h
+        METRICS_PHASE_END(reassemblySample, PHASE_REASSEMBLY);
+        METRICS_PHASE_BEGIN(parsingSample);
+        if (dispatchFrame(*this, receivedBytes, frame) == 0) {
+          DEBUG_PRINTF("Unknown frame type: 0x%02X\n", receivedBytes[4]);
         }
+        METRICS_PHASE_END(parsingSample, PHASE_PARSING);
 
-        break;  // Exit the loop after processing the complete frame
+        return;  // Frame processed, parser time is accounted separately
       }
     }
   }
@@ -293,6 +352,9 @@ void JKBMS::handleNotification(uint8_t* pData, size_t length) {
   else {
     DEBUG_PRINTLN("Received notification but no frame started - ignoring");
   }
+
+  METRICS_PHASE_END(reassemblySample, PHASE_REASSEMBLY);
+  JKBMS_PROFILE_END(notifySample, PROFILE_NOTIFY_FRAGMENT);
 }
 
 /**
@@ -324,6 +386,7 @@ void JKBMS::writeRegister(uint8_t address, uint32_t value, uint8_t length) {
 
   if (pChr) {
     pChr->writeValue((uint8_t*)frame, (size_t)sizeof(frame));
+    linkStatsWrite(linkStats, sizeof(frame));
   }
 }
 
@@ -332,37 +395,36 @@ void JKBMS::writeRegister(uint8_t address, uint32_t value, uint8_t length) {
  * Extracts protection thresholds, current limits, temperature limits, and other configuration parameters
  * from the received data frame and updates corresponding class member variables
  */
-void JKBMS::bms_settings() {
+void JKBMS_HOT JKBMS::bms_settings() {
   DEBUG_PRINTLN("Processing BMS settings...");
-  cell_voltage_undervoltage_protection = ((receivedBytes[13] << 24 | receivedBytes[12] << 16 | receivedBytes[11] << 8 | receivedBytes[10]) * 0.001);
-  cell_voltage_undervoltage_recovery = ((receivedBytes[17] << 24 | receivedBytes[16] << 16 | receivedBytes[15] << 8 | receivedBytes[14]) * 0.001);
-  cell_voltage_overvoltage_protection = ((receivedBytes[21] << 24 | receivedBytes[20] << 16 | receivedBytes[19] << 8 | receivedBytes[18]) * 0.001);
-  cell_voltage_overvoltage_recovery = ((receivedBytes[25] << 24 | receivedBytes[24] << 16 | receivedBytes[23] << 8 | receivedBytes[22]) * 0.001);
-  balance_trigger_voltage = ((receivedBytes[29] << 24 | receivedBytes[28] << 16 | receivedBytes[27] << 8 | receivedBytes[26]) * 0.001);
-  power_off_voltage = ((receivedBytes[49] << 24 | receivedBytes[48] << 16 | receivedBytes[47] << 8 | receivedBytes[46]) * 0.001);
-  max_charge_current = ((receivedBytes[53] << 24 | receivedBytes[52] << 16 | receivedBytes[51] << 8 | receivedBytes[50]) * 0.001);
-  charge_overcurrent_protection_delay = ((receivedBytes[57] << 24 | receivedBytes[56] << 16 | receivedBytes[55] << 8 | receivedBytes[54]));
-  charge_overcurrent_protection_recovery_time = ((receivedBytes[61] << 24 | receivedBytes[60] << 16 | receivedBytes[59] << 8 | receivedBytes[58]));
-  max_discharge_current = ((receivedBytes[65] << 24 | receivedBytes[64] << 16 | receivedBytes[63] << 8 | receivedBytes[62]) * 0.001);
-  discharge_overcurrent_protection_delay = ((receivedBytes[69] << 24 | receivedBytes[68] << 16 | receivedBytes[67] << 8 | receivedBytes[66]));
-  discharge_overcurrent_protection_recovery_time = ((receivedBytes[73] << 24 | receivedBytes[72] << 16 | receivedBytes[71] << 8 | receivedBytes[70]));
-  short_circuit_protection_recovery_time = ((receivedBytes[77] << 24 | receivedBytes[76] << 16 | receivedBytes[75] << 8 | receivedBytes[74]));
-  max_balance_current = ((receivedBytes[81] << 24 | receivedBytes[80] << 16 | receivedBytes[79] << 8 | receivedBytes[78]) * 0.001);
-  charge_overtemperature_protection = ((receivedBytes[85] << 24 | receivedBytes[84] << 16 | receivedBytes[83] << 8 | receivedBytes[82]) * 0.1);
-  charge_overtemperature_protection_recovery = ((receivedBytes[89] << 24 | receivedBytes[88] << 16 | receivedBytes[87] << 8 | receivedBytes[86]) * 0.1);
-  discharge_overtemperature_protection = ((receivedBytes[93] << 24 | receivedBytes[92] << 16 | receivedBytes[91] << 8 | receivedBytes[90]) * 0.1);
-  discharge_overtemperature_protection_recovery = ((receivedBytes[97] << 24 | receivedBytes[96] << 16 | receivedBytes[95] << 8 | receivedBytes[94]) * 0.1);
-  charge_undertemperature_protection = ((receivedBytes[101] << 24 | receivedBytes[100] << 16 | receivedBytes[99] << 8 | receivedBytes[98]) * 0.1);
-  charge_undertemperature_protection_recovery = ((receivedBytes[105] << 24 | receivedBytes[104] << 16 | receivedBytes[103] << 8 | receivedBytes[102]) * 0.1);
-  power_tube_overtemperature_protection = ((receivedBytes[109] << 24 | receivedBytes[108] << 16 | receivedBytes[107] << 8 | receivedBytes[106]) * 0.1);
-  power_tube_overtemperature_protection_recovery = ((receivedBytes[113] << 24 | receivedBytes[112] << 16 | receivedBytes[111] << 8 | receivedBytes[110]) * 0.1);
-  cell_count = ((receivedBytes[117] << 24 | receivedBytes[116] << 16 | receivedBytes[115] << 8 | receivedBytes[114]));
-  // 118   4   0x01 0x00 0x00 0x00    Charge switch
-  // 122   4   0x01 0x00 0x00 0x00    Discharge switch
-  // 126   4   0x01 0x00 0x00 0x00    Balancer switch
-  total_battery_capacity = ((receivedBytes[133] << 24 | receivedBytes[132] << 16 | receivedBytes[131] << 8 | receivedBytes[130]) * 0.001);
-  short_circuit_protection_delay = ((receivedBytes[137] << 24 | receivedBytes[136] << 16 | receivedBytes[135] << 8 | receivedBytes[134]) * 1);
-  balance_starting_voltage = ((receivedBytes[141] << 24 | receivedBytes[140] << 16 | receivedBytes[139] << 8 | receivedBytes[138]) * 0.001);
+  JkSettingsData<JkFloatStorage> s;
+  JkDefaultDecoder::decodeSettings(receivedBytes, s);
+  cell_voltage_undervoltage_protection = s.cellUvp;
+  cell_voltage_undervoltage_recovery = s.cellUvpr;
+  cell_voltage_overvoltage_protection = s.cellOvp;
+  cell_voltage_overvoltage_recovery = s.cellOvpr;
+  balance_trigger_voltage = s.balanceTrigger;
+  power_off_voltage = s.powerOff;
+  max_charge_current = s.maxChargeCurrent;
+  charge_overcurrent_protection_delay = s.chargeOcpDelayS;
+  charge_overcurrent_protection_recovery_time = s.chargeOcpRecoveryS;
+  max_discharge_current = s.maxDischargeCurrent;
+  discharge_overcurrent_protection_delay = s.dischargeOcpDelayS;
+  discharge_overcurrent_protection_recovery_time = s.dischargeOcpRecoveryS;
+  short_circuit_protection_recovery_time = s.scpRecoveryS;
+  max_balance_current = s.maxBalanceCurrent;
+  charge_overtemperature_protection = s.chargeOtp;
+  charge_overtemperature_protection_recovery = s.chargeOtpr;
+  discharge_overtemperature_protection = s.dischargeOtp;
+  discharge_overtemperature_protection_recovery = s.dischargeOtpr;
+  charge_undertemperature_protection = s.chargeUtp;
+  charge_undertemperature_protection_recovery = s.chargeUtpr;
+  power_tube_overtemperature_protection = s.mosOtp;
+  power_tube_overtemperature_protection_recovery = s.mosOtpr;
+  cell_count = (int)s.cellCount;
+  total_battery_capacity = s.totalCapacity;
+  short_circuit_protection_delay = s.scpDelayUs;
+  balance_starting_voltage = s.balanceStart;
 
   DEBUG_PRINTF("Cell voltage undervoltage protection: %.2fV\n", cell_voltage_undervoltage_protection);
   DEBUG_PRINTF("Cell voltage undervoltage recovery: %.2fV\n", cell_voltage_undervoltage_recovery);
@@ -416,33 +478,34 @@ void JKBMS::parseDeviceInfo() {
     return;
   }
 
-  // Extract device information from the received bytes
-  std::string vendorID(receivedBytes + 6, receivedBytes + 6 + 16);
-  std::string hardwareVersion(receivedBytes + 22, receivedBytes + 22 + 8);
-  std::string softwareVersion(receivedBytes + 30, receivedBytes + 30 + 8);
-  uint32_t uptime = (receivedBytes[41] << 24) | (receivedBytes[40] << 16) | (receivedBytes[39] << 8) | receivedBytes[38];
-  uint32_t powerOnCount = (receivedBytes[45] << 24) | (receivedBytes[44] << 16) | (receivedBytes[43] << 8) | receivedBytes[42];
-  std::string deviceName(receivedBytes + 46, receivedBytes + 46 + 16);
-  std::string devicePasscode(receivedBytes + 62, receivedBytes + 62 + 16);
-  std::string manufacturingDate(receivedBytes + 78, receivedBytes + 78 + 8);
-  std::string serialNumber(receivedBytes + 86, receivedBytes + 86 + 11);
-  std::string passcode(receivedBytes + 97, receivedBytes + 97 + 5);
-  std::string userData(receivedBytes + 102, receivedBytes + 102 + 16);
-  std::string setupPasscode(receivedBytes + 118, receivedBytes + 118 + 16);
+  // Passcodes and user data are not kept
+  JkDeviceInfoData info;
+  JkDefaultDecoder::decodeDeviceInfo(receivedBytes, info);
+
+  // The hardware version tells which cell-info layout the device uses
+  ProtocolVariant variant = protocolFromHardwareVersion(info.hardwareVersion, sizeof(info.hardwareVersion) - 1);
+  if (variant != PROTOCOL_AUTO) detectedProtocol = variant;
 
   // Debugging: Print the parsed device information
-  DEBUG_PRINTF("  Vendor ID: %s\n", vendorID.c_str());
-  DEBUG_PRINTF("  Hardware version: %s\n", hardwareVersion.c_str());
-  DEBUG_PRINTF("  Software version: %s\n", softwareVersion.c_str());
-  DEBUG_PRINTF("  Uptime: %d s\n", uptime);
-  DEBUG_PRINTF("  Power on count: %d\n", powerOnCount);
-  DEBUG_PRINTF("  Device name: %s\n", deviceName.c_str());
-  DEBUG_PRINTF("  Device passcode: %s\n", devicePasscode.c_str());
-  DEBUG_PRINTF("  Manufacturing date: %s\n", manufacturingDate.c_str());
-  DEBUG_PRINTF("  Serial number: %s\n", serialNumber.c_str());
-  DEBUG_PRINTF("  Passcode: %s\n", passcode.c_str());
-  DEBUG_PRINTF("  User data: %s\n", userData.c_str());
-  DEBUG_PRINTF("  Setup passcode: %s\n", setupPasscode.c_str());
+  DEBUG_PRINTF("  Vendor ID: %s\n", info.vendor);
+  DEBUG_PRINTF("  Hardware version: %s\n", info.hardwareVersion);
+  DEBUG_PRINTF("  Software version: %s\n", info.softwareVersion);
+  DEBUG_PRINTF("  Uptime: %u s\n", (unsigned)info.uptimeS);
+  DEBUG_PRINTF("  Power on count: %u\n", (unsigned)info.powerOnCount);
+  DEBUG_PRINTF("  Device name: %s\n", info.name);
+  DEBUG_PRINTF("  Manufacturing date: %s\n", info.manufactured);
+  DEBUG_PRINTF("  Serial number: %s\n", info.serial);
+  DEBUG_PRINTF("  Protocol: %s\n", protocolName(activeProtocol()));
+}
+
+/**
+ * Protocol variant in use for this device
+ * A forced protocol wins; otherwise the detected one, falling back to JK02
+ * until a device-info or cell frame has been seen.
+ */
+ProtocolVariant JKBMS::activeProtocol() const {
+  if (protocol != PROTOCOL_AUTO) return protocol;
+  return detectedProtocol != PROTOCOL_AUTO ? detectedProtocol : PROTOCOL_JK02;
 }
 
 /**
@@ -450,84 +513,14 @@ void JKBMS::parseDeviceInfo() {
  * Processes cell data frame to extract cell voltages, wire resistances, battery voltage,
  * current, power, temperatures, capacity information, charge/discharge status, and balancing data
  */
-void JKBMS::parseData() {
+void JKBMS_HOT JKBMS::parseData() {
   DEBUG_PRINTLN("Parsing data...");
   new_data = false;
   ignoreNotifyCount = 10;
-  // Cell voltages
-  for (int j = 0, i = 7; i < 38; j++, i += 2) {
-    cellVoltage[j] = ((receivedBytes[i] << 8 | receivedBytes[i - 1]) * 0.001);
-  }
-
-  Average_Cell_Voltage = (((int)receivedBytes[75] << 8 | receivedBytes[74]) * 0.001);
-
-  Delta_Cell_Voltage = (((int)receivedBytes[77] << 8 | receivedBytes[76]) * 0.001);
-
-  for (int j = 0, i = 81; i < 112; j++, i += 2) {
-    wireResist[j] = (((int)receivedBytes[i] << 8 | receivedBytes[i - 1]) * 0.001);
-  }
-
-  if (receivedBytes[145] == 0xFF) {
-    MOS_Temp = ((0xFF << 24 | 0xFF << 16 | receivedBytes[145] << 8 | receivedBytes[144]) * 0.1);
-  } else {
-    MOS_Temp = ((receivedBytes[145] << 8 | receivedBytes[144]) * 0.1);
-  }
-
-  // Battery voltage
-  Battery_Voltage = ((receivedBytes[153] << 24 | receivedBytes[152] << 16 | receivedBytes[151] << 8 | receivedBytes[150]) * 0.001);
-
-  Charge_Current = ((receivedBytes[161] << 24 | receivedBytes[160] << 16 | receivedBytes[159] << 8 | receivedBytes[158]) * 0.001);
-
-  Battery_Power = Battery_Voltage * Charge_Current;
-
-  if (receivedBytes[163] == 0xFF) {
-    Battery_T1 = ((0xFF << 24 | 0xFF << 16 | receivedBytes[163] << 8 | receivedBytes[162]) * 0.1);
-  } else {
-    Battery_T1 = ((receivedBytes[163] << 8 | receivedBytes[162]) * 0.1);
-  }
-
-  if (receivedBytes[165] == 0xFF) {
-    Battery_T2 = ((0xFF << 24 | 0xFF << 16 | receivedBytes[165] << 8 | receivedBytes[164]) * 0.1);
-  } else {
-    Battery_T2 = ((receivedBytes[165] << 8 | receivedBytes[164]) * 0.1);
-  }
-
-  if ((receivedBytes[171] & 0xF0) == 0x0) {
-    Balance_Curr = ((receivedBytes[171] << 8 | receivedBytes[170]) * 0.001);
-  } else if ((receivedBytes[171] & 0xF0) == 0xF0) {
-    Balance_Curr = (((receivedBytes[171] & 0x0F) << 8 | receivedBytes[170]) * -0.001);
-  }
-
-  Balancing_Action = receivedBytes[172];
-  Percent_Remain = (receivedBytes[173]);
-  Capacity_Remain = ((receivedBytes[177] << 24 | receivedBytes[176] << 16 | receivedBytes[175] << 8 | receivedBytes[174]) * 0.001);
-  Nominal_Capacity = ((receivedBytes[181] << 24 | receivedBytes[180] << 16 | receivedBytes[179] << 8 | receivedBytes[178]) * 0.001);
-  Cycle_Count = ((receivedBytes[185] << 24 | receivedBytes[184] << 16 | receivedBytes[183] << 8 | receivedBytes[182]));
-  Cycle_Capacity = ((receivedBytes[189] << 24 | receivedBytes[188] << 16 | receivedBytes[187] << 8 | receivedBytes[186]) * 0.001);
-
-  Uptime = receivedBytes[196] << 16 | receivedBytes[195] << 8 | receivedBytes[194];
-  sec = Uptime % 60;
-  Uptime /= 60;
-  mi = Uptime % 60;
-  Uptime /= 60;
-  hr = Uptime % 24;
-  days = Uptime / 24;
-
-  if (receivedBytes[198] > 0) {
-    Charge = true;
-  } else if (receivedBytes[198] == 0) {
-    Charge = false;
-  }
-  if (receivedBytes[199] > 0) {
-    Discharge = true;
-  } else if (receivedBytes[199] == 0) {
-    Discharge = false;
-  }
-  if (receivedBytes[201] > 0) {
-    Balance = true;
-  } else if (receivedBytes[201] == 0) {
-    Balance = false;
-  }
+  JkDefaultDecoder::Cells c;
+  loadCells(c);
+  JkDefaultDecoder::decodeJk02(receivedBytes, c);
+  storeCells(c, 16);
 
   // Output values
   DEBUG_PRINTF("\n--- Data from %s ---\n", targetMAC.c_str());
@@ -560,6 +553,77 @@ void JKBMS::parseData() {
   DEBUG_PRINTF("Balancing Action: %d\n", Balancing_Action);
 }
 
+static_assert(JkDefaultDecoder::CELLS <= JKBMS_MAX_CELLS, "decoded cells do not fit JKBMS");
+
+/**
+ * Current values as decoder input
+ * The decoders leave the fields a frame does not carry unchanged, so they
+ * start from what the device had.
+ */
+void JKBMS::loadCells(JkDefaultDecoder::Cells& c) const {
+  for (int i = 0; i < JkDefaultDecoder::CELLS; i++) {
+    c.cellMv[i] = cellVoltage[i];
+    c.wireResist[i] = wireResist[i];
+  }
+  c.averageCell = Average_Cell_Voltage;
+  c.deltaCell = Delta_Cell_Voltage;
+  c.batteryVoltage = Battery_Voltage;
+  c.current = Charge_Current;
+  c.power = Battery_Power;
+  c.balanceCurrent = Balance_Curr;
+  c.capacityRemain = Capacity_Remain;
+  c.nominalCapacity = Nominal_Capacity;
+  c.cycleCapacity = Cycle_Capacity;
+  c.mosTemp = MOS_Temp;
+  c.t1 = Battery_T1;
+  c.t2 = Battery_T2;
+  c.cycleCount = (uint32_t)Cycle_Count;
+  c.uptimeS = 0;
+  c.cellCount = (uint8_t)cellCountClamped();
+  c.soc = (uint8_t)Percent_Remain;
+  c.balancingAction = (uint8_t)Balancing_Action;
+  c.charge = Charge;
+  c.discharge = Discharge;
+  c.balance = Balance;
+}
+
+/**
+ * Publish decoded values into the fields
+ * @param cells Cell slots the frame carries (16 for JK02); the rest keep their values
+ */
+void JKBMS::storeCells(const JkDefaultDecoder::Cells& c, int cells) {
+  for (int i = 0; i < cells && i < JkDefaultDecoder::CELLS; i++) {
+    cellVoltage[i] = c.cellMv[i];
+    wireResist[i] = c.wireResist[i];
+  }
+  Average_Cell_Voltage = c.averageCell;
+  Delta_Cell_Voltage = c.deltaCell;
+  Battery_Voltage = c.batteryVoltage;
+  Charge_Current = c.current;
+  Battery_Power = c.power;
+  Balance_Curr = c.balanceCurrent;
+  Capacity_Remain = c.capacityRemain;
+  Nominal_Capacity = c.nominalCapacity;
+  Cycle_Capacity = c.cycleCapacity;
+  MOS_Temp = c.mosTemp;
+  Battery_T1 = c.t1;
+  Battery_T2 = c.t2;
+  Cycle_Count = c.cycleCount;
+  Percent_Remain = c.soc;
+  Balancing_Action = c.balancingAction;
+  Charge = c.charge;
+  Discharge = c.discharge;
+  Balance = c.balance;
+
+  Uptime = c.uptimeS;
+  sec = Uptime % 60;
+  Uptime /= 60;
+  mi = Uptime % 60;
+  Uptime /= 60;
+  hr = Uptime % 24;
+  days = Uptime / 24;
+}
+
 /**
  * Calculate CRC checksum for data frame
  * Computes simple sum-based checksum for data integrity verification
@@ -567,7 +631,7 @@ void JKBMS::parseData() {
  * @param len Length of the data array
  * @return Calculated CRC checksum value
  */
-uint8_t JKBMS::crc(const uint8_t data[], uint16_t len) {
+uint8_t JKBMS_HOT JKBMS::crc(const uint8_t data[], uint16_t len) {
   uint8_t crc = 0;
   for (uint16_t i = 0; i < len; i++) crc += data[i];
   return crc;
@@ -604,24 +668,50 @@ void ClientCallbacks::onDisconnect(NimBLEClient* pClient, int reason) {
   DEBUG_PRINTF("%s disconnected, reason: %d\n", bms->targetMAC.c_str(), reason);
   bms->connected = false;
   bms->doConnect = false;
+  phyRecordDisconnect(bms->phy, reason);
+  shardDeviceLeft(*bms);
+  worstDeviceLeft(*bms);
+}
+
+/**
+ * PHY update completed callback
+ * Called when the controller finished a PHY update, requested or not
+ * @param pClient Pointer to the BLE client
+ * @param txPhy Negotiated transmit PHY
+ * @param rxPhy Negotiated receive PHY (the one BMS data arrives on)
+ */
+void ClientCallbacks::onPhyUpdate(NimBLEClient* pClient, uint8_t txPhy, uint8_t rxPhy) {
+  DEBUG_PRINTF("%s PHY now %s\n", bms->targetMAC.c_str(), phyName(rxPhy));
+  phyUpdated(bms->phy, rxPhy);
+  bms->linkStats.phy = rxPhy;
 }
 
 /**
  * BLE scan result callback
  * Called when a BLE device is discovered during scanning
- * Checks if the discovered device matches any target BMS MAC address
+ * Checks if the discovered device matches any target BMS MAC address. With
+ * the controller accept list active (scan_filter.h) only configured devices
+ * get here; this match is the fallback for open scans.
  * @param advertisedDevice Pointer to the discovered BLE device
  */
 void ScanCallbacks::onResult(const NimBLEAdvertisedDevice* advertisedDevice) {
   DEBUG_PRINTF("BLE Device found: %s\n", advertisedDevice->toString().c_str());
+  const std::string address = advertisedDevice->getAddress().toString();
+  int matched = -1;
   for (int i = 0; i < bmsDeviceCount; i++) {
     if (jkBmsDevices[i].targetMAC.empty()) continue;  // Skip empty MAC addresses
-    if (advertisedDevice->getAddress().toString() == jkBmsDevices[i].targetMAC && !jkBmsDevices[i].connected && !jkBmsDevices[i].doConnect) {
+    if (address != jkBmsDevices[i].targetMAC) continue;
+    matched = i;
+    phyRecordRssi(jkBmsDevices[i].phy, advertisedDevice->getRSSI());
+    jkBmsDevices[i].warm.addressType = advertisedDevice->getAddress().getType();
+    if (!jkBmsDevices[i].connected && !jkBmsDevices[i].doConnect) {
       jkBmsDevices[i].advDevice = advertisedDevice;
       jkBmsDevices[i].doConnect = true;
       DEBUG_PRINTF("Found target device: %s\n", jkBmsDevices[i].targetMAC.c_str());
     }
   }
+  scanFilterResult(matched);
+  linkStatsScanResult(matched >= 0);
 }
 
 //********************************************
@@ -630,17 +720,20 @@ void ScanCallbacks::onResult(const NimBLEAdvertisedDevice* advertisedDevice) {
 
 /**
  * Global BLE notification callback function
- * Routes incoming notifications to the appropriate JKBMS instance
+ * Routes incoming notifications to the appropriate JKBMS instance, through
+ * the device's shard task once the shards are started (device_shards.h),
+ * and copies them to the USB capture stream if enabled (usb_stream.h)
  * @param pChr Pointer to the characteristic that sent the notification
  * @param pData Pointer to the received data
  * @param length Length of the received data
  * @param isNotify Boolean indicating if this is a notification (vs indication)
  */
-void notifyCB(NimBLERemoteCharacteristic* pChr, uint8_t* pData, size_t length, bool isNotify) {
+void JKBMS_HOT notifyCB(NimBLERemoteCharacteristic* pChr, uint8_t* pData, size_t length, bool isNotify) {
   DEBUG_PRINTLN("Notification received...");
   for (int i = 0; i < bmsDeviceCount; i++) {
     if (jkBmsDevices[i].pChr == pChr) {
-      jkBmsDevices[i].handleNotification(pData, length);
+      usbStreamNotification(jkBmsDevices[i], pData, length);
+      shardNotify(jkBmsDevices[i], pData, length);
       break;
     }
   }
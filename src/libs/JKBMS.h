@@ -4,6 +4,13 @@
 #include <Arduino.h>
 #include <NimBLEDevice.h>
 #include <string>
+#include "notify_profile.h"
+#include "link_stats.h"
+#include "phy_policy.h"
+#include "protocol_variant.h"
+#include "checkpoint.h"
+#include "init_phases.h"
+#include "jk_decoder.h"
 
 // Forward declarations
 class NimBLERemoteCharacteristic;
@@ -11,6 +18,9 @@ class NimBLEAdvertisedDevice;
 
 #define DEBUG_ENABLED false
 
+// Cell slots per pack: JK02 reports 16 cells, JK04 up to 24
+#define JKBMS_MAX_CELLS 24
+
 // Debug output function type
 typedef void (*DebugPrintFunc)(const char* format, ...);
 typedef void (*DebugPrintlnFunc)(const char* message);
@@ -34,7 +44,7 @@ extern DebugPrintSimpleFunc debugPrintSimpleFunc;
 
 class JKBMS {
 public:
-  JKBMS(const std::string& mac);
+  JKBMS(const std::string& mac = "");
 
   // BLE Components
   NimBLERemoteCharacteristic* pChr = nullptr;
@@ -44,6 +54,13 @@ public:
   uint32_t lastNotifyTime = 0;
   std::string targetMAC;
 
+  // Radio accounting (bytes, fragments, estimated airtime)
+  LinkStats linkStats = {};
+  // PHY preference, negotiated PHY and per-PHY frame latency
+  PhyState phy = {};
+  // Restored from a checkpoint at boot (checkpoint.h)
+  WarmState warm = {};
+
   // Data Processing
   byte receivedBytes[320];
   int frame = 0;
@@ -52,9 +69,18 @@ public:
   bool new_data = false;
   int ignoreNotifyCount = 0;
 
+  // Protocol variant: set to force one, PROTOCOL_AUTO detects it per device
+  ProtocolVariant protocol = PROTOCOL_AUTO;
+  ProtocolVariant detectedProtocol = PROTOCOL_AUTO;
+
+  // Incremented after every parsed cell frame; sequence of the flat snapshot (snapshot.h)
+  uint32_t snapshotVersion = 0;
+  // Seqlock (gateway_sync.h) over the cell-frame fields, odd while a frame is parsed into them
+  volatile uint32_t parseSequence = 0;
+
   // BMS Data Fields
-  float cellVoltage[16] = { 0 };
-  float wireResist[16] = { 0 };
+  float cellVoltage[JKBMS_MAX_CELLS] = { 0 };
+  float wireResist[JKBMS_MAX_CELLS] = { 0 };
   float Average_Cell_Voltage = 0;
   float Delta_Cell_Voltage = 0;
   float Battery_Voltage = 0;
@@ -106,14 +132,25 @@ public:
 
   // Methods
   bool connectToServer();
+  NimBLEAddress peerAddress() const;
   void parseDeviceInfo();
   void parseData();
+  void parseDataJk04();
+  ProtocolVariant activeProtocol() const;
   void bms_settings();
   void writeRegister(uint8_t address, uint32_t value, uint8_t length);
   void handleNotification(uint8_t* pData, size_t length);
   void enableBMSFunctions();
+  // cell_count as an index bound into cellVoltage/wireResist
+  int cellCountClamped() const {
+    return cell_count < 0 ? 0 : cell_count > JKBMS_MAX_CELLS ? JKBMS_MAX_CELLS : cell_count;
+  }
 
 private:
+  // Frames are decoded by JkDefaultDecoder (jk_decoder.h) into a JkCellData and copied into the fields
+  void loadCells(JkDefaultDecoder::Cells& c) const;
+  void storeCells(const JkDefaultDecoder::Cells& c, int cells);
+  bool requestAndWait(uint8_t command, InitPhase phase);
   uint8_t crc(const uint8_t data[], uint16_t len);
 };
 
@@ -124,6 +161,7 @@ public:
   ClientCallbacks(JKBMS* bmsInstance);
   void onConnect(NimBLEClient* pClient) override;
   void onDisconnect(NimBLEClient* pClient, int reason) override;
+  void onPhyUpdate(NimBLEClient* pClient, uint8_t txPhy, uint8_t rxPhy) override;
 };
 
 class ScanCallbacks : public NimBLEScanCallbacks {
@@ -0,0 +1,301 @@
+/**
+ * @file charge_limits.cpp
+ * @brief CVL/CCL/DCL engine and its cell-frame handler
+ */
+
+#include "charge_limits.h"
+#include "JKBMS.h"
+#include "frame_handlers.h"
+#include "gateway_sync.h"
+
+#include <math.h>
+
+//****************************************************
+// Engine
+//****************************************************
+
+void chargeLimitInit(ChargeLimitState& state, const ChargeLimitConfig* config) {
+  state = ChargeLimitState();
+  if (config) state.config = *config;
+}
+
+void chargeLimitDefaults(ChargeLimitInput& in) {
+  if (in.ovpV <= 0) in.ovpV = 3.65f;
+  if (in.uvpV <= 0) in.uvpV = 2.80f;
+  if (in.chargeOtC == 0) in.chargeOtC = 55.0f;
+  if (in.dischargeOtC == 0) in.dischargeOtC = 60.0f;
+  if (in.mosOtC == 0) in.mosOtC = 80.0f;
+  // 0 °C is a valid charge under-temperature limit and also the default
+}
+
+// Cell extremes over the cells present; the parser leaves 0 for the others
+static void cellExtremes(const float* cellV, int count, ChargeLimitInput& in) {
+  in.cellMinV = 0;
+  in.cellMaxV = 0;
+  for (int c = 0; c < count; c++) {
+    const float v = cellV[c];
+    if (v <= 0) continue;
+    if (in.cellMinV == 0 || v < in.cellMinV) in.cellMinV = v;
+    if (v > in.cellMaxV) in.cellMaxV = v;
+  }
+}
+
+// T2 reads 0 on packs with a single probe
+static void temperatures(float t1, float t2, ChargeLimitInput& in) {
+  in.tempMinC = t1;
+  in.tempMaxC = t1;
+  if (t2 != 0) {
+    if (t2 < in.tempMinC) in.tempMinC = t2;
+    if (t2 > in.tempMaxC) in.tempMaxC = t2;
+  }
+}
+
+void chargeLimitInputFromBms(const JKBMS& bms, ChargeLimitInput& in) {
+  in = ChargeLimitInput();
+  in.frameMs = millis();
+  in.sequence = bms.snapshotVersion;
+  in.cellCount = bms.cellCountClamped();
+  cellExtremes(bms.cellVoltage, in.cellCount, in);
+  in.batteryV = bms.Battery_Voltage;
+  temperatures(bms.Battery_T1, bms.Battery_T2, in);
+  in.mosC = bms.MOS_Temp;
+  in.charge = bms.Charge;
+  in.discharge = bms.Discharge;
+  in.ovpV = bms.cell_voltage_overvoltage_protection;
+  in.uvpV = bms.cell_voltage_undervoltage_protection;
+  in.maxChargeA = bms.max_charge_current;
+  in.maxDischargeA = bms.max_discharge_current;
+  in.chargeOtC = bms.charge_overtemperature_protection;
+  in.chargeUtC = bms.charge_undertemperature_protection;
+  in.dischargeOtC = bms.discharge_overtemperature_protection;
+  in.mosOtC = bms.power_tube_overtemperature_protection;
+  chargeLimitDefaults(in);
+}
+
+void chargeLimitInputFromSnapshot(const JkSnapshot& snap, const ChargeLimitInput& settings, ChargeLimitInput& in) {
+  in = settings;
+  const JkSnapshotHeader& h = snap.header;
+  in.frameMs = h.timestampMs;
+  in.sequence = h.sequence;
+  in.cellCount = h.cellCount < JKBMS_SNAPSHOT_CELLS ? h.cellCount : JKBMS_SNAPSHOT_CELLS;
+  float cellV[JKBMS_SNAPSHOT_CELLS];
+  for (int c = 0; c < in.cellCount; c++) cellV[c] = snap.cellMv[c] * 0.001f;
+  cellExtremes(cellV, in.cellCount, in);
+  in.batteryV = snap.batteryMv * 0.001f;
+  temperatures(snap.t1DeciC * 0.1f, snap.t2DeciC * 0.1f, in);
+  in.mosC = snap.mosDeciC * 0.1f;
+  in.charge = h.flags & SNAPSHOT_CHARGE;
+  in.discharge = h.flags & SNAPSHOT_DISCHARGE;
+  chargeLimitDefaults(in);
+}
+
+// Narrowest cell-voltage ramp: a knee at or past the stop voltage is moved this far to its safe side
+static const float MIN_CELL_RAMP_V = 0.02f;
+
+/**
+ * Limit that falls as x rises: 1 up to the knee, 0 from the stop on
+ * A knee closer than minWidth to the stop, or past it (a BMS protection set
+ * at or inside the knee), is moved below the stop: the limit never comes
+ * back up as x goes further towards the protection.
+ * Example: rampDown(cellMax, 3.40, 3.60, MIN_CELL_RAMP_V).
+ */
+static float rampDown(float x, float knee, float stop, float minWidth) {
+  if (knee > stop - minWidth) knee = stop - minWidth;
+  if (x >= stop) return 0.0f;
+  if (x <= knee) return 1.0f;
+  return (stop - x) / (stop - knee);
+}
+
+// Limit that falls as x drops: 1 down to the knee, 0 from the stop on, e.g. rampUp(temp, 5, 0, 0)
+static float rampUp(float x, float knee, float stop, float minWidth) {
+  if (knee < stop + minWidth) knee = stop + minWidth;
+  if (x <= stop) return 0.0f;
+  if (x >= knee) return 1.0f;
+  return (x - stop) / (knee - stop);
+}
+
+// Down to the inverter resolution, never above the computed limit
+static float roundDown(float x, float step) {
+  return floorf(x / step + 1e-3f) * step;
+}
+
+// Down at once, up at most by rate * dt
+static float slew(float target, float previous, float ratePerS, uint32_t dtMs, uint16_t& reasons) {
+  if (target <= previous) return target;
+  const float limit = previous + ratePerS * dtMs * 0.001f;
+  if (target <= limit) return target;
+  reasons |= LIMIT_RAMP;
+  return limit;
+}
+
+const ChargeLimits& chargeLimitFrame(ChargeLimitState& state, const ChargeLimitInput& in) {
+  const ChargeLimitConfig& cfg = state.config;
+  uint16_t reasons = 0;
+
+  // Charge current
+  float maxCharge = in.maxChargeA;
+  if (cfg.maxChargeA > 0 && (maxCharge <= 0 || cfg.maxChargeA < maxCharge)) maxCharge = cfg.maxChargeA;
+  const float chargeStopV = in.ovpV - cfg.cellMarginV;
+  const float kCell = rampDown(in.cellMaxV, cfg.chargeKneeV, chargeStopV, MIN_CELL_RAMP_V);
+  const float kHot = rampDown(in.tempMaxC, in.chargeOtC - cfg.tempKneeC, in.chargeOtC, 0);
+  const float kCold = rampUp(in.tempMinC, in.chargeUtC + cfg.tempKneeC, in.chargeUtC, 0);
+  const float kMos = rampDown(in.mosC, in.mosOtC - cfg.tempKneeC, in.mosOtC, 0);
+  if (kCell < 1) reasons |= LIMIT_CELL_HIGH;
+  if (kHot < 1 || kCold < 1) reasons |= LIMIT_CHARGE_TEMP;
+  if (kMos < 1) reasons |= LIMIT_MOS_TEMP;
+  float ccl = maxCharge * fminf(fminf(kCell, kMos), fminf(kHot, kCold));
+
+  // Discharge current
+  float maxDischarge = in.maxDischargeA;
+  if (cfg.maxDischargeA > 0 && (maxDischarge <= 0 || cfg.maxDischargeA < maxDischarge)) maxDischarge = cfg.maxDischargeA;
+  const float dischargeStopV = in.uvpV + cfg.cellMarginV;
+  const float kLow = rampUp(in.cellMinV, cfg.dischargeKneeV, dischargeStopV, MIN_CELL_RAMP_V);
+  const float kHotD = rampDown(in.tempMaxC, in.dischargeOtC - cfg.tempKneeC, in.dischargeOtC, 0);
+  if (kLow < 1) reasons |= LIMIT_CELL_LOW;
+  if (kHotD < 1) reasons |= LIMIT_DISCHARGE_TEMP;
+  float dcl = maxDischarge * fminf(fminf(kLow, kHotD), kMos);
+
+  if (!in.charge) ccl = 0;
+  if (!in.discharge) dcl = 0;
+  if (!in.charge || !in.discharge) reasons |= LIMIT_MOSFET_OFF;
+
+  // Charge voltage: hold the highest cell at the target
+  float cvl = in.cellCount * cfg.cellTargetV;
+  const float excess = in.cellMaxV - cfg.cellTargetV;
+  if (excess > 0 && in.batteryV > 0) {
+    reasons |= LIMIT_CELL_HIGH;
+    const float held = in.batteryV - excess;
+    if (held < cvl) cvl = held;
+  }
+  const float cvlFloor = in.cellCount * cfg.cvlMinCellV;
+  if (cvl < cvlFloor) cvl = cvlFloor;
+
+  // Ramps from the previous frame; after a gap the currents start from zero
+  ChargeLimits& out = state.out;
+  const uint32_t dtMs = state.haveFrame ? in.frameMs - state.lastFrameMs : 0;
+  if (!state.haveFrame || dtMs > cfg.staleMs) {
+    out.ccl = 0;
+    out.dcl = 0;
+    out.cvl = cvl;
+  }
+  out.ccl = roundDown(slew(ccl, out.ccl, cfg.rampUpAps, dtMs, reasons), 0.1f);
+  out.dcl = roundDown(slew(dcl, out.dcl, cfg.rampUpAps, dtMs, reasons), 0.1f);
+  out.cvl = roundDown(slew(cvl, out.cvl, cfg.cvlRampVps, dtMs, reasons), 0.01f);
+  out.sequence = in.sequence;
+  out.frameMs = in.frameMs;
+  out.reasons = reasons;
+  state.haveFrame = true;
+  state.lastFrameMs = in.frameMs;
+  state.updates++;
+  return out;
+}
+
+ChargeLimits chargeLimitAt(const ChargeLimits& limits, const ChargeLimitConfig& config, uint32_t nowMs) {
+  ChargeLimits out = limits;
+  if (nowMs - limits.frameMs > config.staleMs) {
+    out.ccl = 0;
+    out.dcl = 0;
+    out.reasons |= LIMIT_STALE;
+  }
+  return out;
+}
+
+//****************************************************
+// Gateway
+//****************************************************
+
+static ChargeLimitState states[JKBMS_LIMIT_DEVICES];
+// Seqlock per device: the parsing task writes, any task reads
+static Seqlocked<ChargeLimits> published[JKBMS_LIMIT_DEVICES];
+static ChargeLimitConfig attachedConfig;
+static ChargeLimitSink limitSink = nullptr;
+static void* limitSinkCtx = nullptr;
+static bool attached = false;
+static uint32_t computeUsMax = 0;
+
+static void onCellFrame(const FrameView& frame, void* ctx) {
+  const int device = (int)(frame.device - jkBmsDevices);
+  if (device < 0 || device >= JKBMS_LIMIT_DEVICES) return;
+  const uint32_t start = micros();
+  ChargeLimitInput in;
+  chargeLimitInputFromBms(*frame.device, in);
+  const ChargeLimits& limits = chargeLimitFrame(states[device], in);
+  seqlockStore(published[device], limits);
+  const uint32_t us = micros() - start;
+  if (us > computeUsMax) computeUsMax = us;
+  if (limitSink) limitSink(device, limits, limitSinkCtx);
+}
+
+bool chargeLimitsAttach(const ChargeLimitConfig* config, ChargeLimitSink sink, void* ctx) {
+  if (attached) unregisterFrameHandler(onCellFrame);
+  attachedConfig = config ? *config : ChargeLimitConfig();
+  for (int i = 0; i < JKBMS_LIMIT_DEVICES; i++) chargeLimitInit(states[i], &attachedConfig);
+  limitSink = sink;
+  limitSinkCtx = ctx;
+  attached = registerFrameHandler(0x02, onCellFrame);
+  return attached;
+}
+
+bool chargeLimitsRead(int device, ChargeLimits& out) {
+  if (device < 0 || device >= JKBMS_LIMIT_DEVICES) return false;
+  return seqlockLoad(published[device], out) != 0;
+}
+
+bool chargeLimitsAggregate(uint32_t nowMs, ChargeLimits& out) {
+  out = ChargeLimits();
+  int packs = 0, missing = 0;
+  float ccl = 0, dcl = 0;
+  const int count = bmsDeviceCount < JKBMS_LIMIT_DEVICES ? bmsDeviceCount : JKBMS_LIMIT_DEVICES;
+  for (int i = 0; i < count; i++) {
+    if (jkBmsDevices[i].targetMAC.empty()) continue;
+    ChargeLimits pack;
+    // A read that keeps meeting a writer is retried: it is not a missing pack
+    bool read = false;
+    for (int attempt = 0; attempt < 4 && !read; attempt++) read = chargeLimitsRead(i, pack);
+    if (read) pack = chargeLimitAt(pack, attachedConfig, nowMs);
+    if (!jkBmsDevices[i].connected || !read || (pack.reasons & LIMIT_STALE)) {
+      missing++;
+      continue;
+    }
+    if (!packs || pack.cvl < out.cvl) out.cvl = pack.cvl;
+    if (!packs || pack.ccl < ccl) ccl = pack.ccl;
+    if (!packs || pack.dcl < dcl) dcl = pack.dcl;
+    if (!packs || (int32_t)(pack.frameMs - out.frameMs) < 0) out.frameMs = pack.frameMs;
+    out.reasons |= pack.reasons;
+    packs++;
+  }
+  if (!packs) {
+    out.reasons = LIMIT_STALE;
+    return false;
+  }
+  out.ccl = ccl * packs;
+  out.dcl = dcl * packs;
+  if (!missing) return true;
+  // The missing packs' share would land on the others: only the safe currents
+  if (out.ccl > attachedConfig.safeChargeA) out.ccl = attachedConfig.safeChargeA;
+  if (out.dcl > attachedConfig.safeDischargeA) out.dcl = attachedConfig.safeDischargeA;
+  out.reasons |= LIMIT_STALE;
+  return false;
+}
+
+void chargeLimitsEmit(MetricsEmitFunc emit, void* ctx) {
+  if (!attached) return;
+  char name[64];
+  const uint32_t now = millis();
+  const int count = bmsDeviceCount < JKBMS_LIMIT_DEVICES ? bmsDeviceCount : JKBMS_LIMIT_DEVICES;
+  for (int i = 0; i < count; i++) {
+    ChargeLimits limits;
+    if (jkBmsDevices[i].targetMAC.empty() || !chargeLimitsRead(i, limits)) continue;
+    limits = chargeLimitAt(limits, attachedConfig, now);
+    const char* mac = jkBmsDevices[i].targetMAC.c_str();
+    snprintf(name, sizeof(name), "limits.%s.cvl", mac);
+    emit(name, limits.cvl, ctx);
+    snprintf(name, sizeof(name), "limits.%s.ccl", mac);
+    emit(name, limits.ccl, ctx);
+    snprintf(name, sizeof(name), "limits.%s.dcl", mac);
+    emit(name, limits.dcl, ctx);
+    snprintf(name, sizeof(name), "limits.%s.reasons", mac);
+    emit(name, limits.reasons, ctx);
+  }
+  emit("limits.compute_us_max", computeUsMax, ctx);
+}
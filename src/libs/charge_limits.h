@@ -0,0 +1,162 @@
+#ifndef CHARGE_LIMITS_H
+#define CHARGE_LIMITS_H
+
+#include <Arduino.h>
+#include "metrics.h"
+#include "snapshot.h"
+
+class JKBMS;
+
+/**
+ * Charge voltage / charge current / discharge current limits (CVL/CCL/DCL)
+ *
+ * Computed for the inverter from every parsed cell frame:
+ * - CCL: the BMS max_charge_current (or a lower configured maximum), ramped
+ *   down linearly as the highest cell goes from chargeKneeV to
+ *   cellMarginV below cell_voltage_overvoltage_protection, as the
+ *   temperatures approach the charge over/under-temperature protections and
+ *   the MOSFET temperature its protection (tempKneeC wide ramps). A
+ *   protection set at or inside the knee moves the knee just below the
+ *   stop voltage, so the limit only ever falls towards the protection;
+ * - DCL: the same for discharge, from the lowest cell towards
+ *   cell_voltage_undervoltage_protection and the discharge temperature;
+ * - CVL: cellCount * cellTargetV, lowered by the excess of the highest cell
+ *   over cellTargetV so an unbalanced pack is not pushed further.
+ * A MOSFET the BMS has switched off zeroes its current. Limits go down at
+ * once and come back up at rampUpAps / cvlRampVps; after a gap longer than
+ * staleMs the currents restart from zero.
+ *
+ * The engine (chargeLimitFrame()) is a pure function of its state, the
+ * frame input and the frame time: a recorded snapshot trace replayed on the
+ * host (host/limits_replay.cpp) gives the same limits as the gateway did.
+ * Outputs are rounded down to the resolution inverters take (0.1 A, 0.01 V).
+ *
+ * On the gateway chargeLimitsAttach() runs the engine in a cell-frame
+ * handler, in the same call that completed the frame: the limits lag the
+ * last fragment by the parse and an O(cells) computation only, and the
+ * worst case is published as limits.compute_us_max.
+ */
+
+#ifndef JKBMS_LIMIT_DEVICES
+#define JKBMS_LIMIT_DEVICES 8
+#endif
+
+struct ChargeLimitConfig {
+  float cellTargetV = 3.45f;      // CVL per cell; the highest cell is held here
+  float cvlMinCellV = 3.35f;      // CVL never goes below this per cell
+  float chargeKneeV = 3.40f;      // highest cell above: CCL ramps down...
+  float dischargeKneeV = 3.05f;   // lowest cell below: DCL ramps down...
+  float cellMarginV = 0.05f;      // ...to zero this far inside the BMS cell protections
+  float tempKneeC = 5.0f;         // width of the temperature ramps
+  // 0: the BMS max_charge_current / max_discharge_current. Set them for JK04
+  // packs, whose settings frame is not decoded: an unknown maximum gives 0 A
+  float maxChargeA = 0;
+  float maxDischargeA = 0;
+  float rampUpAps = 10.0f;        // A/s; reductions are immediate
+  float cvlRampVps = 0.2f;        // V/s
+  uint32_t staleMs = 5000;        // no frame for this long: CCL = DCL = 0
+  // chargeLimitsAggregate() while a configured pack has no recent frame
+  float safeChargeA = 0;
+  float safeDischargeA = 0;
+};
+
+// Everything the engine reads from one frame plus the BMS settings
+struct ChargeLimitInput {
+  uint32_t frameMs;               // when the frame was parsed
+  uint32_t sequence;
+  uint8_t cellCount;
+  float cellMinV;
+  float cellMaxV;
+  float batteryV;
+  float tempMinC;                 // T1/T2
+  float tempMaxC;
+  float mosC;
+  bool charge;                    // MOSFET states
+  bool discharge;
+  // BMS settings; 0 (not read yet) falls back to chargeLimitDefaults()
+  float ovpV;
+  float uvpV;
+  float maxChargeA;
+  float maxDischargeA;
+  float chargeOtC;
+  float chargeUtC;
+  float dischargeOtC;
+  float mosOtC;
+};
+
+enum ChargeLimitReason {
+  LIMIT_CELL_HIGH = 1 << 0,       // CCL / CVL by the highest cell
+  LIMIT_CELL_LOW = 1 << 1,        // DCL by the lowest cell
+  LIMIT_CHARGE_TEMP = 1 << 2,
+  LIMIT_DISCHARGE_TEMP = 1 << 3,
+  LIMIT_MOS_TEMP = 1 << 4,
+  LIMIT_MOSFET_OFF = 1 << 5,
+  LIMIT_RAMP = 1 << 6,            // still coming back up
+  LIMIT_STALE = 1 << 7,           // no recent frame
+};
+
+struct ChargeLimits {
+  float cvl;                      // V
+  float ccl;                      // A
+  float dcl;                      // A
+  uint32_t sequence;              // frame the limits come from
+  uint32_t frameMs;
+  uint16_t reasons;               // ChargeLimitReason bits
+};
+
+struct ChargeLimitState {
+  ChargeLimitConfig config;
+  bool haveFrame;
+  uint32_t lastFrameMs;
+  ChargeLimits out;
+  uint32_t updates;
+};
+
+void chargeLimitInit(ChargeLimitState& state, const ChargeLimitConfig* config = nullptr);
+
+// LFP defaults for BMS settings that have not been read: 3.65 / 2.80 V, 0 °C to 55 °C, MOS 80 °C
+void chargeLimitDefaults(ChargeLimitInput& in);
+
+void chargeLimitInputFromBms(const JKBMS& bms, ChargeLimitInput& in);
+// Settings are copied from the template (a snapshot carries no settings)
+void chargeLimitInputFromSnapshot(const JkSnapshot& snap, const ChargeLimitInput& settings, ChargeLimitInput& in);
+
+// Run the engine on one frame; deterministic
+const ChargeLimits& chargeLimitFrame(ChargeLimitState& state, const ChargeLimitInput& in);
+
+// Limits as seen at nowMs: zero currents if the frame is older than staleMs
+ChargeLimits chargeLimitAt(const ChargeLimits& limits, const ChargeLimitConfig& config, uint32_t nowMs);
+
+//****************************************************
+// Gateway
+//****************************************************
+
+typedef void (*ChargeLimitSink)(int device, const ChargeLimits& limits, void* ctx);
+
+/**
+ * Compute the limits of the first JKBMS_LIMIT_DEVICES devices on every cell frame
+ * @param sink Called with the new limits right after they are computed, on
+ *             the task that parsed the frame; keep it short
+ * @return false if no frame-handler slot is free
+ */
+bool chargeLimitsAttach(const ChargeLimitConfig* config = nullptr, ChargeLimitSink sink = nullptr, void* ctx = nullptr);
+
+// Latest limits of one device, from any task; false if none yet
+bool chargeLimitsRead(int device, ChargeLimits& out);
+
+/**
+ * Limits for packs in parallel on one inverter
+ * CVL is the lowest of the packs, CCL/DCL the lowest times the number of
+ * packs: current splits about evenly, so no pack gets more than its own
+ * limit. While a configured pack is disconnected or has no recent frame its
+ * share would fall on the others, so CCL/DCL drop to safeChargeA /
+ * safeDischargeA (0 by default) and LIMIT_STALE is set.
+ * @return false if a configured pack has no recent frame (zero currents and
+ *         CVL if none has)
+ */
+bool chargeLimitsAggregate(uint32_t nowMs, ChargeLimits& out);
+
+// Metrics source: limits.<mac>.cvl/ccl/dcl, limits.compute_us_max
+void chargeLimitsEmit(MetricsEmitFunc emit, void* ctx);
+
+#endif // CHARGE_LIMITS_H
@@ -0,0 +1,252 @@
+/**
+ * @file checkpoint.cpp
+ * @brief Per-device checkpoints in RTC memory and NVS for warm restarts
+ *
+ * RTC slow memory keeps its content across software, watchdog and panic
+ * resets (including the reboot after an OTA update) but not across a power
+ * cycle; NVS keeps it across everything but costs a flash write. Records are
+ * written to RTC every JKBMS_CHECKPOINT_RTC_MS and to NVS far less often;
+ * at boot the newest valid copy of each device wins.
+ *
+ * Records are matched to devices by MAC, so reordering jkBmsDevices[] in a
+ * firmware update does not mix packs up.
+ */
+
+#include "checkpoint.h"
+#include "JKBMS.h"
+
+#if defined(ESP_PLATFORM)
+#include <Preferences.h>
+#include <esp_attr.h>
+#endif
+
+// Settings frame fields, in DeviceCheckpoint::settings order (append only)
+static float JKBMS::* const settingsFields[CHECKPOINT_SETTINGS] = {
+  &JKBMS::balance_trigger_voltage,
+  &JKBMS::cell_voltage_undervoltage_protection,
+  &JKBMS::cell_voltage_undervoltage_recovery,
+  &JKBMS::cell_voltage_overvoltage_protection,
+  &JKBMS::cell_voltage_overvoltage_recovery,
+  &JKBMS::power_off_voltage,
+  &JKBMS::max_charge_current,
+  &JKBMS::charge_overcurrent_protection_delay,
+  &JKBMS::charge_overcurrent_protection_recovery_time,
+  &JKBMS::max_discharge_current,
+  &JKBMS::discharge_overcurrent_protection_delay,
+  &JKBMS::discharge_overcurrent_protection_recovery_time,
+  &JKBMS::short_circuit_protection_recovery_time,
+  &JKBMS::max_balance_current,
+  &JKBMS::charge_overtemperature_protection,
+  &JKBMS::charge_overtemperature_protection_recovery,
+  &JKBMS::discharge_overtemperature_protection,
+  &JKBMS::discharge_overtemperature_protection_recovery,
+  &JKBMS::charge_undertemperature_protection,
+  &JKBMS::charge_undertemperature_protection_recovery,
+  &JKBMS::power_tube_overtemperature_protection,
+  &JKBMS::power_tube_overtemperature_protection_recovery,
+  &JKBMS::total_battery_capacity,
+  &JKBMS::short_circuit_protection_delay,
+  &JKBMS::balance_starting_voltage,
+};
+
+#if defined(ESP_PLATFORM)
+RTC_NOINIT_ATTR static DeviceCheckpoint rtcStore[JKBMS_CHECKPOINT_DEVICES];
+static const char* const NVS_NAMESPACE = "jkbms_ckpt";
+#else
+// Host builds: process memory stands in for both stores and outlives the
+// gateway restarts simulated by the benchmarks
+static DeviceCheckpoint rtcStore[JKBMS_CHECKPOINT_DEVICES];
+static DeviceCheckpoint nvsStore[JKBMS_CHECKPOINT_DEVICES];
+#endif
+
+struct CheckpointSlot {
+  uint32_t generation;
+  uint32_t savedVersion;    // JKBMS::snapshotVersion at the last RTC write
+  uint32_t lastRtcMs;
+  uint32_t lastNvsMs;
+  bool nvsWritten;          // written to NVS since boot
+};
+
+static CheckpointSlot slots[JKBMS_CHECKPOINT_DEVICES];
+static CheckpointCounters counters;
+
+static int checkpointDevices() {
+  return bmsDeviceCount < JKBMS_CHECKPOINT_DEVICES ? bmsDeviceCount : JKBMS_CHECKPOINT_DEVICES;
+}
+
+static void seal(DeviceCheckpoint& record) {
+  record.crc = snapshotCrc((const uint8_t*)&record, offsetof(DeviceCheckpoint, crc));
+}
+
+static bool recordValid(const DeviceCheckpoint& record) {
+  return record.magic == JKBMS_CHECKPOINT_MAGIC && record.version == JKBMS_CHECKPOINT_VERSION &&
+         record.size == sizeof(DeviceCheckpoint) &&
+         record.crc == snapshotCrc((const uint8_t*)&record, offsetof(DeviceCheckpoint, crc)) &&
+         snapshotView(&record.last, sizeof(record.last)) != nullptr;
+}
+
+//****************************************************
+// NVS
+//****************************************************
+
+static bool nvsRead(int slot, DeviceCheckpoint& out) {
+#if defined(ESP_PLATFORM)
+  Preferences prefs;
+  if (!prefs.begin(NVS_NAMESPACE, true)) return false;
+  char key[8];
+  snprintf(key, sizeof(key), "dev%d", slot);
+  size_t n = prefs.getBytes(key, &out, sizeof(out));
+  prefs.end();
+  return n == sizeof(out);
+#else
+  out = nvsStore[slot];
+  return true;
+#endif
+}
+
+static void nvsWrite(int slot, const DeviceCheckpoint& record) {
+#if defined(ESP_PLATFORM)
+  Preferences prefs;
+  if (!prefs.begin(NVS_NAMESPACE, false)) return;
+  char key[8];
+  snprintf(key, sizeof(key), "dev%d", slot);
+  prefs.putBytes(key, &record, sizeof(record));
+  prefs.end();
+#else
+  nvsStore[slot] = record;
+#endif
+  counters.nvsWrites++;
+}
+
+//****************************************************
+// Records
+//****************************************************
+
+void checkpointFromBms(const JKBMS& bms, DeviceCheckpoint& out) {
+  memset(&out, 0, sizeof(out));
+  out.magic = JKBMS_CHECKPOINT_MAGIC;
+  out.version = JKBMS_CHECKPOINT_VERSION;
+  out.size = sizeof(DeviceCheckpoint);
+  macToBytes(bms.targetMAC.c_str(), out.mac);
+  out.addressType = bms.warm.addressType;
+  out.protocol = bms.detectedProtocol;
+  out.phy = bms.linkStats.phy;
+  out.functionsEnabled = bms.warm.functionsEnabled;
+  out.chrHandle = bms.warm.chrHandle;
+  out.mtu = bms.linkStats.mtu;
+  out.connInterval = bms.linkStats.connInterval;
+  out.rssi = (int8_t)bms.phy.rssi;
+  out.cellCount = bms.cell_count;
+  for (int i = 0; i < CHECKPOINT_SETTINGS; i++) out.settings[i] = bms.*settingsFields[i];
+  snapshotFromBms(bms, out.last);
+  seal(out);
+}
+
+void checkpointToBms(const DeviceCheckpoint& in, JKBMS& bms) {
+  snapshotToBms(in.last, bms);
+  for (int i = 0; i < CHECKPOINT_SETTINGS; i++) bms.*settingsFields[i] = in.settings[i];
+  bms.cell_count = in.cellCount;
+  bms.detectedProtocol = (ProtocolVariant)in.protocol;
+  bms.linkStats.phy = in.phy;
+  bms.linkStats.mtu = in.mtu;
+  bms.linkStats.connInterval = in.connInterval;
+  bms.phy.rssi = in.rssi;
+  bms.warm.addressType = in.addressType;
+  bms.warm.chrHandle = in.chrHandle;
+  bms.warm.functionsEnabled = in.functionsEnabled;
+}
+
+//****************************************************
+// Restore and update
+//****************************************************
+
+int checkpointRestore() {
+  const int devices = checkpointDevices();
+  DeviceCheckpoint* nvs = new DeviceCheckpoint[JKBMS_CHECKPOINT_DEVICES];
+  bool nvsValid[JKBMS_CHECKPOINT_DEVICES];
+  for (int s = 0; s < JKBMS_CHECKPOINT_DEVICES; s++) nvsValid[s] = nvsRead(s, nvs[s]) && recordValid(nvs[s]);
+
+  int restored = 0;
+  for (int i = 0; i < devices; i++) {
+    JKBMS& bms = jkBmsDevices[i];
+    slots[i] = CheckpointSlot();
+    if (bms.targetMAC.empty()) continue;
+    uint8_t mac[6];
+    macToBytes(bms.targetMAC.c_str(), mac);
+
+    const DeviceCheckpoint* best = nullptr;
+    bool fromRtc = false;
+    for (int s = 0; s < JKBMS_CHECKPOINT_DEVICES; s++) {
+      const DeviceCheckpoint& r = rtcStore[s];
+      if (recordValid(r) && memcmp(r.mac, mac, 6) == 0 && (!best || r.generation > best->generation)) {
+        best = &r;
+        fromRtc = true;
+      }
+      const DeviceCheckpoint& n = nvs[s];
+      if (nvsValid[s] && memcmp(n.mac, mac, 6) == 0 && (!best || n.generation > best->generation)) {
+        best = &n;
+        fromRtc = false;
+      }
+    }
+    if (!best) continue;
+
+    checkpointToBms(*best, bms);
+    bms.warm.direct = true;
+    bms.doConnect = true;
+    slots[i].generation = best->generation;
+    slots[i].savedVersion = bms.snapshotVersion;
+    restored++;
+    if (fromRtc) counters.restoredFromRtc++;
+    DEBUG_PRINTF("%s restored from %s (frame %u)\n", bms.targetMAC.c_str(), fromRtc ? "RTC" : "NVS", bms.snapshotVersion);
+  }
+  delete[] nvs;
+
+  // Records of devices no longer configured are dropped from RTC memory
+  for (int s = devices; s < JKBMS_CHECKPOINT_DEVICES; s++) rtcStore[s].magic = 0;
+  counters.restored += restored;
+  return restored;
+}
+
+void checkpointUpdate() {
+  const uint32_t now = millis();
+  for (int i = 0; i < checkpointDevices(); i++) {
+    JKBMS& bms = jkBmsDevices[i];
+    CheckpointSlot& slot = slots[i];
+    if (bms.targetMAC.empty() || !bms.connected || bms.snapshotVersion == slot.savedVersion) continue;
+    bool rtcDue = now - slot.lastRtcMs >= JKBMS_CHECKPOINT_RTC_MS;
+    bool nvsDue = !slot.nvsWritten || now - slot.lastNvsMs >= JKBMS_CHECKPOINT_NVS_MS;
+    if (!rtcDue && !nvsDue) continue;
+
+    DeviceCheckpoint record;
+    checkpointFromBms(bms, record);
+    record.generation = ++slot.generation;
+    seal(record);
+    rtcStore[i] = record;
+    counters.rtcWrites++;
+    slot.lastRtcMs = now;
+    slot.savedVersion = bms.snapshotVersion;
+    if (nvsDue) {
+      nvsWrite(i, record);
+      slot.nvsWritten = true;
+      slot.lastNvsMs = now;
+    }
+  }
+}
+
+void checkpointWarmResult(bool connected) {
+  if (connected) counters.warmConnects++;
+  else counters.warmFallbacks++;
+}
+
+const CheckpointCounters& checkpointCounters() {
+  return counters;
+}
+
+void checkpointEmit(MetricsEmitFunc emit, void* ctx) {
+  emit("checkpoint.restored", counters.restored, ctx);
+  emit("checkpoint.restored_from_rtc", counters.restoredFromRtc, ctx);
+  emit("checkpoint.warm_connects", counters.warmConnects, ctx);
+  emit("checkpoint.warm_fallbacks", counters.warmFallbacks, ctx);
+  emit("checkpoint.rtc_writes", counters.rtcWrites, ctx);
+  emit("checkpoint.nvs_writes", counters.nvsWrites, ctx);
+}
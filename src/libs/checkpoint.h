@@ -0,0 +1,107 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <Arduino.h>
+#include "snapshot.h"
+#include "metrics.h"
+
+class JKBMS;
+
+// Devices checkpointed (the first ones in jkBmsDevices[])
+#ifndef JKBMS_CHECKPOINT_DEVICES
+#define JKBMS_CHECKPOINT_DEVICES 8
+#endif
+
+// RTC slow memory is rewritten often (survives watchdog, panic and OTA resets);
+// NVS rarely, to spare the flash (survives power loss)
+#ifndef JKBMS_CHECKPOINT_RTC_MS
+#define JKBMS_CHECKPOINT_RTC_MS 5000
+#endif
+#ifndef JKBMS_CHECKPOINT_NVS_MS
+#define JKBMS_CHECKPOINT_NVS_MS (15UL * 60 * 1000)
+#endif
+
+// Direct connects after a warm restart give up quickly and fall back to scanning
+static const uint32_t WARM_CONNECT_TIMEOUT_MS = 3000;
+
+static const int CHECKPOINT_SETTINGS = 25;
+
+/**
+ * Per-device warm-restart state
+ * Embedded in each JKBMS instance. Filled by checkpointRestore() at boot and
+ * consumed by the first connectToServer() call. The negotiated link
+ * parameters (interval, MTU, PHY) are kept in LinkStats.
+ */
+struct WarmState {
+  bool direct;              // connect by stored address, no scan needed
+  bool functionsEnabled;    // charge/discharge/balance were enabled in an earlier session
+  uint8_t addressType;      // BLE_ADDR_* of the peer
+  uint16_t chrHandle;       // ffe1 handle seen at the last discovery, 0 if unknown
+};
+
+/**
+ * Checkpoint record (one per device)
+ * Flat like JkSnapshot, so the same bytes go to RTC memory and to an NVS blob.
+ */
+#pragma pack(push, 1)
+struct DeviceCheckpoint {
+  uint32_t magic;           // JKBMS_CHECKPOINT_MAGIC
+  uint16_t version;
+  uint16_t size;
+  uint32_t generation;      // incremented on every write, newest copy wins
+  uint8_t mac[6];
+  uint8_t addressType;
+  uint8_t protocol;         // detected ProtocolVariant
+  uint8_t phy;
+  uint8_t functionsEnabled;
+  uint16_t chrHandle;
+  uint16_t mtu;
+  uint16_t connInterval;
+  int8_t rssi;
+  uint8_t cellCount;
+  float settings[CHECKPOINT_SETTINGS];  // BMS settings frame (0x01), see checkpoint.cpp
+  JkSnapshot last;          // last parsed cell frame, incl. capacity and cycle counters
+  uint16_t crc;
+};
+#pragma pack(pop)
+
+#define JKBMS_CHECKPOINT_MAGIC 0x504B434AUL  // "JCKP"
+#define JKBMS_CHECKPOINT_VERSION 1
+
+struct CheckpointCounters {
+  uint32_t restored;        // devices restored at boot
+  uint32_t restoredFromRtc;
+  uint32_t warmConnects;    // direct connects that succeeded
+  uint32_t warmFallbacks;   // direct connects that failed, device went back to scanning
+  uint32_t rtcWrites;
+  uint32_t nvsWrites;
+};
+
+/**
+ * Restore every configured device from RTC memory, else from NVS
+ * Call in setup() after NimBLEDevice::init(). Restored devices get their last
+ * values, settings and protocol back and are marked for a direct connect.
+ * @return Number of devices restored
+ */
+int checkpointRestore();
+
+/**
+ * Save connected devices when their interval elapsed; call from loop()
+ * A device is written to NVS once per boot as soon as it streams, then every
+ * JKBMS_CHECKPOINT_NVS_MS.
+ */
+void checkpointUpdate();
+
+// Copy a device into a record / a record into a device
+void checkpointFromBms(const JKBMS& bms, DeviceCheckpoint& out);
+void checkpointToBms(const DeviceCheckpoint& in, JKBMS& bms);
+
+// Called by connectToServer() with the outcome of a direct connect
+void checkpointWarmResult(bool connected);
+
+const CheckpointCounters& checkpointCounters();
+
+// Metrics source: checkpoint.*
+void checkpointEmit(MetricsEmitFunc emit, void* ctx);
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,352 @@
+/**
+ * @file device_shards.cpp
+ * @brief Per-core shard tasks for notification handling and their rebalancing
+ *
+ * Three parties touch the shard tables:
+ * - notifyCB (NimBLE host task) is the only producer: it assigns devices,
+ *   applies moves and posts to the queues;
+ * - each shard task consumes its queue and is the only writer of the state
+ *   of the devices it owns, including their busy time;
+ * - shardsUpdate() (loop task) reads the busy times and requests moves.
+ * Ownership and move requests are single-byte atomics; the counters are
+ * written by one party each and read unsynchronized by the others.
+ */
+
+#include "device_shards.h"
+#include "JKBMS.h"
+
+#include <atomic>
+
+#if defined(ESP_PLATFORM)
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#else
+#include <chrono>
+#endif
+
+enum ShardItemType : uint8_t {
+  SHARD_ITEM_DATA,
+  SHARD_ITEM_RELEASE,   // the sending shard is done with the device
+};
+
+struct ShardItem {
+  uint8_t type;
+  uint8_t device;
+  uint16_t length;
+  uint8_t data[JKBMS_SHARD_FRAGMENT];
+};
+
+static bool started = false;
+static ShardStats stats[JKBMS_SHARDS];
+
+// Producer side
+static std::atomic<uint8_t> owner[JKBMS_SHARD_DEVICES];
+static std::atomic<uint8_t> moveTo[JKBMS_SHARD_DEVICES];    // requested by shardsUpdate()
+static std::atomic<bool> released[JKBMS_SHARD_DEVICES];     // the owner may handle the device
+static bool present[JKBMS_SHARD_DEVICES];                   // connected since the last leave
+static std::atomic<bool> joined[JKBMS_SHARD_DEVICES];       // not yet seen by shardsUpdate()
+static std::atomic<bool> membershipChanged(false);
+
+// Owner side, read by shardsUpdate()
+static uint32_t deviceBusyUs[JKBMS_SHARD_DEVICES];
+
+// shardsUpdate() side
+static uint32_t lastBusyUs[JKBMS_SHARD_DEVICES];
+static uint32_t deviceLoadUs[JKBMS_SHARD_DEVICES];
+static uint32_t lastUpdateMs = 0;
+
+#if defined(ESP_PLATFORM)
+static QueueHandle_t queues[JKBMS_SHARDS];
+static const char* const taskNames[] = {"jk_shard0", "jk_shard1", "jk_shard2", "jk_shard3"};
+static_assert(JKBMS_SHARDS <= sizeof(taskNames) / sizeof(taskNames[0]), "add task names");
+
+static inline uint32_t busyClockUs() {
+  return micros();
+}
+#else
+// The shim's micros() is the simulation clock; the load is real CPU time
+static inline uint32_t busyClockUs() {
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+static int deviceIndex(const JKBMS& bms) {
+  const int index = (int)(&bms - jkBmsDevices);
+  return (index >= 0 && index < bmsDeviceCount && index < JKBMS_SHARD_DEVICES) ? index : -1;
+}
+
+static void handleTimed(int shard, int device, uint8_t* data, size_t length) {
+  const uint32_t start = busyClockUs();
+  jkBmsDevices[device].handleNotification(data, length);
+  const uint32_t us = busyClockUs() - start;
+  deviceBusyUs[device] += us;
+  stats[shard].busyUs += us;
+  stats[shard].notifications++;
+}
+
+#if defined(ESP_PLATFORM)
+static void shardTask(void* param) {
+  const int shard = (int)(intptr_t)param;
+  static ShardItem items[JKBMS_SHARDS];   // too large for the task stack
+  ShardItem& item = items[shard];
+  for (;;) {
+    if (xQueueReceive(queues[shard], &item, portMAX_DELAY) != pdTRUE) continue;
+    if (item.type == SHARD_ITEM_RELEASE) {
+      released[item.device].store(true);
+      continue;
+    }
+    // Moved here: the previous shard still has older notifications queued
+    if (!released[item.device].load()) {
+      stats[shard].handoverWaits++;
+      while (!released[item.device].load()) vTaskDelay(1);
+    }
+    handleTimed(shard, item.device, item.data, item.length);
+  }
+}
+#endif
+
+bool shardsStart() {
+  if (started) return true;   // setup() runs again after a simulated reboot
+  for (int d = 0; d < JKBMS_SHARD_DEVICES; d++) {
+    owner[d].store(SHARD_NONE);
+    moveTo[d].store(SHARD_NONE);
+    released[d].store(true);
+  }
+  for (int s = 0; s < JKBMS_SHARDS; s++) stats[s].core = s % 2;
+#if defined(ESP_PLATFORM)
+  for (int s = 0; s < JKBMS_SHARDS; s++) {
+    queues[s] = xQueueCreate(JKBMS_SHARD_QUEUE, sizeof(ShardItem));
+    if (!queues[s]) return false;
+  }
+  for (int s = 0; s < JKBMS_SHARDS; s++) {
+    if (xTaskCreatePinnedToCore(shardTask, taskNames[s], JKBMS_SHARD_STACK, (void*)(intptr_t)s,
+                                JKBMS_SHARD_PRIORITY, nullptr, s % 2) != pdPASS) {
+      return false;
+    }
+    metricsWatchTask(taskNames[s]);
+  }
+#endif
+  lastUpdateMs = millis();
+  started = true;
+  return true;
+}
+
+bool shardsActive() {
+  return started;
+}
+
+// Fewest devices, lowest measured load on a tie; the rebalancing corrects
+// the load once the newcomer has been measured
+static uint8_t leastLoaded() {
+  uint16_t devices[JKBMS_SHARDS] = {};
+  const int count = bmsDeviceCount < JKBMS_SHARD_DEVICES ? bmsDeviceCount : JKBMS_SHARD_DEVICES;
+  for (int d = 0; d < count; d++) {
+    const uint8_t s = owner[d].load();
+    if (present[d] && s != SHARD_NONE) devices[s]++;
+  }
+  uint8_t best = 0;
+  for (int s = 1; s < JKBMS_SHARDS; s++) {
+    if (devices[s] < devices[best] ||
+        (devices[s] == devices[best] && stats[s].loadUs < stats[best].loadUs)) {
+      best = s;
+    }
+  }
+  return best;
+}
+
+#if defined(ESP_PLATFORM)
+static bool post(uint8_t shard, const ShardItem& item) {
+  if (xQueueSend(queues[shard], &item, 0) != pdTRUE) return false;
+  const UBaseType_t waiting = uxQueueMessagesWaiting(queues[shard]);
+  if (waiting > stats[shard].queueHigh) stats[shard].queueHigh = waiting;
+  return true;
+}
+#endif
+
+void JKBMS_HOT shardNotify(JKBMS& bms, uint8_t* data, size_t length) {
+  const int device = deviceIndex(bms);
+  if (!started || device < 0) {
+    bms.handleNotification(data, length);
+    return;
+  }
+
+  uint8_t shard = owner[device].load();
+  if (shard == SHARD_NONE) {
+    shard = leastLoaded();
+    owner[device].store(shard);
+  }
+  if (!present[device]) {
+    present[device] = true;
+    joined[device].store(true);
+    membershipChanged.store(true);
+  }
+
+#if defined(ESP_PLATFORM)
+  static ShardItem item;   // only the NimBLE host task posts
+  const uint8_t target = moveTo[device].load();
+  // One handover at a time: while the last marker is still queued the
+  // device's frames sit on two shards, and a second marker would release it
+  // to a third before the second had drained them
+  if (target != SHARD_NONE && released[device].load()) {
+    // The release marker goes behind the notifications already queued.
+    // Cleared before the post: the old shard may reach the marker first
+    released[device].store(false);
+    item.type = SHARD_ITEM_RELEASE;
+    item.device = device;
+    item.length = 0;
+    if (post(shard, item)) {
+      owner[device].store(target);
+      moveTo[device].store(SHARD_NONE);
+      shard = target;
+    } else {
+      released[device].store(true);
+    }
+  }
+  // A cut notification would be appended to the frame as if complete
+  if (length > JKBMS_SHARD_FRAGMENT) {
+    stats[shard].oversized++;
+    return;
+  }
+  item.type = SHARD_ITEM_DATA;
+  item.device = device;
+  item.length = (uint16_t)length;
+  memcpy(item.data, data, length);
+  if (!post(shard, item)) stats[shard].dropped++;
+#else
+  // Host: no tasks, the move takes effect at once
+  const uint8_t target = moveTo[device].load();
+  if (target != SHARD_NONE) {
+    owner[device].store(target);
+    moveTo[device].store(SHARD_NONE);
+    shard = target;
+  }
+  handleTimed(shard, device, data, length);
+#endif
+}
+
+void shardDeviceLeft(JKBMS& bms) {
+  const int device = deviceIndex(bms);
+  if (!started || device < 0 || !present[device]) return;
+  // The owner is kept: notifications still queued are handled where they are,
+  // and a reconnecting device goes back to the same shard until a rebalance
+  present[device] = false;
+  membershipChanged.store(true);
+}
+
+void shardsUpdate(uint32_t intervalMs) {
+  if (!started) return;
+  const uint32_t now = millis();
+  const bool changed = membershipChanged.exchange(false);
+  const bool due = now - lastUpdateMs >= intervalMs;
+  if (!changed && !due) return;
+
+  const int count = bmsDeviceCount < JKBMS_SHARD_DEVICES ? bmsDeviceCount : JKBMS_SHARD_DEVICES;
+  // Loads are measured over whole intervals only; a join or leave in between
+  // rebalances on the last interval's figures
+  if (due) {
+    lastUpdateMs = now;
+    for (int d = 0; d < count; d++) {
+      const uint32_t busy = deviceBusyUs[d];
+      deviceLoadUs[d] = busy - lastBusyUs[d];
+      lastBusyUs[d] = busy;
+    }
+  }
+  uint32_t total = 0;
+  int measured = 0;
+  for (int d = 0; d < count; d++) {
+    if (!present[d] || !deviceLoadUs[d]) continue;
+    total += deviceLoadUs[d];
+    measured++;
+  }
+  // A device that joined since has no figure yet: count it at the average
+  const uint32_t average = measured ? total / measured : 1;
+  for (int s = 0; s < JKBMS_SHARDS; s++) {
+    stats[s].devices = 0;
+    stats[s].loadUs = 0;
+  }
+  for (int d = 0; d < count; d++) {
+    if (!present[d]) continue;
+    if (joined[d].exchange(false) && !deviceLoadUs[d]) deviceLoadUs[d] = average;
+    const uint8_t pending = moveTo[d].load();
+    const uint8_t s = pending != SHARD_NONE ? pending : owner[d].load();
+    if (s == SHARD_NONE) continue;
+    stats[s].devices++;
+    stats[s].loadUs += deviceLoadUs[d];
+  }
+
+  uint8_t busiest = 0, idlest = 0;
+  for (int s = 1; s < JKBMS_SHARDS; s++) {
+    if (stats[s].loadUs > stats[busiest].loadUs) busiest = s;
+    if (stats[s].loadUs < stats[idlest].loadUs) idlest = s;
+  }
+  const uint32_t gap = stats[busiest].loadUs - stats[idlest].loadUs;
+  // Within a quarter of the busiest shard, or a gap too small to matter to
+  // either core: a move would mostly shuffle measurement noise
+  if (busiest == idlest || gap * 4 <= stats[busiest].loadUs) return;
+  if (gap < intervalMs * JKBMS_SHARD_MIN_GAP_PERMILLE) return;
+
+  // The device whose load is closest to half the gap evens the pair best;
+  // it has to be smaller than the gap, or the move just swaps the roles
+  int pick = -1;
+  uint32_t pickError = 0;
+  for (int d = 0; d < count; d++) {
+    if (!present[d] || owner[d].load() != busiest || moveTo[d].load() != SHARD_NONE) continue;
+    if (!released[d].load()) continue;   // still handing over from the last move
+    if (deviceLoadUs[d] >= gap) continue;
+    const uint32_t twice = deviceLoadUs[d] * 2;
+    const uint32_t error = twice > gap ? twice - gap : gap - twice;
+    if (pick < 0 || error < pickError) {
+      pick = d;
+      pickError = error;
+    }
+  }
+  if (pick < 0) return;
+
+  // Applied by notifyCB with the device's next notification
+  moveTo[pick].store(idlest);
+  stats[busiest].devices--;
+  stats[busiest].loadUs -= deviceLoadUs[pick];
+  stats[busiest].movedOut++;
+  stats[idlest].devices++;
+  stats[idlest].loadUs += deviceLoadUs[pick];
+  stats[idlest].movedIn++;
+}
+
+uint8_t shardOf(const JKBMS& bms) {
+  const int device = deviceIndex(bms);
+  if (!started || device < 0) return SHARD_NONE;
+  const uint8_t pending = moveTo[device].load();
+  return pending != SHARD_NONE ? pending : owner[device].load();
+}
+
+const ShardStats& shardStats(int shard) {
+  return stats[shard];
+}
+
+void shardsEmit(MetricsEmitFunc emit, void* ctx) {
+  if (!started) return;
+  char name[40];
+  for (int s = 0; s < JKBMS_SHARDS; s++) {
+    const ShardStats& st = stats[s];
+    snprintf(name, sizeof(name), "shard.%d.devices", s);
+    emit(name, st.devices, ctx);
+    snprintf(name, sizeof(name), "shard.%d.notifications", s);
+    emit(name, st.notifications, ctx);
+    snprintf(name, sizeof(name), "shard.%d.dropped", s);
+    emit(name, st.dropped, ctx);
+    snprintf(name, sizeof(name), "shard.%d.oversized", s);
+    emit(name, st.oversized, ctx);
+    snprintf(name, sizeof(name), "shard.%d.handover_waits", s);
+    emit(name, st.handoverWaits, ctx);
+    snprintf(name, sizeof(name), "shard.%d.moved_in", s);
+    emit(name, st.movedIn, ctx);
+    snprintf(name, sizeof(name), "shard.%d.moved_out", s);
+    emit(name, st.movedOut, ctx);
+    snprintf(name, sizeof(name), "shard.%d.load_us", s);
+    emit(name, st.loadUs, ctx);
+    snprintf(name, sizeof(name), "shard.%d.queue_high", s);
+    emit(name, st.queueHigh, ctx);
+  }
+}
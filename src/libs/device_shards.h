@@ -0,0 +1,103 @@
+#ifndef DEVICE_SHARDS_H
+#define DEVICE_SHARDS_H
+
+#include <Arduino.h>
+#include "metrics.h"
+
+class JKBMS;
+
+/**
+ * Core-affine device shards
+ *
+ * Devices are partitioned into JKBMS_SHARDS shards; shard i has a worker
+ * task pinned to core i % 2 and its own queue. notifyCB only copies the
+ * notification into the queue of the shard that owns the device; the shard
+ * task runs handleNotification(), i.e. reassembly, the frame parsers and
+ * every registered frame handler (analytics, serialization). A device's
+ * state is touched by one task only, so the per-device path needs no locks.
+ *
+ * A device joins the least loaded shard with its first notification and
+ * leaves on disconnect. shardsUpdate() (from loop()) measures the CPU time
+ * each device cost over the last interval and moves one device from the
+ * busiest to the idlest shard when that narrows the gap. Joins and leaves
+ * trigger a rebalance on the next call instead of waiting for the interval.
+ *
+ * A move is ordered through the old shard's queue: notifyCB queues a
+ * hand-over marker behind the device's pending notifications and sends the
+ * following ones to the new shard, which holds them until the old shard
+ * reaches the marker. Frames of a device are therefore never reordered and
+ * never handled by two tasks at once. A device is moved again only once
+ * the new shard has been released: a move requested while a hand-over is
+ * still in flight waits for it, and shardsUpdate() does not pick such a
+ * device.
+ *
+ * Connection setup stays in loop(): NimBLE client calls are serialized there.
+ * Without shardsStart(), and on the host build, notifications are handled
+ * inline in the calling task as before; the host build still does the
+ * assignment and load accounting so the balancing can be simulated.
+ */
+
+#ifndef JKBMS_SHARDS
+#define JKBMS_SHARDS 2
+#endif
+// Devices beyond this index are always handled inline
+#ifndef JKBMS_SHARD_DEVICES
+#define JKBMS_SHARD_DEVICES 32
+#endif
+#ifndef JKBMS_SHARD_QUEUE
+#define JKBMS_SHARD_QUEUE 16
+#endif
+// Largest notification a queue item holds: the 517-byte MTU set in setup() less 3 bytes of ATT header
+#ifndef JKBMS_SHARD_FRAGMENT
+#define JKBMS_SHARD_FRAGMENT 514
+#endif
+#ifndef JKBMS_SHARD_STACK
+#define JKBMS_SHARD_STACK 6144
+#endif
+// Below the NimBLE host task, above loop()
+#ifndef JKBMS_SHARD_PRIORITY
+#define JKBMS_SHARD_PRIORITY 3
+#endif
+#ifndef JKBMS_SHARD_REBALANCE_MS
+#define JKBMS_SHARD_REBALANCE_MS 10000
+#endif
+// Load gap between two shards worth a move, in thousandths of a core
+#ifndef JKBMS_SHARD_MIN_GAP_PERMILLE
+#define JKBMS_SHARD_MIN_GAP_PERMILLE 1
+#endif
+
+static const uint8_t SHARD_NONE = 0xFF;
+
+struct ShardStats {
+  uint8_t core;
+  uint16_t devices;
+  uint32_t notifications;   // handled by the shard task
+  uint32_t dropped;         // queue full, notification lost
+  uint32_t oversized;       // longer than JKBMS_SHARD_FRAGMENT, dropped rather than cut
+  uint32_t handoverWaits;   // notifications held until the old shard released the device
+  uint32_t movedIn;
+  uint32_t movedOut;
+  uint32_t busyUs;          // cumulative
+  uint32_t loadUs;          // busy time over the last rebalance interval
+  uint16_t queueHigh;       // most items waiting at once
+};
+
+// Create the shard queues and tasks; call once from setup() after NimBLE init
+bool shardsStart();
+bool shardsActive();
+
+// notifyCB: hand the notification to the device's shard (inline if not started)
+void shardNotify(JKBMS& bms, uint8_t* data, size_t length);
+// ClientCallbacks::onDisconnect: the device leaves its shard
+void shardDeviceLeft(JKBMS& bms);
+
+// loop(): per-device load over the last interval and at most one move per call
+void shardsUpdate(uint32_t intervalMs = JKBMS_SHARD_REBALANCE_MS);
+
+uint8_t shardOf(const JKBMS& bms);
+const ShardStats& shardStats(int shard);
+
+// Metrics source: shard.<i>.*
+void shardsEmit(MetricsEmitFunc emit, void* ctx);
+
+#endif // DEVICE_SHARDS_H
@@ -0,0 +1,190 @@
+/**
+ * @file fleet_outliers.cpp
+ * @brief Per-position median/MAD across packs and running per-cell scores
+ */
+
+#include "fleet_outliers.h"
+#include "JKBMS.h"
+
+#include <algorithm>
+#include <math.h>
+
+// MAD of a normal distribution is 0.6745 sigma
+static const float MAD_TO_SIGMA = 1.4826f;
+
+template <typename T>
+static T* allocArray(size_t n) {
+  return (T*)calloc(n, sizeof(T));
+}
+
+bool fleetOutlierInit(FleetOutliers& fo, uint16_t packs, uint8_t cells, const FleetOutlierConfig* config) {
+  fo = FleetOutliers();
+  if (config) fo.config = *config;
+  if (!packs || !cells || cells > JKBMS_SNAPSHOT_CELLS) return false;
+  const size_t n = (size_t)packs * cells;
+  fo.value = allocArray<float>(n);
+  fo.present = allocArray<uint8_t>(n);
+  fo.work = allocArray<float>(packs);
+  fo.score = allocArray<float>(n);
+  fo.lastZ = allocArray<float>(n);
+  fo.seen = allocArray<uint16_t>(n);
+  fo.flagged = allocArray<uint8_t>(n);
+  fo.flaggedSamples = allocArray<uint32_t>(n);
+  fo.median = allocArray<float>(cells);
+  fo.mad = allocArray<float>(cells);
+  fo.lastVersion = allocArray<uint32_t>(packs);
+  if (!fo.value || !fo.present || !fo.work || !fo.score || !fo.lastZ || !fo.seen || !fo.flagged ||
+      !fo.flaggedSamples || !fo.median || !fo.mad || !fo.lastVersion) {
+    fleetOutlierFree(fo);
+    return false;
+  }
+  fo.packs = packs;
+  fo.cells = cells;
+  return true;
+}
+
+void fleetOutlierFree(FleetOutliers& fo) {
+  free(fo.value);
+  free(fo.present);
+  free(fo.work);
+  free(fo.score);
+  free(fo.lastZ);
+  free(fo.seen);
+  free(fo.flagged);
+  free(fo.flaggedSamples);
+  free(fo.median);
+  free(fo.mad);
+  free(fo.lastVersion);
+  const FleetOutlierConfig config = fo.config;
+  fo = FleetOutliers();
+  fo.config = config;
+}
+
+void fleetOutlierBegin(FleetOutliers& fo) {
+  memset(fo.present, 0, (size_t)fo.packs * fo.cells);
+}
+
+// Values are in mV; zero means the cell is not there
+static void addPack(FleetOutliers& fo, uint16_t pack, const float* mv, int count) {
+  if (pack >= fo.packs) return;
+  if (count > fo.cells) count = fo.cells;
+  float mean = 0;
+  if (fo.config.relativeToPack) {
+    int n = 0;
+    for (int c = 0; c < count; c++) {
+      if (mv[c] <= 0) continue;
+      mean += mv[c];
+      n++;
+    }
+    if (!n) return;
+    mean /= n;
+  }
+  for (int c = 0; c < count; c++) {
+    if (mv[c] <= 0) continue;
+    const size_t k = (size_t)c * fo.packs + pack;
+    fo.value[k] = mv[c] - mean;
+    fo.present[k] = 1;
+  }
+}
+
+void fleetOutlierAdd(FleetOutliers& fo, uint16_t pack, const float* cellV, int count) {
+  float mv[JKBMS_SNAPSHOT_CELLS];
+  if (count > JKBMS_SNAPSHOT_CELLS) count = JKBMS_SNAPSHOT_CELLS;
+  for (int c = 0; c < count; c++) mv[c] = cellV[c] * 1000.0f;
+  addPack(fo, pack, mv, count);
+}
+
+void fleetOutlierAddSnapshot(FleetOutliers& fo, uint16_t pack, const JkSnapshot& snap) {
+  float mv[JKBMS_SNAPSHOT_CELLS];
+  const int count = snap.header.cellCount < JKBMS_SNAPSHOT_CELLS ? snap.header.cellCount : JKBMS_SNAPSHOT_CELLS;
+  for (int c = 0; c < count; c++) mv[c] = snap.cellMv[c];
+  addPack(fo, pack, mv, count);
+}
+
+// Median of work[0..n), reorders work
+static float medianOf(float* work, uint16_t n) {
+  const uint16_t mid = n / 2;
+  std::nth_element(work, work + mid, work + n);
+  float m = work[mid];
+  if (n % 2 == 0) m = (m + *std::max_element(work, work + mid)) * 0.5f;
+  return m;
+}
+
+int fleetOutlierEvaluate(FleetOutliers& fo, FleetOutlierEvent* events, int maxEvents) {
+  const FleetOutlierConfig& cfg = fo.config;
+  const uint16_t packs = fo.packs;
+  int written = 0;
+  fo.samples++;
+
+  for (uint8_t c = 0; c < fo.cells; c++) {
+    const size_t base = (size_t)c * packs;
+    const float* __restrict x = fo.value + base;
+    const uint8_t* __restrict present = fo.present + base;
+    float* __restrict work = fo.work;
+
+    uint16_t n = 0;
+    for (uint16_t p = 0; p < packs; p++) {
+      work[n] = x[p];
+      n += present[p];
+    }
+    if (n < cfg.minPacks) continue;
+
+    const float med = medianOf(work, n);
+    for (uint16_t i = 0; i < n; i++) work[i] = fabsf(work[i] - med);
+    const float mad = medianOf(work, n);
+    fo.median[c] = med;
+    fo.mad[c] = mad;
+
+    // Branch-free update: absent cells keep their score
+    const float invScale = 1.0f / (MAD_TO_SIGMA * (mad > cfg.madFloorMv ? mad : cfg.madFloorMv));
+    const float alpha = cfg.alpha;
+    float* __restrict score = fo.score + base;
+    float* __restrict lastZ = fo.lastZ + base;
+    for (uint16_t p = 0; p < packs; p++) {
+      const float z = (x[p] - med) * invScale;
+      const float m = present[p];
+      lastZ[p] = m * z + (1.0f - m) * lastZ[p];
+      score[p] += m * alpha * (z - score[p]);
+    }
+
+    // Flag transitions (rare): scalar pass
+    uint16_t* seen = fo.seen + base;
+    uint8_t* flagged = fo.flagged + base;
+    uint32_t* flaggedSamples = fo.flaggedSamples + base;
+    for (uint16_t p = 0; p < packs; p++) {
+      if (!present[p]) continue;
+      if (seen[p] < 0xFFFF) seen[p]++;
+      const float s = fabsf(score[p]);
+      bool change = false;
+      if (!flagged[p] && seen[p] >= cfg.warmupSamples && s > cfg.zRaise) {
+        flagged[p] = 1;
+        change = true;
+      } else if (flagged[p] && s < cfg.zClear) {
+        flagged[p] = 0;
+        change = true;
+      }
+      if (flagged[p]) flaggedSamples[p]++;
+      if (change && written < maxEvents) {
+        FleetOutlierEvent& e = events[written++];
+        e.pack = p;
+        e.cell = c;
+        e.raised = flagged[p];
+        e.score = score[p];
+        e.deviationMv = x[p] - med;
+      }
+    }
+  }
+  return written;
+}
+
+int fleetOutlierSample(FleetOutliers& fo, const JKBMS* devices, int count, FleetOutlierEvent* events, int maxEvents) {
+  fleetOutlierBegin(fo);
+  if (count > fo.packs) count = fo.packs;
+  for (int i = 0; i < count; i++) {
+    const JKBMS& bms = devices[i];
+    if (!bms.connected || !bms.snapshotVersion || bms.snapshotVersion == fo.lastVersion[i]) continue;
+    fo.lastVersion[i] = bms.snapshotVersion;
+    fleetOutlierAdd(fo, (uint16_t)i, bms.cellVoltage, bms.cellCountClamped());
+  }
+  return fleetOutlierEvaluate(fo, events, maxEvents);
+}
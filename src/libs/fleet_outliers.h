@@ -0,0 +1,102 @@
+#ifndef FLEET_OUTLIERS_H
+#define FLEET_OUTLIERS_H
+
+#include <Arduino.h>
+#include "snapshot.h"
+
+class JKBMS;
+
+/**
+ * Fleet-level cell outlier detection
+ *
+ * parseData() only sees one pack. Here each cell is compared with the cells
+ * at the same position in the sibling packs: for every fleet sample the
+ * median and MAD (median absolute deviation) of each position are computed
+ * across packs, and every cell gets a robust z-score
+ *
+ *   z = (x - median) / (1.4826 * max(MAD, madFloorMv))
+ *
+ * which is smoothed per cell by an EWMA. A cell is flagged when |score|
+ * rises above zRaise and cleared below zClear. With relativeToPack, x is
+ * the cell's deviation from its own pack's mean cell voltage, so packs at
+ * different SoC or load can still be compared.
+ *
+ * Memory is allocated once by fleetOutlierInit() and does not grow: about
+ * 20 bytes per (pack, cell) plus one float per pack. The per-position
+ * arrays are contiguous over packs, and the deviation and score loops are
+ * branch-free so the compiler can vectorize them.
+ *
+ * Not thread-safe; call from loop().
+ */
+
+struct FleetOutlierConfig {
+  float alpha = 0.05f;        // EWMA weight of one sample (~20 samples of memory)
+  float zRaise = 3.5f;
+  float zClear = 2.5f;
+  float madFloorMv = 1.5f;    // keeps a tight fleet (MAD ~ 0) from flagging noise
+  uint16_t minPacks = 5;      // positions with fewer packs in the sample are skipped
+  uint16_t warmupSamples = 20;
+  bool relativeToPack = true;
+};
+
+struct FleetOutlierEvent {
+  uint16_t pack;
+  uint8_t cell;
+  bool raised;                // false: cleared
+  float score;
+  float deviationMv;          // from the position median in this sample
+};
+
+struct FleetOutliers {
+  FleetOutlierConfig config;
+  uint16_t packs;
+  uint8_t cells;
+  uint32_t samples;
+  // Current sample, position-major: [cell * packs + pack]
+  float* value;
+  uint8_t* present;
+  float* work;                // scratch, one per pack
+  // Running state per (cell, pack), same layout
+  float* score;
+  float* lastZ;
+  uint16_t* seen;             // samples the cell took part in (saturating)
+  uint8_t* flagged;
+  uint32_t* flaggedSamples;
+  // Per position, last evaluated sample
+  float* median;
+  float* mad;
+  // Per pack
+  uint32_t* lastVersion;      // JKBMS::snapshotVersion taken by fleetOutlierSample()
+};
+
+bool fleetOutlierInit(FleetOutliers& fo, uint16_t packs, uint8_t cells = JKBMS_SNAPSHOT_CELLS,
+                      const FleetOutlierConfig* config = nullptr);
+void fleetOutlierFree(FleetOutliers& fo);
+
+// Start a new sample; packs not added are left out of it
+void fleetOutlierBegin(FleetOutliers& fo);
+// Cell voltages in volts (JKBMS::cellVoltage); 0 marks a missing cell
+void fleetOutlierAdd(FleetOutliers& fo, uint16_t pack, const float* cellV, int count);
+void fleetOutlierAddSnapshot(FleetOutliers& fo, uint16_t pack, const JkSnapshot& snap);
+
+/**
+ * Compute the position statistics of the sample and update the scores
+ * @return Number of flag changes written to events (at most maxEvents)
+ */
+int fleetOutlierEvaluate(FleetOutliers& fo, FleetOutlierEvent* events, int maxEvents);
+
+/**
+ * One sample from a device table: every connected device with a cell frame
+ * newer than the previous sample takes part (pack index = table index)
+ */
+int fleetOutlierSample(FleetOutliers& fo, const JKBMS* devices, int count, FleetOutlierEvent* events, int maxEvents);
+
+static inline float fleetOutlierScore(const FleetOutliers& fo, uint16_t pack, uint8_t cell) {
+  return fo.score[(size_t)cell * fo.packs + pack];
+}
+
+static inline bool fleetOutlierFlagged(const FleetOutliers& fo, uint16_t pack, uint8_t cell) {
+  return fo.flagged[(size_t)cell * fo.packs + pack];
+}
+
+#endif // FLEET_OUTLIERS_H
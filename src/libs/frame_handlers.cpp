@@ -0,0 +1,107 @@
+/**
+ * @file frame_handlers.cpp
+ * @brief Fixed-size frame-handler table and dispatch
+ *
+ * The first slots hold the built-in parsers (settings, cell info, device
+ * info); application handlers take the remaining ones. Dispatch walks the
+ * table in order, so built-in parsing always runs before application
+ * handlers for the same frame.
+ */
+
+#include "frame_handlers.h"
+#include "JKBMS.h"
+
+struct FrameHandlerSlot {
+  FrameHandler handler;
+  void* ctx;
+  const JKBMS* device;
+  int16_t type;
+};
+
+static void JKBMS_HOT builtinSettings(const FrameView& frame, void* ctx) {
+  DEBUG_PRINTLN("BMS Settings frame detected.");
+  JKBMS_PROFILE_BEGIN(parseSample);
+  // JK04 settings are floats at other offsets; not decoded
+  if (frame.device->activeProtocol() != PROTOCOL_JK04) frame.device->bms_settings();
+  JKBMS_PROFILE_END(parseSample, PROFILE_PARSE_SETTINGS);
+}
+
+static void JKBMS_HOT builtinCellInfo(const FrameView& frame, void* ctx) {
+  DEBUG_PRINTLN("Cell data frame detected.");
+  JKBMS_PROFILE_BEGIN(parseSample);
+  JKBMS& bms = *frame.device;
+  if (bms.protocol == PROTOCOL_AUTO && bms.detectedProtocol == PROTOCOL_AUTO) {
+    bms.detectedProtocol = protocolFromCellFrame(frame.data);
+  }
+  // Readers on other tasks (the REST server) copy the fields between two even sequences
+  seqlockWriteBegin(bms.parseSequence);
+  if (bms.activeProtocol() == PROTOCOL_JK04) {
+    bms.parseDataJk04();
+  } else {
+    bms.parseData();
+  }
+  bms.snapshotVersion++;
+  seqlockWriteEnd(bms.parseSequence);
+  JKBMS_PROFILE_END(parseSample, PROFILE_PARSE_CELL_DATA);
+}
+
+static void builtinDeviceInfo(const FrameView& frame, void* ctx) {
+  DEBUG_PRINTLN("Device info frame detected.");
+  JKBMS_PROFILE_BEGIN(parseSample);
+  frame.device->parseDeviceInfo();
+  JKBMS_PROFILE_END(parseSample, PROFILE_PARSE_DEVICE_INFO);
+}
+
+static const int BUILTIN_HANDLERS = 3;
+
+static FrameHandlerSlot handlers[FRAME_HANDLER_SLOTS] = {
+  { builtinSettings, nullptr, nullptr, 0x01 },
+  { builtinCellInfo, nullptr, nullptr, 0x02 },
+  { builtinDeviceInfo, nullptr, nullptr, 0x03 },
+};
+
+bool registerFrameHandler(int frameType, FrameHandler handler, void* ctx, const JKBMS* device) {
+  if (!handler || frameType < FRAME_TYPE_ANY || frameType > 0xFF) return false;
+  for (int i = BUILTIN_HANDLERS; i < FRAME_HANDLER_SLOTS; i++) {
+    FrameHandlerSlot& slot = handlers[i];
+    if (slot.handler) continue;
+    slot.ctx = ctx;
+    slot.device = device;
+    slot.type = frameType;
+    slot.handler = handler;  // Last, so dispatch never sees a half-filled slot
+    return true;
+  }
+  return false;
+}
+
+bool unregisterFrameHandler(FrameHandler handler, void* ctx) {
+  for (int i = BUILTIN_HANDLERS; i < FRAME_HANDLER_SLOTS; i++) {
+    FrameHandlerSlot& slot = handlers[i];
+    if (slot.handler == handler && slot.ctx == ctx) {
+      slot.handler = nullptr;
+      return true;
+    }
+  }
+  return false;
+}
+
+int JKBMS_HOT dispatchFrame(JKBMS& device, const uint8_t* data, size_t length) {
+  // The built-in parsers read receivedBytes/frame: a frame from elsewhere is copied in first
+  if (data != device.receivedBytes) {
+    if (length > sizeof(device.receivedBytes)) length = sizeof(device.receivedBytes);
+    memcpy(device.receivedBytes, data, length);
+    data = device.receivedBytes;
+  }
+  device.frame = (int)length;
+  FrameView view = { data, length, length > 4 ? data[4] : (uint8_t)0, length > 5 ? data[5] : (uint8_t)0, &device };
+  int handled = 0;
+  for (int i = 0; i < FRAME_HANDLER_SLOTS; i++) {
+    const FrameHandlerSlot& slot = handlers[i];
+    if (!slot.handler) continue;
+    if (slot.type != FRAME_TYPE_ANY && slot.type != view.type) continue;
+    if (slot.device && slot.device != &device) continue;
+    slot.handler(view, slot.ctx);
+    handled++;
+  }
+  return handled;
+}
@@ -0,0 +1,65 @@
+#ifndef FRAME_HANDLERS_H
+#define FRAME_HANDLERS_H
+
+#include <Arduino.h>
+
+class JKBMS;
+
+static const int FRAME_HANDLER_SLOTS = 16;  // built-in parsers included
+static const int FRAME_TYPE_ANY = -1;
+
+/**
+ * Read-only view of a reassembled frame
+ *
+ * Points into the device's reassembly buffer, so no copy is made. The view
+ * is only valid during the handler call: the next notification overwrites
+ * the buffer. Handlers that keep data must copy what they need.
+ */
+struct FrameView {
+  const uint8_t* data;
+  size_t length;
+  uint8_t type;             // byte 4
+  uint8_t counter;          // byte 5
+  JKBMS* device;
+
+  uint8_t u8(size_t offset) const { return offset < length ? data[offset] : 0; }
+  uint16_t u16(size_t offset) const { return offset + 1 < length ? (uint16_t)(data[offset] | data[offset + 1] << 8) : 0; }
+  uint32_t u32(size_t offset) const {
+    return offset + 3 < length ? (uint32_t)data[offset] | (uint32_t)data[offset + 1] << 8 |
+                                 (uint32_t)data[offset + 2] << 16 | (uint32_t)data[offset + 3] << 24 : 0;
+  }
+};
+
+/**
+ * Frame handler
+ * Runs on the NimBLE host task right after the frame is complete; keep it
+ * short and do not block.
+ */
+typedef void (*FrameHandler)(const FrameView& frame, void* ctx);
+
+/**
+ * Register a handler
+ * @param frameType Frame type (byte 4) or FRAME_TYPE_ANY
+ * @param handler Function to call
+ * @param ctx Passed back to the handler
+ * @param device Only frames from this device, or nullptr for all devices
+ * @return false if all FRAME_HANDLER_SLOTS are taken
+ *
+ * Handlers run after the built-in parser for the same frame type, so the
+ * parsed JKBMS fields are already up to date. Register during setup(),
+ * before the first connection: the table is read without locking.
+ */
+bool registerFrameHandler(int frameType, FrameHandler handler, void* ctx = nullptr, const JKBMS* device = nullptr);
+bool unregisterFrameHandler(FrameHandler handler, void* ctx = nullptr);
+
+/**
+ * Dispatch a complete frame to the built-in parsers and registered handlers
+ * The built-in parsers read device.receivedBytes: data is copied there
+ * unless it already points to it (at most sizeof(receivedBytes) bytes), and
+ * device.frame is set to the length, so the FrameView and the parsers see
+ * the same bytes.
+ * @return Number of handlers that ran (0: unknown frame type)
+ */
+int dispatchFrame(JKBMS& device, const uint8_t* data, size_t length);
+
+#endif // FRAME_HANDLERS_H
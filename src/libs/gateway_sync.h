@@ -0,0 +1,104 @@
+#ifndef GATEWAY_SYNC_H
+#define GATEWAY_SYNC_H
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(ESP_PLATFORM)
+#include <freertos/FreeRTOS.h>
+#endif
+
+/**
+ * Locks and seqlocks shared by the gateway modules
+ *
+ * Frame handlers run on the shard task that owns the device (device_shards.h),
+ * so with two shards they run on both cores at once. State that every device
+ * feeds (the worst-cell heaps, the windows, the USB ring, the snapshot ring)
+ * is guarded by one spinlock per module, taken with GATEWAY_LOCK(): a
+ * portMUX critical section on the ESP32, nothing on the host where one thread
+ * parses.
+ *
+ * Trade-off: every cell frame takes these global locks, and the other core
+ * spins while one holds them. The sections are kept to a copy or a bounded
+ * update, the longest being worstUpdate() (cells x criteria x log K heap
+ * steps; worst.update_us_max reports its time), and frames arrive about once
+ * a second per pack, so contention stays rare. Splitting these structures
+ * per shard would avoid the spin but make every reader merge them.
+ * Per-device state with a single writer uses a seqlock instead: readers on
+ * any task never block the parser.
+ */
+
+#if defined(ESP_PLATFORM)
+#define GATEWAY_LOCK_DEFINE(name) static portMUX_TYPE name = portMUX_INITIALIZER_UNLOCKED
+#define GATEWAY_LOCK(name) portENTER_CRITICAL(&name)
+#define GATEWAY_UNLOCK(name) portEXIT_CRITICAL(&name)
+#else
+#define GATEWAY_LOCK_DEFINE(name) [[maybe_unused]] static const int name = 0
+#define GATEWAY_LOCK(name) (void)name
+#define GATEWAY_UNLOCK(name) (void)name
+#endif
+
+//****************************************************
+// Seqlock
+//****************************************************
+
+/**
+ * The sequence word is odd while the single writer updates the data; a
+ * reader that sees the same even value before and after its copy has a
+ * consistent one. 0 means never written.
+ */
+static inline void seqlockWriteBegin(volatile uint32_t& sequence, uint32_t current) {
+  sequence = current + 1;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seqlockWriteBegin(volatile uint32_t& sequence) {
+  seqlockWriteBegin(sequence, sequence);
+}
+
+static inline void seqlockWriteEnd(volatile uint32_t& sequence) {
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  sequence = sequence + 1;
+}
+
+static inline uint32_t seqlockReadBegin(const volatile uint32_t& sequence) {
+  const uint32_t before = sequence;
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return before;
+}
+
+// True if the copy made since seqlockReadBegin() returned before is consistent
+static inline bool seqlockReadValid(const volatile uint32_t& sequence, uint32_t before) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return (before & 1) == 0 && before == sequence;
+}
+
+// A value published by one task and copied by any other
+template <typename T>
+struct Seqlocked {
+  volatile uint32_t sequence;
+  T value;
+};
+
+template <typename T>
+static inline void seqlockStore(Seqlocked<T>& s, const T& value) {
+  seqlockWriteBegin(s.sequence);
+  memcpy((void*)&s.value, &value, sizeof(T));
+  seqlockWriteEnd(s.sequence);
+}
+
+/**
+ * Copy the value, retrying a copy torn by the writer
+ * @return the sequence of the copy, 0 if never written or torn on every attempt
+ */
+template <typename T>
+static inline uint32_t seqlockLoad(const Seqlocked<T>& s, T& out, int attempts = 4) {
+  for (int attempt = 0; attempt < attempts; attempt++) {
+    const uint32_t before = seqlockReadBegin(s.sequence);
+    memcpy(&out, (const void*)&s.value, sizeof(T));
+    if (seqlockReadValid(s.sequence, before)) return before;
+  }
+  return 0;
+}
+
+#endif // GATEWAY_SYNC_H
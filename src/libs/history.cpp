@@ -0,0 +1,352 @@
+/**
+ * @file history.cpp
+ * @brief Segment ring with per-segment summaries and the queries over it
+ */
+
+#include "history.h"
+#include "JKBMS.h"
+
+#if defined(ESP_PLATFORM)
+#include <esp_heap_caps.h>
+#endif
+
+static const char* const fieldNames[HIST_FIELD_COUNT] = {
+  "voltage_mv", "current_ma", "soc", "cell_min_mv", "cell_max_mv", "cell_delta_mv", "temp_max_dc"
+};
+
+// Default histogram ranges: 16s LFP pack, +-200 A, cells 2.5-3.7 V, -20..80 °C
+static const int32_t defaultRange[HIST_FIELD_COUNT][2] = {
+  { 40000, 60000 }, { -200000, 200000 }, { 0, 101 }, { 2500, 3700 }, { 2500, 3700 }, { 0, 320 }, { -200, 800 }
+};
+
+static inline int binOf(const HistoryStore& store, int field, int32_t v) {
+  int32_t b = (v - store.binLo[field]) / store.binWidth[field];
+  if (v < store.binLo[field]) return 0;
+  return b >= JKBMS_HISTORY_BINS ? JKBMS_HISTORY_BINS - 1 : (int)b;
+}
+
+static inline uint32_t oldestSegment(const HistoryStore& store) {
+  return store.started > store.capacity ? store.started - store.capacity : 0;
+}
+
+static inline const HistorySegment& segmentAt(const HistoryStore& store, uint32_t ordinal) {
+  return store.segments[ordinal % store.capacity];
+}
+
+static inline const HistoryRange& rangeAt(const HistoryStore& store, uint32_t ordinal) {
+  return store.directory[ordinal % store.capacity];
+}
+
+//********************************************
+// Storage
+//********************************************
+
+bool historyInit(HistoryStore& store, uint16_t segments, uint32_t minIntervalS) {
+  memset(&store, 0, sizeof(store));
+  if (!segments) return false;
+  const size_t bytes = (size_t)segments * sizeof(HistorySegment);
+#if defined(ESP_PLATFORM)
+  store.segments = (HistorySegment*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!store.segments) store.segments = (HistorySegment*)malloc(bytes);
+#else
+  store.segments = (HistorySegment*)malloc(bytes);
+#endif
+  store.directory = (HistoryRange*)calloc(segments, sizeof(HistoryRange));
+  if (!store.segments || !store.directory) {
+    historyFree(store);
+    return false;
+  }
+  store.capacity = segments;
+  store.minIntervalS = minIntervalS;
+  for (int f = 0; f < HIST_FIELD_COUNT; f++) historySetRange(store, (HistoryField)f, defaultRange[f][0], defaultRange[f][1]);
+  return true;
+}
+
+void historyFree(HistoryStore& store) {
+  free(store.segments);
+  free(store.directory);
+  memset(&store, 0, sizeof(store));
+}
+
+bool historySetRange(HistoryStore& store, HistoryField field, int32_t lo, int32_t hi) {
+  if (store.started || hi <= lo) return false;
+  store.binLo[field] = lo;
+  store.binWidth[field] = (int32_t)(((int64_t)hi - lo + JKBMS_HISTORY_BINS - 1) / JKBMS_HISTORY_BINS);
+  return true;
+}
+
+bool historyAppend(HistoryStore& store, uint32_t timeS, const JkSnapshot& snap) {
+  if (!store.capacity) return false;
+  if (store.started && timeS < rangeAt(store, store.started - 1).lastS) return false;
+
+  int32_t values[HIST_FIELD_COUNT];
+  int32_t cellMin = 0, cellMax = 0;
+  for (int i = 0; i < snap.header.cellCount && i < JKBMS_SNAPSHOT_CELLS; i++) {
+    int32_t mv = snap.cellMv[i];
+    if (!mv) continue;
+    if (!cellMin || mv < cellMin) cellMin = mv;
+    if (mv > cellMax) cellMax = mv;
+  }
+  values[HIST_VOLTAGE] = snap.batteryMv;
+  values[HIST_CURRENT] = snap.currentMa;
+  values[HIST_SOC] = snap.soc;
+  values[HIST_CELL_MIN] = cellMin;
+  values[HIST_CELL_MAX] = cellMax;
+  values[HIST_CELL_DELTA] = snap.deltaCellMv;
+  values[HIST_TEMP_MAX] = snap.t1DeciC > snap.t2DeciC ? snap.t1DeciC : snap.t2DeciC;
+
+  // Start a new segment when the newest one is full; the oldest is overwritten
+  if (!store.started || segmentAt(store, store.started - 1).summary.count == JKBMS_HISTORY_SEGMENT_RECORDS) {
+    HistorySegment& fresh = store.segments[store.started % store.capacity];
+    memset(&fresh.summary, 0, sizeof(fresh.summary));
+    fresh.summary.firstS = timeS;
+    store.directory[store.started % store.capacity].firstS = timeS;
+    store.started++;
+  }
+  HistorySegment& seg = store.segments[(store.started - 1) % store.capacity];
+  HistorySummary& sum = seg.summary;
+  const uint16_t i = sum.count;
+  seg.timeS[i] = timeS;
+  if (i % JKBMS_HISTORY_INDEX_STRIDE == 0) sum.sparseTime[i / JKBMS_HISTORY_INDEX_STRIDE] = timeS;
+  for (int f = 0; f < HIST_FIELD_COUNT; f++) {
+    const int32_t v = values[f];
+    HistoryFieldSummary& fs = sum.field[f];
+    seg.value[f][i] = v;
+    if (!i || v < fs.min) fs.min = v;
+    if (!i || v > fs.max) fs.max = v;
+    fs.sum += v;
+    fs.bins[binOf(store, f, v)]++;
+  }
+  sum.lastS = timeS;
+  sum.count = i + 1;
+  store.directory[(store.started - 1) % store.capacity].lastS = timeS;
+  return true;
+}
+
+bool historyUpdate(HistoryStore& store, const JKBMS& bms, uint32_t timeS) {
+  if (!bms.snapshotVersion || bms.snapshotVersion == store.lastVersion) return false;
+  if (store.started && store.minIntervalS && timeS - rangeAt(store, store.started - 1).lastS < store.minIntervalS) return false;
+  JkSnapshot snap;
+  snapshotFromBms(bms, snap);
+  if (!historyAppend(store, timeS, snap)) return false;
+  store.lastVersion = bms.snapshotVersion;
+  return true;
+}
+
+uint32_t historyRecords(const HistoryStore& store) {
+  if (!store.started) return 0;
+  const uint32_t full = store.started - oldestSegment(store) - 1;
+  return full * JKBMS_HISTORY_SEGMENT_RECORDS + segmentAt(store, store.started - 1).summary.count;
+}
+
+bool historyTimeRange(const HistoryStore& store, uint32_t& firstS, uint32_t& lastS) {
+  if (!store.started) return false;
+  firstS = rangeAt(store, oldestSegment(store)).firstS;
+  lastS = rangeAt(store, store.started - 1).lastS;
+  return true;
+}
+
+//********************************************
+// Queries
+//********************************************
+
+// First segment (ordinal) whose last record is at or after fromS
+static uint32_t firstSegmentFrom(const HistoryStore& store, uint32_t fromS) {
+  uint32_t lo = oldestSegment(store), hi = store.started;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (rangeAt(store, mid).lastS < fromS) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// First record index in the segment at or after timeS: sparse index, then at most one stride
+static uint16_t firstRecordFrom(const HistorySegment& seg, uint32_t timeS) {
+  const HistorySummary& sum = seg.summary;
+  if (timeS <= sum.firstS) return 0;
+  const int strides = (sum.count + JKBMS_HISTORY_INDEX_STRIDE - 1) / JKBMS_HISTORY_INDEX_STRIDE;
+  int lo = 0, hi = strides;
+  while (hi - lo > 1) {
+    int mid = (lo + hi) / 2;
+    if (sum.sparseTime[mid] <= timeS) lo = mid;
+    else hi = mid;
+  }
+  uint16_t i = (uint16_t)(lo * JKBMS_HISTORY_INDEX_STRIDE);
+  while (i < sum.count && seg.timeS[i] < timeS) i++;
+  return i;
+}
+
+static inline void clearAggregate(HistoryAggregate& agg) {
+  memset(&agg, 0, sizeof(agg));
+}
+
+static void mergeSummary(HistoryAggregate& into, const HistoryFieldSummary& fs, uint16_t count) {
+  if (!into.count || fs.min < into.min) into.min = fs.min;
+  if (!into.count || fs.max > into.max) into.max = fs.max;
+  into.count += count;
+  into.sum += fs.sum;
+  for (int b = 0; b < JKBMS_HISTORY_BINS; b++) into.bins[b] += fs.bins[b];
+}
+
+static inline void addValue(const HistoryStore& store, int field, HistoryAggregate& into, int32_t v) {
+  if (!into.count || v < into.min) into.min = v;
+  if (!into.count || v > into.max) into.max = v;
+  into.count++;
+  into.sum += v;
+  into.bins[binOf(store, field, v)]++;
+}
+
+void historyMerge(HistoryAggregate& into, const HistoryAggregate& from) {
+  if (!from.count) return;
+  if (!into.count || from.min < into.min) into.min = from.min;
+  if (!into.count || from.max > into.max) into.max = from.max;
+  into.count += from.count;
+  into.sum += from.sum;
+  for (int b = 0; b < JKBMS_HISTORY_BINS; b++) into.bins[b] += from.bins[b];
+}
+
+int historyWindows(const HistoryStore& store, HistoryField field, uint32_t fromS, uint32_t toS, uint32_t windowS,
+                   HistoryAggregate* out, int maxWindows, HistoryQueryStats* stats) {
+  if (stats) memset(stats, 0, sizeof(*stats));
+  if (toS < fromS || !windowS || maxWindows < 1) return 0;
+  uint64_t windows = ((uint64_t)toS - fromS) / windowS + 1;
+  if (windows > (uint64_t)maxWindows) {
+    windows = maxWindows;
+    toS = (uint32_t)(fromS + windows * windowS - 1);
+  }
+  for (uint32_t w = 0; w < windows; w++) clearAggregate(out[w]);
+  if (!store.started) return (int)windows;
+
+  for (uint32_t k = firstSegmentFrom(store, fromS); k < store.started; k++) {
+    const HistoryRange& range = rangeAt(store, k);
+    if (range.firstS > toS) break;
+    const HistorySegment& seg = segmentAt(store, k);
+    if (stats) stats->segments++;
+
+    // Whole segment inside one window: the summary is the answer
+    const uint32_t firstW = range.firstS < fromS ? UINT32_MAX : (range.firstS - fromS) / windowS;
+    const uint32_t lastW = (range.lastS - fromS) / windowS;
+    if (firstW != UINT32_MAX && firstW == lastW && range.lastS <= toS) {
+      mergeSummary(out[firstW], seg.summary.field[field], seg.summary.count);
+      if (stats) stats->fromSummary++;
+      continue;
+    }
+
+    const uint16_t begin = firstRecordFrom(seg, fromS);
+    const int32_t* values = seg.value[field];
+    const uint32_t* times = seg.timeS;
+    uint16_t i = begin;
+    while (i < seg.summary.count && times[i] <= toS) {
+      // Records of one window are contiguous: find the window once per run
+      const uint32_t w = (times[i] - fromS) / windowS;
+      const uint32_t windowEnd = w + 1 < windows ? fromS + (w + 1) * windowS - 1 : toS;
+      HistoryAggregate& agg = out[w];
+      for (; i < seg.summary.count && times[i] <= windowEnd; i++) addValue(store, field, agg, values[i]);
+    }
+    if (stats) {
+      stats->scanned++;
+      stats->records += i - begin;
+    }
+  }
+  return (int)windows;
+}
+
+void historyAggregate(const HistoryStore& store, HistoryField field, uint32_t fromS, uint32_t toS,
+                      HistoryAggregate& out, HistoryQueryStats* stats) {
+  clearAggregate(out);
+  if (toS < fromS) return;
+  historyWindows(store, field, fromS, toS, toS - fromS + 1, &out, 1, stats);
+}
+
+int historyFind(const HistoryStore& store, HistoryField field, HistoryCompare compare, int32_t threshold,
+                uint32_t fromS, uint32_t toS, HistoryMatch* out, int maxMatches, HistoryQueryStats* stats) {
+  if (stats) memset(stats, 0, sizeof(*stats));
+  if (toS < fromS || maxMatches < 1 || !store.started) return 0;
+  const bool above = compare == HIST_ABOVE;
+  int found = 0;
+  bool open = false;   // out[found] is a run still being extended
+
+  auto closeRun = [&]() {
+    if (open) {
+      found++;
+      open = false;
+    }
+  };
+  auto extendRun = [&](uint32_t firstS, uint32_t lastS, uint32_t records, int32_t extreme) {
+    if (!open) {
+      out[found].firstS = firstS;
+      out[found].records = 0;
+      out[found].extreme = extreme;
+      open = true;
+    }
+    HistoryMatch& m = out[found];
+    m.lastS = lastS;
+    m.records += records;
+    if (above ? extreme > m.extreme : extreme < m.extreme) m.extreme = extreme;
+  };
+
+  for (uint32_t k = firstSegmentFrom(store, fromS); k < store.started && found < maxMatches; k++) {
+    const HistoryRange& range = rangeAt(store, k);
+    if (range.firstS > toS) break;
+    const HistorySegment& seg = segmentAt(store, k);
+    const HistoryFieldSummary& fs = seg.summary.field[field];
+    if (stats) stats->segments++;
+
+    // Pushdown: no record can match, or every record matches
+    if (above ? fs.max <= threshold : fs.min >= threshold) {
+      closeRun();
+      if (stats) stats->pruned++;
+      continue;
+    }
+    const bool inside = range.firstS >= fromS && range.lastS <= toS;
+    if (inside && (above ? fs.min > threshold : fs.max < threshold)) {
+      extendRun(range.firstS, range.lastS, seg.summary.count, above ? fs.max : fs.min);
+      if (stats) stats->fromSummary++;
+      continue;
+    }
+
+    const uint16_t begin = firstRecordFrom(seg, fromS);
+    const int32_t* values = seg.value[field];
+    uint16_t i = begin;
+    for (; i < seg.summary.count && seg.timeS[i] <= toS && found < maxMatches; i++) {
+      const int32_t v = values[i];
+      if (above ? v > threshold : v < threshold) extendRun(seg.timeS[i], seg.timeS[i], 1, v);
+      else closeRun();
+    }
+    if (stats) {
+      stats->scanned++;
+      stats->records += i - begin;
+    }
+  }
+  closeRun();
+  return found;
+}
+
+float historyAverage(const HistoryAggregate& agg) {
+  return agg.count ? (float)((double)agg.sum / agg.count) : 0.0f;
+}
+
+int32_t historyPercentile(const HistoryStore& store, HistoryField field, const HistoryAggregate& agg, float p) {
+  if (!agg.count) return 0;
+  if (p <= 0) return agg.min;
+  if (p >= 1) return agg.max;
+  const double rank = p * (agg.count - 1);
+  uint32_t before = 0;
+  for (int b = 0; b < JKBMS_HISTORY_BINS; b++) {
+    const uint32_t n = agg.bins[b];
+    if (!n || before + n <= rank) {
+      before += n;
+      continue;
+    }
+    // Spread the bin's records evenly over its width
+    const double within = (rank - before + 0.5) / n;
+    int32_t v = (int32_t)(store.binLo[field] + store.binWidth[field] * (b + within));
+    return v < agg.min ? agg.min : v > agg.max ? agg.max : v;
+  }
+  return agg.max;
+}
+
+const char* historyFieldName(HistoryField field) {
+  return field < HIST_FIELD_COUNT ? fieldNames[field] : "?";
+}
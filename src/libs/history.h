@@ -0,0 +1,181 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <Arduino.h>
+#include "snapshot.h"
+
+class JKBMS;
+
+/**
+ * Per-pack history with summary-indexed queries
+ *
+ * Records are appended in time order into fixed-size segments kept in a
+ * ring (PSRAM when present). Every segment carries a summary that is
+ * updated on each append:
+ * - first/last time and a sparse time index (every JKBMS_HISTORY_INDEX_STRIDE
+ *   records), so a time bound is located without reading the records;
+ * - per field min, max, sum and a fixed-bin histogram.
+ * A small directory of segment time ranges stays in internal RAM.
+ *
+ * Queries binary-search the directory for the first segment of the range,
+ * answer segments that lie fully inside one window from their summary,
+ * and only read records of the segments at the window edges. Predicate
+ * queries (historyFind) skip every segment whose min/max cannot match.
+ * Percentiles come from the merged histograms, so they are approximate
+ * (within one bin, see historySetRange()); count, min, max and average are
+ * exact.
+ *
+ * Not thread-safe: append and query from the same task (loop()).
+ */
+
+#ifndef JKBMS_HISTORY_SEGMENT_RECORDS
+#define JKBMS_HISTORY_SEGMENT_RECORDS 256
+#endif
+#define JKBMS_HISTORY_INDEX_STRIDE 16
+#define JKBMS_HISTORY_BINS 32
+
+static_assert(JKBMS_HISTORY_SEGMENT_RECORDS % JKBMS_HISTORY_INDEX_STRIDE == 0, "segment must hold whole index strides");
+static_assert(JKBMS_HISTORY_SEGMENT_RECORDS <= 65535, "bin counts are 16-bit");
+
+// Stored fields, all int32 in the units below
+enum HistoryField {
+  HIST_VOLTAGE = 0,   // pack voltage, mV
+  HIST_CURRENT,       // mA, positive while charging
+  HIST_SOC,           // %
+  HIST_CELL_MIN,      // lowest cell, mV
+  HIST_CELL_MAX,      // highest cell, mV
+  HIST_CELL_DELTA,    // mV
+  HIST_TEMP_MAX,      // hottest of T1/T2, 0.1 °C
+  HIST_FIELD_COUNT
+};
+
+struct HistoryFieldSummary {
+  int32_t min;
+  int32_t max;
+  int64_t sum;
+  uint16_t bins[JKBMS_HISTORY_BINS];
+};
+
+struct HistorySummary {
+  uint32_t firstS;
+  uint32_t lastS;
+  uint16_t count;
+  uint32_t sparseTime[JKBMS_HISTORY_SEGMENT_RECORDS / JKBMS_HISTORY_INDEX_STRIDE];
+  HistoryFieldSummary field[HIST_FIELD_COUNT];
+};
+
+// Column layout: a field scan reads one contiguous array
+struct HistorySegment {
+  HistorySummary summary;
+  uint32_t timeS[JKBMS_HISTORY_SEGMENT_RECORDS];
+  int32_t value[HIST_FIELD_COUNT][JKBMS_HISTORY_SEGMENT_RECORDS];
+};
+
+// Directory entry, one per ring slot
+struct HistoryRange {
+  uint32_t firstS;
+  uint32_t lastS;
+};
+
+struct HistoryStore {
+  HistorySegment* segments;     // ring of `capacity` segments
+  HistoryRange* directory;
+  uint16_t capacity;
+  uint32_t started;             // segments ever started; the newest is (started - 1) % capacity
+  uint32_t minIntervalS;        // historyUpdate() keeps at most one record per interval
+  uint32_t lastVersion;         // JKBMS::snapshotVersion of the last record taken by historyUpdate()
+  int32_t binLo[HIST_FIELD_COUNT];
+  int32_t binWidth[HIST_FIELD_COUNT];
+};
+
+// Result of an aggregate query; can be merged and fed to historyPercentile()
+struct HistoryAggregate {
+  uint32_t count;
+  int32_t min;
+  int32_t max;
+  int64_t sum;
+  uint32_t bins[JKBMS_HISTORY_BINS];
+};
+
+// Work done by one query, to check that pruning works
+struct HistoryQueryStats {
+  uint32_t segments;          // segments overlapping the time range
+  uint32_t fromSummary;       // answered from the summary alone
+  uint32_t pruned;            // skipped by historyFind() on min/max
+  uint32_t scanned;           // segments whose records were read
+  uint32_t records;           // records read
+};
+
+enum HistoryCompare {
+  HIST_ABOVE = 0,             // value > threshold
+  HIST_BELOW                  // value < threshold
+};
+
+// Run of consecutive records matching a predicate
+struct HistoryMatch {
+  uint32_t firstS;
+  uint32_t lastS;
+  uint32_t records;
+  int32_t extreme;            // highest (HIST_ABOVE) or lowest (HIST_BELOW) value of the run
+};
+
+/**
+ * Allocate a store of `segments` segments (about 8.7 KB each with the defaults)
+ * @return false if the memory is not available
+ */
+bool historyInit(HistoryStore& store, uint16_t segments, uint32_t minIntervalS = 0);
+void historyFree(HistoryStore& store);
+
+/**
+ * Histogram range of a field, used for percentiles
+ * Values outside [lo, hi) fall into the first or last bin. Only allowed
+ * while the store is empty.
+ */
+bool historySetRange(HistoryStore& store, HistoryField field, int32_t lo, int32_t hi);
+
+/**
+ * Append one record
+ * @param timeS Seconds on any monotonic clock (epoch once NTP is synced)
+ * @return false if timeS is older than the last record
+ */
+bool historyAppend(HistoryStore& store, uint32_t timeS, const JkSnapshot& snap);
+
+/**
+ * Append the device's latest cell frame if it is new and minIntervalS has passed
+ * Call from loop(), like checkpointUpdate().
+ */
+bool historyUpdate(HistoryStore& store, const JKBMS& bms, uint32_t timeS);
+
+uint32_t historyRecords(const HistoryStore& store);
+bool historyTimeRange(const HistoryStore& store, uint32_t& firstS, uint32_t& lastS);
+
+/**
+ * Aggregate a field over [fromS, toS]
+ */
+void historyAggregate(const HistoryStore& store, HistoryField field, uint32_t fromS, uint32_t toS,
+                      HistoryAggregate& out, HistoryQueryStats* stats = nullptr);
+
+/**
+ * Aggregate a field per window: out[k] covers [fromS + k*windowS, fromS + (k+1)*windowS)
+ * @return Number of windows filled (at most maxWindows; toS is clipped to fit)
+ */
+int historyWindows(const HistoryStore& store, HistoryField field, uint32_t fromS, uint32_t toS, uint32_t windowS,
+                   HistoryAggregate* out, int maxWindows, HistoryQueryStats* stats = nullptr);
+
+/**
+ * Runs of records in [fromS, toS] where the field is above/below the threshold
+ * e.g. historyFind(store, HIST_CELL_MAX, HIST_ABOVE, 3550, ...) finds when any
+ * cell exceeded 3.55 V.
+ * @return Number of runs written (at most maxMatches, oldest first)
+ */
+int historyFind(const HistoryStore& store, HistoryField field, HistoryCompare compare, int32_t threshold,
+                uint32_t fromS, uint32_t toS, HistoryMatch* out, int maxMatches, HistoryQueryStats* stats = nullptr);
+
+void historyMerge(HistoryAggregate& into, const HistoryAggregate& from);
+float historyAverage(const HistoryAggregate& agg);
+// Approximate percentile (p in 0..1) from the histogram, clamped to the exact min/max
+int32_t historyPercentile(const HistoryStore& store, HistoryField field, const HistoryAggregate& agg, float p);
+
+const char* historyFieldName(HistoryField field);
+
+#endif // HISTORY_H
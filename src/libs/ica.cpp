@@ -0,0 +1,175 @@
+/**
+ * @file ica.cpp
+ * @brief Charge-per-voltage-bin accumulation, smoothing and peak tracking
+ */
+
+#include "ica.h"
+#include "JKBMS.h"
+
+#include <math.h>
+
+void icaInit(IcaState& state, const IcaConfig* config) {
+  // Plain data; memset avoids a ~10 KB temporary on the loop() stack
+  memset((void*)&state, 0, sizeof(state));
+  state.config = config ? *config : IcaConfig();
+}
+
+static void startSession(IcaState& state, uint32_t timeMs) {
+  state.active = true;
+  state.sessionAh = 0;
+  state.lastMs = timeMs;
+  memset(state.bins, 0, sizeof(state.bins));
+}
+
+void icaCurve(const IcaState& state, int cell, float* out) {
+  const int k = state.config.smoothBins < 0 ? 0 : state.config.smoothBins;
+  const float* bins = state.bins[cell];
+  for (int b = 0; b < JKBMS_ICA_BINS; b++) {
+    float sum = 0, weight = 0;
+    for (int j = -k; j <= k; j++) {
+      if (b + j < 0 || b + j >= JKBMS_ICA_BINS) continue;
+      const float w = (float)(k + 1 - (j < 0 ? -j : j));
+      sum += w * bins[b + j];
+      weight += w;
+    }
+    out[b] = sum / weight / state.config.binWidthV;
+  }
+}
+
+// Main peak of the cell's curve; only accepted when the charge went across it
+static bool findPeak(const IcaState& state, int cell, IcaPeak& peak) {
+  const IcaConfig& cfg = state.config;
+  const float* bins = state.bins[cell];
+  int firstBin = -1, lastBin = -1;
+  for (int b = 0; b < JKBMS_ICA_BINS; b++) {
+    if (bins[b] <= 0) continue;
+    if (firstBin < 0) firstBin = b;
+    lastBin = b;
+  }
+  if (firstBin < 0) return false;
+
+  float curve[JKBMS_ICA_BINS];
+  icaCurve(state, cell, curve);
+  int best = -1;
+  for (int b = 1; b < JKBMS_ICA_BINS - 1; b++) {
+    if (best < 0 || curve[b] > curve[best]) best = b;
+  }
+  const int margin = cfg.smoothBins + 1;
+  if (best < firstBin + margin || best > lastBin - margin || curve[best] <= 0) return false;
+
+  // Parabola through the peak bin and its neighbours
+  const float y0 = curve[best - 1], y1 = curve[best], y2 = curve[best + 1];
+  const float denom = y0 - 2 * y1 + y2;
+  const float offset = denom < 0 ? 0.5f * (y0 - y2) / denom : 0.0f;
+  peak.voltage = cfg.binStartV + (best + 0.5f + offset) * cfg.binWidthV;
+  peak.height = y1 - 0.25f * (y0 - y2) * offset;
+  return true;
+}
+
+static int closeSession(IcaState& state, uint32_t timeS) {
+  const IcaConfig& cfg = state.config;
+  state.active = false;
+  if (state.sessionAh <= 0 || (state.nominalAh > 0 && state.sessionAh < cfg.minSessionSoc * state.nominalAh)) {
+    state.rejected++;
+    return 0;
+  }
+
+  const uint8_t slot = state.recentHead;
+  state.recentHead = (state.recentHead + 1) % JKBMS_ICA_SESSIONS;
+  if (state.recentCount < JKBMS_ICA_SESSIONS) state.recentCount++;
+  state.sessions++;
+
+  int found = 0;
+  for (int c = 0; c < state.cells; c++) {
+    IcaPeak peak = {};
+    peak.endS = timeS;
+    peak.chargeAh = state.sessionAh;
+    if (!findPeak(state, c, peak)) {
+      peak.voltage = 0;
+      peak.height = 0;
+    } else {
+      IcaCellTrend& t = state.trend[c];
+      if (!t.sessions) {
+        t.first = peak;
+        t.voltage = peak.voltage;
+        t.height = peak.height;
+      } else {
+        t.voltage += cfg.trendAlpha * (peak.voltage - t.voltage);
+        t.height += cfg.trendAlpha * (peak.height - t.height);
+      }
+      if (t.sessions < 0xFFFF) t.sessions++;
+      found++;
+    }
+    state.recent[c][slot] = peak;
+  }
+  return found;
+}
+
+int icaAddSample(IcaState& state, uint32_t timeMs, uint32_t timeS, float currentA, float nominalAh,
+                 const float* cellV, int count) {
+  const IcaConfig& cfg = state.config;
+  if (count > JKBMS_ICA_CELLS) count = JKBMS_ICA_CELLS;
+  const float nominal = cfg.nominalAh > 0 ? cfg.nominalAh : nominalAh;
+  const bool slow = currentA >= cfg.minCurrentA && (nominal <= 0 || currentA <= cfg.maxCRate * nominal);
+
+  int found = 0;
+  if (state.active && (!slow || timeMs - state.lastMs > cfg.maxGapMs || count != state.cells)) {
+    found = closeSession(state, timeS);
+  }
+  if (!slow) return found;
+  if (!state.active) {
+    // The first sample of a session only sets the time base
+    startSession(state, timeMs);
+    state.cells = (uint8_t)count;
+    state.nominalAh = nominal;
+    return found;
+  }
+
+  const float dAh = currentA * (float)(timeMs - state.lastMs) / 3600000.0f;
+  state.lastMs = timeMs;
+  state.sessionAh += dAh;
+  const float invWidth = 1.0f / cfg.binWidthV;
+  for (int c = 0; c < count; c++) {
+    if (cellV[c] <= 0) continue;
+    const float pos = (cellV[c] - cfg.binStartV) * invWidth;
+    if (pos < 0 || pos >= JKBMS_ICA_BINS) continue;
+    state.bins[c][(int)pos] += dAh;
+  }
+  return found;
+}
+
+int icaUpdate(IcaState& state, const JKBMS& bms, uint32_t timeS) {
+  if (!bms.snapshotVersion || bms.snapshotVersion == state.lastVersion) return 0;
+  state.lastVersion = bms.snapshotVersion;
+  const int count = bms.cellCountClamped();
+  return icaAddSample(state, millis(), timeS, bms.Charge_Current, bms.Nominal_Capacity, bms.cellVoltage, count);
+}
+
+int icaAddSnapshot(IcaState& state, const JkSnapshot& snap, uint32_t timeS) {
+  float cellV[JKBMS_SNAPSHOT_CELLS];
+  const int count = snap.header.cellCount < JKBMS_SNAPSHOT_CELLS ? snap.header.cellCount : JKBMS_SNAPSHOT_CELLS;
+  for (int c = 0; c < count; c++) cellV[c] = snap.cellMv[c] * 0.001f;
+  return icaAddSample(state, snap.header.timestampMs, timeS, snap.currentMa * 0.001f,
+                      snap.nominalCapacityMah * 0.001f, cellV, count);
+}
+
+int icaFinish(IcaState& state, uint32_t timeS) {
+  return state.active ? closeSession(state, timeS) : 0;
+}
+
+bool icaRecentPeak(const IcaState& state, int cell, int k, IcaPeak& out) {
+  if (k < 0 || k >= state.recentCount) return false;
+  const int slot = (state.recentHead + JKBMS_ICA_SESSIONS - 1 - k) % JKBMS_ICA_SESSIONS;
+  out = state.recent[cell][slot];
+  return out.height > 0;
+}
+
+float icaHeightRatio(const IcaState& state, int cell) {
+  const IcaCellTrend& t = state.trend[cell];
+  if (!t.sessions || t.first.height <= 0) return 0;
+  for (int k = 0; k < state.recentCount; k++) {
+    IcaPeak peak;
+    if (icaRecentPeak(state, cell, k, peak)) return peak.height / t.first.height;
+  }
+  return 0;
+}
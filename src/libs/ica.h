@@ -0,0 +1,114 @@
+#ifndef ICA_H
+#define ICA_H
+
+#include <Arduino.h>
+#include "snapshot.h"
+
+class JKBMS;
+
+/**
+ * Incremental capacity analysis (dQ/dV) per cell
+ *
+ * While the pack charges slowly, the charge integrated from Charge_Current
+ * is added to a fixed voltage bin of every cell (the bin of the cell's
+ * voltage at that moment). At the end of the charge session the bins hold
+ * dQ per voltage step; smoothed with a triangular kernel and divided by the
+ * bin width they give the dQ/dV curve in Ah/V. Its main peak (LFP: around
+ * 3.33-3.35 V) moves and shrinks as the cell ages: the peak height relative
+ * to the sibling cells, or to the cell's own first sessions, is the SoH
+ * estimate.
+ *
+ * Memory is fixed per pack (~10 KB with the defaults): the bins of the
+ * session in progress, the last JKBMS_ICA_SESSIONS peaks of each cell and a
+ * long-term trend (first peak and EWMA). The same code runs on the gateway
+ * (icaUpdate() from loop()) and in the host batch job over snapshot archives
+ * (host/ica_batch.cpp), one IcaState per pack.
+ */
+
+#ifndef JKBMS_ICA_BINS
+#define JKBMS_ICA_BINS 64
+#endif
+#ifndef JKBMS_ICA_SESSIONS
+#define JKBMS_ICA_SESSIONS 8
+#endif
+#define JKBMS_ICA_CELLS 24
+
+struct IcaConfig {
+  float binStartV = 3.20f;    // LFP charge plateau; JKBMS_ICA_BINS bins from here
+  float binWidthV = 0.005f;
+  float nominalAh = 0;        // 0: Nominal_Capacity / snapshot nominalCapacityMah
+  float minCurrentA = 1.0f;   // below: not charging
+  float maxCRate = 0.25f;     // above: too fast, IR drop smears the curve
+  uint32_t maxGapMs = 30000;  // longer without a sample ends the session
+  float minSessionSoc = 0.2f; // sessions shorter than this share of nominalAh are dropped
+  int smoothBins = 3;         // triangular kernel half-width
+  float trendAlpha = 0.2f;    // EWMA weight of one session in the trend
+};
+
+// Main dQ/dV peak of one cell in one session
+struct IcaPeak {
+  uint32_t endS;              // caller clock at the end of the session
+  float voltage;              // V, interpolated between bins
+  float height;               // Ah/V
+  float chargeAh;             // charge of the whole session
+};
+
+struct IcaCellTrend {
+  IcaPeak first;              // reference: first valid session
+  float voltage;              // EWMA over sessions
+  float height;
+  uint16_t sessions;
+};
+
+struct IcaState {
+  IcaConfig config;
+  uint8_t cells;
+  bool active;                // slow-charge session in progress
+  uint32_t lastMs;
+  uint32_t lastVersion;       // JKBMS::snapshotVersion of the last sample taken by icaUpdate()
+  float sessionAh;
+  float nominalAh;            // capacity the session is measured against
+  uint32_t sessions;          // sessions analysed
+  uint32_t rejected;          // sessions too short
+  float bins[JKBMS_ICA_CELLS][JKBMS_ICA_BINS];   // Ah per bin, session in progress
+  IcaPeak recent[JKBMS_ICA_CELLS][JKBMS_ICA_SESSIONS];  // ring over sessions; height 0: no peak found
+  uint8_t recentCount;
+  uint8_t recentHead;
+  IcaCellTrend trend[JKBMS_ICA_CELLS];
+};
+
+void icaInit(IcaState& state, const IcaConfig* config = nullptr);
+
+/**
+ * Feed one sample
+ * @param timeMs Sample time (millis() on the gateway), used to integrate the charge
+ * @param timeS Wall-clock seconds stored with the peaks (epoch, or timeMs / 1000)
+ * @param currentA Pack current, positive while charging
+ * @param nominalAh Pack capacity, used unless config.nominalAh is set (0 if unknown)
+ * @param cellV Cell voltages in volts, 0 for missing cells
+ * @return Number of cells with a new peak (a session was just closed), 0 otherwise
+ */
+int icaAddSample(IcaState& state, uint32_t timeMs, uint32_t timeS, float currentA, float nominalAh,
+                 const float* cellV, int count);
+
+// Take the device's latest cell frame if it is new; call from loop()
+int icaUpdate(IcaState& state, const JKBMS& bms, uint32_t timeS);
+int icaAddSnapshot(IcaState& state, const JkSnapshot& snap, uint32_t timeS);
+
+// Close the session in progress now (e.g. at the end of an archive)
+int icaFinish(IcaState& state, uint32_t timeS);
+
+/**
+ * Smoothed dQ/dV curve of a cell for the session in progress
+ * @param out JKBMS_ICA_BINS values in Ah/V; bin b is centred at
+ *            binStartV + (b + 0.5) * binWidthV
+ */
+void icaCurve(const IcaState& state, int cell, float* out);
+
+// Newest peak of a cell (k = 0), or older ones; false if there is none
+bool icaRecentPeak(const IcaState& state, int cell, int k, IcaPeak& out);
+
+// Latest peak height against the first session's, 0 if unknown
+float icaHeightRatio(const IcaState& state, int cell);
+
+#endif // ICA_H
@@ -0,0 +1,69 @@
+#ifndef INGEST_PROTOCOL_H
+#define INGEST_PROTOCOL_H
+
+#include "snapshot.h"
+
+/**
+ * Gateway -> ingest server wire format
+ *
+ * A TCP stream of messages. Each message is an IngestMessageHeader followed
+ * by `length` payload bytes holding `count` records:
+ * - INGEST_SNAPSHOTS: JkSnapshot records back to back (each carries its own
+ *   size, so newer, larger snapshots pass through older servers). A gateway
+ *   can send the content of its snapshot ring verbatim.
+ * - INGEST_RAW_FRAMES: IngestRawFrame + `length` bytes of a reassembled JK
+ *   frame, for gateways that forward frames without parsing them; the server
+ *   runs the library parsers.
+ * - INGEST_HELLO: payload is the gateway name (not NUL-terminated), optional.
+ * - INGEST_SKETCHES: sealed JkSketch records (quantile_sketch.h) back to
+ *   back, for gateways that send distributions instead of every snapshot.
+ *   The server merges them into the pack's sketches of the current day;
+ *   a gateway that also sends snapshots of the same pack counts it twice.
+ *
+ * Little-endian, packed, no pointers; like snapshot.h this header only needs
+ * the C library.
+ */
+
+#define JKBMS_INGEST_MAGIC 0x474B494AUL  // "JIKG"
+#define JKBMS_INGEST_VERSION 1
+#define JKBMS_INGEST_MAX_PAYLOAD (1024UL * 1024)
+
+enum IngestMessageType {
+  INGEST_HELLO = 1,
+  INGEST_SNAPSHOTS = 2,
+  INGEST_RAW_FRAMES = 3,
+  INGEST_SKETCHES = 4,
+};
+
+#pragma pack(push, 1)
+
+struct IngestMessageHeader {
+  uint32_t magic;           // JKBMS_INGEST_MAGIC
+  uint8_t version;          // JKBMS_INGEST_VERSION
+  uint8_t type;             // IngestMessageType
+  uint16_t count;           // records in the payload
+  uint32_t length;          // payload bytes, at most JKBMS_INGEST_MAX_PAYLOAD
+};
+
+struct IngestRawFrame {
+  uint8_t mac[6];           // most significant byte first
+  uint8_t protocol;         // ProtocolVariant, 0 to detect
+  uint8_t reserved;
+  uint32_t timestampMs;     // gateway millis() when the frame completed
+  uint16_t length;          // frame bytes that follow (300 for JK02/JK04)
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(IngestMessageHeader) == 12, "ingest header layout changed");
+static_assert(sizeof(IngestRawFrame) == 14, "ingest raw frame layout changed");
+
+static inline void ingestHeader(IngestMessageHeader& h, IngestMessageType type, uint16_t count, uint32_t length) {
+  h.magic = JKBMS_INGEST_MAGIC;
+  h.version = JKBMS_INGEST_VERSION;
+  h.type = (uint8_t)type;
+  h.count = count;
+  h.length = length;
+}
+
+#endif // INGEST_PROTOCOL_H
@@ -0,0 +1,45 @@
+/**
+ * @file init_phases.cpp
+ * @brief Time spent in each startup and session-setup step
+ */
+
+#include "init_phases.h"
+
+static const char* const phaseNames[INIT_PHASE_COUNT] = {
+  "ble_sync", "connect", "discovery", "subscribe", "device_info", "first_data", "enable"
+};
+
+static InitPhaseStats stats[INIT_PHASE_COUNT];
+
+void initPhaseRecord(InitPhase phase, uint32_t ms, bool timedOut) {
+  InitPhaseStats& s = stats[phase];
+  s.count++;
+  if (timedOut) s.timeouts++;
+  s.lastMs = ms;
+  s.totalMs += ms;
+  if (ms > s.maxMs) s.maxMs = ms;
+}
+
+const InitPhaseStats& initPhaseStats(InitPhase phase) {
+  return stats[phase];
+}
+
+const char* initPhaseName(InitPhase phase) {
+  return phaseNames[phase];
+}
+
+void initPhaseEmit(MetricsEmitFunc emit, void* ctx) {
+  char name[48];
+  for (int p = 0; p < INIT_PHASE_COUNT; p++) {
+    const InitPhaseStats& s = stats[p];
+    if (!s.count) continue;
+    snprintf(name, sizeof(name), "init.%s.last_ms", phaseNames[p]);
+    emit(name, s.lastMs, ctx);
+    snprintf(name, sizeof(name), "init.%s.avg_ms", phaseNames[p]);
+    emit(name, (float)s.totalMs / s.count, ctx);
+    snprintf(name, sizeof(name), "init.%s.max_ms", phaseNames[p]);
+    emit(name, s.maxMs, ctx);
+    snprintf(name, sizeof(name), "init.%s.timeouts", phaseNames[p]);
+    emit(name, s.timeouts, ctx);
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef INIT_PHASES_H
+#define INIT_PHASES_H
+
+#include <Arduino.h>
+#include "metrics.h"
+
+// Fallback timeouts: the steps normally finish as soon as their signal arrives
+#ifndef JKBMS_RESPONSE_TIMEOUT_MS
+#define JKBMS_RESPONSE_TIMEOUT_MS 800   // request -> first complete frame
+#endif
+// Minimum gap between commands the BMS does not answer (charge/discharge/balance)
+#ifndef JKBMS_COMMAND_GAP_MS
+#define JKBMS_COMMAND_GAP_MS 100
+#endif
+
+// Startup and session setup steps, in order
+enum InitPhase {
+  INIT_BLE_SYNC = 0,   // NimBLEDevice::init(), which returns once host and controller are in sync
+  INIT_CONNECT,        // connection request until link up (including retries)
+  INIT_DISCOVERY,      // ffe0/ffe1 discovery
+  INIT_SUBSCRIBE,      // CCCD write until confirmed
+  INIT_DEVICE_INFO,    // 0x97 request until the device-info frame
+  INIT_FIRST_DATA,     // 0x96 request until the first frame of the stream
+  INIT_ENABLE,         // charge/discharge/balance commands
+  INIT_PHASE_COUNT
+};
+
+struct InitPhaseStats {
+  uint32_t count;
+  uint32_t timeouts;   // the signal never came and the fallback timeout expired
+  uint32_t lastMs;
+  uint32_t maxMs;
+  uint64_t totalMs;
+};
+
+/**
+ * Poll a readiness condition
+ * Sleeps in small steps with delay(), so the NimBLE task keeps running.
+ * @return true if the condition became true, false at the timeout
+ */
+template <typename Ready>
+bool waitUntil(Ready ready, uint32_t timeoutMs, uint32_t pollMs = 5) {
+  const uint32_t start = millis();
+  while (!ready()) {
+    if (millis() - start >= timeoutMs) return false;
+    delay(pollMs);
+  }
+  return true;
+}
+
+void initPhaseRecord(InitPhase phase, uint32_t ms, bool timedOut = false);
+const InitPhaseStats& initPhaseStats(InitPhase phase);
+const char* initPhaseName(InitPhase phase);
+
+// Metrics source: init.<phase>.last_ms / avg_ms / max_ms / timeouts
+void initPhaseEmit(MetricsEmitFunc emit, void* ctx);
+
+#endif // INIT_PHASES_H
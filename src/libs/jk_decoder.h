@@ -0,0 +1,407 @@
+#ifndef JK_DECODER_H
+#define JK_DECODER_H
+
+#include <Arduino.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <type_traits>
+#include "protocol_variant.h"
+
+/**
+ * Compile-time configured frame decoder
+ *
+ * JKBMS always carries the settings and device-info parsers, the debug
+ * hooks, JKBMS_MAX_CELLS float arrays and every float field, plus the BLE
+ * connection state. JkDecoder is the frame-decoding half on its own, header
+ * only, configured by four policies:
+ *
+ *   Layout    JkLayoutJk02<N>, JkLayoutJk04<N> or JkLayoutAuto<N>: protocol
+ *             and cell count. A fixed protocol drops the other decoder.
+ *   Storage   JkFloatStorage (V, A, Ah, Ohm, °C as float, like JKBMS) or
+ *             JkFixedStorage (mV, mA, mAh, mOhm, mW as integers, 0.1 °C),
+ *             which needs no floating point on JK02.
+ *   Logging   JkNoLog (nothing compiled in) or JkPrintfLog.
+ *   Features  JkAllFrames or JkCellFramesOnly; frame types switched off are
+ *             not compiled and take no space in the instance.
+ *
+ * decode() takes one reassembled frame (55 AA EB 90 header, 300 bytes) and
+ * returns its type if it was decoded. The static decodeJk02(), decodeJk04(),
+ * decodeSettings() and decodeDeviceInfo() fill caller-held data instead:
+ * JKBMS::parseData(), parseDataJk04(), bms_settings() and parseDeviceInfo()
+ * go through them with JkDefaultDecoder, so the offsets and scaling below
+ * are the only copy, shared by the firmware, the host tools and the Python
+ * bindings.
+ *
+ *   JkDecoder<JkLayoutJk02<16>, JkFixedStorage, JkNoLog, JkCellFramesOnly> pack;
+ *   if (pack.decode(frame, length) == JK_FRAME_CELL_INFO) use(pack.cells.cellMv[0]);
+ */
+
+static const uint8_t JK_FRAME_SETTINGS = 0x01;
+static const uint8_t JK_FRAME_CELL_INFO = 0x02;
+static const uint8_t JK_FRAME_DEVICE_INFO = 0x03;
+static const size_t JK_FRAME_SIZE = 300;
+
+//********************************************
+// Layout policies
+//********************************************
+
+template <int Cells = 16>
+struct JkLayoutJk02 {
+  static_assert(Cells > 0 && Cells <= 16, "JK02 frames carry 16 cells");
+  static const int CELLS = Cells;
+  static const ProtocolVariant PROTOCOL = PROTOCOL_JK02;
+};
+
+template <int Cells = JK04_CELLS>
+struct JkLayoutJk04 {
+  static_assert(Cells > 0 && Cells <= JK04_CELLS, "JK04 frames carry 24 cells");
+  static const int CELLS = Cells;
+  static const ProtocolVariant PROTOCOL = PROTOCOL_JK04;
+};
+
+// Detected per device from the device-info frame, else from the first cell frame
+template <int Cells = JK04_CELLS>
+struct JkLayoutAuto {
+  static_assert(Cells > 0 && Cells <= JK04_CELLS, "at most 24 cells");
+  static const int CELLS = Cells;
+  static const ProtocolVariant PROTOCOL = PROTOCOL_AUTO;
+};
+
+//********************************************
+// Storage policies
+//********************************************
+
+struct JkFloatStorage {
+  typedef float Milli;        // V, A, Ah, W from milli-units
+  typedef float Cell;         // cell V, wire Ohm
+  typedef float Deci;         // °C
+  static Milli milli(int32_t raw) { return raw * 0.001f; }
+  static Cell cell(uint16_t raw) { return raw * 0.001f; }
+  static Deci deci(int32_t raw) { return raw * 0.1f; }
+  static Milli unit(float value) { return value; }
+  static Cell cellUnit(float value) { return value; }
+  static Milli power(Milli volts, Milli amps) { return volts * amps; }
+};
+
+struct JkFixedStorage {
+  typedef int32_t Milli;      // mV, mA, mAh, mW
+  typedef uint16_t Cell;      // cell mV, wire mOhm
+  typedef int16_t Deci;       // 0.1 °C
+  static Milli milli(int32_t raw) { return raw; }
+  static Cell cell(uint16_t raw) { return raw; }
+  static Deci deci(int32_t raw) { return (Deci)raw; }
+  static Milli unit(float value) { return (Milli)lroundf(value * 1000.0f); }
+  static Cell cellUnit(float value) { return value <= 0 ? 0 : value >= 65.535f ? 0xFFFF : (Cell)lroundf(value * 1000.0f); }
+  static Milli power(Milli mv, Milli ma) { return (Milli)((int64_t)mv * ma / 1000); }
+};
+
+//********************************************
+// Logging and feature policies
+//********************************************
+
+struct JkNoLog {
+  static const bool ENABLED = false;
+  static void print(const char* format, ...) {}
+};
+
+struct JkPrintfLog {
+  static const bool ENABLED = true;
+  static void print(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+  }
+};
+
+struct JkAllFrames {
+  static const bool CELLS = true;
+  static const bool SETTINGS = true;
+  static const bool DEVICE_INFO = true;
+};
+
+struct JkCellFramesOnly {
+  static const bool CELLS = true;
+  static const bool SETTINGS = false;
+  static const bool DEVICE_INFO = false;
+};
+
+//********************************************
+// Decoded data
+//********************************************
+
+template <class Storage, int Cells>
+struct JkCellData {
+  typedef typename Storage::Milli Milli;
+  typedef typename Storage::Cell Cell;
+  typedef typename Storage::Deci Deci;
+  Cell cellMv[Cells];         // named for JkFixedStorage; volts with JkFloatStorage
+  Cell wireResist[Cells];
+  Cell averageCell;
+  Cell deltaCell;
+  Milli batteryVoltage;
+  Milli current;              // positive while charging
+  Milli power;
+  Milli balanceCurrent;
+  Milli capacityRemain;
+  Milli nominalCapacity;
+  Milli cycleCapacity;
+  Deci mosTemp;
+  Deci t1;
+  Deci t2;
+  uint32_t cycleCount;
+  uint32_t uptimeS;
+  uint8_t cellCount;          // cells with a voltage
+  uint8_t soc;
+  uint8_t balancingAction;
+  bool charge;
+  bool discharge;
+  bool balance;
+};
+
+template <class Storage>
+struct JkSettingsData {
+  typedef typename Storage::Milli Milli;
+  typedef typename Storage::Deci Deci;
+  Milli cellUvp, cellUvpr, cellOvp, cellOvpr;
+  Milli balanceTrigger, balanceStart, powerOff;
+  Milli maxChargeCurrent, maxDischargeCurrent, maxBalanceCurrent;
+  Milli totalCapacity;
+  Deci chargeOtp, chargeOtpr, dischargeOtp, dischargeOtpr;
+  Deci chargeUtp, chargeUtpr, mosOtp, mosOtpr;
+  uint32_t chargeOcpDelayS, chargeOcpRecoveryS;
+  uint32_t dischargeOcpDelayS, dischargeOcpRecoveryS;
+  uint32_t scpRecoveryS, scpDelayUs;
+  uint32_t cellCount;
+};
+
+// Passcode fields of the 0x03 frame are not kept
+struct JkDeviceInfoData {
+  char vendor[17];
+  char hardwareVersion[9];
+  char softwareVersion[9];
+  char name[17];
+  char manufactured[9];
+  char serial[12];
+  uint32_t uptimeS;
+  uint32_t powerOnCount;
+};
+
+struct JkNoData {};
+
+//********************************************
+// Decoder
+//********************************************
+
+template <class Layout, class Storage = JkFloatStorage, class Logging = JkNoLog, class Features = JkAllFrames>
+class JkDecoder {
+public:
+  static const int CELLS = Layout::CELLS;
+  typedef JkCellData<Storage, CELLS> Cells;
+  typedef typename std::conditional<Features::SETTINGS, JkSettingsData<Storage>, JkNoData>::type Settings;
+  typedef typename std::conditional<Features::DEVICE_INFO, JkDeviceInfoData, JkNoData>::type DeviceInfo;
+
+  Cells cells = {};
+  Settings settings = {};
+  DeviceInfo info = {};
+  ProtocolVariant protocol = Layout::PROTOCOL;  // JkLayoutAuto: PROTOCOL_AUTO until detected
+  uint32_t cellFrames = 0;    // also the sequence of the cell data, like JKBMS::snapshotVersion
+  uint32_t otherFrames = 0;   // settings and device info
+  uint32_t skipped = 0;       // bad header, too short, compiled out or JK04 settings
+
+  /**
+   * Decode one reassembled frame
+   * @return Frame type (JK_FRAME_*) if decoded, 0 otherwise
+   */
+  uint8_t decode(const uint8_t* frame, size_t length) {
+    if (length < JK_FRAME_SIZE || frame[0] != 0x55 || frame[1] != 0xAA || frame[2] != 0xEB || frame[3] != 0x90) {
+      skipped++;
+      return 0;
+    }
+    bool done = false;
+    switch (frame[4]) {
+      case JK_FRAME_CELL_INFO:
+        done = decodeCells(frame, std::integral_constant<bool, Features::CELLS>());
+        if (done) cellFrames++;
+        break;
+      case JK_FRAME_SETTINGS:
+        done = decodeSettings(frame, std::integral_constant<bool, Features::SETTINGS>());
+        break;
+      case JK_FRAME_DEVICE_INFO:
+        done = decodeDeviceInfo(frame, std::integral_constant<bool, Features::DEVICE_INFO>());
+        break;
+      default:
+        break;
+    }
+    if (!done) {
+      skipped++;
+      return 0;
+    }
+    if (frame[4] != JK_FRAME_CELL_INFO) otherFrames++;
+    return frame[4];
+  }
+
+  // JK02 cell-info frame; cells past 16 and a balance current with a bad sign nibble are left unchanged
+  static void decodeJk02(const uint8_t* f, Cells& c) {
+    static const int JK02_CELLS = 16;
+    uint8_t count = 0;
+    for (int i = 0; i < CELLS && i < JK02_CELLS; i++) {
+      const uint16_t mv = u16(f + 6 + i * 2);
+      c.cellMv[i] = Storage::cell(mv);
+      c.wireResist[i] = Storage::cell(u16(f + 80 + i * 2));
+      count += mv != 0;
+    }
+    c.cellCount = count;
+    c.averageCell = Storage::cell(u16(f + 74));
+    c.deltaCell = Storage::cell(u16(f + 76));
+    c.mosTemp = Storage::deci((int16_t)u16(f + 144));
+    c.batteryVoltage = Storage::milli((int32_t)u32(f + 150));
+    c.current = Storage::milli((int32_t)u32(f + 158));
+    c.power = Storage::power(c.batteryVoltage, c.current);
+    c.t1 = Storage::deci((int16_t)u16(f + 162));
+    c.t2 = Storage::deci((int16_t)u16(f + 164));
+    // Sign and magnitude: high nibble F is negative
+    if ((f[171] & 0xF0) == 0x00) {
+      c.balanceCurrent = Storage::milli(f[171] << 8 | f[170]);
+    } else if ((f[171] & 0xF0) == 0xF0) {
+      c.balanceCurrent = Storage::milli(-((f[171] & 0x0F) << 8 | f[170]));
+    }
+    c.balancingAction = f[172];
+    c.soc = f[173];
+    c.capacityRemain = Storage::milli((int32_t)u32(f + 174));
+    c.nominalCapacity = Storage::milli((int32_t)u32(f + 178));
+    c.cycleCount = u32(f + 182);
+    c.cycleCapacity = Storage::milli((int32_t)u32(f + 186));
+    c.uptimeS = (uint32_t)f[196] << 16 | f[195] << 8 | f[194];
+    c.charge = f[198] > 0;
+    c.discharge = f[199] > 0;
+    c.balance = f[201] > 0;
+
+    if (Logging::ENABLED) {
+      Logging::print("JK02: %u cells, %g / %g, SOC %u%%\n", count, (double)c.batteryVoltage, (double)c.current, c.soc);
+    }
+  }
+
+  // JK04 has no current, SOC, capacity or temperatures; those are left unchanged
+  static void decodeJk04(const uint8_t* f, Cells& c) {
+    float sum = 0, minV = 0, maxV = 0;
+    uint8_t count = 0;
+    for (int i = 0; i < CELLS && i < JK04_CELLS; i++) {
+      const float v = readFloatLE(f + JK04_CELL_VOLTAGE + i * 4);
+      c.cellMv[i] = Storage::cellUnit(v);
+      c.wireResist[i] = Storage::cellUnit(readFloatLE(f + JK04_CELL_RESISTANCE + i * 4));
+      if (v <= 0) continue;
+      if (count == 0 || v < minV) minV = v;
+      if (count == 0 || v > maxV) maxV = v;
+      sum += v;
+      count++;
+    }
+    c.cellCount = count;
+    c.batteryVoltage = Storage::unit(sum);
+    c.averageCell = Storage::cellUnit(count ? sum / count : 0);
+    c.deltaCell = Storage::cellUnit(maxV - minV);
+    c.power = Storage::power(c.batteryVoltage, c.current);
+    c.balancingAction = f[JK04_BALANCING_ACTION];
+    c.balance = c.balancingAction != 0;
+    c.balanceCurrent = Storage::unit(readFloatLE(f + JK04_BALANCE_CURRENT));
+    c.uptimeS = (uint32_t)f[JK04_UPTIME + 2] << 16 | f[JK04_UPTIME + 1] << 8 | f[JK04_UPTIME];
+
+    if (Logging::ENABLED) Logging::print("JK04: %u cells, %.3f V\n", count, sum);
+  }
+
+  // JK02 settings frame; JK04 settings are floats at other offsets and not decoded
+  static void decodeSettings(const uint8_t* f, JkSettingsData<Storage>& s) {
+    s.cellUvp = Storage::milli((int32_t)u32(f + 10));
+    s.cellUvpr = Storage::milli((int32_t)u32(f + 14));
+    s.cellOvp = Storage::milli((int32_t)u32(f + 18));
+    s.cellOvpr = Storage::milli((int32_t)u32(f + 22));
+    s.balanceTrigger = Storage::milli((int32_t)u32(f + 26));
+    s.powerOff = Storage::milli((int32_t)u32(f + 46));
+    s.maxChargeCurrent = Storage::milli((int32_t)u32(f + 50));
+    s.chargeOcpDelayS = u32(f + 54);
+    s.chargeOcpRecoveryS = u32(f + 58);
+    s.maxDischargeCurrent = Storage::milli((int32_t)u32(f + 62));
+    s.dischargeOcpDelayS = u32(f + 66);
+    s.dischargeOcpRecoveryS = u32(f + 70);
+    s.scpRecoveryS = u32(f + 74);
+    s.maxBalanceCurrent = Storage::milli((int32_t)u32(f + 78));
+    s.chargeOtp = Storage::deci((int32_t)u32(f + 82));
+    s.chargeOtpr = Storage::deci((int32_t)u32(f + 86));
+    s.dischargeOtp = Storage::deci((int32_t)u32(f + 90));
+    s.dischargeOtpr = Storage::deci((int32_t)u32(f + 94));
+    s.chargeUtp = Storage::deci((int32_t)u32(f + 98));
+    s.chargeUtpr = Storage::deci((int32_t)u32(f + 102));
+    s.mosOtp = Storage::deci((int32_t)u32(f + 106));
+    s.mosOtpr = Storage::deci((int32_t)u32(f + 110));
+    s.cellCount = u32(f + 114);
+    s.totalCapacity = Storage::milli((int32_t)u32(f + 130));
+    s.scpDelayUs = u32(f + 134);
+    s.balanceStart = Storage::milli((int32_t)u32(f + 138));
+
+    if (Logging::ENABLED) Logging::print("Settings: %u cells\n", (unsigned)s.cellCount);
+  }
+
+  // Device-info frame; the hardware version tells the cell-info layout (protocolFromHardwareVersion())
+  static void decodeDeviceInfo(const uint8_t* f, JkDeviceInfoData& d) {
+    copyField(d.vendor, sizeof(d.vendor), f + 6);
+    copyField(d.hardwareVersion, sizeof(d.hardwareVersion), f + 22);
+    copyField(d.softwareVersion, sizeof(d.softwareVersion), f + 30);
+    d.uptimeS = u32(f + 38);
+    d.powerOnCount = u32(f + 42);
+    copyField(d.name, sizeof(d.name), f + 46);
+    copyField(d.manufactured, sizeof(d.manufactured), f + 78);
+    copyField(d.serial, sizeof(d.serial), f + 86);
+
+    if (Logging::ENABLED) Logging::print("Device info: %s hw %s sw %s\n", d.name, d.hardwareVersion, d.softwareVersion);
+  }
+
+private:
+  static uint16_t u16(const uint8_t* p) { return (uint16_t)(p[0] | p[1] << 8); }
+  static uint32_t u32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+  }
+
+  static void copyField(char* out, size_t size, const uint8_t* in) {
+    memcpy(out, in, size - 1);
+    out[size - 1] = '\0';
+  }
+
+  ProtocolVariant cellProtocol(const uint8_t* frame) {
+    if (Layout::PROTOCOL != PROTOCOL_AUTO) return Layout::PROTOCOL;
+    if (protocol == PROTOCOL_AUTO) protocol = protocolFromCellFrame(frame);
+    return protocol == PROTOCOL_JK04 ? PROTOCOL_JK04 : PROTOCOL_JK02;
+  }
+
+  bool decodeCells(const uint8_t*, std::false_type) { return false; }
+  bool decodeCells(const uint8_t* frame, std::true_type) {
+    if (Layout::PROTOCOL != PROTOCOL_JK04 && cellProtocol(frame) == PROTOCOL_JK02) {
+      decodeJk02(frame, cells);
+    } else {
+      decodeJk04(frame, cells);
+    }
+    return true;
+  }
+
+  bool decodeSettings(const uint8_t*, std::false_type) { return false; }
+  bool decodeSettings(const uint8_t* frame, std::true_type) {
+    if (Layout::PROTOCOL == PROTOCOL_JK04 || protocol == PROTOCOL_JK04) return false;
+    decodeSettings(frame, settings);
+    return true;
+  }
+
+  bool decodeDeviceInfo(const uint8_t*, std::false_type) { return false; }
+  bool decodeDeviceInfo(const uint8_t* frame, std::true_type) {
+    decodeDeviceInfo(frame, info);
+    if (Layout::PROTOCOL == PROTOCOL_AUTO) {
+      const ProtocolVariant variant = protocolFromHardwareVersion(info.hardwareVersion, 8);
+      if (variant != PROTOCOL_AUTO) protocol = variant;
+    }
+    return true;
+  }
+};
+
+// Same frames, units and protocol detection as the JKBMS class
+typedef JkDecoder<JkLayoutAuto<JK04_CELLS>, JkFloatStorage, JkNoLog, JkAllFrames> JkDefaultDecoder;
+
+#endif // JK_DECODER_H
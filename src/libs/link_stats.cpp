@@ -0,0 +1,221 @@
+/**
+ * @file link_stats.cpp
+ * @brief BLE airtime and throughput accounting per device and for the scanner
+ *
+ * Counts bytes, notifications, writes and fragments per frame for every BMS
+ * link, and estimates how long the radio is busy from the PDU sizes and the
+ * connection interval. Scans are accounted by their requested duration and
+ * scan window. Everything is kept in a 60 s rolling window of fixed slots so
+ * the memory cost per device is constant.
+ *
+ * Airtime model (8 us per byte on 1M, 4 on 2M, 64 on Coded S8):
+ * - each link-layer packet costs 10 bytes of overhead (preamble, access
+ *   address, header, CRC) plus its payload, then T_IFS, an empty ack packet
+ *   from the central and T_IFS again;
+ * - ATT PDUs larger than JKBMS_LL_MAX_PAYLOAD minus the L2CAP header are split;
+ * - every connection event costs at least one empty packet exchange, so an
+ *   idle link still uses radio time proportional to 1 / interval.
+ */
+
+#include "link_stats.h"
+#include "JKBMS.h"
+
+static const uint32_t LL_OVERHEAD_BYTES = 10;
+static const uint32_t L2CAP_HEADER_BYTES = 4;
+static const uint32_t T_IFS_US = 150;
+
+static inline uint32_t usPerByte(uint8_t phy) {
+  return phy == 2 ? 4 : phy == 3 ? 64 : 8;
+}
+
+static ScanCounters scanSlot[LINK_WINDOW_SLOTS];
+static uint32_t scanSlotEpoch[LINK_WINDOW_SLOTS];
+
+/**
+ * Return the slot for the current time, clearing it if it belongs to an older window
+ */
+template <typename T>
+static T& currentSlot(T* slots, uint32_t* epochs) {
+  uint32_t epoch = millis() / LINK_SLOT_MS;
+  int index = epoch % LINK_WINDOW_SLOTS;
+  if (epochs[index] != epoch) {
+    memset(&slots[index], 0, sizeof(T));
+    epochs[index] = epoch;
+  }
+  return slots[index];
+}
+
+static bool slotInWindow(uint32_t slotEpoch, uint32_t nowEpoch) {
+  return nowEpoch - slotEpoch < (uint32_t)LINK_WINDOW_SLOTS;
+}
+
+// Length of the rolling window right now (shorter right after boot)
+static uint32_t windowMs() {
+  uint32_t now = millis();
+  uint32_t full = (LINK_WINDOW_SLOTS - 1) * LINK_SLOT_MS + now % LINK_SLOT_MS;
+  return now < full ? now : full;
+}
+
+uint32_t JKBMS_HOT linkAirtimeUs(size_t attLength, uint8_t phy) {
+  const uint32_t byteUs = usPerByte(phy);
+  const uint32_t emptyPacketUs = LL_OVERHEAD_BYTES * byteUs;
+  uint32_t remaining = attLength + L2CAP_HEADER_BYTES;
+  uint32_t us = 0;
+  while (remaining > 0) {
+    uint32_t chunk = remaining < JKBMS_LL_MAX_PAYLOAD ? remaining : JKBMS_LL_MAX_PAYLOAD;
+    us += (LL_OVERHEAD_BYTES + chunk) * byteUs + T_IFS_US + emptyPacketUs + T_IFS_US;
+    remaining -= chunk;
+  }
+  return us;
+}
+
+/**
+ * Record the parameters of a new connection
+ * @param connInterval Connection interval in 1.25 ms units
+ * @param mtu Negotiated ATT MTU
+ */
+void linkStatsConnected(LinkStats& stats, uint16_t connInterval, uint16_t mtu) {
+  stats.connInterval = connInterval;
+  stats.mtu = mtu;
+  stats.phy = 1;
+  stats.frameFragments = 0;
+}
+
+void JKBMS_HOT linkStatsNotify(LinkStats& stats, size_t length) {
+  LinkCounters& slot = currentSlot(stats.slot, stats.slotEpoch);
+  slot.rxBytes += length;
+  slot.notifications++;
+  slot.airtimeUs += linkAirtimeUs(length + 3, stats.phy);  // ATT opcode and handle
+  stats.rxBytesTotal += length;
+  stats.notificationsTotal++;
+  stats.frameFragments++;
+}
+
+void JKBMS_HOT linkStatsFrameStart(LinkStats& stats) {
+  stats.frameFragments = 1;
+  stats.frameStartUs = micros();
+}
+
+uint32_t JKBMS_HOT linkStatsFrameComplete(LinkStats& stats) {
+  LinkCounters& slot = currentSlot(stats.slot, stats.slotEpoch);
+  slot.frames++;
+  slot.fragments += stats.frameFragments;
+  stats.framesTotal++;
+  stats.frameFragments = 0;
+  return micros() - stats.frameStartUs;
+}
+
+void linkStatsWrite(LinkStats& stats, size_t length) {
+  LinkCounters& slot = currentSlot(stats.slot, stats.slotEpoch);
+  slot.txBytes += length;
+  slot.writes++;
+  slot.airtimeUs += linkAirtimeUs(length + 3, stats.phy);
+  stats.txBytesTotal += length;
+}
+
+/**
+ * Compute rates over the rolling window
+ * @param connected Whether the link is up; adds the empty connection events of an idle link
+ */
+LinkRates linkStatsRates(const LinkStats& stats, bool connected) {
+  LinkRates rates = {};
+  rates.windowMs = windowMs();
+  if (!rates.windowMs) return rates;
+
+  LinkCounters sum = {};
+  uint32_t nowEpoch = millis() / LINK_SLOT_MS;
+  for (int i = 0; i < LINK_WINDOW_SLOTS; i++) {
+    if (!slotInWindow(stats.slotEpoch[i], nowEpoch)) continue;
+    const LinkCounters& slot = stats.slot[i];
+    sum.rxBytes += slot.rxBytes;
+    sum.txBytes += slot.txBytes;
+    sum.notifications += slot.notifications;
+    sum.writes += slot.writes;
+    sum.frames += slot.frames;
+    sum.fragments += slot.fragments;
+    sum.airtimeUs += slot.airtimeUs;
+  }
+
+  float seconds = rates.windowMs / 1000.0f;
+  rates.rxBytesPerS = sum.rxBytes / seconds;
+  rates.txBytesPerS = sum.txBytes / seconds;
+  rates.notificationsPerS = sum.notifications / seconds;
+  rates.fragmentsPerFrame = sum.frames ? (float)sum.fragments / sum.frames : 0;
+
+  float airtimeUs = sum.airtimeUs;
+  if (connected && stats.connInterval) {
+    float events = rates.windowMs * 1000.0f / (stats.connInterval * 1250.0f);
+    uint32_t emptyPacketUs = LL_OVERHEAD_BYTES * usPerByte(stats.phy);
+    airtimeUs += events * (emptyPacketUs + T_IFS_US + emptyPacketUs);
+  }
+  rates.airtimePermille = airtimeUs / (rates.windowMs * 1000.0f) * 1000.0f;
+  return rates;
+}
+
+/**
+ * Record a scan start
+ * @param durationMs Requested scan duration
+ * @param interval Scan interval in 0.625 ms units
+ * @param window Scan window in 0.625 ms units
+ */
+void linkStatsScanStarted(uint32_t durationMs, uint16_t interval, uint16_t window) {
+  ScanCounters& slot = currentSlot(scanSlot, scanSlotEpoch);
+  slot.scans++;
+  slot.scanMs += durationMs;
+  slot.radioOnMs += interval ? (uint32_t)((uint64_t)durationMs * window / interval) : durationMs;
+}
+
+void linkStatsScanResult(bool matched) {
+  ScanCounters& slot = currentSlot(scanSlot, scanSlotEpoch);
+  slot.results++;
+  if (matched) slot.matched++;
+}
+
+ScanRates linkStatsScanRates() {
+  ScanRates rates = {};
+  rates.windowMs = windowMs();
+  if (!rates.windowMs) return rates;
+
+  ScanCounters sum = {};
+  uint32_t nowEpoch = millis() / LINK_SLOT_MS;
+  for (int i = 0; i < LINK_WINDOW_SLOTS; i++) {
+    if (!slotInWindow(scanSlotEpoch[i], nowEpoch)) continue;
+    sum.scans += scanSlot[i].scans;
+    sum.radioOnMs += scanSlot[i].radioOnMs;
+    sum.results += scanSlot[i].results;
+    sum.matched += scanSlot[i].matched;
+  }
+
+  float seconds = rates.windowMs / 1000.0f;
+  rates.scansPerMin = sum.scans * 60.0f / seconds;
+  rates.resultsPerS = sum.results / seconds;
+  rates.matchedPerS = sum.matched / seconds;
+  rates.dutyPermille = sum.radioOnMs * 1000.0f / rates.windowMs;
+  return rates;
+}
+
+void linkStatsEmit(MetricsEmitFunc emit, void* ctx) {
+  char name[64];
+  for (int i = 0; i < bmsDeviceCount; i++) {
+    JKBMS& bms = jkBmsDevices[i];
+    if (bms.targetMAC.empty()) continue;
+    LinkRates rates = linkStatsRates(bms.linkStats, bms.connected);
+    const char* mac = bms.targetMAC.c_str();
+    snprintf(name, sizeof(name), "link.%s.rx_bytes_per_s", mac);
+    emit(name, rates.rxBytesPerS, ctx);
+    snprintf(name, sizeof(name), "link.%s.tx_bytes_per_s", mac);
+    emit(name, rates.txBytesPerS, ctx);
+    snprintf(name, sizeof(name), "link.%s.notifications_per_s", mac);
+    emit(name, rates.notificationsPerS, ctx);
+    snprintf(name, sizeof(name), "link.%s.fragments_per_frame", mac);
+    emit(name, rates.fragmentsPerFrame, ctx);
+    snprintf(name, sizeof(name), "link.%s.airtime_permille", mac);
+    emit(name, rates.airtimePermille, ctx);
+  }
+
+  ScanRates scan = linkStatsScanRates();
+  emit("scan.per_min", scan.scansPerMin, ctx);
+  emit("scan.results_per_s", scan.resultsPerS, ctx);
+  emit("scan.matched_per_s", scan.matchedPerS, ctx);
+  emit("scan.duty_permille", scan.dutyPermille, ctx);
+}
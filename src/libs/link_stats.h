@@ -0,0 +1,93 @@
+#ifndef LINK_STATS_H
+#define LINK_STATS_H
+
+#include <Arduino.h>
+#include "metrics.h"
+
+// Largest link-layer payload assumed for the airtime estimate:
+// 27 bytes without Data Length Extension, 251 with it. The default is the
+// pessimistic case since not every BMS radio negotiates DLE.
+#ifndef JKBMS_LL_MAX_PAYLOAD
+#define JKBMS_LL_MAX_PAYLOAD 27
+#endif
+
+// Rolling window: LINK_WINDOW_SLOTS slots of LINK_SLOT_MS each (60 s)
+static const int LINK_WINDOW_SLOTS = 10;
+static const uint32_t LINK_SLOT_MS = 6000;
+
+// Counters for one slot of the rolling window
+struct LinkCounters {
+  uint32_t rxBytes;
+  uint32_t txBytes;
+  uint32_t notifications;
+  uint32_t writes;
+  uint32_t frames;
+  uint32_t fragments;       // notifications that belonged to completed frames
+  uint32_t airtimeUs;       // estimated radio time of the data packets
+};
+
+/**
+ * Per-device radio accounting
+ * Embedded in each JKBMS instance. Written from the NimBLE host task
+ * (notifications) and the loop task (writes, connection setup).
+ */
+struct LinkStats {
+  uint64_t rxBytesTotal;
+  uint64_t txBytesTotal;
+  uint32_t notificationsTotal;
+  uint32_t framesTotal;
+  uint16_t connInterval;    // 1.25 ms units, 0 while never connected
+  uint16_t mtu;
+  uint16_t frameFragments;  // notifications in the frame being reassembled
+  uint8_t phy;              // BLE_GAP_LE_PHY_*, 0 is treated as 1M
+  uint32_t frameStartUs;    // first fragment of the frame being reassembled
+  LinkCounters slot[LINK_WINDOW_SLOTS];
+  uint32_t slotEpoch[LINK_WINDOW_SLOTS];
+};
+
+// Scanner accounting, shared by all devices
+struct ScanCounters {
+  uint32_t scans;
+  uint32_t scanMs;          // requested scan duration
+  uint32_t radioOnMs;       // scanMs * window / interval
+  uint32_t results;
+  uint32_t matched;         // results for a configured BMS
+};
+
+// Rates over the rolling window
+struct LinkRates {
+  uint32_t windowMs;
+  float rxBytesPerS;
+  float txBytesPerS;
+  float notificationsPerS;
+  float fragmentsPerFrame;
+  float airtimePermille;    // data packets plus empty connection events
+};
+
+struct ScanRates {
+  uint32_t windowMs;
+  float scansPerMin;
+  float resultsPerS;
+  float matchedPerS;
+  float dutyPermille;       // share of time the radio spent listening
+};
+
+// Estimated airtime of one ATT PDU (opcode and handle included) with its link-layer acks
+uint32_t linkAirtimeUs(size_t attLength, uint8_t phy = 1);
+
+void linkStatsConnected(LinkStats& stats, uint16_t connInterval, uint16_t mtu);
+void linkStatsNotify(LinkStats& stats, size_t length);
+void linkStatsFrameStart(LinkStats& stats);
+// Returns the frame latency: first fragment to complete frame, in microseconds
+uint32_t linkStatsFrameComplete(LinkStats& stats);
+void linkStatsWrite(LinkStats& stats, size_t length);
+LinkRates linkStatsRates(const LinkStats& stats, bool connected);
+
+void linkStatsScanStarted(uint32_t durationMs, uint16_t interval, uint16_t window);
+void linkStatsScanResult(bool matched);
+ScanRates linkStatsScanRates();
+
+// Metrics source: link.<mac>.* for every configured device and scan.*
+void linkStatsEmit(MetricsEmitFunc emit, void* ctx);
+
+#endif // LINK_STATS_H
@@ -0,0 +1,222 @@
+/**
+ * @file metrics.cpp
+ * @brief CPU and stack usage monitor plus the library metrics API
+ *
+ * Two views of where the gateway spends its CPU:
+ * - phase timers around the library's own code paths (reassembly, parsing,
+ *   scheduling, serialization), a micros() pair per section;
+ * - FreeRTOS run-time stats and stack high-water marks for every task,
+ *   sampled periodically from loop().
+ *
+ * Phase counters are written by the task that runs the phase (the shard
+ * tasks on both cores, or the NimBLE host task, for reassembly and parsing;
+ * loop task for the rest) and read unsynchronized. Two shards may now
+ * update the same phase at once and lose a count now and then, which is
+ * acceptable for diagnostics.
+ */
+
+#include "metrics.h"
+#include "debug_functions.h"
+#include "notify_profile.h"
+
+static const char* const phaseNames[PHASE_COUNT] = {
+  "reassembly",
+  "parsing",
+  "scheduling",
+  "serialization",
+};
+
+static const int MAX_WATCHED_TASKS = 8;
+
+static MetricsSnapshot snapshot;
+static PhaseStats lastPhase[PHASE_COUNT];
+static uint32_t lastSampleMs = 0;
+static bool sampled = false;
+
+static const char* watchedTasks[MAX_WATCHED_TASKS] = { "loopTask", "nimble_host" };
+static int watchedCount = 2;
+
+static MetricsSourceFunc sources[METRICS_MAX_SOURCES];
+static int sourceCount = 0;
+
+#if defined(ESP_PLATFORM) && configUSE_TRACE_FACILITY
+#define METRICS_HAVE_TASK_STATS 1
+// Run-time counters from the previous sample, used to compute per-interval shares
+static TaskHandle_t prevHandle[METRICS_MAX_TASKS];
+static uint32_t prevRunTime[METRICS_MAX_TASKS];
+static int prevCount = 0;
+static uint32_t prevTotalRunTime = 0;
+static TaskStatus_t taskStatus[METRICS_MAX_TASKS];
+#else
+#define METRICS_HAVE_TASK_STATS 0
+#endif
+
+void JKBMS_HOT metricsAddPhase(MetricsPhase phase, uint32_t us) {
+  PhaseStats& s = snapshot.phase[phase];
+  s.calls++;
+  s.totalUs += us;
+  if (us > s.maxUs) s.maxUs = us;
+}
+
+const char* metricsPhaseName(MetricsPhase phase) {
+  return phaseNames[phase];
+}
+
+bool metricsWatchTask(const char* name) {
+  for (int i = 0; i < watchedCount; i++) {
+    if (strcmp(watchedTasks[i], name) == 0) return true;
+  }
+  if (watchedCount >= MAX_WATCHED_TASKS) return false;
+  watchedTasks[watchedCount++] = name;
+  return true;
+}
+
+#if METRICS_HAVE_TASK_STATS
+static bool isWatched(const char* name) {
+  for (int i = 0; i < watchedCount; i++) {
+    if (strcmp(watchedTasks[i], name) == 0) return true;
+  }
+  return false;
+}
+
+static void sampleTasks() {
+  uint32_t totalRunTime = 0;
+  UBaseType_t count = uxTaskGetSystemState(taskStatus, METRICS_MAX_TASKS, &totalRunTime);
+  // More tasks than slots: uxTaskGetSystemState fills nothing
+  if (count == 0) {
+    snapshot.taskCount = 0;
+    return;
+  }
+
+  uint32_t totalDelta = totalRunTime - prevTotalRunTime;
+  snapshot.runtimeStats = totalRunTime != 0;
+  snapshot.taskCount = (int)count;
+
+  for (UBaseType_t i = 0; i < count; i++) {
+    const TaskStatus_t& status = taskStatus[i];
+    TaskMetrics& task = snapshot.task[i];
+    strncpy(task.name, status.pcTaskName, sizeof(task.name) - 1);
+    task.name[sizeof(task.name) - 1] = '\0';
+#if configTASKLIST_INCLUDE_COREID
+    task.core = status.xCoreID == tskNO_AFFINITY ? -1 : (int)status.xCoreID;
+#else
+    task.core = -1;
+#endif
+    // ESP-IDF stacks are byte-addressed, so the high-water mark is already in bytes
+    task.stackFreeMin = status.usStackHighWaterMark;
+    task.watched = isWatched(status.pcTaskName);
+
+    uint32_t taskDelta = status.ulRunTimeCounter;
+    for (int j = 0; j < prevCount; j++) {
+      if (prevHandle[j] == status.xHandle) {
+        taskDelta = status.ulRunTimeCounter - prevRunTime[j];
+        break;
+      }
+    }
+    task.cpuPermille = totalDelta ? (uint16_t)((uint64_t)taskDelta * 1000 / totalDelta) : 0;
+  }
+
+  for (UBaseType_t i = 0; i < count; i++) {
+    prevHandle[i] = taskStatus[i].xHandle;
+    prevRunTime[i] = taskStatus[i].ulRunTimeCounter;
+  }
+  prevCount = (int)count;
+  prevTotalRunTime = totalRunTime;
+}
+#endif
+
+/**
+ * Take a sample of task CPU shares, stack high-water marks and phase shares
+ * Shares cover the time since the previous sample.
+ */
+void metricsSample() {
+  uint32_t now = millis();
+  uint32_t intervalMs = sampled ? now - lastSampleMs : now;
+  snapshot.intervalMs = intervalMs;
+
+  for (int i = 0; i < PHASE_COUNT; i++) {
+    uint64_t deltaUs = snapshot.phase[i].totalUs - lastPhase[i].totalUs;
+    snapshot.phasePermille[i] = intervalMs ? (uint16_t)(deltaUs / intervalMs) : 0;
+    lastPhase[i] = snapshot.phase[i];
+  }
+
+#if METRICS_HAVE_TASK_STATS
+  sampleTasks();
+#else
+  snapshot.taskCount = 0;
+  snapshot.runtimeStats = false;
+#endif
+
+  lastSampleMs = now;
+  sampled = true;
+}
+
+bool metricsUpdate(uint32_t intervalMs) {
+  if (sampled && millis() - lastSampleMs < intervalMs) return false;
+  metricsSample();
+  return true;
+}
+
+const MetricsSnapshot& metricsSnapshot() {
+  return snapshot;
+}
+
+void metricsReset() {
+  memset(snapshot.phase, 0, sizeof(snapshot.phase));
+  memset(snapshot.phasePermille, 0, sizeof(snapshot.phasePermille));
+  memset(lastPhase, 0, sizeof(lastPhase));
+}
+
+bool metricsRegisterSource(MetricsSourceFunc source) {
+  for (int i = 0; i < sourceCount; i++) {
+    if (sources[i] == source) return true;
+  }
+  if (sourceCount >= METRICS_MAX_SOURCES) return false;
+  sources[sourceCount++] = source;
+  return true;
+}
+
+/**
+ * Emit every metric as a flat name/value pair
+ * Phase and task values come from the last sample, then each registered source emits its own.
+ */
+void metricsForEach(MetricsEmitFunc emit, void* ctx) {
+  char name[48];
+  for (int i = 0; i < PHASE_COUNT; i++) {
+    snprintf(name, sizeof(name), "phase.%s.cpu_permille", phaseNames[i]);
+    emit(name, snapshot.phasePermille[i], ctx);
+    snprintf(name, sizeof(name), "phase.%s.max_us", phaseNames[i]);
+    emit(name, snapshot.phase[i].maxUs, ctx);
+  }
+  for (int i = 0; i < snapshot.taskCount; i++) {
+    const TaskMetrics& task = snapshot.task[i];
+    if (!task.watched) continue;
+    snprintf(name, sizeof(name), "task.%s.cpu_permille", task.name);
+    emit(name, task.cpuPermille, ctx);
+    snprintf(name, sizeof(name), "task.%s.stack_free_min", task.name);
+    emit(name, task.stackFreeMin, ctx);
+  }
+  for (int i = 0; i < sourceCount; i++) {
+    sources[i](emit, ctx);
+  }
+}
+
+void metricsPrintReport() {
+  if (!debugPrintFunc) return;
+
+  debugPrintFunc("CPU usage over %lu ms (run-time stats %s)\n",
+                 (unsigned long)snapshot.intervalMs, snapshot.runtimeStats ? "on" : "off");
+  for (int i = 0; i < PHASE_COUNT; i++) {
+    const PhaseStats& s = snapshot.phase[i];
+    debugPrintFunc("  %-14s %3u.%u%%  calls=%lu avg=%luus max=%luus\n", phaseNames[i],
+                   snapshot.phasePermille[i] / 10, snapshot.phasePermille[i] % 10,
+                   (unsigned long)s.calls, (unsigned long)(s.calls ? s.totalUs / s.calls : 0),
+                   (unsigned long)s.maxUs);
+  }
+  for (int i = 0; i < snapshot.taskCount; i++) {
+    const TaskMetrics& task = snapshot.task[i];
+    debugPrintFunc("  %c %-15s core %2d %3u.%u%%  stack free min %lu\n", task.watched ? '*' : ' ',
+                   task.name, task.core, task.cpuPermille / 10, task.cpuPermille % 10,
+                   (unsigned long)task.stackFreeMin);
+  }
+}
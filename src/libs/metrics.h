@@ -0,0 +1,89 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+
+// JKBMS_METRICS=0 compiles the phase timers out of the hot path
+#ifndef JKBMS_METRICS
+#define JKBMS_METRICS 1
+#endif
+
+// Library phases that CPU time is attributed to
+enum MetricsPhase {
+  PHASE_REASSEMBLY = 0,  // notifyCB/handleNotification appending fragments
+  PHASE_PARSING,         // frame parsers on a complete frame
+  PHASE_SCHEDULING,      // loop() connection, timeout and scan decisions
+  PHASE_SERIALIZATION,   // encoding data for the uplink
+  PHASE_COUNT
+};
+
+static const int METRICS_MAX_TASKS = 24;
+static const int METRICS_MAX_SOURCES = 16;
+
+// Cumulative time spent in one phase
+struct PhaseStats {
+  uint32_t calls;
+  uint64_t totalUs;
+  uint32_t maxUs;
+};
+
+// One FreeRTOS task as seen by the last sample
+struct TaskMetrics {
+  char name[16];
+  int core;                  // -1 if not pinned or unknown
+  uint16_t cpuPermille;      // share of one core over the last interval
+  uint32_t stackFreeMin;     // stack high-water mark: minimum free bytes ever
+  bool watched;              // task belongs to the library or the gateway
+};
+
+struct MetricsSnapshot {
+  uint32_t intervalMs;                    // wall time covered by the CPU shares
+  bool runtimeStats;                      // FreeRTOS run-time stats were available
+  PhaseStats phase[PHASE_COUNT];          // cumulative since boot or metricsReset()
+  uint16_t phasePermille[PHASE_COUNT];    // share of one core over the last interval
+  int taskCount;
+  TaskMetrics task[METRICS_MAX_TASKS];
+};
+
+/**
+ * Metrics API
+ *
+ * Values are published as flat "group.name" pairs through metricsForEach().
+ * Other modules register a source that emits their own values; the gateway
+ * forwards everything to its uplink without knowing the individual modules.
+ */
+typedef void (*MetricsEmitFunc)(const char* name, float value, void* ctx);
+typedef void (*MetricsSourceFunc)(MetricsEmitFunc emit, void* ctx);
+
+#if JKBMS_METRICS
+#define METRICS_PHASE_BEGIN(sample) uint32_t sample = micros()
+#define METRICS_PHASE_RESTART(sample) sample = micros()
+#define METRICS_PHASE_END(sample, phase) metricsAddPhase(phase, micros() - sample)
+#else
+#define METRICS_PHASE_BEGIN(sample)
+#define METRICS_PHASE_RESTART(sample)
+#define METRICS_PHASE_END(sample, phase)
+#endif
+
+void metricsAddPhase(MetricsPhase phase, uint32_t us);
+const char* metricsPhaseName(MetricsPhase phase);
+
+// Mark a task by name so it is flagged as watched (loopTask and nimble_host are by default)
+// The name is stored by pointer and must stay valid, e.g. a string literal
+bool metricsWatchTask(const char* name);
+
+// Sample task run-time stats and stack high-water marks now
+void metricsSample();
+// Sample when intervalMs has passed since the last sample; call from loop()
+bool metricsUpdate(uint32_t intervalMs = 10000);
+
+const MetricsSnapshot& metricsSnapshot();
+void metricsReset();
+
+bool metricsRegisterSource(MetricsSourceFunc source);
+void metricsForEach(MetricsEmitFunc emit, void* ctx);
+
+// Print the last sample through debugPrintFunc
+void metricsPrintReport();
+
+#endif // METRICS_H
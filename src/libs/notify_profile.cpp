@@ -0,0 +1,169 @@
+/**
+ * @file notify_profile.cpp
+ * @brief Cycle-count profiling of the BLE notification hot path
+ *
+ * Records per-section cycle statistics for notifyCB/handleNotification and
+ * the frame parsers when built with JKBMS_PROFILE_NOTIFY=1. The goal is to
+ * see how much of the notify path is lost to flash cache misses (e.g. while
+ * another task writes to flash) and whether JKBMS_IRAM_HOTPATH=1 removes it.
+ *
+ * Statistics are written from the NimBLE host task and read from loop();
+ * reads are not synchronized, which is acceptable for diagnostics.
+ */
+
+#include "notify_profile.h"
+#include "debug_functions.h"
+
+#if defined(ESP_PLATFORM)
+#include <esp_heap_caps.h>
+#endif
+
+#if JKBMS_PROFILE_PERFMON && defined(ESP_PLATFORM) && defined(__XTENSA__) && __has_include(<xtensa_perfmon_access.h>)
+#include <xtensa_perfmon_access.h>
+#include <xtensa_perfmon_masks.h>
+#define PROFILE_HAVE_PERFMON 1
+#else
+#define PROFILE_HAVE_PERFMON 0
+#endif
+
+#if defined(ESP_PLATFORM)
+// Provided by the ESP-IDF linker script
+extern int _iram_text_start;
+extern int _iram_text_end;
+#else
+#include <chrono>
+#endif
+
+static ProfileStats profile[PROFILE_POINT_COUNT];
+static bool profileInitialized = false;
+
+static const char* const profileNames[PROFILE_POINT_COUNT] = {
+  "notify fragment",
+  "parse cell data",
+  "parse settings",
+  "parse device info",
+};
+
+/**
+ * Read the CPU cycle counter
+ * On the host there is no cycle counter, so nanoseconds are used instead.
+ */
+static inline uint32_t JKBMS_HOT profileCycles() {
+#if defined(ESP_PLATFORM)
+  return ESP.getCycleCount();
+#else
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static inline uint32_t JKBMS_HOT profileIcacheStall() {
+#if PROFILE_HAVE_PERFMON
+  return xtensa_perfmon_value(0);
+#else
+  return 0;
+#endif
+}
+
+static void profileInit() {
+  profileReset();
+#if PROFILE_HAVE_PERFMON
+  // Counter 0 counts instruction-fetch stalls caused by I-cache misses.
+  // Counters are per core; the NimBLE host task that runs notifyCB stays on one core.
+  xtensa_perfmon_stop();
+  xtensa_perfmon_init(0, XTPERF_CNT_I_STALL, XTPERF_MASK_I_STALL_ICM, 0, -1);
+  xtensa_perfmon_reset(0);
+  xtensa_perfmon_start();
+#endif
+  profileInitialized = true;
+}
+
+/**
+ * Start measuring a section of the notify path
+ * @param sample Storage for the start counters, passed back to profileEnd()
+ */
+void JKBMS_HOT profileBegin(ProfileSample& sample) {
+  if (!profileInitialized) profileInit();
+  sample.startIcacheStall = profileIcacheStall();
+  sample.startCycles = profileCycles();
+}
+
+/**
+ * Finish a measurement and fold it into the statistics for a profile point
+ * @param sample Counters captured by profileBegin()
+ * @param point Section being measured
+ */
+void JKBMS_HOT profileEnd(const ProfileSample& sample, ProfilePoint point) {
+  uint32_t cycles = profileCycles() - sample.startCycles;
+  uint32_t icacheStall = profileIcacheStall() - sample.startIcacheStall;
+  ProfileStats& s = profile[point];
+
+  s.samples++;
+  s.totalCycles += cycles;
+  s.icacheStallCycles += icacheStall;
+  if (cycles < s.minCycles) s.minCycles = cycles;
+  if (cycles > s.maxCycles) s.maxCycles = cycles;
+  // Anything above the warm-cache floor is attributed to stalls
+  s.stallCycles += cycles - s.minCycles;
+
+  int bucket = 0;
+  while (bucket < PROFILE_HISTOGRAM_BUCKETS - 1 && (cycles >> (bucket + 1)) != 0) bucket++;
+  s.histogram[bucket]++;
+}
+
+const ProfileStats& profileStats(ProfilePoint point) {
+  return profile[point];
+}
+
+const char* profilePointName(ProfilePoint point) {
+  return profileNames[point];
+}
+
+void profileReset() {
+  memset(profile, 0, sizeof(profile));
+  for (int i = 0; i < PROFILE_POINT_COUNT; i++) profile[i].minCycles = UINT32_MAX;
+}
+
+/**
+ * Summarize IRAM usage
+ * @return Linked IRAM text size, free executable heap and whether the hot path was built into IRAM
+ */
+IramReport iramReport() {
+  IramReport report;
+#if defined(ESP_PLATFORM)
+  report.iramTextBytes = (uint32_t)((uintptr_t)&_iram_text_end - (uintptr_t)&_iram_text_start);
+  report.iramHeapFreeBytes = heap_caps_get_free_size(MALLOC_CAP_EXEC);
+#else
+  report.iramTextBytes = 0;
+  report.iramHeapFreeBytes = 0;
+#endif
+  report.hotPathInIram = JKBMS_HOT_IN_IRAM;
+  return report;
+}
+
+/**
+ * Print the profile and IRAM summary through the library debug output
+ * Uses debugPrintFunc directly so the report is available even with DEBUG_ENABLED false.
+ */
+void profilePrintReport() {
+  if (!debugPrintFunc) return;
+
+  IramReport iram = iramReport();
+  debugPrintFunc("Notify path profile (hot path in %s, perfmon %s)\n",
+                 iram.hotPathInIram ? "IRAM" : "flash", PROFILE_HAVE_PERFMON ? "on" : "off");
+  debugPrintFunc("  IRAM text: %lu bytes, executable heap free: %lu bytes\n",
+                 (unsigned long)iram.iramTextBytes, (unsigned long)iram.iramHeapFreeBytes);
+
+  for (int i = 0; i < PROFILE_POINT_COUNT; i++) {
+    const ProfileStats& s = profile[i];
+    if (!s.samples) continue;
+    debugPrintFunc("  %-18s n=%lu min=%lu avg=%lu max=%lu stall~%lu%%",
+                   profileNames[i], (unsigned long)s.samples, (unsigned long)s.minCycles,
+                   (unsigned long)(s.totalCycles / s.samples), (unsigned long)s.maxCycles,
+                   (unsigned long)(s.totalCycles ? s.stallCycles * 100 / s.totalCycles : 0));
+#if PROFILE_HAVE_PERFMON
+    debugPrintFunc(" icache=%lu%%", (unsigned long)(s.totalCycles ? s.icacheStallCycles * 100 / s.totalCycles : 0));
+#endif
+    debugPrintFunc("\n");
+  }
+}
@@ -0,0 +1,90 @@
+#ifndef NOTIFY_PROFILE_H
+#define NOTIFY_PROFILE_H
+
+#include <Arduino.h>
+
+// Build options for the notification hot path:
+//   JKBMS_IRAM_HOTPATH=1   place notifyCB, handleNotification and the frame parsers in IRAM
+//   JKBMS_PROFILE_NOTIFY=1 record cycle counts and stall estimates for the notify path
+//   JKBMS_PROFILE_PERFMON=1 also read the Xtensa performance counters for I-cache miss stalls
+#ifndef JKBMS_IRAM_HOTPATH
+#define JKBMS_IRAM_HOTPATH 0
+#endif
+
+#ifndef JKBMS_PROFILE_NOTIFY
+#define JKBMS_PROFILE_NOTIFY 0
+#endif
+
+#ifndef JKBMS_PROFILE_PERFMON
+#define JKBMS_PROFILE_PERFMON 0
+#endif
+
+#if JKBMS_IRAM_HOTPATH && defined(ESP_PLATFORM)
+#define JKBMS_HOT IRAM_ATTR
+#define JKBMS_HOT_IN_IRAM 1
+#else
+#define JKBMS_HOT
+#define JKBMS_HOT_IN_IRAM 0
+#endif
+
+// Measured sections of the notify path
+enum ProfilePoint {
+  PROFILE_NOTIFY_FRAGMENT = 0,  // notifyCB calls that only append to the reassembly buffer
+  PROFILE_PARSE_CELL_DATA,      // parseData() on a complete 0x02 frame
+  PROFILE_PARSE_SETTINGS,       // bms_settings() on a complete 0x01 frame
+  PROFILE_PARSE_DEVICE_INFO,    // parseDeviceInfo() on a complete 0x03 frame
+  PROFILE_POINT_COUNT
+};
+
+static const int PROFILE_HISTOGRAM_BUCKETS = 20;  // log2(cycles) buckets
+
+/**
+ * Cycle statistics for one profile point
+ *
+ * stallCycles estimates the time lost to flash cache misses as the cycles
+ * spent above the fastest (warm cache) run of the same section. When the
+ * performance counters are available, icacheStallCycles holds the measured
+ * instruction-fetch stall cycles instead.
+ */
+struct ProfileStats {
+  uint32_t samples;
+  uint32_t minCycles;
+  uint32_t maxCycles;
+  uint64_t totalCycles;
+  uint64_t stallCycles;
+  uint64_t icacheStallCycles;
+  uint32_t histogram[PROFILE_HISTOGRAM_BUCKETS];
+};
+
+// IRAM usage summary
+struct IramReport {
+  uint32_t iramTextBytes;     // .iram text linked into the image (0 if unknown)
+  uint32_t iramHeapFreeBytes; // executable heap still available
+  bool hotPathInIram;
+};
+
+// In-flight measurement started by profileBegin()
+struct ProfileSample {
+  uint32_t startCycles;
+  uint32_t startIcacheStall;
+};
+
+#if JKBMS_PROFILE_NOTIFY
+#define JKBMS_PROFILE_BEGIN(sample) ProfileSample sample; profileBegin(sample)
+#define JKBMS_PROFILE_END(sample, point) profileEnd(sample, point)
+#else
+#define JKBMS_PROFILE_BEGIN(sample)
+#define JKBMS_PROFILE_END(sample, point)
+#endif
+
+void profileBegin(ProfileSample& sample);
+void profileEnd(const ProfileSample& sample, ProfilePoint point);
+const ProfileStats& profileStats(ProfilePoint point);
+const char* profilePointName(ProfilePoint point);
+void profileReset();
+IramReport iramReport();
+
+// Print all profile points and the IRAM summary through debugPrintFunc
+void profilePrintReport();
+
+#endif // NOTIFY_PROFILE_H
@@ -0,0 +1,135 @@
+/**
+ * @file phy_policy.cpp
+ * @brief Per-link BLE PHY selection from RSSI and link-loss history
+ *
+ * Connections are always set up on 1M (the BMS advertises with legacy
+ * advertising). Once the link is up, connectToServer() asks for the PHY the
+ * policy selects and loop() reviews the choice as RSSI and drops change:
+ * - strong, stable links move to 2M to halve the airtime of each frame;
+ * - weak links, or links that dropped repeatedly, move to Coded S8.
+ * BMS radios without BLE 5 reject the update and stay on 1M, which the
+ * negotiated PHY reported in onPhyUpdate() reflects.
+ */
+
+#include "phy_policy.h"
+#include "JKBMS.h"
+
+// Disconnect initiated by the gateway itself (BLE_HS_ERR_HCI_BASE + local host terminated)
+static const int DISCONNECT_LOCAL_HOST = 0x216;
+
+static const char* const phyNames[PHY_COUNT + 1] = { "unknown", "1m", "2m", "coded" };
+
+const char* phyName(uint8_t phy) {
+  return phy <= PHY_COUNT ? phyNames[phy] : phyNames[0];
+}
+
+void phyRecordRssi(PhyState& state, int rssi) {
+  if (rssi >= 0 || rssi < -127) return;  // not a valid reading
+  state.rssi = state.rssi == 0 ? rssi : state.rssi * 0.8f + rssi * 0.2f;
+}
+
+void phyRecordDisconnect(PhyState& state, int reason) {
+  state.current = 0;
+  state.requested = 0;
+  if (reason == DISCONNECT_LOCAL_HOST) return;
+  state.dropMs[state.dropIndex] = millis();
+  state.dropIndex = (state.dropIndex + 1) % PHY_DROP_HISTORY;
+}
+
+void JKBMS_HOT phyRecordFrame(PhyState& state, uint32_t latencyUs) {
+  if (state.current < 1 || state.current > PHY_COUNT) return;
+  PhyLatency& l = state.latency[state.current - 1];
+  l.frames++;
+  l.totalUs += latencyUs;
+  if (latencyUs > l.maxUs) l.maxUs = latencyUs;
+}
+
+void phyUpdated(PhyState& state, uint8_t phy) {
+  state.current = phy;
+}
+
+int phyRecentDrops(const PhyState& state) {
+  uint32_t now = millis();
+  int drops = 0;
+  for (int i = 0; i < PHY_DROP_HISTORY; i++) {
+    if (state.dropMs[i] && now - state.dropMs[i] < PHY_DROP_WINDOW_MS) drops++;
+  }
+  return drops;
+}
+
+/**
+ * Select a PHY for the current conditions
+ * Thresholds have hysteresis around the current PHY so a link near a
+ * boundary does not flap between PHYs.
+ */
+uint8_t phySelect(const PhyState& state) {
+  switch (state.preference) {
+    case PHY_PREF_1M: return BLE_GAP_LE_PHY_1M;
+    case PHY_PREF_2M: return BLE_GAP_LE_PHY_2M;
+    case PHY_PREF_CODED: return BLE_GAP_LE_PHY_CODED;
+    default: break;
+  }
+
+  int drops = phyRecentDrops(state);
+  if (state.rssi == 0) return drops >= PHY_DROPS_FOR_CODED ? BLE_GAP_LE_PHY_CODED : BLE_GAP_LE_PHY_1M;
+
+  int codedThreshold = state.current == BLE_GAP_LE_PHY_CODED ? PHY_RSSI_CODED_LEAVE : PHY_RSSI_CODED_ENTER;
+  if (drops >= PHY_DROPS_FOR_CODED || state.rssi < codedThreshold) return BLE_GAP_LE_PHY_CODED;
+
+  int fastThreshold = state.current == BLE_GAP_LE_PHY_2M ? PHY_RSSI_2M_LEAVE : PHY_RSSI_2M_ENTER;
+  if (drops == 0 && state.rssi > fastThreshold) return BLE_GAP_LE_PHY_2M;
+
+  return BLE_GAP_LE_PHY_1M;
+}
+
+bool phyApply(PhyState& state, NimBLEClient* client, bool force) {
+#if JKBMS_BLE_PHY
+  if (!client || !client->isConnected()) return false;
+  if (!force && millis() - state.lastRequestMs < PHY_REVIEW_MS) return false;
+  state.lastRequestMs = millis();
+  phyRecordRssi(state, client->getRssi());
+
+  uint8_t txPhy = 0, rxPhy = 0;
+  if (state.current == 0 && client->getPhy(&txPhy, &rxPhy)) state.current = rxPhy;
+
+  uint8_t phy = phySelect(state);
+  if (phy == state.current || phy == state.requested) return false;
+
+  uint8_t mask = phy == BLE_GAP_LE_PHY_2M ? BLE_GAP_LE_PHY_2M_MASK
+               : phy == BLE_GAP_LE_PHY_CODED ? BLE_GAP_LE_PHY_CODED_MASK
+               : BLE_GAP_LE_PHY_1M_MASK;
+  uint16_t options = phy == BLE_GAP_LE_PHY_CODED ? BLE_GAP_LE_PHY_CODED_S8 : 0;
+  if (!client->updatePhy(mask, mask, options)) return false;
+  state.requested = phy;
+  DEBUG_PRINTF("Requested %s PHY (RSSI %d, drops %d)\n", phyName(phy), (int)state.rssi, phyRecentDrops(state));
+  return true;
+#else
+  // 1M only: keep the current PHY known so frame latency is still recorded
+  if (client && client->isConnected()) state.current = BLE_GAP_LE_PHY_1M;
+  return false;
+#endif
+}
+
+void phyEmit(MetricsEmitFunc emit, void* ctx) {
+  char name[64];
+  for (int i = 0; i < bmsDeviceCount; i++) {
+    JKBMS& bms = jkBmsDevices[i];
+    if (bms.targetMAC.empty()) continue;
+    const PhyState& state = bms.phy;
+    const char* mac = bms.targetMAC.c_str();
+    snprintf(name, sizeof(name), "phy.%s.current", mac);
+    emit(name, state.current, ctx);
+    snprintf(name, sizeof(name), "phy.%s.rssi", mac);
+    emit(name, state.rssi, ctx);
+    snprintf(name, sizeof(name), "phy.%s.drops_30min", mac);
+    emit(name, phyRecentDrops(state), ctx);
+    for (int p = 0; p < PHY_COUNT; p++) {
+      const PhyLatency& l = state.latency[p];
+      if (!l.frames) continue;
+      snprintf(name, sizeof(name), "phy.%s.%s.frame_latency_avg_ms", mac, phyNames[p + 1]);
+      emit(name, l.totalUs / 1000.0f / l.frames, ctx);
+      snprintf(name, sizeof(name), "phy.%s.%s.frame_latency_max_ms", mac, phyNames[p + 1]);
+      emit(name, l.maxUs / 1000.0f, ctx);
+    }
+  }
+}
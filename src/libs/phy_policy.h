@@ -0,0 +1,85 @@
+#ifndef PHY_POLICY_H
+#define PHY_POLICY_H
+
+#include <Arduino.h>
+#include <NimBLEDevice.h>
+#include "metrics.h"
+
+// PHY updates need a BLE 5 controller (ESP32-S3, C3, C6...). The classic
+// ESP32 only has 1M, so the policy only records RSSI and latency there.
+#ifndef JKBMS_BLE_PHY
+#if defined(CONFIG_IDF_TARGET_ESP32S3) || defined(JKBMS_HOST)
+#define JKBMS_BLE_PHY 1
+#else
+#define JKBMS_BLE_PHY 0
+#endif
+#endif
+
+enum PhyPreference {
+  PHY_PREF_AUTO = 0,  // chosen from RSSI and link-loss history
+  PHY_PREF_1M,
+  PHY_PREF_2M,        // half the airtime, needs a strong signal
+  PHY_PREF_CODED      // S8 coding, about 4x the range margin, 8x the airtime
+};
+
+// Indexes for per-PHY statistics (BLE_GAP_LE_PHY_* minus one)
+static const int PHY_COUNT = 3;
+static const int PHY_DROP_HISTORY = 4;
+
+// Auto selection thresholds (dBm) with hysteresis
+static const int PHY_RSSI_2M_ENTER = -70;
+static const int PHY_RSSI_2M_LEAVE = -75;
+static const int PHY_RSSI_CODED_ENTER = -85;
+static const int PHY_RSSI_CODED_LEAVE = -80;
+static const uint32_t PHY_DROP_WINDOW_MS = 30UL * 60 * 1000;  // drops counted over 30 min
+static const int PHY_DROPS_FOR_CODED = 2;
+static const uint32_t PHY_REVIEW_MS = 60000;                  // minimum time between reviews
+
+// Frame latency (first fragment to parsed frame) on one PHY
+struct PhyLatency {
+  uint32_t frames;
+  uint64_t totalUs;
+  uint32_t maxUs;
+};
+
+/**
+ * Per-device PHY state
+ * Embedded in each JKBMS instance; preference can be set by the application
+ * before connecting.
+ */
+struct PhyState {
+  PhyPreference preference;
+  uint8_t current;            // negotiated PHY (BLE_GAP_LE_PHY_*), 0 while unknown
+  uint8_t requested;          // last PHY asked for, 0 if none
+  float rssi;                 // smoothed RSSI, 0 while unknown
+  uint32_t lastRequestMs;
+  uint32_t dropMs[PHY_DROP_HISTORY];  // times of the most recent link losses
+  uint8_t dropIndex;
+  PhyLatency latency[PHY_COUNT];
+};
+
+// Feed an RSSI reading (scan result or connected link)
+void phyRecordRssi(PhyState& state, int rssi);
+// Record a disconnect; only link losses count, not disconnects initiated by the gateway
+void phyRecordDisconnect(PhyState& state, int reason);
+void phyRecordFrame(PhyState& state, uint32_t latencyUs);
+void phyUpdated(PhyState& state, uint8_t phy);
+
+// PHY the policy wants right now (BLE_GAP_LE_PHY_*)
+uint8_t phySelect(const PhyState& state);
+// Drops within PHY_DROP_WINDOW_MS
+int phyRecentDrops(const PhyState& state);
+
+/**
+ * Read the link RSSI and request the selected PHY if it differs from the current one
+ * Rate limited to one review per PHY_REVIEW_MS unless force is set.
+ * @return true if a PHY update was requested
+ */
+bool phyApply(PhyState& state, NimBLEClient* client, bool force = false);
+
+const char* phyName(uint8_t phy);
+
+// Metrics source: phy.<mac>.* for every configured device
+void phyEmit(MetricsEmitFunc emit, void* ctx);
+
+#endif // PHY_POLICY_H
@@ -0,0 +1,44 @@
+/**
+ * @file protocol_variant.cpp
+ * @brief Protocol names and the JK04 cell-info decoder (detection is inline in the header)
+ *
+ * The decoder publishes into the same JKBMS fields as parseData(), so the
+ * rest of the gateway does not need to know which variant a pack speaks.
+ */
+
+#include "protocol_variant.h"
+#include "JKBMS.h"
+
+static const char* const protocolNames[] = { "auto", "JK02", "JK04" };
+
+const char* protocolName(ProtocolVariant protocol) {
+  return protocolNames[protocol];
+}
+
+/**
+ * Parse a JK04 cell-info frame
+ * Fills the same fields as parseData(), through JkDefaultDecoder::decodeJk04().
+ * Totals the JK04 frame does not carry (pack voltage, average and delta) are
+ * computed from the cells; current, SOC, capacity and temperatures are left
+ * unchanged.
+ */
+void JKBMS_HOT JKBMS::parseDataJk04() {
+  DEBUG_PRINTLN("Parsing JK04 data...");
+  new_data = false;
+  ignoreNotifyCount = 10;
+
+  JkDefaultDecoder::Cells c;
+  loadCells(c);
+  JkDefaultDecoder::decodeJk04(receivedBytes, c);
+  storeCells(c, JK04_CELLS);
+  cell_count = c.cellCount;
+
+  DEBUG_PRINTF("\n--- JK04 data from %s ---\n", targetMAC.c_str());
+  for (int j = 0; j < cell_count; j++) {
+    DEBUG_PRINTF("  Cell %02d: %.3f V\n", j + 1, cellVoltage[j]);
+  }
+  DEBUG_PRINTF("Battery Voltage: %.2fV\n", Battery_Voltage);
+  DEBUG_PRINTF("Delta Cell Voltage: %.3fV\n", Delta_Cell_Voltage);
+  DEBUG_PRINTF("Balance Curr: %.2fA\n", Balance_Curr);
+  DEBUG_PRINTF("Balancing Action: %d\n", Balancing_Action);
+}
@@ -0,0 +1,72 @@
+#ifndef PROTOCOL_VARIANT_H
+#define PROTOCOL_VARIANT_H
+
+#include <Arduino.h>
+
+/**
+ * JK protocol variants
+ *
+ * Both variants share the framing (55 AA EB 90 header, frame type in byte 4,
+ * 300-byte frames, sum checksum) and the command format. They differ in the
+ * cell-info payload:
+ * - JK02: integers scaled by 0.001/0.1, 16 cells (current JK BMS)
+ * - JK04: little-endian IEEE-754 floats, 24 cells (older JK active balancers,
+ *         no current, SOC or temperature fields)
+ */
+enum ProtocolVariant {
+  PROTOCOL_AUTO = 0,  // detect from the device-info frame, else from the first cell frame
+  PROTOCOL_JK02,
+  PROTOCOL_JK04
+};
+
+// JK04 cell-info offsets
+static const int JK04_CELLS = 24;
+static const int JK04_CELL_VOLTAGE = 6;      // float V, 4 bytes per cell
+static const int JK04_CELL_RESISTANCE = 106; // float Ohm, 4 bytes per cell
+static const int JK04_BALANCING_ACTION = 220;// 0 off, 1 charging balancer, 2 discharging balancer
+static const int JK04_BALANCE_CURRENT = 222; // float A
+static const int JK04_UPTIME = 286;          // 24-bit seconds
+
+// Hardware versions below this major number speak JK04
+static const int JK04_MAX_HW_MAJOR = 5;
+
+/** @brief Read a little-endian IEEE-754 float from a frame */
+static inline float readFloatLE(const uint8_t* p) {
+  uint32_t bits = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+/**
+ * Variant from the hardware version string of the 0x03 frame, PROTOCOL_AUTO if unparseable
+ * (e.g. "11.XW" is JK02, "3.0" is JK04)
+ * @param hardwareVersion Hardware version field, not necessarily NUL-terminated
+ * @param length Field width
+ */
+static inline ProtocolVariant protocolFromHardwareVersion(const char* hardwareVersion, size_t length) {
+  int major = 0;
+  size_t i = 0;
+  while (i < length && hardwareVersion[i] >= '0' && hardwareVersion[i] <= '9') {
+    major = major * 10 + (hardwareVersion[i] - '0');
+    i++;
+  }
+  if (i == 0) return PROTOCOL_AUTO;
+  return major <= JK04_MAX_HW_MAJOR ? PROTOCOL_JK04 : PROTOCOL_JK02;
+}
+
+/**
+ * Variant from the content of a cell-info frame, PROTOCOL_AUTO if the frame is not conclusive
+ * JK04 stores the first cell voltage as a float in volts. The same four bytes
+ * in a JK02 frame are two 16-bit millivolt values, which read as a float far
+ * below 1e-30.
+ */
+static inline ProtocolVariant protocolFromCellFrame(const uint8_t* frame) {
+  const uint8_t* cell = frame + JK04_CELL_VOLTAGE;
+  if ((cell[0] | cell[1] | cell[2] | cell[3]) == 0) return PROTOCOL_AUTO;  // no cell data yet
+  float volts = readFloatLE(cell);
+  return volts > 0.5f && volts < 5.5f ? PROTOCOL_JK04 : PROTOCOL_JK02;
+}
+const char* protocolName(ProtocolVariant protocol);
+
+#endif // PROTOCOL_VARIANT_H
@@ -0,0 +1,324 @@
+/**
+ * @file quantile_sketch.cpp
+ * @brief DDSketch stores, merge and quantiles; per-device sketches on the gateway
+ */
+
+#include "quantile_sketch.h"
+#include "JKBMS.h"
+#include "frame_handlers.h"
+#include "gateway_sync.h"
+
+#include <math.h>
+
+//****************************************************
+// Sketch
+//****************************************************
+
+struct SketchSpec {
+  const char* name;
+  float alpha;
+  int32_t offset;
+};
+
+static const SketchSpec specs[SKETCH_METRIC_COUNT] = {
+  { "cell_mv", 0.001f, 0 },
+  { "current_ma", 0.03f, 0 },
+  { "temp_decic", 0.0075f, 400 },
+};
+
+enum { STORE_POS = 1 << 0, STORE_NEG = 1 << 1 };
+
+// 1 / ln(gamma) and gamma per metric, computed once
+static float invLnGamma[SKETCH_METRIC_COUNT];
+static float gammas[SKETCH_METRIC_COUNT];
+
+static void initGammas() {
+  if (gammas[0] != 0) return;
+  for (int m = 0; m < SKETCH_METRIC_COUNT; m++) {
+    const float gamma = (1 + specs[m].alpha) / (1 - specs[m].alpha);
+    invLnGamma[m] = 1.0f / logf(gamma);
+    gammas[m] = gamma;
+  }
+}
+
+const char* sketchMetricName(SketchMetric metric) {
+  return metric >= 0 && metric < SKETCH_METRIC_COUNT ? specs[metric].name : "unknown";
+}
+
+int sketchMetricFromName(const char* name) {
+  for (int m = 0; m < SKETCH_METRIC_COUNT; m++) {
+    if (strcmp(name, specs[m].name) == 0) return m;
+  }
+  return -1;
+}
+
+void sketchInit(JkSketch& sketch, SketchMetric metric, const uint8_t* mac) {
+  initGammas();
+  memset(&sketch, 0, sizeof(sketch));
+  sketch.magic = JKBMS_SKETCH_MAGIC;
+  sketch.version = JKBMS_SKETCH_VERSION;
+  sketch.metric = (uint8_t)metric;
+  sketch.size = sizeof(JkSketch);
+  sketch.bins = JKBMS_SKETCH_BINS;
+  if (mac) memcpy(sketch.mac, mac, 6);
+}
+
+static inline void addSaturating(uint32_t& bin, uint32_t n) {
+  bin = bin > UINT32_MAX - n ? UINT32_MAX : bin + n;
+}
+
+// Window moves up to newLow: bins below it fold into the new lowest bin
+static void shiftUp(uint32_t* bins, int16_t& low, int32_t newLow) {
+  const int32_t d = newLow - low;
+  uint32_t folded = 0;
+  for (int32_t i = 0; i < d && i < JKBMS_SKETCH_BINS; i++) addSaturating(folded, bins[i]);
+  if (d < JKBMS_SKETCH_BINS) {
+    memmove(bins, bins + d, (JKBMS_SKETCH_BINS - d) * sizeof(uint32_t));
+    memset(bins + JKBMS_SKETCH_BINS - d, 0, d * sizeof(uint32_t));
+  } else {
+    memset(bins, 0, JKBMS_SKETCH_BINS * sizeof(uint32_t));
+  }
+  addSaturating(bins[0], folded);
+  low = (int16_t)newLow;
+}
+
+static void storeAdd(uint32_t* bins, int16_t& low, uint8_t& stores, uint8_t flag, int32_t key, uint32_t n) {
+  if (!(stores & flag)) {
+    stores |= flag;
+    low = (int16_t)(key - JKBMS_SKETCH_BINS / 2);
+  }
+  if (key >= low + JKBMS_SKETCH_BINS) {
+    shiftUp(bins, low, key - JKBMS_SKETCH_BINS + 1);
+  } else if (key < low) {
+    // Move the window down as far as the highest bin in use allows, fold the rest
+    int32_t top = JKBMS_SKETCH_BINS - 1;
+    while (top > 0 && bins[top] == 0) top--;
+    int32_t newLow = low + top - (JKBMS_SKETCH_BINS - 1);
+    if (newLow < key) newLow = key;
+    if (newLow < low) {
+      const int32_t d = low - newLow;
+      memmove(bins + d, bins, (JKBMS_SKETCH_BINS - d) * sizeof(uint32_t));
+      memset(bins, 0, d * sizeof(uint32_t));
+      low = (int16_t)newLow;
+    }
+    if (key < low) key = low;
+  }
+  addSaturating(bins[key - low], n);
+}
+
+static inline int32_t keyOf(float magnitude, int metric) {
+  return (int32_t)ceilf(logf(magnitude) * invLnGamma[metric]);
+}
+
+// Midpoint of bin k, (gamma^(k-1), gamma^k], in the relative sense
+static inline float binValue(int32_t key, int metric) {
+  const float gamma = gammas[metric];
+  return 2.0f * powf(gamma, (float)key) / (gamma + 1.0f);
+}
+
+void sketchAdd(JkSketch& sketch, int32_t value, uint32_t count) {
+  if (!count || sketch.metric >= SKETCH_METRIC_COUNT) return;
+  const int m = sketch.metric;
+  if (sketch.count == 0 || value < sketch.min) sketch.min = value;
+  if (sketch.count == 0 || value > sketch.max) sketch.max = value;
+  sketch.count += count;
+  sketch.sum += (int64_t)value * count;
+  const int64_t shifted = (int64_t)value + specs[m].offset;
+  if (shifted == 0) {
+    addSaturating(sketch.zero, count);
+  } else if (shifted > 0) {
+    storeAdd(sketch.pos, sketch.posLow, sketch.stores, STORE_POS, keyOf((float)shifted, m), count);
+  } else {
+    storeAdd(sketch.neg, sketch.negLow, sketch.stores, STORE_NEG, keyOf((float)-shifted, m), count);
+  }
+}
+
+// Highest keys first: the window settles on the first bin and only ever moves down
+static void mergeStore(uint32_t* into, int16_t& intoLow, uint8_t& stores, uint8_t flag, const uint32_t* from,
+                       int16_t fromLow) {
+  for (int i = JKBMS_SKETCH_BINS - 1; i >= 0; i--) {
+    if (from[i]) storeAdd(into, intoLow, stores, flag, fromLow + i, from[i]);
+  }
+}
+
+bool sketchMerge(JkSketch& into, const JkSketch& from) {
+  if (into.metric != from.metric || into.bins != from.bins || from.bins != JKBMS_SKETCH_BINS) return false;
+  if (from.count == 0) return true;
+  if (into.count == 0 || from.min < into.min) into.min = from.min;
+  if (into.count == 0 || from.max > into.max) into.max = from.max;
+  if (into.count && memcmp(into.mac, from.mac, 6) != 0) memset(into.mac, 0, 6);
+  if (into.count == 0) memcpy(into.mac, from.mac, 6);
+  into.count += from.count;
+  into.sum += from.sum;
+  addSaturating(into.zero, from.zero);
+  if (from.stores & STORE_POS) mergeStore(into.pos, into.posLow, into.stores, STORE_POS, from.pos, from.posLow);
+  if (from.stores & STORE_NEG) mergeStore(into.neg, into.negLow, into.stores, STORE_NEG, from.neg, from.negLow);
+  return true;
+}
+
+int32_t sketchQuantile(const JkSketch& sketch, float q) {
+  if (sketch.count == 0 || sketch.metric >= SKETCH_METRIC_COUNT) return 0;
+  initGammas();
+  const int m = sketch.metric;
+  if (q <= 0) return sketch.min;
+  if (q >= 1) return sketch.max;
+  // Walk from the most negative value up; the bins may hold fewer than count when saturated
+  const uint64_t rank = (uint64_t)(q * (double)(sketch.count - 1));
+  uint64_t seen = 0;
+  float shifted = 0;
+  bool found = false;
+  if (sketch.stores & STORE_NEG) {
+    for (int i = JKBMS_SKETCH_BINS - 1; i >= 0 && !found; i--) {
+      seen += sketch.neg[i];
+      if (seen > rank) {
+        shifted = -binValue(sketch.negLow + i, m);
+        found = true;
+      }
+    }
+  }
+  if (!found) {
+    seen += sketch.zero;
+    found = seen > rank;
+  }
+  if (!found && (sketch.stores & STORE_POS)) {
+    for (int i = 0; i < JKBMS_SKETCH_BINS && !found; i++) {
+      seen += sketch.pos[i];
+      if (seen > rank) {
+        shifted = binValue(sketch.posLow + i, m);
+        found = true;
+      }
+    }
+  }
+  if (!found) return sketch.max;
+  int32_t value = (int32_t)lroundf(shifted) - specs[m].offset;
+  if (value < sketch.min) value = sketch.min;
+  if (value > sketch.max) value = sketch.max;
+  return value;
+}
+
+void sketchAddSnapshot(JkSketch* sketches, const JkSnapshot& snap) {
+  const int cells = snap.header.cellCount < JKBMS_SNAPSHOT_CELLS ? snap.header.cellCount : JKBMS_SNAPSHOT_CELLS;
+  for (int c = 0; c < cells; c++) {
+    if (snap.cellMv[c]) sketchAdd(sketches[SKETCH_CELL_MV], snap.cellMv[c]);
+  }
+  sketchAdd(sketches[SKETCH_CURRENT_MA], snap.currentMa);
+  sketchAdd(sketches[SKETCH_TEMP_DECIC], snap.t1DeciC);
+  // T2 reads 0 on packs with a single probe
+  if (snap.t2DeciC != 0) sketchAdd(sketches[SKETCH_TEMP_DECIC], snap.t2DeciC);
+}
+
+void sketchSeal(JkSketch& sketch) {
+  sketch.size = sizeof(JkSketch);
+  sketch.crc = snapshotCrc((const uint8_t*)&sketch, offsetof(JkSketch, crc));
+}
+
+const JkSketch* sketchView(const void* buffer, size_t length) {
+  if (length < sizeof(JkSketch)) return nullptr;
+  const JkSketch* sketch = (const JkSketch*)buffer;
+  if (sketch->magic != JKBMS_SKETCH_MAGIC || sketch->version != JKBMS_SKETCH_VERSION) return nullptr;
+  if (sketch->size != sizeof(JkSketch) || sketch->bins != JKBMS_SKETCH_BINS) return nullptr;
+  if (sketch->metric >= SKETCH_METRIC_COUNT) return nullptr;
+  if (snapshotCrc((const uint8_t*)buffer, offsetof(JkSketch, crc)) != sketch->crc) return nullptr;
+  return sketch;
+}
+
+//****************************************************
+// Gateway
+//****************************************************
+
+// Seqlock per device: the parsing task updates in place, any task copies
+struct DeviceSketches {
+  volatile uint32_t sequence;     // odd while written
+  uint32_t generation;            // sketchesReset() count these sketches belong to
+  JkSketch sketch[SKETCH_METRIC_COUNT];
+};
+
+static DeviceSketches deviceSketches[JKBMS_SKETCH_DEVICES];
+static volatile uint32_t resetGeneration = 0;
+static bool sketchesAttached = false;
+
+static void macBytes(const std::string& text, uint8_t* mac) {
+  unsigned v[6] = {};
+  memset(mac, 0, 6);
+  if (sscanf(text.c_str(), "%x:%x:%x:%x:%x:%x", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) != 6) return;
+  for (int i = 0; i < 6; i++) mac[i] = (uint8_t)v[i];
+}
+
+static void onCellFrame(const FrameView& frame, void* ctx) {
+  const int device = (int)(frame.device - jkBmsDevices);
+  if (device < 0 || device >= JKBMS_SKETCH_DEVICES) return;
+  const JKBMS& bms = *frame.device;
+  DeviceSketches& d = deviceSketches[device];
+  seqlockWriteBegin(d.sequence);
+  if (d.generation != resetGeneration || d.sketch[0].magic != JKBMS_SKETCH_MAGIC) {
+    uint8_t mac[6];
+    macBytes(bms.targetMAC, mac);
+    for (int m = 0; m < SKETCH_METRIC_COUNT; m++) sketchInit(d.sketch[m], (SketchMetric)m, mac);
+    d.generation = resetGeneration;
+  }
+  const int cells = bms.cellCountClamped();
+  for (int c = 0; c < cells; c++) {
+    if (bms.cellVoltage[c] > 0) sketchAdd(d.sketch[SKETCH_CELL_MV], (int32_t)lroundf(bms.cellVoltage[c] * 1000));
+  }
+  sketchAdd(d.sketch[SKETCH_CURRENT_MA], (int32_t)lroundf(bms.Charge_Current * 1000));
+  sketchAdd(d.sketch[SKETCH_TEMP_DECIC], (int32_t)lroundf(bms.Battery_T1 * 10));
+  if (bms.Battery_T2 != 0) sketchAdd(d.sketch[SKETCH_TEMP_DECIC], (int32_t)lroundf(bms.Battery_T2 * 10));
+  seqlockWriteEnd(d.sequence);
+}
+
+bool sketchesAttach() {
+  if (sketchesAttached) return true;
+  initGammas();
+  sketchesAttached = registerFrameHandler(0x02, onCellFrame);
+  return sketchesAttached;
+}
+
+void sketchesReset() {
+  resetGeneration = resetGeneration + 1;
+}
+
+bool sketchesCopy(int device, SketchMetric metric, JkSketch& out) {
+  if (device < 0 || device >= JKBMS_SKETCH_DEVICES || metric < 0 || metric >= SKETCH_METRIC_COUNT) return false;
+  const DeviceSketches& d = deviceSketches[device];
+  for (int attempt = 0; attempt < 4; attempt++) {
+    const uint32_t before = seqlockReadBegin(d.sequence);
+    memcpy(&out, (const void*)&d.sketch[metric], sizeof(out));
+    const uint32_t generation = d.generation;
+    if (!seqlockReadValid(d.sequence, before)) continue;
+    if (before == 0 || generation != resetGeneration || out.count == 0) return false;
+    sketchSeal(out);
+    return true;
+  }
+  return false;
+}
+
+bool sketchesFleet(SketchMetric metric, JkSketch& out) {
+  static JkSketch one;   // 1 KB: kept off the caller's stack
+  sketchInit(out, metric);
+  bool any = false;
+  const int count = bmsDeviceCount < JKBMS_SKETCH_DEVICES ? bmsDeviceCount : JKBMS_SKETCH_DEVICES;
+  for (int i = 0; i < count; i++) {
+    if (!sketchesCopy(i, metric, one)) continue;
+    sketchMerge(out, one);
+    any = true;
+  }
+  sketchSeal(out);
+  return any;
+}
+
+void sketchesEmit(MetricsEmitFunc emit, void* ctx) {
+  if (!sketchesAttached) return;
+  static JkSketch fleet;
+  char name[48];
+  for (int m = 0; m < SKETCH_METRIC_COUNT; m++) {
+    if (!sketchesFleet((SketchMetric)m, fleet)) continue;
+    const char* metric = specs[m].name;
+    snprintf(name, sizeof(name), "sketch.%s.p01", metric);
+    emit(name, sketchQuantile(fleet, 0.01f), ctx);
+    snprintf(name, sizeof(name), "sketch.%s.p50", metric);
+    emit(name, sketchQuantile(fleet, 0.50f), ctx);
+    snprintf(name, sizeof(name), "sketch.%s.p99", metric);
+    emit(name, sketchQuantile(fleet, 0.99f), ctx);
+  }
+  emit("sketch.bytes", (float)sizeof(deviceSketches), ctx);
+}
@@ -0,0 +1,137 @@
+#ifndef QUANTILE_SKETCH_H
+#define QUANTILE_SKETCH_H
+
+#include <Arduino.h>
+#include "metrics.h"
+#include "snapshot.h"
+
+/**
+ * Mergeable quantile sketches (DDSketch)
+ *
+ * A sketch keeps one counter per logarithmic bin: a value v lands in bin
+ * ceil(log_gamma(|v + offset|)), gamma = (1 + alpha) / (1 - alpha), so every
+ * quantile comes back within a relative error alpha of (v + offset). Two
+ * stores hold the positive and the negative side, each a window of
+ * JKBMS_SKETCH_BINS bins that follows the largest magnitude; when the data
+ * spans more than that, the smallest magnitudes are folded into the lowest
+ * bin. Count, min, max and sum are exact.
+ *
+ * Merging adds the bin counters, so sketches of the same metric merge in
+ * O(bins) in any order and grouping: per pack on the gateway, per gateway,
+ * per fleet on the ingest server. The accuracy and offset of each metric
+ * are fixed by this header (changing them bumps JKBMS_SKETCH_VERSION), so
+ * any two sketches of a metric are compatible.
+ *
+ * Values are in the integer units of snapshot.h:
+ *   SKETCH_CELL_MV     every cell, mV            alpha 0.1 %  (3 mV at 3.3 V;
+ *                      128 bins cover 3.65 V down to 2.83 V)
+ *   SKETCH_CURRENT_MA  pack current, mA          alpha 3 %    (down to ~0.1 A at 200 A)
+ *   SKETCH_TEMP_DECIC  T1/T2, 0.1 °C, +40 °C offset  alpha 0.75 % (0.5 °C at 25 °C)
+ *
+ * JkSketch is a flat record with the layout rules of snapshot.h (packed,
+ * little-endian, CRC last), so it can be sent as is (INGEST_SKETCHES) and
+ * read in place. About 1.1 KB with the default bins.
+ */
+
+#ifndef JKBMS_SKETCH_BINS
+#define JKBMS_SKETCH_BINS 128
+#endif
+// Packs with sketches on the gateway (the first entries of jkBmsDevices)
+#ifndef JKBMS_SKETCH_DEVICES
+#define JKBMS_SKETCH_DEVICES 8
+#endif
+
+#define JKBMS_SKETCH_MAGIC 0x53514B4AUL  // "JKQS"
+#define JKBMS_SKETCH_VERSION 1
+
+enum SketchMetric {
+  SKETCH_CELL_MV = 0,
+  SKETCH_CURRENT_MA,
+  SKETCH_TEMP_DECIC,
+  SKETCH_METRIC_COUNT
+};
+
+#pragma pack(push, 1)
+
+struct JkSketch {
+  uint32_t magic;            // JKBMS_SKETCH_MAGIC
+  uint8_t version;           // JKBMS_SKETCH_VERSION
+  uint8_t metric;            // SketchMetric
+  uint16_t size;             // whole record including the CRC
+  uint8_t mac[6];            // the pack; all zero once packs are merged
+  uint16_t bins;             // JKBMS_SKETCH_BINS of the writer
+  uint8_t stores;            // bit 0: pos in use, bit 1: neg in use
+  uint8_t reserved;
+  int16_t posLow;            // key of pos[0]
+  int16_t negLow;            // key of neg[0]
+  uint64_t count;
+  int64_t sum;
+  int32_t min;
+  int32_t max;
+  uint32_t zero;             // values at -offset exactly
+  uint32_t pos[JKBMS_SKETCH_BINS];
+  uint32_t neg[JKBMS_SKETCH_BINS];
+  uint16_t crc;              // CRC-16/CCITT-FALSE, set by sketchSeal()
+};
+
+#pragma pack(pop)
+
+static_assert(offsetof(JkSketch, pos) == 50, "sketch layout changed: bump JKBMS_SKETCH_VERSION");
+
+// Name used in metrics and queries: "cell_mv", "current_ma", "temp_decic"
+const char* sketchMetricName(SketchMetric metric);
+// -1 if unknown
+int sketchMetricFromName(const char* name);
+
+void sketchInit(JkSketch& sketch, SketchMetric metric, const uint8_t* mac = nullptr);
+void sketchAdd(JkSketch& sketch, int32_t value, uint32_t count = 1);
+
+/**
+ * Add every value of `from` to `into`
+ * @return false (into unchanged) if the metric or bin count differ
+ */
+bool sketchMerge(JkSketch& into, const JkSketch& from);
+
+/**
+ * Value at quantile q (0..1), clamped to the exact min/max
+ * @return 0 for an empty sketch
+ */
+int32_t sketchQuantile(const JkSketch& sketch, float q);
+
+// Cells, current and temperatures of one snapshot into sketches[SKETCH_METRIC_COUNT]
+void sketchAddSnapshot(JkSketch* sketches, const JkSnapshot& snap);
+
+// Set size and CRC before sending or storing
+void sketchSeal(JkSketch& sketch);
+
+/**
+ * Validate a sealed sketch in place
+ * @return The sketch, or nullptr if the buffer is short, from another layout
+ *         or bin count, or corrupted
+ */
+const JkSketch* sketchView(const void* buffer, size_t length);
+
+//****************************************************
+// Gateway
+//****************************************************
+
+/**
+ * Keep one sketch per metric for the first JKBMS_SKETCH_DEVICES devices,
+ * fed from every cell frame (frame handler)
+ * @return false if no frame-handler slot is free
+ */
+bool sketchesAttach();
+
+// Start a new period (e.g. daily); the next frame of each device starts empty sketches
+void sketchesReset();
+
+// Sealed copy of one device's sketch, from any task; false if it has no samples
+bool sketchesCopy(int device, SketchMetric metric, JkSketch& out);
+
+// Every device merged; false if none has samples
+bool sketchesFleet(SketchMetric metric, JkSketch& out);
+
+// Metrics source: sketch.<metric>.p01/p50/p99 over the fleet, sketch.bytes
+void sketchesEmit(MetricsEmitFunc emit, void* ctx);
+
+#endif // QUANTILE_SKETCH_H
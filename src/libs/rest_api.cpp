@@ -0,0 +1,665 @@
+/**
+ * @file rest_api.cpp
+ * @brief Version-tagged JSON resources, their render cache and the socket loop
+ */
+
+#include "rest_api.h"
+#include "JKBMS.h"
+#include "snapshot.h"
+#include "gateway_sync.h"
+#include "worst_cells.h"
+#include "debug_functions.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#if defined(ESP_PLATFORM)
+#include <lwip/sockets.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+struct RestCacheEntry {
+  bool valid;
+  uint32_t key;
+  uint16_t length;
+  char body[JKBMS_REST_BODY];
+};
+
+struct RestListCache {
+  bool valid;
+  uint32_t key;
+  size_t length;
+  char* body;
+};
+
+static RestCounters counters;
+static RestCacheEntry* cache = nullptr;
+static RestListCache listCache = {};
+static RestListCache worstCache = {};
+static int cacheCount = 0;
+static uint32_t bootId = 0;
+
+static const int REST_NOT_FOUND = -3;
+
+//****************************************************
+// Resources
+//****************************************************
+
+static bool cacheInit() {
+  if (cache) return true;
+  const int count = bmsDeviceCount < JKBMS_REST_DEVICES ? bmsDeviceCount : JKBMS_REST_DEVICES;
+  cache = (RestCacheEntry*)calloc(count ? count : 1, sizeof(RestCacheEntry));
+  listCache.body = (char*)malloc((size_t)count * JKBMS_REST_BODY + 16);
+  worstCache.body = (char*)malloc(JKBMS_REST_WORST_BODY);
+  if (!cache || !listCache.body || !worstCache.body) {
+    free(cache);
+    free(listCache.body);
+    free(worstCache.body);
+    cache = nullptr;
+    listCache.body = nullptr;
+    worstCache.body = nullptr;
+    return false;
+  }
+  cacheCount = count;
+#if defined(ESP_PLATFORM)
+  bootId = esp_random();
+#else
+  bootId = (uint32_t)time(nullptr) * 2654435761u ^ (uint32_t)(uintptr_t)&bootId;
+#endif
+  return true;
+}
+
+// Changes with every parsed cell frame and with the connection state
+static inline uint32_t deviceKey(int device) {
+  const JKBMS& bms = jkBmsDevices[device];
+  return bms.snapshotVersion << 1 | (bms.connected ? 1 : 0);
+}
+
+uint32_t restResourceKey(int resource) {
+  if (resource == REST_RESOURCE_WORST) return worstVersion();
+  if (resource >= 0) return resource < cacheCount ? deviceKey(resource) : 0;
+  // FNV-1a over the device keys
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < cacheCount; i++) {
+    h = (h ^ deviceKey(i)) * 16777619u;
+  }
+  return h;
+}
+
+static void formatEtag(char* out, size_t size, int resource, uint32_t key) {
+  if (resource >= 0) snprintf(out, size, "\"%08lx-d%d-%lx\"", (unsigned long)bootId, resource, (unsigned long)key);
+  else if (resource == REST_RESOURCE_WORST) snprintf(out, size, "\"%08lx-w-%lx\"", (unsigned long)bootId, (unsigned long)key);
+  else snprintf(out, size, "\"%08lx-l-%lx\"", (unsigned long)bootId, (unsigned long)key);
+}
+
+// Weak validators and lists ("a", W/"b") compare by the quoted tag
+static bool etagMatches(const char* ifNoneMatch, const char* etag) {
+  if (!ifNoneMatch) return false;
+  if (strchr(ifNoneMatch, '*')) return true;
+  return strstr(ifNoneMatch, etag) != nullptr;
+}
+
+static int appendf(char* out, size_t size, int used, const char* format, ...) {
+  if (used < 0 || (size_t)used >= size) return used;
+  va_list args;
+  va_start(args, format);
+  const int n = vsnprintf(out + used, size - used, format, args);
+  va_end(args);
+  return n < 0 ? -1 : used + n;
+}
+
+// Copy of the device's cell-frame fields, false if the shard task kept parsing into them
+static bool copyDevice(const JKBMS& bms, JkSnapshot& s) {
+  for (int attempt = 0; attempt < 4; attempt++) {
+    const uint32_t before = seqlockReadBegin(bms.parseSequence);
+    snapshotFromBms(bms, s);
+    if (seqlockReadValid(bms.parseSequence, before)) return true;
+  }
+  return false;
+}
+
+static int renderDevice(int device, char* out, size_t size) {
+  const JKBMS& bms = jkBmsDevices[device];
+  if (!bms.snapshotVersion) {
+    return snprintf(out, size, "{\"index\":%d,\"mac\":\"%s\",\"connected\":%s,\"sequence\":0}", device,
+                    bms.targetMAC.c_str(), bms.connected ? "true" : "false");
+  }
+  JkSnapshot s;
+  if (!copyDevice(bms, s)) return -1;
+  METRICS_PHASE_BEGIN(serializationSample);
+  int n = appendf(out, size, 0,
+                  "{\"index\":%d,\"mac\":\"%s\",\"connected\":%s,\"sequence\":%lu,\"timestamp_ms\":%lu,\"protocol\":%u,",
+                  device, bms.targetMAC.c_str(), bms.connected ? "true" : "false",
+                  (unsigned long)s.header.sequence, (unsigned long)s.header.timestampMs, s.header.protocol);
+  n = appendf(out, size, n,
+              "\"voltage\":%.3f,\"current\":%.3f,\"power\":%.1f,\"soc\":%u,\"average_cell\":%.3f,\"delta_cell\":%.3f,",
+              s.batteryMv * 0.001, s.currentMa * 0.001, s.powerDw * 0.1, s.soc, s.averageCellMv * 0.001,
+              s.deltaCellMv * 0.001);
+  n = appendf(out, size, n,
+              "\"mos_temp\":%.1f,\"t1\":%.1f,\"t2\":%.1f,\"cycles\":%lu,\"capacity_remain\":%.3f,\"cells\":[",
+              s.mosDeciC * 0.1, s.t1DeciC * 0.1, s.t2DeciC * 0.1, (unsigned long)s.cycleCount,
+              s.capacityRemainMah * 0.001);
+  for (int i = 0; i < s.header.cellCount && i < JKBMS_SNAPSHOT_CELLS; i++) {
+    n = appendf(out, size, n, "%s%.3f", i ? "," : "", s.cellMv[i] * 0.001);
+  }
+  n = appendf(out, size, n, "]}");
+  METRICS_PHASE_END(serializationSample, PHASE_SERIALIZATION);
+  return n;
+}
+
+// Render the device if its cached body is from an older version
+static const RestCacheEntry& freshDevice(int device) {
+  RestCacheEntry& entry = cache[device];
+  const uint32_t key = deviceKey(device);
+  if (entry.valid && entry.key == key) return entry;
+  int n = renderDevice(device, entry.body, sizeof(entry.body));
+  const bool copied = n >= 0;
+  if (!copied) {
+    n = snprintf(entry.body, sizeof(entry.body), "{\"index\":%d,\"error\":\"busy\"}", device);
+  } else if ((size_t)n >= sizeof(entry.body)) {
+    n = snprintf(entry.body, sizeof(entry.body), "{\"index\":%d,\"error\":\"too large\"}", device);
+  }
+  entry.length = (uint16_t)n;
+  // A frame parsed since the key was read may already be in the body: serve
+  // it this once but do not cache it under the older key
+  entry.key = key;
+  entry.valid = copied && deviceKey(device) == key;
+  if (!entry.valid) counters.renderRaces++;
+  counters.renders++;
+  return entry;
+}
+
+static const RestListCache& freshList(uint32_t key) {
+  if (listCache.valid && listCache.key == key) return listCache;
+  size_t n = 0;
+  listCache.body[n++] = '[';
+  for (int i = 0; i < cacheCount; i++) {
+    if (jkBmsDevices[i].targetMAC.empty()) continue;
+    const RestCacheEntry& entry = freshDevice(i);
+    if (n > 1) listCache.body[n++] = ',';
+    memcpy(listCache.body + n, entry.body, entry.length);
+    n += entry.length;
+  }
+  listCache.body[n++] = ']';
+  listCache.body[n] = '\0';
+  listCache.length = n;
+  // Cached only if no device moved on meanwhile, as freshDevice()
+  listCache.key = key;
+  listCache.valid = restResourceKey(REST_RESOURCE_LIST) == key;
+  return listCache;
+}
+
+// Every criterion, worst first; cells are numbered from 1 as on the BMS display
+static const RestListCache& freshWorst(uint32_t key) {
+  if (worstCache.valid && worstCache.key == key) return worstCache;
+  char* out = worstCache.body;
+  const size_t size = JKBMS_REST_WORST_BODY;
+  WorstEntry top[JKBMS_WORST_K];
+  int n = appendf(out, size, 0, "{");
+  for (int c = 0; c < WORST_CRITERION_COUNT; c++) {
+    const int count = worstTop((WorstCriterion)c, top, JKBMS_WORST_K);
+    n = appendf(out, size, n, "%s\"%s\":[", c ? "," : "", worstCriterionName((WorstCriterion)c));
+    for (int i = 0; i < count; i++) {
+      const WorstEntry& e = top[i];
+      const char* mac = e.device < bmsDeviceCount ? jkBmsDevices[e.device].targetMAC.c_str() : "";
+      n = appendf(out, size, n, "%s{\"index\":%u,\"mac\":\"%s\",", i ? "," : "", e.device, mac);
+      if (e.cell != WORST_PACK) n = appendf(out, size, n, "\"cell\":%u,", e.cell + 1);
+      n = appendf(out, size, n, "\"score\":%.1f,\"value\":%.1f,\"timestamp_ms\":%lu}", e.score, e.value,
+                  (unsigned long)e.frameMs);
+    }
+    n = appendf(out, size, n, "]");
+  }
+  n = appendf(out, size, n, "}");
+  if (n < 0 || (size_t)n >= size) n = snprintf(out, size, "{\"error\":\"too large\"}");
+  worstCache.length = (size_t)n;
+  // worstTop() copies each list under the lock; a list that changed after
+  // the version was read only makes the next request render again
+  worstCache.key = key;
+  worstCache.valid = true;
+  counters.renders++;
+  return worstCache;
+}
+
+// "/devices/2" or "/devices/c8:47:80:31:9b:02" (any case)
+static int findDevice(const char* id, size_t length) {
+  if (!length) return REST_NOT_FOUND;
+  char* end = nullptr;
+  const long index = strtol(id, &end, 10);
+  if (end == id + length) return index >= 0 && index < cacheCount ? (int)index : REST_NOT_FOUND;
+  for (int i = 0; i < cacheCount; i++) {
+    const std::string& mac = jkBmsDevices[i].targetMAC;
+    if (!mac.empty() && mac.size() == length && strncasecmp(mac.c_str(), id, length) == 0) return i;
+  }
+  return REST_NOT_FOUND;
+}
+
+static uint32_t waitParam(const char* query) {
+  const char* p = query ? strstr(query, "wait=") : nullptr;
+  if (!p) return 0;
+  long s = strtol(p + 5, nullptr, 10);
+  if (s < 0) s = 0;
+  if (s > JKBMS_REST_MAX_WAIT_S) s = JKBMS_REST_MAX_WAIT_S;
+  return (uint32_t)s * 1000;
+}
+
+void restHandleRequest(const char* method, const char* target, const char* ifNoneMatch, RestReply& reply,
+                       bool allowWait) {
+  reply = RestReply();
+  // The second pass of a held request is the same request
+  if (allowWait) counters.requests++;
+  if (!cacheInit() || strcmp(method, "GET") != 0) {
+    reply.status = 405;
+    counters.errors++;
+    return;
+  }
+  const char* query = strchr(target, '?');
+  const size_t pathLength = query ? (size_t)(query - target) : strlen(target);
+
+  int resource;
+  if (pathLength == 8 && strncmp(target, "/devices", 8) == 0) {
+    resource = REST_RESOURCE_LIST;
+  } else if (pathLength > 9 && strncmp(target, "/devices/", 9) == 0) {
+    resource = findDevice(target + 9, pathLength - 9);
+  } else if (pathLength == 6 && strncmp(target, "/worst", 6) == 0) {
+    resource = REST_RESOURCE_WORST;
+  } else {
+    resource = REST_NOT_FOUND;
+  }
+  if (resource == REST_NOT_FOUND) {
+    reply.status = 404;
+    counters.errors++;
+    return;
+  }
+
+  const uint32_t key = restResourceKey(resource);
+  formatEtag(reply.etag, sizeof(reply.etag), resource, key);
+  const uint32_t waitMs = allowWait ? waitParam(query) : 0;
+  const bool unchanged = etagMatches(ifNoneMatch, reply.etag);
+  // Long poll: hold while the client's version is still the latest; a
+  // client without a version gets the current one right away
+  if (waitMs && unchanged) {
+    reply.status = 0;
+    reply.resource = resource;
+    reply.key = key;
+    reply.deadlineMs = millis() + waitMs;
+    counters.longPolls++;
+    return;
+  }
+  if (unchanged) {
+    reply.status = 304;
+    counters.notModified++;
+    return;
+  }
+
+  const uint32_t rendersBefore = counters.renders;
+  reply.status = 200;
+  if (resource == REST_RESOURCE_LIST) {
+    const RestListCache& list = freshList(key);
+    reply.body = list.body;
+    reply.length = list.length;
+  } else if (resource == REST_RESOURCE_WORST) {
+    const RestListCache& worst = freshWorst(key);
+    reply.body = worst.body;
+    reply.length = worst.length;
+  } else {
+    const RestCacheEntry& entry = freshDevice(resource);
+    reply.body = entry.body;
+    reply.length = entry.length;
+  }
+  if (counters.renders == rendersBefore) counters.cacheHits++;
+}
+
+void restInvalidate() {
+  if (!cache) return;
+  for (int i = 0; i < cacheCount; i++) cache[i].valid = false;
+  listCache.valid = false;
+  worstCache.valid = false;
+}
+
+const RestCounters& restCounters() {
+  return counters;
+}
+
+void restEmit(MetricsEmitFunc emit, void* ctx) {
+  emit("rest.requests", counters.requests, ctx);
+  emit("rest.not_modified", counters.notModified, ctx);
+  emit("rest.renders", counters.renders, ctx);
+  emit("rest.cache_hits", counters.cacheHits, ctx);
+  emit("rest.long_polls", counters.longPolls, ctx);
+  emit("rest.long_poll_timeouts", counters.longPollTimeouts, ctx);
+  emit("rest.errors", counters.errors, ctx);
+  emit("rest.connections", counters.connections, ctx);
+  emit("rest.held", counters.held, ctx);
+  emit("rest.sends_queued", counters.sendsQueued, ctx);
+  emit("rest.render_races", counters.renderRaces, ctx);
+}
+
+//****************************************************
+// Socket loop
+//****************************************************
+
+struct RestConnection {
+  int fd;                   // -1: free
+  bool held;
+  uint16_t used;
+  uint32_t openedMs;        // accepted, or last progress of a pending send
+  char request[512];
+  RestReply reply;          // held request: resource, key and deadline
+  char* out;                // unsent end of the response (malloc), nullptr if none
+  size_t outLength;
+  size_t outSent;
+};
+
+// A request must arrive, and a pending response make progress, within this
+static const uint32_t REST_READ_TIMEOUT_MS = 5000;
+
+static int listenFd = -1;
+static RestConnection connections[JKBMS_REST_CONNECTIONS];
+
+static void setNonBlocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+// Bytes the socket took before its buffer filled up, or -1 if the peer is gone
+static ssize_t sendSome(int fd, const char* data, size_t length) {
+  size_t sent = 0;
+  while (sent < length) {
+    const ssize_t n = send(fd, data + sent, length - sent, 0);
+    if (n > 0) {
+      sent += (size_t)n;
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else {
+      return -1;
+    }
+  }
+  return (ssize_t)sent;
+}
+
+static int formatHead(char* head, size_t size, const RestReply& reply) {
+  int n;
+  switch (reply.status) {
+    case 200:
+      n = snprintf(head, size,
+                   "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nETag: %s\r\nCache-Control: no-cache\r\n"
+                   "Content-Length: %u\r\nConnection: close\r\n\r\n",
+                   reply.etag, (unsigned)reply.length);
+      break;
+    case 304:
+      n = snprintf(head, size, "HTTP/1.1 304 Not Modified\r\nETag: %s\r\nConnection: close\r\n\r\n",
+                   reply.etag);
+      break;
+    case 404:
+      n = snprintf(head, size, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+      break;
+    case 503:
+      n = snprintf(head, size,
+                   "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+      break;
+    default:
+      n = snprintf(head, size,
+                   "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+      break;
+  }
+  return n;
+}
+
+static void closeConnection(RestConnection& c) {
+  if (c.held) counters.held--;
+  close(c.fd);
+  free(c.out);
+  c.fd = -1;
+  c.held = false;
+  c.out = nullptr;
+  counters.connections--;
+}
+
+// Send the reply and close, or keep what the socket buffer did not take for
+// restServerPoll() to send as the peer reads: the list and /worst are larger
+// than the lwIP send buffer
+static void respond(RestConnection& c, const RestReply& reply) {
+  char head[256];
+  const size_t headLength = (size_t)formatHead(head, sizeof(head), reply);
+  const size_t bodyLength = reply.status == 200 ? reply.length : 0;
+  ssize_t sent = sendSome(c.fd, head, headLength);
+  if (sent == (ssize_t)headLength && bodyLength) {
+    const ssize_t n = sendSome(c.fd, reply.body, bodyLength);
+    sent = n < 0 ? -1 : sent + n;
+  }
+  const size_t total = headLength + bodyLength;
+  if (sent < 0 || (size_t)sent == total) {
+    closeConnection(c);
+    return;
+  }
+  // The body belongs to a cache that the next request may render again
+  c.out = (char*)malloc(total - (size_t)sent);
+  if (!c.out) {
+    closeConnection(c);
+    return;
+  }
+  size_t n = 0;
+  if ((size_t)sent < headLength) {
+    memcpy(c.out, head + sent, headLength - (size_t)sent);
+    n = headLength - (size_t)sent;
+  }
+  const size_t bodySent = (size_t)sent > headLength ? (size_t)sent - headLength : 0;
+  memcpy(c.out + n, reply.body + bodySent, bodyLength - bodySent);
+  c.outLength = total - (size_t)sent;
+  c.outSent = 0;
+  if (c.held) counters.held--;
+  c.held = false;
+  c.openedMs = millis();
+  counters.sendsQueued++;
+}
+
+static void sendPending(RestConnection& c, uint32_t now) {
+  const ssize_t n = sendSome(c.fd, c.out + c.outSent, c.outLength - c.outSent);
+  if (n < 0) {
+    closeConnection(c);
+    return;
+  }
+  c.outSent += (size_t)n;
+  if (c.outSent == c.outLength) closeConnection(c);
+  else if (n > 0) c.openedMs = now;
+}
+
+// Header value in place (terminated at its line end), or nullptr
+static const char* findHeader(char* request, const char* name) {
+  const size_t nameLength = strlen(name);
+  for (char* line = strchr(request, '\n'); line; line = strchr(line, '\n')) {
+    line++;
+    if (strncasecmp(line, name, nameLength) != 0 || line[nameLength] != ':') continue;
+    char* value = line + nameLength + 1;
+    while (*value == ' ') value++;
+    char* end = strpbrk(value, "\r\n");
+    if (end) *end = '\0';
+    return value;
+  }
+  return nullptr;
+}
+
+static void answerRequest(RestConnection& c) {
+  char method[8] = {}, target[256] = {};
+  if (sscanf(c.request, "%7s %255s", method, target) != 2) {
+    closeConnection(c);
+    return;
+  }
+  const char* ifNoneMatch = findHeader(c.request, "If-None-Match");
+  restHandleRequest(method, target, ifNoneMatch, c.reply);
+  if (c.reply.status == 0) {
+    // Keep the target for the second pass; the reply remembers the rest
+    strncpy(c.request, target, sizeof(c.request) - 1);
+    c.request[sizeof(c.request) - 1] = '\0';
+    c.held = true;
+    counters.held++;
+    return;
+  }
+  respond(c, c.reply);
+}
+
+static void readRequest(RestConnection& c) {
+  const ssize_t n = recv(c.fd, c.request + c.used, sizeof(c.request) - 1 - c.used, 0);
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+    closeConnection(c);
+    return;
+  }
+  if (n < 0) return;
+  c.used += (uint16_t)n;
+  c.request[c.used] = '\0';
+  if (strstr(c.request, "\r\n\r\n") || strstr(c.request, "\n\n")) {
+    answerRequest(c);
+  } else if (c.used >= sizeof(c.request) - 1) {
+    closeConnection(c);   // headers too large for a poller
+  }
+}
+
+static void wakeHeld(RestConnection& c, uint32_t now) {
+  if (restResourceKey(c.reply.resource) != c.reply.key) {
+    RestReply reply;
+    restHandleRequest("GET", c.request, nullptr, reply, false);
+    respond(c, reply);
+  } else if ((int32_t)(now - c.reply.deadlineMs) >= 0) {
+    counters.longPollTimeouts++;
+    counters.notModified++;
+    c.reply.status = 304;
+    respond(c, c.reply);
+  }
+}
+
+static void acceptConnections() {
+  for (;;) {
+    const int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0) return;
+    RestConnection* slot = nullptr;
+    for (RestConnection& c : connections) {
+      if (c.fd < 0) {
+        slot = &c;
+        break;
+      }
+    }
+    if (!slot) {
+      RestReply busy = RestReply();
+      busy.status = 503;
+      counters.errors++;
+      char head[128];
+      // A fresh socket buffer takes the short head whole; the peer can retry anyway
+      sendSome(fd, head, (size_t)formatHead(head, sizeof(head), busy));
+      close(fd);
+      continue;
+    }
+    setNonBlocking(fd);
+    slot->fd = fd;
+    slot->held = false;
+    slot->used = 0;
+    slot->out = nullptr;
+    slot->openedMs = millis();
+    counters.connections++;
+  }
+}
+
+bool restServerBegin(uint16_t port) {
+  if (listenFd >= 0) return true;
+  if (!cacheInit()) return false;
+  for (RestConnection& c : connections) c.fd = -1;
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return false;
+  const int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+    close(fd);
+    return false;
+  }
+  setNonBlocking(fd);
+  listenFd = fd;
+  DEBUG_PRINTF("REST API listening on port %u\n", port);
+  return true;
+}
+
+void restServerPoll(uint32_t timeoutMs) {
+  if (listenFd < 0) return;
+  fd_set readable, writable;
+  FD_ZERO(&readable);
+  FD_ZERO(&writable);
+  FD_SET(listenFd, &readable);
+  int maxFd = listenFd;
+  bool anyHeld = false;
+  for (const RestConnection& c : connections) {
+    if (c.fd < 0) continue;
+    // Held requests are woken by version changes; their socket only tells
+    // that the client gave up
+    anyHeld |= c.held;
+    FD_SET(c.fd, c.out ? &writable : &readable);
+    if (c.fd > maxFd) maxFd = c.fd;
+  }
+  // Version changes are not socket events: look again soon while requests are held
+  if (anyHeld && timeoutMs > 50) timeoutMs = 50;
+  struct timeval tv;
+  tv.tv_sec = timeoutMs / 1000;
+  tv.tv_usec = (timeoutMs % 1000) * 1000;
+  const int ready = select(maxFd + 1, &readable, &writable, nullptr, &tv);
+
+  const uint32_t now = millis();
+  for (RestConnection& c : connections) {
+    if (c.fd < 0) continue;
+    if (c.out) {
+      if (ready > 0 && FD_ISSET(c.fd, &writable)) sendPending(c, now);
+      else if (now - c.openedMs > REST_READ_TIMEOUT_MS) closeConnection(c);
+    } else if (c.held) {
+      char byte;
+      if (ready > 0 && FD_ISSET(c.fd, &readable) && recv(c.fd, &byte, 1, 0) <= 0) closeConnection(c);
+      else wakeHeld(c, now);
+    } else if (ready > 0 && FD_ISSET(c.fd, &readable)) {
+      readRequest(c);
+    } else if (now - c.openedMs > REST_READ_TIMEOUT_MS) {
+      closeConnection(c);
+    }
+  }
+  if (ready > 0 && FD_ISSET(listenFd, &readable)) acceptConnections();
+}
+
+void restServerEnd() {
+  for (RestConnection& c : connections) {
+    if (c.fd >= 0) closeConnection(c);
+  }
+  if (listenFd >= 0) close(listenFd);
+  listenFd = -1;
+}
+
+#if defined(ESP_PLATFORM)
+static void restTask(void* param) {
+  for (;;) restServerPoll(1000);
+}
+#endif
+
+bool restStart(uint16_t port) {
+#if defined(ESP_PLATFORM)
+  static bool running = false;
+  if (running) return true;
+  if (!restServerBegin(port)) return false;
+  // Same core as loop(): the BLE notification work stays on the shard tasks
+  if (xTaskCreatePinnedToCore(restTask, "jk_rest", 4096, nullptr, 1, nullptr, 1) != pdPASS) {
+    restServerEnd();
+    return false;
+  }
+  metricsWatchTask("jk_rest");
+  running = true;
+  return true;
+#else
+  return restServerBegin(port);
+#endif
+}
@@ -0,0 +1,118 @@
+#ifndef REST_API_H
+#define REST_API_H
+
+#include <Arduino.h>
+#include "metrics.h"
+
+/**
+ * Embedded REST API with version ETags
+ *
+ * Read-only JSON resources over HTTP:
+ *   GET /devices          every configured device (non-empty MAC)
+ *   GET /devices/<i|mac>  one device, by index or MAC
+ *   GET /worst            top-K worst cells and packs (worst_cells.h)
+ *
+ * Each device resource carries an ETag built from JKBMS::snapshotVersion
+ * (plus the connection state and a per-boot id, so a restart never repeats
+ * a tag). A request whose If-None-Match still holds gets 304 without any
+ * serialization. A device body is rendered at most once per version and
+ * served from the cache to every poller after that; the list is assembled
+ * from the cached device bodies. /worst is tagged with worstVersion() and
+ * rendered again only when one of its lists changed.
+ *
+ * Long poll: ?wait=<s> with an If-None-Match that still holds keeps the
+ * request open until the resource changes, then answers 200 with the new
+ * version; on timeout it answers 304. Without If-None-Match the current
+ * version is returned at once, so a client starts with a plain request and
+ * then keeps one conditional request open. Held requests cost a connection
+ * slot and a key comparison every 50 ms, nothing else.
+ *
+ * The server is one non-blocking socket loop (restServerPoll()). A response
+ * the socket buffer cannot take at once is copied and finished as the peer
+ * reads. On the gateway restStart() runs it in its own task once the network
+ * is up; host tools call restServerPoll() themselves or use
+ * restHandleRequest() without sockets. The cache is touched by that one task
+ * only; device bodies are rendered from a copy taken under the seqlock of
+ * JKBMS::parseSequence, since the shard tasks parse while it runs.
+ */
+
+#ifndef JKBMS_REST_PORT
+#define JKBMS_REST_PORT 80
+#endif
+// Devices served; the rest of jkBmsDevices is not visible through the API
+#ifndef JKBMS_REST_DEVICES
+#define JKBMS_REST_DEVICES 32
+#endif
+// Rendered size of /worst: every criterion's JKBMS_WORST_K entries
+#ifndef JKBMS_REST_WORST_BODY
+#define JKBMS_REST_WORST_BODY 5120
+#endif
+// Rendered size of one device, 24 cells included
+#ifndef JKBMS_REST_BODY
+#define JKBMS_REST_BODY 768
+#endif
+// Open connections, held long polls included (lwIP defaults to 10 sockets)
+#ifndef JKBMS_REST_CONNECTIONS
+#define JKBMS_REST_CONNECTIONS 6
+#endif
+#ifndef JKBMS_REST_MAX_WAIT_S
+#define JKBMS_REST_MAX_WAIT_S 60
+#endif
+
+static const int REST_RESOURCE_LIST = -1;
+static const int REST_RESOURCE_WORST = -2;
+
+struct RestReply {
+  int status;               // 200, 304, 404, 405; 0: held, see below
+  char etag[32];            // quoted, as sent
+  const char* body;         // cached, valid until the next request is handled
+  size_t length;
+  // Held long poll: answer again when restResourceKey(resource) != key, or 304 at deadlineMs
+  int resource;
+  uint32_t key;
+  uint32_t deadlineMs;
+};
+
+struct RestCounters {
+  uint32_t requests;
+  uint32_t notModified;     // 304 without rendering, long-poll timeouts included
+  uint32_t renders;         // bodies serialized
+  uint32_t cacheHits;       // 200 answered from the cache
+  uint32_t longPolls;       // requests held
+  uint32_t longPollTimeouts;
+  uint32_t errors;          // 404 / 405 / 503
+  uint32_t renderRaces;     // device bodies not cached: a frame was parsed while rendering them
+  uint32_t sendsQueued;     // responses larger than the socket buffer, finished by restServerPoll()
+  uint16_t connections;     // open now
+  uint16_t held;            // long polls waiting now
+};
+
+/**
+ * Answer one request from the cache, rendering stale device bodies first
+ * @param ifNoneMatch Header value, or nullptr
+ * @param allowWait false answers a held request's second pass right away
+ */
+void restHandleRequest(const char* method, const char* target, const char* ifNoneMatch, RestReply& reply,
+                       bool allowWait = true);
+
+// Cheap change check for held requests: no rendering
+uint32_t restResourceKey(int resource);
+
+// Drop every cached body, e.g. after changing the MAC table
+void restInvalidate();
+
+// Open the listening socket (idempotent)
+bool restServerBegin(uint16_t port = JKBMS_REST_PORT);
+// Accept, read and answer; wakes held requests. Waits up to timeoutMs for socket activity
+void restServerPoll(uint32_t timeoutMs);
+void restServerEnd();
+
+// Gateway: begin and run restServerPoll() in a task; call once the network is up
+bool restStart(uint16_t port = JKBMS_REST_PORT);
+
+const RestCounters& restCounters();
+
+// Metrics source: rest.*
+void restEmit(MetricsEmitFunc emit, void* ctx);
+
+#endif // REST_API_H
@@ -0,0 +1,122 @@
+/**
+ * @file scan_filter.cpp
+ * @brief Filter accept list programming and scan filter counters
+ */
+
+#include "scan_filter.h"
+#include "JKBMS.h"
+
+static ScanFilterCounters counters;
+static bool enabled = true;
+
+// What is on the controller's list, in device order
+static std::string listedMac[JKBMS_ACCEPT_LIST_SIZE];
+static uint8_t listedType[JKBMS_ACCEPT_LIST_SIZE];
+static bool listValid = false;   // the list matches listedMac/listedType
+
+// Filtered scans in a row without an advert, per device
+static uint8_t misses[JKBMS_ACCEPT_LIST_SIZE];
+
+static void clearList() {
+  for (int i = 0; i < counters.entries; i++) {
+    NimBLEDevice::whiteListRemove(NimBLEAddress(listedMac[i], listedType[i]));
+    listedMac[i].clear();
+  }
+  counters.entries = 0;
+  listValid = false;
+}
+
+// Rewrite the list when a MAC or an address type changed; false if it cannot hold the devices
+static bool programList() {
+  int wanted = 0;
+  bool changed = !listValid;
+  for (int i = 0; i < bmsDeviceCount; i++) {
+    const JKBMS& bms = jkBmsDevices[i];
+    if (bms.targetMAC.empty()) continue;
+    if (wanted == JKBMS_ACCEPT_LIST_SIZE) return false;
+    if (wanted >= counters.entries || listedMac[wanted] != bms.targetMAC || listedType[wanted] != bms.warm.addressType) {
+      changed = true;
+    }
+    wanted++;
+  }
+  if (!wanted) return false;
+  if (!changed && wanted == counters.entries) return true;
+
+  clearList();
+  counters.programs++;
+  for (int i = 0; i < bmsDeviceCount; i++) {
+    const JKBMS& bms = jkBmsDevices[i];
+    if (bms.targetMAC.empty()) continue;
+    if (!NimBLEDevice::whiteListAdd(NimBLEAddress(bms.targetMAC, bms.warm.addressType))) {
+      counters.listFailures++;
+      DEBUG_PRINTF("Accept list refused %s\n", bms.targetMAC.c_str());
+      clearList();
+      return false;
+    }
+    listedMac[counters.entries] = bms.targetMAC;
+    listedType[counters.entries] = bms.warm.addressType;
+    counters.entries++;
+  }
+  listValid = true;
+  return true;
+}
+
+bool scanFilterPrepare(NimBLEScan* scan) {
+  // The list cannot be changed while the controller is scanning
+  bool useList = scan->isScanning() ? counters.active : enabled && programList();
+
+  bool fallback = false;
+  if (useList) {
+    for (int i = 0; i < bmsDeviceCount && i < JKBMS_ACCEPT_LIST_SIZE; i++) {
+      if (misses[i] < JKBMS_ACCEPT_LIST_MISSES) continue;
+      fallback = true;
+      misses[i] = 0;
+    }
+  }
+  if (fallback) {
+    counters.fallbacks++;
+    useList = false;
+  }
+
+  scan->setFilterPolicy(useList ? BLE_HCI_SCAN_FILT_USE_WL : BLE_HCI_SCAN_FILT_NO_WL);
+  counters.active = useList;
+  if (!useList) {
+    counters.openScans++;
+    return false;
+  }
+  counters.listScans++;
+  // A miss for every device still looking; scanFilterResult() clears it
+  for (int i = 0; i < bmsDeviceCount && i < JKBMS_ACCEPT_LIST_SIZE; i++) {
+    const JKBMS& bms = jkBmsDevices[i];
+    if (!bms.targetMAC.empty() && !bms.connected && misses[i] < 0xFF) misses[i]++;
+  }
+  return true;
+}
+
+void scanFilterEnable(bool on) {
+  enabled = on;
+}
+
+void scanFilterResult(int device) {
+  if (device < 0) {
+    counters.hostRejected++;
+    return;
+  }
+  counters.hostMatched++;
+  if (device < JKBMS_ACCEPT_LIST_SIZE) misses[device] = 0;
+}
+
+const ScanFilterCounters& scanFilterCounters() {
+  return counters;
+}
+
+void scanFilterEmit(MetricsEmitFunc emit, void* ctx) {
+  emit("scan.filter.active", counters.active ? 1 : 0, ctx);
+  emit("scan.filter.entries", counters.entries, ctx);
+  emit("scan.filter.list_scans", counters.listScans, ctx);
+  emit("scan.filter.open_scans", counters.openScans, ctx);
+  emit("scan.filter.fallbacks", counters.fallbacks, ctx);
+  emit("scan.filter.list_failures", counters.listFailures, ctx);
+  emit("scan.filter.host_matched", counters.hostMatched, ctx);
+  emit("scan.filter.host_rejected", counters.hostRejected, ctx);
+}
@@ -0,0 +1,68 @@
+#ifndef SCAN_FILTER_H
+#define SCAN_FILTER_H
+
+#include <Arduino.h>
+#include <NimBLEDevice.h>
+#include "metrics.h"
+
+/**
+ * Controller-level scan filtering
+ *
+ * Without a filter every advertisement in range (phones, trackers, other
+ * BMSes) wakes the host task and goes through ScanCallbacks::onResult().
+ * Before each scan the configured target MACs are programmed into the BLE
+ * controller's filter accept list (white list) and the scan filter policy
+ * is set to use it, so the controller drops everything else.
+ *
+ * The software match in onResult() stays as the fallback. The scan is
+ * left open when the accept list cannot hold every configured device, when
+ * the controller refuses an entry, or for one scan when a device has not
+ * been heard in JKBMS_ACCEPT_LIST_MISSES filtered scans in a row (e.g. it
+ * advertises with a different address type than the one on the list).
+ */
+
+// Entries the controller accepts (CONFIG_BT_NIMBLE_WHITELIST_SIZE, 12 by default)
+#ifndef JKBMS_ACCEPT_LIST_SIZE
+#ifdef CONFIG_BT_NIMBLE_WHITELIST_SIZE
+#define JKBMS_ACCEPT_LIST_SIZE CONFIG_BT_NIMBLE_WHITELIST_SIZE
+#else
+#define JKBMS_ACCEPT_LIST_SIZE 12
+#endif
+#endif
+
+// Filtered scans without an advert from a device before one open scan
+#ifndef JKBMS_ACCEPT_LIST_MISSES
+#define JKBMS_ACCEPT_LIST_MISSES 3
+#endif
+
+struct ScanFilterCounters {
+  uint32_t listScans;       // scans filtered by the controller
+  uint32_t openScans;       // scans with software matching only
+  uint32_t fallbacks;       // open scans forced by a device missing from filtered scans
+  uint32_t programs;        // accept list rewrites
+  uint32_t listFailures;    // entries the controller refused
+  uint32_t hostMatched;     // adverts that reached onResult() for a configured device
+  uint32_t hostRejected;    // adverts that reached onResult() and were dropped in software
+  uint8_t entries;          // addresses on the accept list
+  bool active;              // the last scan used the accept list
+};
+
+/**
+ * Program the accept list if the configured devices changed and pick the
+ * filter policy for the next scan. Call right before NimBLEScan::start().
+ * @return true if the scan will be filtered by the controller
+ */
+bool scanFilterPrepare(NimBLEScan* scan);
+
+// Software matching only, e.g. to look for the MACs of new packs; on by default
+void scanFilterEnable(bool enabled);
+
+// Outcome of the software match of one scan result: device index, -1 if none
+void scanFilterResult(int device);
+
+const ScanFilterCounters& scanFilterCounters();
+
+// Metrics source: scan.filter.*
+void scanFilterEmit(MetricsEmitFunc emit, void* ctx);
+
+#endif // SCAN_FILTER_H
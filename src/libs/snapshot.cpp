@@ -0,0 +1,169 @@
+/**
+ * @file snapshot.cpp
+ * @brief Fill flat snapshots from JKBMS and publish them into a ring
+ */
+
+#include "snapshot.h"
+#include "JKBMS.h"
+#include "frame_handlers.h"
+#include "gateway_sync.h"
+#include "metrics.h"
+
+
+static_assert(JKBMS_SNAPSHOT_CELLS >= JKBMS_MAX_CELLS, "snapshot cannot hold every cell slot");
+
+static inline int32_t fixedPoint(float value, float scale) {
+  float scaled = value * scale;
+  return (int32_t)(scaled < 0 ? scaled - 0.5f : scaled + 0.5f);
+}
+
+static inline uint16_t fixedPointU16(float value, float scale) {
+  int32_t v = fixedPoint(value, scale);
+  return v < 0 ? 0 : v > 0xFFFF ? 0xFFFF : (uint16_t)v;
+}
+
+static inline int16_t fixedPointI16(float value, float scale) {
+  int32_t v = fixedPoint(value, scale);
+  return v < -32768 ? -32768 : v > 32767 ? 32767 : (int16_t)v;
+}
+
+// Non-hex characters are skipped; missing digits read as zero
+void macToBytes(const char* mac, uint8_t out[6]) {
+  memset(out, 0, 6);
+  int byte = 0, nibbles = 0;
+  for (size_t i = 0; mac[i] && byte < 6; i++) {
+    char c = mac[i];
+    int v = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+    if (v < 0) continue;
+    out[byte] = out[byte] << 4 | v;
+    if (++nibbles == 2) {
+      nibbles = 0;
+      byte++;
+    }
+  }
+}
+
+void snapshotFromBms(const JKBMS& bms, JkSnapshot& out) {
+  METRICS_PHASE_BEGIN(sample);
+  memset(&out, 0, sizeof(out));
+  JkSnapshotHeader& h = out.header;
+  h.magic = JKBMS_SNAPSHOT_MAGIC;
+  h.version = JKBMS_SNAPSHOT_VERSION;
+  h.headerSize = sizeof(JkSnapshotHeader);
+  h.size = sizeof(JkSnapshot);
+  h.sequence = bms.snapshotVersion;
+  h.timestampMs = millis();
+  macToBytes(bms.targetMAC.c_str(), h.mac);
+  h.protocol = bms.activeProtocol();
+  h.cellCount = bms.cellCountClamped();
+  h.flags = (bms.Charge ? SNAPSHOT_CHARGE : 0) | (bms.Discharge ? SNAPSHOT_DISCHARGE : 0) |
+            (bms.Balance ? SNAPSHOT_BALANCE : 0) | (bms.connected ? SNAPSHOT_CONNECTED : 0);
+
+  out.batteryMv = fixedPoint(bms.Battery_Voltage, 1000);
+  out.currentMa = fixedPoint(bms.Charge_Current, 1000);
+  out.powerDw = fixedPoint(bms.Battery_Power, 10);
+  out.averageCellMv = fixedPointU16(bms.Average_Cell_Voltage, 1000);
+  out.deltaCellMv = fixedPointU16(bms.Delta_Cell_Voltage, 1000);
+  out.balanceCurrentMa = fixedPointI16(bms.Balance_Curr, 1000);
+  out.mosDeciC = fixedPointI16(bms.MOS_Temp, 10);
+  out.t1DeciC = fixedPointI16(bms.Battery_T1, 10);
+  out.t2DeciC = fixedPointI16(bms.Battery_T2, 10);
+  out.soc = bms.Percent_Remain < 0 ? 0 : bms.Percent_Remain > 100 ? 100 : bms.Percent_Remain;
+  out.balancingAction = bms.Balancing_Action;
+  out.capacityRemainMah = fixedPoint(bms.Capacity_Remain, 1000);
+  out.nominalCapacityMah = fixedPoint(bms.Nominal_Capacity, 1000);
+  out.cycleCapacityMah = fixedPoint(bms.Cycle_Capacity, 1000);
+  out.cycleCount = fixedPoint(bms.Cycle_Count, 1);
+  out.uptimeS = ((bms.days * 24 + bms.hr) * 60 + bms.mi) * 60UL + bms.sec;
+  for (int i = 0; i < JKBMS_MAX_CELLS; i++) {
+    out.cellMv[i] = fixedPointU16(bms.cellVoltage[i], 1000);
+    out.cellResistMohm[i] = fixedPointU16(bms.wireResist[i], 1000);
+  }
+  out.crc = snapshotCrc((const uint8_t*)&out, offsetof(JkSnapshot, crc));
+  METRICS_PHASE_END(sample, PHASE_SERIALIZATION);
+}
+
+void snapshotToBms(const JkSnapshot& in, JKBMS& bms) {
+  const JkSnapshotHeader& h = in.header;
+  bms.snapshotVersion = h.sequence;
+  bms.cell_count = h.cellCount;
+  bms.Charge = h.flags & SNAPSHOT_CHARGE;
+  bms.Discharge = h.flags & SNAPSHOT_DISCHARGE;
+  bms.Balance = h.flags & SNAPSHOT_BALANCE;
+
+  bms.Battery_Voltage = in.batteryMv * 0.001f;
+  bms.Charge_Current = in.currentMa * 0.001f;
+  bms.Battery_Power = in.powerDw * 0.1f;
+  bms.Average_Cell_Voltage = in.averageCellMv * 0.001f;
+  bms.Delta_Cell_Voltage = in.deltaCellMv * 0.001f;
+  bms.Balance_Curr = in.balanceCurrentMa * 0.001f;
+  bms.MOS_Temp = in.mosDeciC * 0.1f;
+  bms.Battery_T1 = in.t1DeciC * 0.1f;
+  bms.Battery_T2 = in.t2DeciC * 0.1f;
+  bms.Percent_Remain = in.soc;
+  bms.Balancing_Action = in.balancingAction;
+  bms.Capacity_Remain = in.capacityRemainMah * 0.001f;
+  bms.Nominal_Capacity = in.nominalCapacityMah * 0.001f;
+  bms.Cycle_Capacity = in.cycleCapacityMah * 0.001f;
+  bms.Cycle_Count = in.cycleCount;
+  uint32_t uptime = in.uptimeS;
+  bms.sec = uptime % 60;
+  uptime /= 60;
+  bms.mi = uptime % 60;
+  uptime /= 60;
+  bms.Uptime = uptime;  // parseData() leaves the total hours here
+  bms.hr = uptime % 24;
+  bms.days = uptime / 24;
+  for (int i = 0; i < JKBMS_MAX_CELLS; i++) {
+    bms.cellVoltage[i] = in.cellMv[i] * 0.001f;
+    bms.wireResist[i] = in.cellResistMohm[i] * 0.001f;
+  }
+}
+
+//****************************************************
+// Ring
+//****************************************************
+
+SnapshotRingHeader* snapshotRingInit(void* memory, size_t bytes, uint32_t slotCount) {
+  if (!memory || slotCount == 0 || bytes < snapshotRingBytes(slotCount)) return nullptr;
+  memset(memory, 0, snapshotRingBytes(slotCount));
+  SnapshotRingHeader* ring = (SnapshotRingHeader*)memory;
+  ring->version = JKBMS_SNAPSHOT_VERSION;
+  ring->slotSize = (sizeof(SnapshotRingSlot) + 3) & ~(size_t)3;
+  ring->slotCount = slotCount;
+  ring->head = 0;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  ring->magic = JKBMS_SNAPSHOT_RING_MAGIC;  // Last, so readers never see a half-initialised ring
+  return ring;
+}
+
+// Pushes come from both shard tasks: one writer at a time, for the length of a copy
+GATEWAY_LOCK_DEFINE(ringLock);
+
+void snapshotRingPush(SnapshotRingHeader* ring, const JkSnapshot& snapshot) {
+  GATEWAY_LOCK(ringLock);
+  uint32_t index = ring->head;
+  SnapshotRingSlot* slot = snapshotRingSlot(ring, index);
+  seqlockWriteBegin(slot->sequence, index * 2);
+  memcpy((void*)&slot->snapshot, &snapshot, sizeof(snapshot));
+  seqlockWriteEnd(slot->sequence);
+  ring->head = index + 1;
+  GATEWAY_UNLOCK(ringLock);
+}
+
+static void publishSnapshot(const FrameView& frame, void* ctx) {
+  JkSnapshot snap;
+  snapshotFromBms(*frame.device, snap);
+  snapshotRingPush((SnapshotRingHeader*)ctx, snap);
+}
+
+static SnapshotRingHeader* attachedRing = nullptr;
+
+bool snapshotRingAttach(SnapshotRingHeader* ring) {
+  if (attachedRing) unregisterFrameHandler(publishSnapshot, attachedRing);
+  attachedRing = nullptr;
+  if (!ring) return true;
+  if (!registerFrameHandler(0x02, publishSnapshot, ring)) return false;
+  attachedRing = ring;
+  return true;
+}
@@ -0,0 +1,202 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "gateway_sync.h"
+
+/**
+ * Flat BMS snapshot
+ *
+ * One parsed cell-info frame in a fixed, pointer-free layout: a header, the
+ * pack values in fixed point and the per-cell arrays. The same bytes can be
+ * kept in a ring in PSRAM or shared memory, sent in a UDP datagram or written
+ * to flash, and read in place by the host tools without a decode step.
+ *
+ * Layout rules (bump JKBMS_SNAPSHOT_VERSION when any of them change):
+ * - packed, little-endian (ESP32 and x86/ARM hosts; big-endian readers must swap)
+ * - fields are only appended before the CRC; readers accept larger sizes
+ * - the CRC covers every byte before it
+ *
+ * This header only depends on the C library, so host tools can include it
+ * without the Arduino/NimBLE shims.
+ */
+
+#define JKBMS_SNAPSHOT_MAGIC 0x4E534B4AUL  // "JKSN"
+#define JKBMS_SNAPSHOT_VERSION 1
+#define JKBMS_SNAPSHOT_CELLS 24
+
+// JkSnapshotHeader::flags
+enum SnapshotFlags {
+  SNAPSHOT_CHARGE = 1 << 0,
+  SNAPSHOT_DISCHARGE = 1 << 1,
+  SNAPSHOT_BALANCE = 1 << 2,
+  SNAPSHOT_CONNECTED = 1 << 3,
+};
+
+#pragma pack(push, 1)
+
+struct JkSnapshotHeader {
+  uint32_t magic;            // JKBMS_SNAPSHOT_MAGIC
+  uint8_t version;           // JKBMS_SNAPSHOT_VERSION
+  uint8_t headerSize;        // sizeof(JkSnapshotHeader)
+  uint16_t size;             // whole snapshot including the CRC
+  uint32_t sequence;         // per-device frame counter (JKBMS::snapshotVersion)
+  uint32_t timestampMs;      // gateway millis() when the frame was parsed
+  uint8_t mac[6];            // most significant byte first, as printed
+  uint8_t protocol;          // ProtocolVariant
+  uint8_t cellCount;
+  uint16_t flags;            // SnapshotFlags
+};
+
+struct JkSnapshot {
+  JkSnapshotHeader header;
+  int32_t batteryMv;
+  int32_t currentMa;         // positive while charging
+  int32_t powerDw;           // 0.1 W
+  uint16_t averageCellMv;
+  uint16_t deltaCellMv;
+  int16_t balanceCurrentMa;
+  int16_t mosDeciC;          // 0.1 °C
+  int16_t t1DeciC;
+  int16_t t2DeciC;
+  uint8_t soc;               // %
+  uint8_t balancingAction;
+  uint32_t capacityRemainMah;
+  uint32_t nominalCapacityMah;
+  uint32_t cycleCapacityMah;
+  uint32_t cycleCount;
+  uint32_t uptimeS;
+  uint16_t cellMv[JKBMS_SNAPSHOT_CELLS];
+  uint16_t cellResistMohm[JKBMS_SNAPSHOT_CELLS];
+  uint16_t crc;              // CRC-16/CCITT-FALSE of the preceding bytes
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(JkSnapshotHeader) == 26, "snapshot header layout changed");
+static_assert(sizeof(JkSnapshot) == 170, "snapshot layout changed: bump JKBMS_SNAPSHOT_VERSION");
+static_assert(offsetof(JkSnapshot, cellMv) == 72, "snapshot layout changed: bump JKBMS_SNAPSHOT_VERSION");
+
+/** @brief CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) */
+static inline uint16_t snapshotCrc(const uint8_t* data, size_t length) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int b = 0; b < 8; b++) crc = crc & 0x8000 ? (uint16_t)(crc << 1 ^ 0x1021) : (uint16_t)(crc << 1);
+  }
+  return crc;
+}
+
+/**
+ * Validate a snapshot in place
+ * @return The snapshot, or nullptr if the buffer is short, from another
+ *         major layout or corrupted. Snapshots from a newer writer (larger
+ *         size) are accepted; only the fields known here are read.
+ */
+static inline const JkSnapshot* snapshotView(const void* buffer, size_t length) {
+  if (length < sizeof(JkSnapshot)) return nullptr;
+  const JkSnapshot* snap = (const JkSnapshot*)buffer;
+  const JkSnapshotHeader& h = snap->header;
+  if (h.magic != JKBMS_SNAPSHOT_MAGIC || h.version != JKBMS_SNAPSHOT_VERSION) return nullptr;
+  if (h.headerSize != sizeof(JkSnapshotHeader) || h.size < sizeof(JkSnapshot) || h.size > length) return nullptr;
+  uint16_t stored;
+  memcpy(&stored, (const uint8_t*)buffer + h.size - 2, sizeof(stored));
+  if (snapshotCrc((const uint8_t*)buffer, h.size - 2) != stored) return nullptr;
+  return snap;
+}
+
+//****************************************************
+// Snapshot ring
+//****************************************************
+
+#define JKBMS_SNAPSHOT_RING_MAGIC 0x52534B4AUL  // "JKSR"
+
+/**
+ * Ring of snapshots in caller-provided memory
+ *
+ * Layout: SnapshotRingHeader followed by slotCount slots of slotSize bytes
+ * (a 32-bit sequence word, then the snapshot). Offsets only, no pointers, so
+ * the block can sit in PSRAM, in a POSIX shared-memory segment or in a flash
+ * dump and still be read by another task or process.
+ *
+ * Writers are serialized by snapshotRingPush() (a critical section on the
+ * gateway, where both shard tasks publish), readers take no lock. Each slot
+ * is a seqlock: the sequence is odd while the writer is copying, so a reader
+ * that sees the same even value before and after its copy has a consistent
+ * snapshot.
+ */
+struct SnapshotRingHeader {
+  uint32_t magic;            // JKBMS_SNAPSHOT_RING_MAGIC
+  uint16_t version;          // JKBMS_SNAPSHOT_VERSION of the slots
+  uint16_t slotSize;
+  uint32_t slotCount;
+  volatile uint32_t head;    // snapshots published so far; slot = index % slotCount
+};
+
+struct SnapshotRingSlot {
+  volatile uint32_t sequence;
+  JkSnapshot snapshot;
+};
+
+static inline size_t snapshotRingBytes(uint32_t slotCount) {
+  return sizeof(SnapshotRingHeader) + (size_t)slotCount * ((sizeof(SnapshotRingSlot) + 3) & ~(size_t)3);
+}
+
+static inline SnapshotRingSlot* snapshotRingSlot(const SnapshotRingHeader* ring, uint32_t index) {
+  uint8_t* base = (uint8_t*)ring + sizeof(SnapshotRingHeader);
+  return (SnapshotRingSlot*)(base + (size_t)(index % ring->slotCount) * ring->slotSize);
+}
+
+/** @brief Check a ring found in shared memory or a dump before reading it */
+static inline bool snapshotRingValid(const void* memory, size_t bytes) {
+  if (bytes < sizeof(SnapshotRingHeader)) return false;
+  const SnapshotRingHeader* ring = (const SnapshotRingHeader*)memory;
+  return ring->magic == JKBMS_SNAPSHOT_RING_MAGIC && ring->version == JKBMS_SNAPSHOT_VERSION &&
+         ring->slotCount > 0 && ring->slotSize >= sizeof(SnapshotRingSlot) &&
+         sizeof(SnapshotRingHeader) + (size_t)ring->slotCount * ring->slotSize <= bytes;
+}
+
+/**
+ * Copy snapshot number index out of the ring
+ * @return false if it was already overwritten, not yet written or torn by a
+ *         concurrent write
+ */
+static inline bool snapshotRingRead(const SnapshotRingHeader* ring, uint32_t index, JkSnapshot& out) {
+  uint32_t head = ring->head;
+  if (index >= head || head - index > ring->slotCount) return false;
+  const SnapshotRingSlot* slot = snapshotRingSlot(ring, index);
+  const uint32_t before = seqlockReadBegin(slot->sequence);
+  memcpy(&out, (const void*)&slot->snapshot, sizeof(out));
+  return seqlockReadValid(slot->sequence, before) && before == index * 2 + 2;
+}
+
+// Prepare memory of snapshotRingBytes(slotCount) bytes; returns nullptr if too small
+SnapshotRingHeader* snapshotRingInit(void* memory, size_t bytes, uint32_t slotCount);
+// Append one snapshot; safe from several tasks of one process
+void snapshotRingPush(SnapshotRingHeader* ring, const JkSnapshot& snapshot);
+
+//****************************************************
+// Gateway side
+//****************************************************
+
+class JKBMS;
+
+// Fill a snapshot from the parsed fields of a device (timed as PHASE_SERIALIZATION)
+void snapshotFromBms(const JKBMS& bms, JkSnapshot& out);
+// Put a snapshot back into the parsed fields (warm restart); new_data is left alone
+void snapshotToBms(const JkSnapshot& in, JKBMS& bms);
+// "c8:47:80:31:9b:02" -> 6 bytes, most significant first
+void macToBytes(const char* mac, uint8_t out[6]);
+
+/**
+ * Publish every parsed cell frame into a ring
+ * Registers a frame handler, so the ring is filled on the shard task that
+ * parsed the frame, right after parsing. Call from setup(); pass nullptr to stop publishing.
+ * @return false if no frame-handler slot is free
+ */
+bool snapshotRingAttach(SnapshotRingHeader* ring);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,289 @@
+/**
+ * @file usb_stream.cpp
+ * @brief COBS-framed capture records, the byte ring and its USB writer
+ */
+
+#include "usb_stream.h"
+#include "JKBMS.h"
+#include "frame_handlers.h"
+#include "gateway_sync.h"
+#include "snapshot.h"
+
+#include <stdlib.h>
+
+#if defined(ESP_PLATFORM)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_heap_caps.h>
+#include <soc/soc_caps.h>
+#if SOC_USB_SERIAL_JTAG_SUPPORTED
+#include <driver/usb_serial_jtag.h>
+#endif
+#endif
+
+//****************************************************
+// Records
+//****************************************************
+
+// CRC-16/CCITT-FALSE a nibble at a time: the same value as snapshotCrc(), 32 bytes of table
+static const uint16_t crcNibble[16] = {
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+};
+
+static uint16_t JKBMS_HOT crcUpdate(uint16_t crc, const void* data, size_t length) {
+  const uint8_t* p = (const uint8_t*)data;
+  for (size_t i = 0; i < length; i++) {
+    crc = (uint16_t)(crc << 4) ^ crcNibble[(crc >> 12) ^ (p[i] >> 4)];
+    crc = (uint16_t)(crc << 4) ^ crcNibble[(crc >> 12) ^ (p[i] & 0x0F)];
+  }
+  return crc;
+}
+
+// COBS into a linear buffer (mask ~0) or a power-of-two ring; positions run free
+struct CobsWriter {
+  uint8_t* buffer;
+  uint32_t mask;
+  uint32_t pos;
+  uint32_t codeAt;
+  uint8_t code;
+};
+
+static inline void JKBMS_HOT cobsBegin(CobsWriter& w) {
+  w.codeAt = w.pos++;
+  w.code = 1;
+}
+
+static inline void JKBMS_HOT cobsPut(CobsWriter& w, const void* data, size_t length) {
+  const uint8_t* p = (const uint8_t*)data;
+  for (size_t i = 0; i < length; i++) {
+    if (p[i]) {
+      w.buffer[w.pos++ & w.mask] = p[i];
+      w.code++;
+    }
+    // A zero, or 254 non-zero bytes, closes the block
+    if (!p[i] || w.code == 0xFF) {
+      w.buffer[w.codeAt & w.mask] = w.code;
+      w.codeAt = w.pos++;
+      w.code = 1;
+    }
+  }
+}
+
+static inline void JKBMS_HOT cobsEnd(CobsWriter& w) {
+  w.buffer[w.codeAt & w.mask] = w.code;
+}
+
+size_t cobsEncode(const uint8_t* in, size_t length, uint8_t* out) {
+  CobsWriter w = { out, 0xFFFFFFFFu, 0, 0, 0 };
+  cobsBegin(w);
+  cobsPut(w, in, length);
+  cobsEnd(w);
+  return w.pos;
+}
+
+size_t cobsDecode(const uint8_t* in, size_t length, uint8_t* out) {
+  size_t i = 0, o = 0;
+  while (i < length) {
+    const uint8_t code = in[i++];
+    if (!code || i + code - 1 > length) return 0;
+    for (uint8_t k = 1; k < code; k++) {
+      if (!in[i]) return 0;
+      out[o++] = in[i++];
+    }
+    // Every block but a full one and the last stands for a zero
+    if (code != 0xFF && i < length) out[o++] = 0;
+  }
+  return o;
+}
+
+static void JKBMS_HOT encodeRecord(CobsWriter& w, const StreamRecordHeader& header, const uint8_t* payload, uint16_t crc) {
+  const uint8_t tail[2] = { (uint8_t)crc, (uint8_t)(crc >> 8) };
+  cobsBegin(w);
+  cobsPut(w, &header, sizeof(header));
+  cobsPut(w, payload, header.length);
+  cobsPut(w, tail, sizeof(tail));
+  cobsEnd(w);
+  w.buffer[w.pos++ & w.mask] = 0;
+}
+
+size_t streamEncodeRecord(const StreamRecordHeader& header, const uint8_t* payload, uint8_t* out) {
+  const uint16_t crc = crcUpdate(crcUpdate(0xFFFF, &header, sizeof(header)), payload, header.length);
+  CobsWriter w = { out, 0xFFFFFFFFu, 0, 0, 0 };
+  encodeRecord(w, header, payload, crc);
+  return w.pos;
+}
+
+const StreamRecordHeader* streamRecordView(const void* buffer, size_t length) {
+  if (!buffer || length < streamRecordBytes(0)) return nullptr;
+  const StreamRecordHeader* h = (const StreamRecordHeader*)buffer;
+  if (h->version != JKBMS_STREAM_VERSION || h->length > JKBMS_STREAM_MAX_PAYLOAD) return nullptr;
+  const size_t size = streamRecordBytes(h->length);
+  if (size > length) return nullptr;
+  const uint8_t* p = (const uint8_t*)buffer;
+  const uint16_t stored = (uint16_t)(p[size - 2] | p[size - 1] << 8);
+  return crcUpdate(0xFFFF, p, size - 2) == stored ? h : nullptr;
+}
+
+//****************************************************
+// Gateway
+//****************************************************
+
+// Producers on both cores and the NimBLE task: short critical sections, the encoding only
+GATEWAY_LOCK_DEFINE(streamLock);
+
+static const uint32_t RING_MASK = JKBMS_STREAM_RING - 1;
+
+static uint8_t* ring = nullptr;
+static uint32_t ringHead = 0;             // written under the lock
+static uint32_t ringTail = 0;             // written by the writer only
+static uint32_t nextSequence = 0;
+static uint8_t streamContent = 0;
+static StreamSink streamSink = nullptr;
+static void* sinkCtx = nullptr;
+static StreamCounters counters;
+
+static bool JKBMS_HOT offer(uint8_t type, uint16_t device, const void* payload, size_t length) {
+  StreamRecordHeader h;
+  h.type = type;
+  h.version = JKBMS_STREAM_VERSION;
+  h.device = device;
+  h.sequence = __atomic_fetch_add(&nextSequence, 1, __ATOMIC_RELAXED);
+  h.timestampUs = micros();
+  h.length = (uint16_t)(length < JKBMS_STREAM_MAX_PAYLOAD ? length : JKBMS_STREAM_MAX_PAYLOAD);
+  const uint16_t crc = crcUpdate(crcUpdate(0xFFFF, &h, sizeof(h)), payload, h.length);
+  const uint32_t need = (uint32_t)streamEncodedMax(h.length);
+
+  GATEWAY_LOCK(streamLock);
+  const uint32_t used = ringHead - __atomic_load_n(&ringTail, __ATOMIC_ACQUIRE);
+  if (JKBMS_STREAM_RING - used < need) {
+    counters.dropped++;
+    GATEWAY_UNLOCK(streamLock);
+    return false;
+  }
+  CobsWriter w = { ring, RING_MASK, ringHead, 0, 0 };
+  encodeRecord(w, h, (const uint8_t*)payload, crc);
+  const uint32_t waiting = used + (w.pos - ringHead);
+  __atomic_store_n(&ringHead, w.pos, __ATOMIC_RELEASE);
+  counters.records++;
+  if (waiting > counters.ringHigh) counters.ringHigh = waiting;
+  GATEWAY_UNLOCK(streamLock);
+  return true;
+}
+
+static void JKBMS_HOT onFrame(const FrameView& frame, void* ctx) {
+  const int device = (int)(frame.device - jkBmsDevices);
+  if (device < 0 || device >= bmsDeviceCount) return;
+  if (streamContent & STREAM_FRAMES) offer(STREAM_FRAME, (uint16_t)device, frame.data, frame.length);
+  if ((streamContent & STREAM_SNAPSHOTS) && frame.type == 0x02) {
+    JkSnapshot snap;
+    snapshotFromBms(*frame.device, snap);
+    offer(STREAM_SNAPSHOT, (uint16_t)device, &snap, sizeof(snap));
+  }
+}
+
+void JKBMS_HOT usbStreamNotification(const JKBMS& bms, const uint8_t* data, size_t length) {
+  if (!(streamContent & STREAM_NOTIFICATIONS)) return;
+  offer(STREAM_NOTIFICATION, (uint16_t)(&bms - jkBmsDevices), data, length);
+}
+
+size_t usbStreamPoll(size_t maxBytes) {
+  if (!ring || !streamSink) return 0;
+  size_t total = 0;
+  while (total < maxBytes) {
+    const uint32_t head = __atomic_load_n(&ringHead, __ATOMIC_ACQUIRE);
+    const uint32_t tail = ringTail;
+    if (head == tail) break;
+    // Contiguous span up to the end of the ring; the rest goes next round
+    const uint32_t offset = tail & RING_MASK;
+    size_t n = head - tail;
+    if (n > JKBMS_STREAM_RING - offset) n = JKBMS_STREAM_RING - offset;
+    if (n > maxBytes - total) n = maxBytes - total;
+    const size_t taken = streamSink(ring + offset, n, sinkCtx);
+    if (!taken) {
+      counters.sinkStalls++;
+      break;
+    }
+    __atomic_store_n(&ringTail, tail + (uint32_t)taken, __ATOMIC_RELEASE);
+    counters.bytes += taken;
+    total += taken;
+  }
+  return total;
+}
+
+#if defined(ESP_PLATFORM)
+#if SOC_USB_SERIAL_JTAG_SUPPORTED
+static size_t usbSerialSink(const uint8_t* data, size_t length, void* ctx) {
+  // Copies into the driver's buffer; waits a little for the host to read
+  const int n = usb_serial_jtag_write_bytes(data, length, pdMS_TO_TICKS(20));
+  return n > 0 ? (size_t)n : 0;
+}
+#endif
+
+static void writerTask(void* param) {
+  for (;;) {
+    if (!usbStreamPoll()) vTaskDelay(1);
+  }
+}
+#endif
+
+bool usbStreamStart(uint8_t content, StreamSink sink, void* ctx) {
+  if (ring) return true;
+  if (!(content & STREAM_ALL)) return false;
+#if defined(ESP_PLATFORM)
+  uint8_t* memory = (uint8_t*)heap_caps_malloc(JKBMS_STREAM_RING, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+  if (!memory) return false;
+  if (!sink) {
+#if SOC_USB_SERIAL_JTAG_SUPPORTED
+    usb_serial_jtag_driver_config_t config = USB_SERIAL_JTAG_DRIVER_CONFIG_DEFAULT();
+    config.tx_buffer_size = 4096;
+    if (usb_serial_jtag_driver_install(&config) != ESP_OK) {
+      free(memory);
+      return false;
+    }
+    sink = usbSerialSink;
+#else
+    free(memory);
+    return false;
+#endif
+  }
+#else
+  if (!sink) return false;
+  uint8_t* memory = (uint8_t*)malloc(JKBMS_STREAM_RING);
+  if (!memory) return false;
+#endif
+  if ((content & (STREAM_FRAMES | STREAM_SNAPSHOTS)) && !registerFrameHandler(FRAME_TYPE_ANY, onFrame)) {
+    free(memory);
+    return false;
+  }
+  streamSink = sink;
+  sinkCtx = ctx;
+  ring = memory;
+#if defined(ESP_PLATFORM)
+  // Same core as loop(): the notification work stays on the shard tasks
+  if (xTaskCreatePinnedToCore(writerTask, "jk_stream", 3072, nullptr, 1, nullptr, 1) != pdPASS) {
+    unregisterFrameHandler(onFrame);
+    streamSink = nullptr;
+    ring = nullptr;
+    free(memory);
+    return false;
+  }
+  metricsWatchTask("jk_stream");
+#endif
+  // Last: producers only look at the content mask
+  __atomic_store_n(&streamContent, content, __ATOMIC_RELEASE);
+  return true;
+}
+
+const StreamCounters& usbStreamCounters() {
+  return counters;
+}
+
+void usbStreamEmit(MetricsEmitFunc emit, void* ctx) {
+  if (!ring) return;
+  emit("stream.records", counters.records, ctx);
+  emit("stream.dropped", counters.dropped, ctx);
+  emit("stream.bytes", (float)counters.bytes, ctx);
+  emit("stream.ring_high", counters.ringHigh, ctx);
+  emit("stream.sink_stalls", counters.sinkStalls, ctx);
+}
@@ -0,0 +1,137 @@
+#ifndef USB_STREAM_H
+#define USB_STREAM_H
+
+#include <Arduino.h>
+#include "metrics.h"
+
+/**
+ * Binary capture stream over the native USB port
+ *
+ * For bench characterization: every notification, every reassembled frame
+ * and/or every snapshot goes out as a record, at full rate and for all
+ * packs, on the ESP32-S3 USB-Serial/JTAG port (full-speed USB, the console
+ * stays on UART0 at 115200 baud).
+ *
+ * Record: StreamRecordHeader, payload, CRC-16/CCITT-FALSE of both, COBS
+ * encoded and terminated by 0x00. A receiver resynchronizes on the next
+ * 0x00 after any garbage; a gap in StreamRecordHeader::sequence is a record
+ * the gateway had to drop (producers on both cores may interleave a few
+ * sequence numbers, so receivers count, rather than expect order).
+ *
+ * Producers (the NimBLE task for notifications, the shard tasks for frames
+ * and snapshots) encode straight into one byte ring under a short critical
+ * section; a writer task hands contiguous spans of the ring to the USB
+ * driver. The ring sits in internal DMA-capable RAM. When it is full the
+ * record is dropped and counted, the producer never waits.
+ *
+ * Host tools drive the same ring with usbStreamPoll() and a sink of their
+ * own; host/usb_capture.cpp receives the stream and writes capture files.
+ */
+
+#define JKBMS_STREAM_VERSION 1
+
+// Ring size, a power of two
+#ifndef JKBMS_STREAM_RING
+#define JKBMS_STREAM_RING 32768
+#endif
+// Largest payload: one notification at the 517-byte MTU
+#define JKBMS_STREAM_MAX_PAYLOAD 514
+
+static_assert((JKBMS_STREAM_RING & (JKBMS_STREAM_RING - 1)) == 0, "ring size must be a power of two");
+
+enum StreamRecordType {
+  STREAM_NOTIFICATION = 1,  // one BLE notification as received, before reassembly
+  STREAM_FRAME = 2,         // one reassembled 300-byte frame, any type
+  STREAM_SNAPSHOT = 3,      // JkSnapshot of a parsed cell frame
+};
+
+// usbStreamStart() mask
+enum StreamContent {
+  STREAM_NOTIFICATIONS = 1 << STREAM_NOTIFICATION,
+  STREAM_FRAMES = 1 << STREAM_FRAME,
+  STREAM_SNAPSHOTS = 1 << STREAM_SNAPSHOT,
+  STREAM_ALL = STREAM_NOTIFICATIONS | STREAM_FRAMES | STREAM_SNAPSHOTS,
+};
+
+#pragma pack(push, 1)
+
+struct StreamRecordHeader {
+  uint8_t type;             // StreamRecordType
+  uint8_t version;          // JKBMS_STREAM_VERSION
+  uint16_t device;          // index in jkBmsDevices
+  uint32_t sequence;        // per gateway boot, one per record offered (dropped ones included)
+  uint32_t timestampUs;     // micros() when the data was received or parsed
+  uint16_t length;          // payload bytes
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(StreamRecordHeader) == 14, "stream record layout changed: bump JKBMS_STREAM_VERSION");
+
+// Decoded record size, and the most its COBS encoding plus the 0x00 delimiter takes
+static inline size_t streamRecordBytes(size_t payload) {
+  return sizeof(StreamRecordHeader) + payload + 2;
+}
+static inline size_t streamEncodedMax(size_t payload) {
+  const size_t n = streamRecordBytes(payload);
+  return n + n / 254 + 2;
+}
+
+// COBS; out must hold length + length / 254 + 1 bytes. No delimiter is added
+size_t cobsEncode(const uint8_t* in, size_t length, uint8_t* out);
+// @return Decoded length, 0 if the input is not valid COBS (or empty)
+size_t cobsDecode(const uint8_t* in, size_t length, uint8_t* out);
+
+/**
+ * Build one encoded record, delimiter included
+ * @param out At least streamEncodedMax(length) bytes
+ * @return Bytes written
+ */
+size_t streamEncodeRecord(const StreamRecordHeader& header, const uint8_t* payload, uint8_t* out);
+
+/**
+ * Validate a decoded record in place (capture files hold them back to back)
+ * @return The header, or nullptr if too short, of another version or the CRC fails
+ */
+const StreamRecordHeader* streamRecordView(const void* buffer, size_t length);
+
+//****************************************************
+// Gateway
+//****************************************************
+
+class JKBMS;
+
+struct StreamCounters {
+  uint32_t records;         // records queued
+  uint32_t dropped;         // records dropped, ring full
+  uint64_t bytes;           // encoded bytes handed to the sink
+  uint32_t ringHigh;        // most bytes waiting in the ring
+  uint32_t sinkStalls;      // sink calls that took nothing
+};
+
+// Takes up to length bytes, returns how many it took; called from the writer task only
+typedef size_t (*StreamSink)(const uint8_t* data, size_t length, void* ctx);
+
+/**
+ * Start streaming the given StreamContent
+ * @param sink nullptr: the USB-Serial/JTAG port (gateway only)
+ * @return false without memory, a frame-handler slot, the USB driver or the task
+ *
+ * On the gateway a writer task drains the ring; host tools call
+ * usbStreamPoll() themselves.
+ */
+bool usbStreamStart(uint8_t content, StreamSink sink = nullptr, void* ctx = nullptr);
+
+// Called from notifyCB() with every notification, before it is routed; in IRAM
+// with the encoder and the ring push when built with JKBMS_IRAM_HOTPATH=1
+void usbStreamNotification(const JKBMS& bms, const uint8_t* data, size_t length);
+
+// Hand up to maxBytes of the ring to the sink; returns bytes taken
+size_t usbStreamPoll(size_t maxBytes = JKBMS_STREAM_RING);
+
+const StreamCounters& usbStreamCounters();
+
+// Metrics source: stream.records, stream.dropped, stream.bytes, stream.ring_high, stream.sink_stalls
+void usbStreamEmit(MetricsEmitFunc emit, void* ctx);
+
+#endif // USB_STREAM_H
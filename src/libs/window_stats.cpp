@@ -0,0 +1,269 @@
+/**
+ * @file window_stats.cpp
+ * @brief Slotted sliding windows with monotonic deques, and the gateway windows
+ */
+
+#include "window_stats.h"
+#include "JKBMS.h"
+#include "frame_handlers.h"
+#include "gateway_sync.h"
+
+#include <stdlib.h>
+
+
+static const uint32_t SLOTS = JKBMS_WINDOW_SLOTS;
+
+static const char* const fieldNames[WINDOW_FIELD_COUNT] = {
+  "voltage", "current", "power", "soc", "cell_min", "cell_max", "cell_delta", "temp_max", "mos_temp",
+  "balance_current", "custom"
+};
+
+const char* windowFieldName(WindowField field) {
+  return field >= 0 && field < WINDOW_FIELD_COUNT ? fieldNames[field] : "unknown";
+}
+
+int32_t windowFieldValue(WindowField field, const JkSnapshot& snap) {
+  switch (field) {
+    case WINDOW_VOLTAGE: return snap.batteryMv;
+    case WINDOW_CURRENT: return snap.currentMa;
+    case WINDOW_POWER: return snap.powerDw;
+    case WINDOW_SOC: return snap.soc;
+    case WINDOW_CELL_DELTA: return snap.deltaCellMv;
+    case WINDOW_TEMP_MAX:
+      // T2 reads 0 on single-probe packs, as in chargeLimitInputFromSnapshot()
+      return snap.t2DeciC != 0 && snap.t2DeciC > snap.t1DeciC ? snap.t2DeciC : snap.t1DeciC;
+    case WINDOW_MOS_TEMP: return snap.mosDeciC;
+    case WINDOW_BALANCE_CURRENT: return snap.balanceCurrentMa;
+    case WINDOW_CELL_MIN:
+    case WINDOW_CELL_MAX: {
+      // Cells reading 0 are missing, as in historyAppend()
+      int32_t lo = 0, hi = 0;
+      for (int i = 0; i < snap.header.cellCount && i < JKBMS_SNAPSHOT_CELLS; i++) {
+        const int32_t mv = snap.cellMv[i];
+        if (!mv) continue;
+        if (!lo || mv < lo) lo = mv;
+        if (mv > hi) hi = mv;
+      }
+      return field == WINDOW_CELL_MIN ? lo : hi;
+    }
+    default: return 0;
+  }
+}
+
+//****************************************************
+// Window
+//****************************************************
+
+void windowInit(SlidingWindow& w, uint32_t windowMs) {
+  memset(&w, 0, sizeof(w));
+  w.slotMs = (windowMs + SLOTS - 1) / SLOTS;
+  if (!w.slotMs) w.slotMs = 1;
+}
+
+void windowReset(SlidingWindow& w) {
+  const uint32_t slotMs = w.slotMs;
+  memset(&w, 0, sizeof(w));
+  w.slotMs = slotMs;
+}
+
+static inline uint8_t& dequeAt(uint8_t* queue, uint8_t head, uint32_t i) {
+  return queue[(head + i) % SLOTS];
+}
+
+static void restart(SlidingWindow& w, uint32_t epoch) {
+  w.count = 0;
+  w.sum = 0;
+  w.minHead = w.minSize = w.maxHead = w.maxSize = 0;
+  for (uint32_t i = 0; i < SLOTS; i++) w.slot[i].count = 0;
+  w.started = true;
+  w.first = epoch;
+  w.newest = epoch;
+  w.slot[epoch % SLOTS].epoch = epoch;
+}
+
+// Open the slots up to `epoch`; each one takes the place of a slot that leaves the window
+static void advance(SlidingWindow& w, uint32_t epoch) {
+  if (!w.started || epoch - w.newest >= SLOTS) {
+    restart(w, epoch);
+    return;
+  }
+  for (uint32_t e = w.newest + 1; e != epoch + 1; e++) {
+    const uint8_t i = (uint8_t)(e % SLOTS);
+    WindowSlot& s = w.slot[i];
+    if (s.count) {
+      w.sum -= s.sum;
+      w.count -= s.count;
+    }
+    // The slot leaving is the oldest one: if still a candidate, it is at the head
+    if (w.minSize && w.minQueue[w.minHead] == i) {
+      w.minHead = (uint8_t)((w.minHead + 1) % SLOTS);
+      w.minSize--;
+    }
+    if (w.maxSize && w.maxQueue[w.maxHead] == i) {
+      w.maxHead = (uint8_t)((w.maxHead + 1) % SLOTS);
+      w.maxSize--;
+    }
+    s.epoch = e;
+    s.count = 0;
+  }
+  w.newest = epoch;
+}
+
+void windowAdd(SlidingWindow& w, uint32_t nowMs, int32_t value) {
+  const uint32_t epoch = nowMs / w.slotMs;
+  if (!w.started || epoch != w.newest) advance(w, epoch);
+  const uint8_t i = (uint8_t)(epoch % SLOTS);
+  WindowSlot& s = w.slot[i];
+  if (!s.count) {
+    s.min = s.max = value;
+    s.sum = 0;
+  } else {
+    if (value < s.min) s.min = value;
+    if (value > s.max) s.max = value;
+  }
+  s.sum += value;
+  s.count++;
+  w.sum += value;
+  w.count++;
+
+  // The newest slot is at the back of each deque if it is there at all:
+  // drop what it now dominates, itself included, and push it again
+  while (w.maxSize && w.slot[dequeAt(w.maxQueue, w.maxHead, w.maxSize - 1)].max <= s.max) w.maxSize--;
+  dequeAt(w.maxQueue, w.maxHead, w.maxSize++) = i;
+  while (w.minSize && w.slot[dequeAt(w.minQueue, w.minHead, w.minSize - 1)].min >= s.min) w.minSize--;
+  dequeAt(w.minQueue, w.minHead, w.minSize++) = i;
+}
+
+void windowRead(const SlidingWindow& w, uint32_t nowMs, WindowStats& out) {
+  out = WindowStats();
+  if (!w.started) return;
+  uint32_t epoch = nowMs / w.slotMs;
+  if ((int32_t)(epoch - w.newest) < 0) epoch = w.newest;
+  if (epoch - w.newest >= SLOTS) return;
+
+  // Slots that left since the last sample, without touching the window
+  uint32_t count = w.count;
+  int64_t sum = w.sum;
+  for (uint32_t e = w.newest + 1; e != epoch + 1; e++) {
+    const WindowSlot& s = w.slot[e % SLOTS];
+    if (s.count) {
+      sum -= s.sum;
+      count -= s.count;
+    }
+  }
+  if (!count) return;
+
+  // The first deque entry still inside the window is the answer
+  const uint32_t oldest = epoch - (SLOTS - 1);
+  for (uint32_t k = 0; k < w.minSize; k++) {
+    const WindowSlot& s = w.slot[w.minQueue[(w.minHead + k) % SLOTS]];
+    if ((int32_t)(s.epoch - oldest) < 0) continue;
+    out.min = s.min;
+    break;
+  }
+  for (uint32_t k = 0; k < w.maxSize; k++) {
+    const WindowSlot& s = w.slot[w.maxQueue[(w.maxHead + k) % SLOTS]];
+    if ((int32_t)(s.epoch - oldest) < 0) continue;
+    out.max = s.max;
+    break;
+  }
+  out.count = count;
+  out.average = (float)((double)sum / count);
+  const uint32_t start = (int32_t)(w.first - oldest) > 0 ? w.first : oldest;
+  out.spanMs = (epoch - start) * w.slotMs + nowMs % w.slotMs;
+}
+
+//****************************************************
+// Gateway
+//****************************************************
+
+// Shard tasks on both cores feed the windows: short critical sections
+GATEWAY_LOCK_DEFINE(windowLock);
+
+static SlidingWindow* windows = nullptr;   // [device * specCount + spec]
+static const WindowSpec* windowSpecs = nullptr;
+static int specCount = 0;
+static int deviceCount = 0;
+static uint32_t updateUsMax = 0;
+
+static void onCellFrame(const FrameView& frame, void* ctx) {
+  const int device = (int)(frame.device - jkBmsDevices);
+  if (device < 0 || device >= deviceCount) return;
+  const uint32_t start = micros();
+  JkSnapshot snap;
+  snapshotFromBms(*frame.device, snap);
+  int32_t values[JKBMS_WINDOW_SPECS];
+  for (int s = 0; s < specCount; s++) {
+    const WindowSpec& spec = windowSpecs[s];
+    values[s] = spec.field == WINDOW_CUSTOM ? spec.get(snap) : windowFieldValue(spec.field, snap);
+  }
+  SlidingWindow* w = windows + device * specCount;
+  GATEWAY_LOCK(windowLock);
+  for (int s = 0; s < specCount; s++) windowAdd(w[s], snap.header.timestampMs, values[s]);
+  GATEWAY_UNLOCK(windowLock);
+  const uint32_t us = micros() - start;
+  if (us > updateUsMax) updateUsMax = us;
+}
+
+bool windowsAttach(const WindowSpec* specs, int count) {
+  if (windows) return true;
+  if (!specs || count <= 0 || count > JKBMS_WINDOW_SPECS) return false;
+  for (int s = 0; s < count; s++) {
+    const WindowSpec& spec = specs[s];
+    if (!spec.name || !spec.windowMs || spec.field < 0 || spec.field >= WINDOW_FIELD_COUNT) return false;
+    if (spec.field == WINDOW_CUSTOM && !spec.get) return false;
+  }
+  const int devices = bmsDeviceCount < JKBMS_WINDOW_DEVICES ? bmsDeviceCount : JKBMS_WINDOW_DEVICES;
+  SlidingWindow* all = (SlidingWindow*)calloc((size_t)(devices ? devices : 1) * count, sizeof(SlidingWindow));
+  if (!all) return false;
+  for (int d = 0; d < devices; d++) {
+    for (int s = 0; s < count; s++) windowInit(all[d * count + s], specs[s].windowMs);
+  }
+  windowSpecs = specs;
+  specCount = count;
+  deviceCount = devices;
+  windows = all;
+  if (!registerFrameHandler(0x02, onCellFrame)) {
+    free(all);
+    windows = nullptr;
+    deviceCount = specCount = 0;
+    return false;
+  }
+  return true;
+}
+
+int windowsFind(const char* name) {
+  for (int s = 0; s < specCount; s++) {
+    if (name && strcmp(windowSpecs[s].name, name) == 0) return s;
+  }
+  return -1;
+}
+
+bool windowsRead(int device, int spec, WindowStats& out) {
+  if (!windows || device < 0 || device >= deviceCount || spec < 0 || spec >= specCount) return false;
+  const uint32_t now = millis();
+  GATEWAY_LOCK(windowLock);
+  windowRead(windows[device * specCount + spec], now, out);
+  GATEWAY_UNLOCK(windowLock);
+  return true;
+}
+
+void windowsEmit(MetricsEmitFunc emit, void* ctx) {
+  if (!windows) return;
+  char name[80];
+  for (int d = 0; d < deviceCount; d++) {
+    if (jkBmsDevices[d].targetMAC.empty()) continue;
+    const char* mac = jkBmsDevices[d].targetMAC.c_str();
+    for (int s = 0; s < specCount; s++) {
+      WindowStats stats;
+      if (!windowsRead(d, s, stats) || !stats.count) continue;
+      snprintf(name, sizeof(name), "window.%s.%s.min", mac, windowSpecs[s].name);
+      emit(name, stats.min, ctx);
+      snprintf(name, sizeof(name), "window.%s.%s.max", mac, windowSpecs[s].name);
+      emit(name, stats.max, ctx);
+      snprintf(name, sizeof(name), "window.%s.%s.avg", mac, windowSpecs[s].name);
+      emit(name, stats.average, ctx);
+    }
+  }
+  emit("window.update_us_max", updateUsMax, ctx);
+}
@@ -0,0 +1,128 @@
+#ifndef WINDOW_STATS_H
+#define WINDOW_STATS_H
+
+#include <Arduino.h>
+#include "metrics.h"
+#include "snapshot.h"
+
+/**
+ * Sliding-window min, max and average of telemetry fields
+ *
+ * A window of windowMs is split into JKBMS_WINDOW_SLOTS time slots. Each
+ * slot keeps the min, max, sum and count of the samples that fell in it;
+ * the window covers the current slot and the JKBMS_WINDOW_SLOTS - 1 before
+ * it, so its edge moves in steps of windowMs / JKBMS_WINDOW_SLOTS
+ * (3 s for a 60 s window). Memory is fixed whatever the frame rate.
+ *
+ * - average: running sum and count, a slot's totals are subtracted when it
+ *   leaves the window;
+ * - min / max: monotonic deques of slots (increasing minima, decreasing
+ *   maxima), the front is the answer; a slot is pushed once and popped once.
+ * An update is amortized O(1); a read skips the slots that expired since
+ * the last update, at most JKBMS_WINDOW_SLOTS.
+ *
+ * Values are int32 in the units of the field (see WindowField). Time comes
+ * from the caller (millis() on the gateway, record timestamps in replays);
+ * a jump back in time restarts the window.
+ */
+
+#ifndef JKBMS_WINDOW_SLOTS
+#define JKBMS_WINDOW_SLOTS 20
+#endif
+// Devices and windows per device tracked by windowsAttach()
+#ifndef JKBMS_WINDOW_DEVICES
+#define JKBMS_WINDOW_DEVICES 8
+#endif
+#ifndef JKBMS_WINDOW_SPECS
+#define JKBMS_WINDOW_SPECS 8
+#endif
+
+static_assert(JKBMS_WINDOW_SLOTS >= 2 && JKBMS_WINDOW_SLOTS <= 255, "deque entries are 8-bit slot indices");
+
+// Telemetry fields, in snapshot units
+enum WindowField {
+  WINDOW_VOLTAGE = 0,       // pack voltage, mV
+  WINDOW_CURRENT,           // mA, positive while charging
+  WINDOW_POWER,             // 0.1 W
+  WINDOW_SOC,               // %
+  WINDOW_CELL_MIN,          // lowest cell, mV
+  WINDOW_CELL_MAX,          // highest cell, mV
+  WINDOW_CELL_DELTA,        // mV
+  WINDOW_TEMP_MAX,          // hottest of T1/T2 (T2 0 = no probe), 0.1 °C
+  WINDOW_MOS_TEMP,          // 0.1 °C
+  WINDOW_BALANCE_CURRENT,   // mA
+  WINDOW_CUSTOM,            // WindowSpec::get
+  WINDOW_FIELD_COUNT
+};
+
+struct WindowSlot {
+  int64_t sum;
+  uint32_t epoch;           // timeMs / slotMs of the samples in the slot
+  int32_t min;
+  int32_t max;
+  uint32_t count;
+};
+
+struct SlidingWindow {
+  uint32_t slotMs;
+  bool started;             // false until the first sample after a reset
+  uint32_t first;           // epoch of the first sample after a reset
+  uint32_t newest;          // epoch of the newest slot written
+  uint32_t count;           // samples in the window
+  int64_t sum;
+  uint8_t minHead, minSize; // deque of slot indices, minima increasing from the head
+  uint8_t maxHead, maxSize; // deque of slot indices, maxima decreasing from the head
+  uint8_t minQueue[JKBMS_WINDOW_SLOTS];
+  uint8_t maxQueue[JKBMS_WINDOW_SLOTS];
+  WindowSlot slot[JKBMS_WINDOW_SLOTS];
+};
+
+struct WindowStats {
+  uint32_t count;           // samples in the window, 0: min/max/average are 0
+  int32_t min;
+  int32_t max;
+  float average;
+  uint32_t spanMs;          // time the window covers right now (shorter after a restart)
+};
+
+// windowMs is rounded up to a whole number of slots, at least 1 ms each
+void windowInit(SlidingWindow& w, uint32_t windowMs);
+void windowReset(SlidingWindow& w);
+void windowAdd(SlidingWindow& w, uint32_t nowMs, int32_t value);
+// Aggregates as of nowMs, without changing the window: readers may share it under a lock
+void windowRead(const SlidingWindow& w, uint32_t nowMs, WindowStats& out);
+
+int32_t windowFieldValue(WindowField field, const JkSnapshot& snap);
+// "voltage", "current", ..., "custom"
+const char* windowFieldName(WindowField field);
+
+//****************************************************
+// Gateway
+//****************************************************
+
+typedef int32_t (*WindowGetter)(const JkSnapshot& snap);
+
+struct WindowSpec {
+  const char* name;         // metric and lookup name, e.g. "cell_max_60s"
+  WindowField field;
+  uint32_t windowMs;
+  WindowGetter get;         // WINDOW_CUSTOM only
+};
+
+/**
+ * Keep every spec for the first JKBMS_WINDOW_DEVICES devices, fed by their cell frames
+ * @param specs Kept by pointer: static storage
+ * @return false on a bad spec, without memory or a free frame-handler slot
+ */
+bool windowsAttach(const WindowSpec* specs, int count);
+
+// Index of a spec by name, -1 if unknown
+int windowsFind(const char* name);
+
+// One device's window as of now, from any task; false if not tracked
+bool windowsRead(int device, int spec, WindowStats& out);
+
+// Metrics source: window.<mac>.<name>.min, .max, .avg; window.update_us_max
+void windowsEmit(MetricsEmitFunc emit, void* ctx);
+
+#endif // WINDOW_STATS_H
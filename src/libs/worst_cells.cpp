@@ -0,0 +1,323 @@
+/**
+ * @file worst_cells.cpp
+ * @brief Bounded indexed heaps of the worst cells and packs
+ */
+
+#include "worst_cells.h"
+#include "JKBMS.h"
+#include "frame_handlers.h"
+#include "gateway_sync.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+
+static const char* const criterionNames[WORST_CRITERION_COUNT] = {
+  "cell_deviation", "wire_resist", "pack_temp", "pack_delta"
+};
+
+const char* worstCriterionName(WorstCriterion criterion) {
+  return criterion >= 0 && criterion < WORST_CRITERION_COUNT ? criterionNames[criterion] : "unknown";
+}
+
+bool worstInit(WorstCells& w, uint16_t devices) {
+  w = WorstCells();
+  w.devices = devices;
+  for (int c = 0; c < WORST_CRITERION_COUNT; c++) {
+    w.heap[c].slot = (uint8_t*)calloc((size_t)devices * JKBMS_SNAPSHOT_CELLS, 1);
+    if (!w.heap[c].slot) {
+      worstFree(w);
+      return false;
+    }
+  }
+  return true;
+}
+
+void worstFree(WorstCells& w) {
+  for (int c = 0; c < WORST_CRITERION_COUNT; c++) free(w.heap[c].slot);
+  w = WorstCells();
+}
+
+//****************************************************
+// Heap
+//****************************************************
+
+// Pack entries use the slot of cell 0 in their own criterion's index
+static inline size_t slotIndex(uint16_t device, uint8_t cell) {
+  return (size_t)device * JKBMS_SNAPSHOT_CELLS + (cell == WORST_PACK ? 0 : cell);
+}
+
+// Min-heap order: lower score first, ties broken by (device, cell) so the lists are deterministic
+static inline bool better(const WorstEntry& a, const WorstEntry& b) {
+  if (a.score != b.score) return a.score < b.score;
+  return (a.device << 8 | a.cell) > (b.device << 8 | b.cell);
+}
+
+static inline void place(WorstHeap& h, int i) {
+  h.slot[slotIndex(h.entry[i].device, h.entry[i].cell)] = (uint8_t)(i + 1);
+}
+
+static int siftUp(WorstHeap& h, int i) {
+  while (i > 0) {
+    const int parent = (i - 1) / 2;
+    if (!better(h.entry[i], h.entry[parent])) break;
+    const WorstEntry t = h.entry[i];
+    h.entry[i] = h.entry[parent];
+    h.entry[parent] = t;
+    place(h, i);
+    place(h, parent);
+    i = parent;
+  }
+  return i;
+}
+
+static void siftDown(WorstHeap& h, int i) {
+  for (;;) {
+    const int left = 2 * i + 1, right = left + 1;
+    int least = i;
+    if (left < h.size && better(h.entry[left], h.entry[least])) least = left;
+    if (right < h.size && better(h.entry[right], h.entry[least])) least = right;
+    if (least == i) return;
+    const WorstEntry t = h.entry[i];
+    h.entry[i] = h.entry[least];
+    h.entry[least] = t;
+    place(h, i);
+    place(h, least);
+    i = least;
+  }
+}
+
+// Update a listed entry in place, or list it if it beats the root; true if the list changed
+static bool offer(WorstHeap& h, uint16_t device, uint8_t cell, float score, float value, uint32_t frameMs) {
+  const uint8_t s = h.slot[slotIndex(device, cell)];
+  if (s) {
+    WorstEntry& e = h.entry[s - 1];
+    e.frameMs = frameMs;
+    if (e.score == score && e.value == value) return false;
+    e.score = score;
+    e.value = value;
+    siftDown(h, siftUp(h, s - 1));
+    return true;
+  }
+  WorstEntry n;
+  n.device = device;
+  n.cell = cell;
+  n.score = score;
+  n.value = value;
+  n.frameMs = frameMs;
+  if (h.size < JKBMS_WORST_K) {
+    h.entry[h.size] = n;
+    place(h, h.size);
+    siftUp(h, h.size++);
+    return true;
+  }
+  if (!better(h.entry[0], n)) return false;
+  h.slot[slotIndex(h.entry[0].device, h.entry[0].cell)] = 0;
+  h.entry[0] = n;
+  place(h, 0);
+  siftDown(h, 0);
+  return true;
+}
+
+static bool drop(WorstHeap& h, uint16_t device, uint8_t cell) {
+  uint8_t& s = h.slot[slotIndex(device, cell)];
+  if (!s) return false;
+  const int i = s - 1;
+  s = 0;
+  h.size--;
+  if (i != h.size) {
+    h.entry[i] = h.entry[h.size];
+    place(h, i);
+    siftDown(h, siftUp(h, i));
+  }
+  return true;
+}
+
+//****************************************************
+// Updates
+//****************************************************
+
+// What the criteria read from one frame, from either source
+struct WorstFrame {
+  int cells;
+  float cellMv[JKBMS_SNAPSHOT_CELLS];     // 0: missing
+  float resistMohm[JKBMS_SNAPSHOT_CELLS];
+  float tempC;
+  uint32_t frameMs;
+};
+
+static void apply(WorstCells& w, uint16_t device, const WorstFrame& f) {
+  if (device >= w.devices) return;
+  // Average and delta over the cells present, the same way for both sources
+  float sum = 0, lo = 0, hi = 0;
+  int present = 0;
+  for (int c = 0; c < f.cells; c++) {
+    const float v = f.cellMv[c];
+    if (v <= 0) continue;
+    if (!present || v < lo) lo = v;
+    if (!present || v > hi) hi = v;
+    sum += v;
+    present++;
+  }
+  const float average = present ? sum / present : 0;
+
+  bool changed = false;
+  WorstHeap& deviation = w.heap[WORST_CELL_DEVIATION];
+  WorstHeap& resist = w.heap[WORST_WIRE_RESIST];
+  for (int c = 0; c < JKBMS_SNAPSHOT_CELLS; c++) {
+    if (c < f.cells && f.cellMv[c] > 0) {
+      const float d = f.cellMv[c] - average;
+      changed |= offer(deviation, device, (uint8_t)c, fabsf(d), d, f.frameMs);
+    } else {
+      changed |= drop(deviation, device, (uint8_t)c);
+    }
+    if (c < f.cells && f.resistMohm[c] > 0) {
+      changed |= offer(resist, device, (uint8_t)c, f.resistMohm[c], f.resistMohm[c], f.frameMs);
+    } else {
+      changed |= drop(resist, device, (uint8_t)c);
+    }
+  }
+  changed |= offer(w.heap[WORST_PACK_TEMP], device, WORST_PACK, f.tempC, f.tempC, f.frameMs);
+  if (present) {
+    changed |= offer(w.heap[WORST_PACK_DELTA], device, WORST_PACK, hi - lo, hi - lo, f.frameMs);
+  } else {
+    changed |= drop(w.heap[WORST_PACK_DELTA], device, WORST_PACK);
+  }
+  if (changed) w.version++;
+  w.updates++;
+}
+
+// T2 reads 0 on packs with a single probe
+static float hottest(float t1, float t2, float mos) {
+  float t = t1 > mos ? t1 : mos;
+  if (t2 != 0 && t2 > t) t = t2;
+  return t;
+}
+
+void worstUpdate(WorstCells& w, uint16_t device, const JKBMS& bms) {
+  WorstFrame f;
+  f.cells = bms.cellCountClamped();
+  if (f.cells > JKBMS_SNAPSHOT_CELLS) f.cells = JKBMS_SNAPSHOT_CELLS;
+  for (int c = 0; c < f.cells; c++) {
+    f.cellMv[c] = bms.cellVoltage[c] * 1000;
+    f.resistMohm[c] = bms.wireResist[c] * 1000;
+  }
+  f.tempC = hottest(bms.Battery_T1, bms.Battery_T2, bms.MOS_Temp);
+  f.frameMs = millis();
+  apply(w, device, f);
+}
+
+void worstUpdateSnapshot(WorstCells& w, uint16_t device, const JkSnapshot& snap) {
+  WorstFrame f;
+  f.cells = snap.header.cellCount < JKBMS_SNAPSHOT_CELLS ? snap.header.cellCount : JKBMS_SNAPSHOT_CELLS;
+  for (int c = 0; c < f.cells; c++) {
+    f.cellMv[c] = snap.cellMv[c];
+    f.resistMohm[c] = snap.cellResistMohm[c];
+  }
+  f.tempC = hottest(snap.t1DeciC * 0.1f, snap.t2DeciC * 0.1f, snap.mosDeciC * 0.1f);
+  f.frameMs = snap.header.timestampMs;
+  apply(w, device, f);
+}
+
+void worstRemoveDevice(WorstCells& w, uint16_t device) {
+  if (device >= w.devices) return;
+  bool changed = false;
+  for (int c = 0; c < JKBMS_SNAPSHOT_CELLS; c++) {
+    changed |= drop(w.heap[WORST_CELL_DEVIATION], device, (uint8_t)c);
+    changed |= drop(w.heap[WORST_WIRE_RESIST], device, (uint8_t)c);
+  }
+  changed |= drop(w.heap[WORST_PACK_TEMP], device, WORST_PACK);
+  changed |= drop(w.heap[WORST_PACK_DELTA], device, WORST_PACK);
+  if (changed) w.version++;
+}
+
+// Worst first; K is small, so insertion sort
+static void sortWorstFirst(WorstEntry* e, int n) {
+  for (int i = 1; i < n; i++) {
+    const WorstEntry t = e[i];
+    int j = i;
+    while (j > 0 && better(e[j - 1], t)) {
+      e[j] = e[j - 1];
+      j--;
+    }
+    e[j] = t;
+  }
+}
+
+int worstRead(const WorstCells& w, WorstCriterion criterion, WorstEntry* out, int max) {
+  if (criterion < 0 || criterion >= WORST_CRITERION_COUNT || max <= 0) return 0;
+  const WorstHeap& h = w.heap[criterion];
+  WorstEntry all[JKBMS_WORST_K];
+  memcpy(all, h.entry, h.size * sizeof(WorstEntry));
+  sortWorstFirst(all, h.size);
+  const int n = h.size < max ? h.size : max;
+  memcpy(out, all, n * sizeof(WorstEntry));
+  return n;
+}
+
+//****************************************************
+// Gateway
+//****************************************************
+
+// Shard tasks on both cores update the shared lists: short critical sections
+GATEWAY_LOCK_DEFINE(worstLock);
+
+static WorstCells gatewayWorst;
+static bool worstAttached = false;
+static uint32_t updateUsMax = 0;
+
+static void onCellFrame(const FrameView& frame, void* ctx) {
+  const int device = (int)(frame.device - jkBmsDevices);
+  if (device < 0 || device >= gatewayWorst.devices) return;
+  const uint32_t start = micros();
+  GATEWAY_LOCK(worstLock);
+  worstUpdate(gatewayWorst, (uint16_t)device, *frame.device);
+  GATEWAY_UNLOCK(worstLock);
+  const uint32_t us = micros() - start;
+  if (us > updateUsMax) updateUsMax = us;
+}
+
+bool worstAttach() {
+  if (worstAttached) return true;
+  if (!worstInit(gatewayWorst, (uint16_t)bmsDeviceCount)) return false;
+  worstAttached = registerFrameHandler(0x02, onCellFrame);
+  if (!worstAttached) worstFree(gatewayWorst);
+  return worstAttached;
+}
+
+void worstDeviceLeft(const JKBMS& bms) {
+  const int device = (int)(&bms - jkBmsDevices);
+  if (!worstAttached || device < 0 || device >= gatewayWorst.devices) return;
+  GATEWAY_LOCK(worstLock);
+  worstRemoveDevice(gatewayWorst, (uint16_t)device);
+  GATEWAY_UNLOCK(worstLock);
+}
+
+int worstTop(WorstCriterion criterion, WorstEntry* out, int max) {
+  if (!worstAttached || criterion < 0 || criterion >= WORST_CRITERION_COUNT || max <= 0) return 0;
+  WorstEntry all[JKBMS_WORST_K];
+  GATEWAY_LOCK(worstLock);
+  const int size = gatewayWorst.heap[criterion].size;
+  memcpy(all, gatewayWorst.heap[criterion].entry, size * sizeof(WorstEntry));
+  GATEWAY_UNLOCK(worstLock);
+  sortWorstFirst(all, size);
+  const int n = size < max ? size : max;
+  memcpy(out, all, n * sizeof(WorstEntry));
+  return n;
+}
+
+uint32_t worstVersion() {
+  return __atomic_load_n(&gatewayWorst.version, __ATOMIC_RELAXED);
+}
+
+void worstEmit(MetricsEmitFunc emit, void* ctx) {
+  if (!worstAttached) return;
+  char name[48];
+  WorstEntry top;
+  for (int c = 0; c < WORST_CRITERION_COUNT; c++) {
+    if (!worstTop((WorstCriterion)c, &top, 1)) continue;
+    snprintf(name, sizeof(name), "worst.%s.score", criterionNames[c]);
+    emit(name, top.score, ctx);
+  }
+  emit("worst.update_us_max", updateUsMax, ctx);
+}
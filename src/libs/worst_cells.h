@@ -0,0 +1,110 @@
+#ifndef WORST_CELLS_H
+#define WORST_CELLS_H
+
+#include <Arduino.h>
+#include "metrics.h"
+#include "snapshot.h"
+
+class JKBMS;
+
+/**
+ * Top-K worst cells and packs, maintained as frames are parsed
+ *
+ * One bounded min-heap per criterion holds the K highest scores; the root is
+ * the entry to evict. An index from (device, cell) to heap slot lets a frame
+ * update the entries it already has in place, so each cell of a frame costs
+ * O(log K) per criterion and nothing is rescanned. Reading the top K sorts K
+ * entries, whatever the fleet size.
+ *
+ * Every cell is re-ranked on its own device's frames: when a listed entry
+ * improves, a cell of another device that now scores higher takes its place
+ * at that device's next frame, so the list lags by at most one frame period.
+ * worstRemoveDevice() drops a device that went away.
+ *
+ * Criteria, higher is worse:
+ *   WORST_CELL_DEVIATION  |cell - pack average|, mV      one entry per cell
+ *   WORST_WIRE_RESIST     balance wire resistance, mOhm  one entry per cell
+ *   WORST_PACK_TEMP       hottest of T1/T2/MOS, °C       one entry per pack
+ *   WORST_PACK_DELTA      highest - lowest cell, mV      one entry per pack
+ *
+ * Memory is allocated once by worstInit(): K entries plus one byte per
+ * (device, cell) per criterion.
+ */
+
+#ifndef JKBMS_WORST_K
+#define JKBMS_WORST_K 10
+#endif
+
+static_assert(JKBMS_WORST_K > 0 && JKBMS_WORST_K < 255, "heap slots are 8-bit");
+
+enum WorstCriterion {
+  WORST_CELL_DEVIATION = 0,
+  WORST_WIRE_RESIST,
+  WORST_PACK_TEMP,
+  WORST_PACK_DELTA,
+  WORST_CRITERION_COUNT
+};
+
+static const uint8_t WORST_PACK = 0xFF;   // WorstEntry::cell of the pack criteria
+
+struct WorstEntry {
+  uint16_t device;
+  uint8_t cell;               // 0-based, or WORST_PACK
+  float score;                // ranking value, higher is worse
+  float value;                // signed deviation for WORST_CELL_DEVIATION, else the score
+  uint32_t frameMs;           // frame the score comes from
+};
+
+struct WorstHeap {
+  WorstEntry entry[JKBMS_WORST_K];
+  uint8_t size;
+  uint8_t* slot;              // [device * JKBMS_SNAPSHOT_CELLS + cell]: heap index + 1, 0 if not listed
+};
+
+struct WorstCells {
+  uint16_t devices;
+  WorstHeap heap[WORST_CRITERION_COUNT];
+  uint32_t version;           // bumped whenever a list changes
+  uint32_t updates;           // frames taken
+};
+
+bool worstInit(WorstCells& w, uint16_t devices);
+void worstFree(WorstCells& w);
+
+// Re-rank every cell and the pack of one device from its parsed frame
+void worstUpdate(WorstCells& w, uint16_t device, const JKBMS& bms);
+void worstUpdateSnapshot(WorstCells& w, uint16_t device, const JkSnapshot& snap);
+void worstRemoveDevice(WorstCells& w, uint16_t device);
+
+/**
+ * The listed entries of one criterion, worst first
+ * @return Entries written, at most min(max, JKBMS_WORST_K)
+ */
+int worstRead(const WorstCells& w, WorstCriterion criterion, WorstEntry* out, int max);
+
+// "cell_deviation", "wire_resist", "pack_temp", "pack_delta"
+const char* worstCriterionName(WorstCriterion criterion);
+
+//****************************************************
+// Gateway
+//****************************************************
+
+/**
+ * Track every entry of jkBmsDevices from its cell frames (frame handler)
+ * @return false without memory or a free frame-handler slot
+ */
+bool worstAttach();
+
+// Called from onDisconnect(): the device's entries leave the lists
+void worstDeviceLeft(const JKBMS& bms);
+
+// worstRead() on the gateway lists, from any task
+int worstTop(WorstCriterion criterion, WorstEntry* out, int max);
+
+// WorstCells::version of the gateway lists: unchanged means worstTop() is too
+uint32_t worstVersion();
+
+// Metrics source: worst.<criterion>.score (worst entry), worst.update_us_max
+void worstEmit(MetricsEmitFunc emit, void* ctx);
+
+#endif // WORST_CELLS_H
@@ -4,6 +4,19 @@
 #include <HTTPClient.h>
 #include "libs/JKBMS.h"
 #include "libs/debug_functions.h"
+#include "libs/metrics.h"
+#include "libs/link_stats.h"
+#include "libs/phy_policy.h"
+#include "libs/checkpoint.h"
+#include "libs/init_phases.h"
+#include "libs/scan_filter.h"
+#include "libs/device_shards.h"
+#include "libs/rest_api.h"
+#include "libs/charge_limits.h"
+#include "libs/quantile_sketch.h"
+#include "libs/worst_cells.h"
+#include "libs/window_stats.h"
+#include "libs/usb_stream.h"
 
 /**
  * @brief Global array of JKBMS device instances
@@ -17,9 +30,29 @@ JKBMS jkBmsDevices[] = {
 
 const int bmsDeviceCount = sizeof(jkBmsDevices) / sizeof(jkBmsDevices[0]);
 
+// Sliding-window aggregates kept for every device (window_stats.h), read
+// with windowsRead(device, windowsFind("cell_max_60s"), stats)
+static const WindowSpec windowSpecs[] = {
+  { "cell_max_60s", WINDOW_CELL_MAX, 60000 },
+  { "cell_min_60s", WINDOW_CELL_MIN, 60000 },
+  { "current_5m", WINDOW_CURRENT, 300000 },
+  { "temp_max_10m", WINDOW_TEMP_MAX, 600000 },
+};
+
+// Build with -DJKBMS_WIFI_SSID='"name"' -DJKBMS_WIFI_PASSWORD='"secret"' to
+// join a network and serve the REST API (rest_api.h) on JKBMS_REST_PORT
+#if defined(JKBMS_WIFI_SSID) && !defined(JKBMS_WIFI_PASSWORD)
+#define JKBMS_WIFI_PASSWORD ""
+#endif
+
+// Build with -DJKBMS_USB_STREAM=STREAM_ALL (or a mask of StreamContent) to
+// stream captures on the native USB port (usb_stream.h); the console stays on
+// UART0, keep ARDUINO_USB_CDC_ON_BOOT=0
+
 // BLE Scanning
 NimBLEScan* pScan;
 unsigned long lastScanTime = 0;
+unsigned long lastConnectionAttempt = 0;
 ScanCallbacks scanCallbacks;
 
 // Debug functions for JKBMS library
@@ -51,9 +84,12 @@ void setup() {
   debugPrintlnFunc = debugPrintlnForJKBMS;
   debugPrintSimpleFunc = debugPrintSimpleForJKBMS;
 
-  // Initialize NimBLE first (used to communicate with JKBMS)
+  // Initialize NimBLE first (used to communicate with JKBMS); init() returns
+  // once host and controller are in sync
   DEBUG_PRINTLN("Initializing NimBLE");
+  uint32_t bleStart = millis();
   NimBLEDevice::init("Photon test");
+  initPhaseRecord(INIT_BLE_SYNC, millis() - bleStart);
   NimBLEDevice::setPower(ESP_PWR_LVL_P9); // Maximum power for better range
   
   // Set larger BLE configurations for stability
@@ -65,25 +101,75 @@ void setup() {
   pScan->setInterval(1600); // 1000ms scan interval (less aggressive)
   pScan->setWindow(100);    // 62.5ms scan window
   pScan->setActiveScan(true);
-  
-  delay(3000); // Wait for BLE stack to stabilize and turning on the BMS 
-  
+
+  // Notification handling moves to one worker task per core; devices are
+  // spread over them as they connect
+  if (!shardsStart()) DEBUG_PRINTLN("Device shards unavailable, notifications handled inline");
+
+  // Inverter limits (CVL/CCL/DCL) follow every parsed cell frame
+  if (!chargeLimitsAttach()) DEBUG_PRINTLN("No frame handler slot for the charge limits");
+  // Daily distributions of cells, current and temperatures, mergeable upstream
+  if (!sketchesAttach()) DEBUG_PRINTLN("No frame handler slot for the quantile sketches");
+  // Worst cells and packs of the fleet, re-ranked as each frame is parsed
+  if (!worstAttach()) DEBUG_PRINTLN("Worst-cell lists unavailable");
+  // Min/max/average over the last minutes for alarms and dashboards
+  if (!windowsAttach(windowSpecs, sizeof(windowSpecs) / sizeof(windowSpecs[0]))) {
+    DEBUG_PRINTLN("Sliding windows unavailable");
+  }
+#if defined(JKBMS_USB_STREAM)
+  // Bench captures at full rate, before any notification arrives
+  if (!usbStreamStart(JKBMS_USB_STREAM)) DEBUG_PRINTLN("USB capture stream unavailable");
+#endif
+
+  // Publish per-device radio accounting through the metrics API
+  metricsRegisterSource(linkStatsEmit);
+  metricsRegisterSource(phyEmit);
+  metricsRegisterSource(checkpointEmit);
+  metricsRegisterSource(initPhaseEmit);
+  metricsRegisterSource(scanFilterEmit);
+  metricsRegisterSource(shardsEmit);
+  metricsRegisterSource(chargeLimitsEmit);
+  metricsRegisterSource(sketchesEmit);
+  metricsRegisterSource(worstEmit);
+  metricsRegisterSource(windowsEmit);
+#if defined(JKBMS_USB_STREAM)
+  metricsRegisterSource(usbStreamEmit);
+#endif
+
+#if defined(JKBMS_WIFI_SSID)
+  // The REST API starts from loop() once the station has an address
+  WiFi.mode(WIFI_STA);
+  WiFi.begin(JKBMS_WIFI_SSID, JKBMS_WIFI_PASSWORD);
+  metricsRegisterSource(restEmit);
+#endif
+
+  // Warm restart: last values, settings and link parameters come back from
+  // RTC memory or NVS, and known packs are connected directly without a scan
+  [[maybe_unused]] int restored = checkpointRestore();
+  DEBUG_PRINTF("Restored %d of %d devices from checkpoint\n", restored, bmsDeviceCount);
+
   DEBUG_PRINTLN("Setup complete!");
 }
 
 void loop() {
+  METRICS_PHASE_BEGIN(schedulingSample);
+
   // Connection management for BMS devices
   int connectedCount = 0;
-  static unsigned long lastConnectionAttempt = 0;
 
   for (int i = 0; i < bmsDeviceCount; i++) {
     if (jkBmsDevices[i].targetMAC.empty()) continue;
 
     // Attempt to connect if not already connected
-    // Add delay between connection attempts to reduce resource conflicts
+    // Add delay between connection attempts to reduce resource conflicts;
+    // direct connects after a warm restart go back to back
     if (jkBmsDevices[i].doConnect && !jkBmsDevices[i].connected) {
-      if (millis() - lastConnectionAttempt > 5000) {  // Wait 5 seconds between attempts
-        if (jkBmsDevices[i].connectToServer()) {
+      if (jkBmsDevices[i].warm.direct || millis() - lastConnectionAttempt > 5000) {  // Wait 5 seconds between attempts
+        // Connection setup mostly sleeps in delay(), keep it out of the scheduling time
+        METRICS_PHASE_END(schedulingSample, PHASE_SCHEDULING);
+        bool ok = jkBmsDevices[i].connectToServer();
+        METRICS_PHASE_RESTART(schedulingSample);
+        if (ok) {
           DEBUG_PRINTF("%s connected successfully\n", jkBmsDevices[i].targetMAC.c_str());
         } else {
           DEBUG_PRINTF("%s connection failed\n", jkBmsDevices[i].targetMAC.c_str());
@@ -96,9 +182,13 @@ void loop() {
     // Check connection status and handle timeouts 
     if (jkBmsDevices[i].connected) {
       connectedCount++;
+
+      // Review link quality and move to another PHY when it changed (rate limited)
+      NimBLEClient* pLink = NimBLEDevice::getClientByPeerAddress(jkBmsDevices[i].peerAddress());
+      if (pLink) phyApply(jkBmsDevices[i].phy, pLink);
       if (millis() - jkBmsDevices[i].lastNotifyTime > 25000) {  // Increased timeout
         DEBUG_PRINTF("%s connection timeout (no data for 25s)\n", jkBmsDevices[i].targetMAC.c_str());
-        NimBLEClient* pClient = NimBLEDevice::getClientByPeerAddress(jkBmsDevices[i].advDevice->getAddress());
+        NimBLEClient* pClient = NimBLEDevice::getClientByPeerAddress(jkBmsDevices[i].peerAddress());
         if (pClient) {
           pClient->disconnect();
           jkBmsDevices[i].connected = false;
@@ -108,16 +198,42 @@ void loop() {
   }
 
   // Start scan only if not all devices are connected and enough time has passed
-  // Reduce scan frequency to minimize conflicts with mobile app and improve stability
+  // Reduce scan frequency to minimize conflicts with mobile app and improve stability.
+  // The first scan after boot starts right away.
   bool shouldScan = (connectedCount < bmsDeviceCount) && 
-                    (millis() - lastScanTime >= 20000) && // Scan every 20 seconds
-                    (millis() - lastConnectionAttempt > 10000); // Wait 10s after connection attempts
+                    (lastScanTime == 0 || millis() - lastScanTime >= 20000) && // Scan every 20 seconds
+                    (lastConnectionAttempt == 0 || millis() - lastConnectionAttempt > 10000); // Wait 10s after connection attempts
   
   if (shouldScan) {
-    DEBUG_PRINTF("Starting BMS scan... (Connected: %d/%d)\n", connectedCount, bmsDeviceCount);
+    // Let the controller drop adverts from devices that are not configured
+    scanFilterPrepare(pScan);
+    DEBUG_PRINTF("Starting BMS scan... (Connected: %d/%d, %s)\n", connectedCount, bmsDeviceCount,
+                 scanFilterCounters().active ? "accept list" : "open");
     pScan->start(3000, false, true); // 3 second scan duration
+    linkStatsScanStarted(3000, 1600, 100);
     lastScanTime = millis();
   }
+  METRICS_PHASE_END(schedulingSample, PHASE_SCHEDULING);
+
+  // Even out the shard load; joins and leaves are handled on the next pass
+  shardsUpdate();
+
+  // One sketch period per day of uptime
+  static uint32_t sketchPeriodStart = 0;
+  if (millis() - sketchPeriodStart >= 24UL * 60 * 60 * 1000) {
+    sketchesReset();
+    sketchPeriodStart = millis();
+  }
+
+#if defined(JKBMS_WIFI_SSID)
+  if (WiFi.status() == WL_CONNECTED) restStart();
+#endif
+
+  // Sample task CPU and stack usage every 10 seconds
+  metricsUpdate(10000);
+
+  // Checkpoint streaming devices for the next warm restart
+  checkpointUpdate();
 
   // Small delay to prevent excessive CPU usage and allow BLE stack to process
   // Increased delay for better stability (ideally the BMS need 100ms between requests)